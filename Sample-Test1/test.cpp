@@ -1,5 +1,42 @@
 #include "pch.h"
+#include <accumulation.h>
+#include <ambient_occlusion.h>
+#include <area_light.h>
+#include <blue_noise.h>
+#include <denoiser.h>
+#include <frame_ring.h>
+#include <frame_stream.h>
+#include <lighting.h>
+#include <lighting_cache.h>
+#include <load_balancer.h>
+#include <occluder_lists.h>
+#include <pixel_order.h>
+#include <ray_binning.h>
+#include <render_farm.h>
+#include <render_server.h>
+#include <renderer.h>
+#include <sampling.h>
+#include <sequence_writer.h>
+#include <shadow_batches.h>
+#include <shadow_cache.h>
+#include <shadow_cube_maps.h>
 #include <sphere.h>
+#include <thread_placement.h>
+#include <thread_pool.h>
+#include <tile_culling.h>
+#include <tile_scheduler.h>
+#include <tracing.h>
+#include <visibility_buffer.h>
+#include <wavefront.h>
+
+#include <filesystem>
+#include <fstream>
+
+#if !defined(_WIN32) && defined(__linux__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 TEST(sphere_test, intersection_test) {
 	sphere sphere(1.0, bardrix::point3(0.0, 0.0, 3.0));
@@ -13,4 +50,1190 @@ TEST(sphere_test, intersection_test) {
 	
 	//EXPECT_EQ(1, 1);
  // EXPECT_TRUE(true);
-}
\ No newline at end of file
+}
+
+TEST(ray_binning_test, bin_key_octant_test) {
+	bardrix::ray ray(bardrix::point3(0.5, 0.5, 0.5), bardrix::vector3(-1, 1, -1).normalized(), 10);
+
+	// x and z are negative, so the octant is 0b101
+	ASSERT_EQ(ray_bin_key(ray, 1.0, 12) & 7u, 5u);
+}
+
+TEST(ray_binning_test, binning_is_stable_test) {
+	std::vector<secondary_ray> rays;
+	for (uint32_t i = 0; i < 8; i++) {
+		// Alternate between 2 directions so pixel order has no coherence at all
+		bardrix::vector3 direction = i % 2 == 0 ? bardrix::vector3(1, 0, 0) : bardrix::vector3(-1, 0, 0);
+		rays.push_back({ bardrix::ray(bardrix::point3(0.5, 0.5, 0.5), direction, 10), i, 0, nullptr });
+	}
+
+	std::vector<uint32_t> order;
+	bin_rays(rays, 1.0, order);
+
+	ASSERT_EQ(order, std::vector<uint32_t>({ 0, 2, 4, 6, 1, 3, 5, 7 }));
+	ASSERT_EQ(ray_coherence(rays, {}, 1.0), 0.0);
+	ASSERT_GT(ray_coherence(rays, order, 1.0), 0.8);
+}
+
+/// \brief Exposes the stream compaction of the wavefront renderer
+class compacting_renderer : public wavefront_renderer {
+public:
+	using wavefront_renderer::wavefront_renderer;
+	using wavefront_renderer::compact_indices;
+	using wavefront_renderer::indices_;
+};
+
+TEST(wavefront_test, compact_indices_test) {
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 32, 24, 60);
+	std::vector<sphere> spheres;
+	std::vector<bardrix::light> lights;
+	thread_pool pool(3);
+	compacting_renderer r(camera, spheres, lights, pool);
+
+	std::vector<uint8_t> alive(1000);
+	std::vector<uint32_t> expected;
+	for (uint32_t i = 0; i < alive.size(); i++) {
+		alive[i] = (i * 7 + i / 13) % 3 == 0;
+		if (alive[i])
+			expected.push_back(i);
+	}
+
+	// Chunks of any size give the live items in their original order, a grain of 0 is one item per chunk
+	for (const std::size_t grain : { 0, 1, 7, 64, 4096 }) {
+		r.settings.grain = grain;
+		ASSERT_EQ(r.compact_indices(alive), expected.size());
+		ASSERT_EQ(r.indices_, expected);
+	}
+	ASSERT_EQ(r.compact_indices(std::vector<uint8_t>(100, 0)), 0u);
+	ASSERT_EQ(r.compact_indices({}), 0u);
+}
+
+TEST(wavefront_test, empty_view_test) {
+	// The spheres are behind the camera, so every path ends in the background on its first bounce
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 32, 24, 60);
+	std::vector<sphere> spheres{ sphere(1.0, { 0.0, 0.0, -3.0 }), sphere(1.5, { 2.0, 2.0, -4.0 }) };
+	std::vector<bardrix::light> lights{ bardrix::light({ 2, 1, 1 }, 1, bardrix::color::cyan()) };
+	thread_pool pool(2);
+	wavefront_renderer r(camera, spheres, lights, pool);
+	r.settings.samples_per_pixel = 2;
+	r.settings.grain = 0;
+
+	std::vector<uint32_t> buffer(32 * 24, 0xFFFFFFFF);
+	r.render(buffer, 32, 24);
+	ASSERT_EQ(buffer, std::vector<uint32_t>(32 * 24, bardrix::color::black().argb()));
+	ASSERT_EQ(r.get_stats().shadow_rays, 0u);
+}
+
+TEST(shadow_batches_test, batches_match_single_rays_test) {
+	std::vector<sphere> spheres;
+	for (int i = 0; i < 16; i++)
+		spheres.push_back(sphere(0.5, bardrix::point3((i % 4) * 1.2 - 2, (i / 4) * 1.2 - 2, 4.0 + (i % 3))));
+	std::vector<bardrix::light> lights{ bardrix::light({ 0, 0, 0 }, 1, bardrix::color::white()),
+										bardrix::light({ 1, 2, 1 }, 1, bardrix::color::white()) };
+
+	// A 32x32 frame where every pixel sees a random point on a random sphere
+	std::vector<secondary_ray> rays;
+	uint32_t state = 1;
+	for (uint32_t pixel = 0; pixel < 32 * 32; pixel++) {
+		const sphere& receiver = spheres[sampling::hash(pixel) % spheres.size()];
+		const bardrix::vector3 normal = sampling::cosine_hemisphere({ 0, 0, -1 }, sampling::next_double(state),
+																	sampling::next_double(state));
+		const bardrix::point3 point = receiver.get_position() + normal * receiver.get_radius();
+		for (uint32_t l = 0; l < lights.size(); l++) {
+			const bardrix::vector3 to_point = lights[l].position.vector_to(point);
+			rays.push_back({ bardrix::ray(lights[l].position, to_point.normalized(), to_point.length() - 1e-6),
+							 pixel, l, &receiver });
+		}
+	}
+
+	occluder_lists occluders;
+	occluders.update(spheres, lights, {});
+
+	shadow_batches batches;
+	batches.build(rays, 32, 16, lights.size());
+	ASSERT_EQ(batches.get_stats().batches, 8u);
+
+	std::vector<uint8_t> blocked, culled;
+	batches.trace(rays, spheres, blocked);
+	batches.trace(rays, spheres, culled, &occluders);
+	std::size_t blocked_count = 0;
+	for (std::size_t i = 0; i < rays.size(); i++) {
+		ASSERT_EQ(blocked[i] != 0, is_occluded(rays[i].ray, spheres, rays[i].shape));
+		ASSERT_EQ(culled[i], blocked[i]);
+		blocked_count += blocked[i];
+	}
+	ASSERT_GT(blocked_count, 0u);
+}
+
+TEST(thread_pool_test, parallel_for_visits_every_item_once_test) {
+	thread_pool pool(4);
+	std::vector<int> visits(10000, 0);
+
+	pool.parallel_for(visits.size(), 64, [&](std::size_t begin, std::size_t end) {
+		for (std::size_t i = begin; i < end; i++)
+			visits[i]++;
+	});
+
+	ASSERT_EQ(std::count(visits.begin(), visits.end(), 1), 10000);
+}
+
+TEST(blue_noise_test, table_is_a_permutation_test) {
+	std::vector<float> values = blue_noise::table();
+	std::sort(values.begin(), values.end());
+
+	// Every rank is used exactly once, so the values are evenly spread over [0, 1)
+	for (std::size_t i = 0; i < values.size(); i++)
+		ASSERT_FLOAT_EQ(values[i], (static_cast<float>(i) + 0.5f) / values.size());
+
+	const double sample = blue_noise::sample(5, 7, 1, 1234, 3);
+	ASSERT_GE(sample, 0.0);
+	ASSERT_LT(sample, 1.0);
+}
+
+TEST(ray_generator_test, matches_camera_rays_test) {
+	bardrix::camera camera({ 1, 2, 3 }, { 0.3, -0.2, 1 }, 64, 48, 60);
+	ray_generator generator(camera, 10);
+
+	for (int y = 0; y < 48; y += 7) {
+		for (int x = 0; x < 64; x += 9) {
+			bardrix::ray expected = camera.shoot_ray(x, y, 10).value();
+			bardrix::ray ray = generator.shoot(x, y);
+			ASSERT_NEAR(ray.get_direction().x, expected.get_direction().x, 1e-9);
+			ASSERT_NEAR(ray.get_direction().y, expected.get_direction().y, 1e-9);
+			ASSERT_NEAR(ray.get_direction().z, expected.get_direction().z, 1e-9);
+		}
+	}
+}
+
+TEST(ray_generator_test, sphere_bounds_test) {
+	bardrix::camera camera({ 0, 0, 0 }, { 0.2, 0.1, 1 }, 80, 60, 60);
+	ray_generator generator(camera, 100);
+	const sphere s(0.7, bardrix::point3(0.5, -0.3, 4));
+
+	double left, top, right, bottom;
+	ASSERT_TRUE(generator.bounds(s.get_position(), s.get_radius(), left, top, right, bottom));
+
+	// Every ray that hits the sphere is inside the box, and the box touches the hits on every side
+	double hit_left = 1e9, hit_top = 1e9, hit_right = -1e9, hit_bottom = -1e9;
+	for (double y = -10; y < 70; y += 0.25) {
+		for (double x = -10; x < 90; x += 0.25) {
+			if (!s.intersection(generator.shoot(x, y)).has_value())
+				continue;
+			hit_left = std::min(hit_left, x);
+			hit_top = std::min(hit_top, y);
+			hit_right = std::max(hit_right, x);
+			hit_bottom = std::max(hit_bottom, y);
+		}
+	}
+	ASSERT_LE(left, hit_left);
+	ASSERT_LE(top, hit_top);
+	ASSERT_GE(right, hit_right);
+	ASSERT_GE(bottom, hit_bottom);
+	ASSERT_NEAR(left, hit_left, 0.25);
+	ASSERT_NEAR(bottom, hit_bottom, 0.25);
+
+	// Behind the camera nothing is covered, around the camera everything can be
+	ASSERT_TRUE(generator.bounds(bardrix::point3(0, 0, -5), 1, left, top, right, bottom));
+	ASSERT_GT(left, right);
+	ASSERT_FALSE(generator.bounds(bardrix::point3(0, 0, 0.5), 1, left, top, right, bottom));
+}
+
+TEST(tile_culling_test, culled_tiles_give_the_same_hits_test) {
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 70, 50, 60);
+	ray_generator generator(camera, 10);
+	std::vector<sphere> spheres;
+	for (int i = 0; i < 12; i++)
+		spheres.push_back(sphere(0.3, bardrix::point3((i % 4) * 1.1 - 1.6, (i / 4) * 1.0 - 1, 3.0 + (i % 5))));
+	spheres.push_back(sphere(1.0, bardrix::point3(0, 0, -3))); // Behind the camera
+	spheres.push_back(sphere(1.0, bardrix::point3(0, 0, 12))); // Beyond the end of the rays
+
+	thread_pool pool(2);
+	tile_culling tiles;
+	tiles.build(generator, 0.25, -0.25, 70, 50, 16, spheres, pool);
+	ASSERT_EQ(tiles.get_stats().tiles, 5u * 4u);
+	ASSERT_GT(tiles.get_stats().empty_tiles, 0u);
+	ASSERT_LT(tiles.get_stats().average_candidates, 12.0);
+	ASSERT_LT(tiles.get_stats().covered_pixels, 70u * 50u);
+
+	for (int y = 0; y < 50; y++) {
+		for (int x = 0; x < 70; x++) {
+			const bardrix::ray ray = generator.shoot(x + 0.25, y - 0.25);
+			const std::size_t tile = (y / 16) * tiles.get_tiles_x() + x / 16;
+			const hit_record hit = closest_hit(ray, spheres);
+			ASSERT_EQ(closest_hit(ray, spheres, tiles.candidates(tile)).shape, hit.shape);
+
+			// A pixel that shows a sphere is inside its bounds, the covered part of its tile and the scene bounds
+			if (hit.shape != nullptr) {
+				ASSERT_TRUE(tiles.sphere_bounds(hit.shape - spheres.data()).contains(x, y));
+				ASSERT_TRUE(tiles.covered(tile).contains(x, y));
+				ASSERT_TRUE(tiles.scene_bounds().contains(x, y));
+			}
+		}
+	}
+}
+
+TEST(visibility_buffer_test, matches_traced_hits_test) {
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 60, 40, 60);
+	ray_generator generator(camera, 10);
+	std::vector<sphere> spheres;
+	for (int i = 0; i < 10; i++)
+		spheres.push_back(sphere(0.6, bardrix::point3((i % 5) * 0.7 - 1.4, (i / 5) * 0.8 - 0.4, 3.0 + (i % 3) * 0.3)));
+	spheres.push_back(spheres[3]); // The same sphere twice, the first one wins like in closest_hit
+	spheres.push_back(sphere(1.0, bardrix::point3(0, 0, 0.5))); // Around the camera, its footprint is everything
+
+	thread_pool pool(3);
+	visibility_buffer buffer;
+	buffer.render(generator, 0.3, 0.1, 60, 40, spheres, pool);
+
+	std::size_t covered = 0;
+	for (int y = 0; y < 40; y++) {
+		for (int x = 0; x < 60; x++) {
+			const hit_record hit = closest_hit(generator.shoot(x + 0.3, y + 0.1), spheres);
+			const uint32_t id = buffer.id(static_cast<std::size_t>(y) * 60 + x);
+			ASSERT_EQ(id, hit.shape == nullptr ? visibility_buffer::none : static_cast<uint32_t>(hit.shape - spheres.data()));
+			if (hit.shape != nullptr) {
+				ASSERT_EQ(buffer.depth(static_cast<std::size_t>(y) * 60 + x), hit.distance);
+			}
+			covered += hit.shape != nullptr;
+		}
+	}
+	ASSERT_GT(covered, 0u);
+	ASSERT_EQ(buffer.get_stats().covered_pixels, covered);
+}
+
+TEST(area_light_test, samples_on_surface_test) {
+	const bardrix::point3 center(1, 2, 3), lit(4, -2, 3);
+	const area_light bulb(bardrix::light(center, 2, bardrix::color::white()), 0.5);
+	const area_light panel(bardrix::light(center, 2, bardrix::color::white()), { 2, 0, 0 }, { 0, 0, 1 });
+	const bardrix::vector3 facing = center.vector_to(lit).normalized();
+
+	for (int i = 0; i < 16; i++) {
+		for (int j = 0; j < 16; j++) {
+			const double u1 = i / 16.0, u2 = j / 16.0;
+
+			// A sphere is sampled on the disk through its center that faces the lit point
+			const bardrix::vector3 on_bulb = center.vector_to(bulb.sample(lit, u1, u2));
+			ASSERT_LE(on_bulb.length(), 0.5 + 1e-9);
+			ASSERT_NEAR(on_bulb.dot(facing), 0.0, 1e-9);
+
+			// A rectangle is sampled inside its edges
+			const bardrix::vector3 on_panel = center.vector_to(panel.sample(lit, u1, u2));
+			ASSERT_LE(std::abs(on_panel.x), 1.0);
+			ASSERT_NEAR(on_panel.y, 0.0, 1e-9);
+			ASSERT_LE(std::abs(on_panel.z), 0.5);
+		}
+	}
+}
+
+/// \brief Exposes the primary hits and the area light visibility of the renderer
+class area_light_renderer : public renderer {
+public:
+	using renderer::renderer;
+	using renderer::area_visibility_;
+	using renderer::hits_;
+};
+
+TEST(area_light_test, soft_shadow_test) {
+	// A ball hangs between a spherical light and the floor, right under the light its shadow is a full umbra
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 64, 48, 60);
+	std::vector<sphere> spheres{ sphere(100.0, { 0.0, -101.0, 4.0 }), sphere(0.5, { 0.0, 1.5, 4.0 }) };
+	std::vector<bardrix::light> lights;
+	std::vector<area_light> area_lights{ area_light(bardrix::light({ 0, 4, 4 }, 5, bardrix::color::white()), 0.5) };
+
+	thread_pool pool(2);
+	area_light_renderer r(camera, spheres, lights, area_lights, pool);
+	r.settings.deterministic = true;
+
+	// More samples than a byte counts are clamped, a fully lit point stays fully lit
+	for (const int samples : { 64, 300 }) {
+		r.settings.area_light_samples = samples;
+		std::vector<uint32_t> buffer(64 * 48);
+		r.render(buffer, 64, 48);
+
+		// The floor is unoccluded far from the ball, in shadow under it and partly lit in between
+		std::size_t umbra = 0, penumbra = 0, lit = 0;
+		for (std::size_t pixel = 0; pixel < buffer.size(); pixel++) {
+			const hit_record& hit = r.hits_[pixel];
+			if (hit.shape != &spheres[0])
+				continue;
+
+			const double offset = std::hypot(hit.point.x, hit.point.z - 4);
+			const float visibility = r.area_visibility_[pixel];
+			if (offset < 0.2) {
+				ASSERT_EQ(visibility, 0.0f);
+				umbra++;
+			} else if (offset > 0.9 && offset < 1.1) {
+				ASSERT_GT(visibility, 0.0f);
+				ASSERT_LT(visibility, 1.0f);
+				penumbra++;
+			} else if (offset > 3) {
+				ASSERT_EQ(visibility, 1.0f);
+				lit++;
+			}
+		}
+		ASSERT_GT(umbra, 0u);
+		ASSERT_GT(penumbra, 0u);
+		ASSERT_GT(lit, 0u);
+	}
+}
+
+/// \brief Guides of a 32x16 image of one flat surface, with the right half turned away or further away if asked
+guide_buffers split_guides(bool turn_right, bool push_right) {
+	guide_buffers guides;
+	guides.reset(32, 16);
+	for (std::size_t i = 0; i < guides.depth.size(); i++) {
+		const bool right = i % 32 >= 16;
+		guides.normal_x[i] = turn_right && right ? 1.0f : 0.0f;
+		guides.normal_z[i] = turn_right && right ? 0.0f : -1.0f;
+		guides.depth[i] = push_right && right ? 40.0f : 2.0f;
+		guides.albedo_r[i] = guides.albedo_g[i] = guides.albedo_b[i] = 0.5f;
+	}
+	return guides;
+}
+
+TEST(denoiser_test, flat_image_test) {
+	// Nothing to filter, every pixel stays what it was
+	thread_pool pool(2);
+	denoiser image_denoiser(pool);
+	const guide_buffers guides = split_guides(false, false);
+	std::vector<uint32_t> buffer(32 * 16, 0xFF336699);
+	image_denoiser.denoise(buffer, guides);
+	ASSERT_EQ(buffer, std::vector<uint32_t>(32 * 16, 0xFF336699));
+}
+
+TEST(denoiser_test, guide_edges_test) {
+	// The left half is darker than the right half, near enough in color to be averaged over the middle
+	std::vector<uint32_t> image(32 * 16);
+	for (std::size_t i = 0; i < image.size(); i++)
+		image[i] = i % 32 < 16 ? 0xFF606060 : 0xFF707070;
+
+	thread_pool pool(2);
+	denoiser image_denoiser(pool);
+	const auto denoise = [&](const guide_buffers& guides) {
+		std::vector<uint32_t> buffer = image;
+		image_denoiser.denoise(buffer, guides);
+		return buffer;
+	};
+
+	// Without an edge in the guides the halves bleed into each other, with one in the normal or depth they don't
+	const std::size_t left = 8 * 32 + 15, right = left + 1;
+	const std::vector<uint32_t> blurred = denoise(split_guides(false, false));
+	ASSERT_NE(blurred[left], image[left]);
+	ASSERT_NE(blurred[right], image[right]);
+	ASSERT_EQ(denoise(split_guides(true, false)), image);
+	ASSERT_EQ(denoise(split_guides(false, true)), image);
+}
+
+TEST(accumulation_test, static_view_converges_test) {
+	accumulation_buffer accumulation;
+	ASSERT_TRUE(accumulation.prepare(2, 1, 42));
+	ASSERT_FALSE(accumulation.prepare(2, 1, 42));
+
+	// Alternate between 2 colors, the average is halfway and every sample changes it less
+	const float dark[] = { 0.2f, 0.2f }, bright[] = { 0.6f, 0.6f };
+	for (uint32_t i = 0; i < accumulation.settings.max_samples && !accumulation.converged(); i++)
+		accumulation.add(hdr_view{ i % 2 == 0 ? dark : bright, dark, dark, 1 });
+
+	ASSERT_TRUE(accumulation.converged());
+	ASSERT_LT(accumulation.get_samples(), accumulation.settings.max_samples);
+
+	std::vector<uint32_t> buffer(2);
+	accumulation.resolve(buffer);
+	ASSERT_NEAR(static_cast<int>((buffer[0] >> 16) & 0xFF), 102, 1);
+	ASSERT_EQ(buffer[0] & 0xFF, 51u);
+
+	// A different view starts over
+	ASSERT_TRUE(accumulation.prepare(2, 1, 43));
+	ASSERT_EQ(accumulation.get_samples(), 0u);
+}
+
+TEST(ao_cache_test, occlusion_is_cached_test) {
+	std::vector<sphere> spheres{ sphere(1.0, bardrix::point3(0, 0, 0)), sphere(1.0, bardrix::point3(2.5, 0, 0)) };
+	ao_cache cache(1024);
+	cache.settings.samples_per_lookup = cache.settings.max_samples;
+	cache.begin_frame(spheres);
+
+	// The point facing the other sphere is partly occluded, the point on the far side isn't
+	double facing = cache.visibility({ 1, 0, 0 }, { 1, 0, 0 }, spheres);
+	double away = cache.visibility({ -1, 0, 0 }, { -1, 0, 0 }, spheres);
+	ASSERT_GT(facing, 0.0);
+	ASSERT_LT(facing, 1.0);
+	ASSERT_EQ(away, 1.0);
+	ASSERT_EQ(cache.get_stats().rays, 2u * cache.settings.max_samples);
+
+	// The next frame reads the converged cells without tracing
+	cache.begin_frame(spheres);
+	ASSERT_EQ(cache.visibility({ 1, 0, 0 }, { 1, 0, 0 }, spheres), facing);
+	ASSERT_EQ(cache.get_stats().rays, 0u);
+	ASSERT_EQ(cache.get_stats().converged_lookups, 1u);
+
+	// Moving a sphere clears the cache
+	spheres[1].set_position({ 3, 0, 0 });
+	cache.begin_frame(spheres);
+	ASSERT_EQ(cache.get_stats().cells, 0u);
+}
+
+TEST(shadow_cache_test, only_agreeing_texels_are_cached_test) {
+	std::vector<sphere> spheres{ sphere(1.0, bardrix::point3(0, 0, 0)) };
+	std::vector<bardrix::light> lights{ bardrix::light({ 0, 5, 0 }, 1, bardrix::color::white()) };
+	shadow_cache cache;
+	cache.prepare(spheres, lights);
+
+	surface_grid grid(1.0, cache.texels_per_unit);
+	auto texel_center = [&](int column, int row) {
+		double longitude = (column + 0.5) * 2 * sampling::pi / grid.columns - sampling::pi;
+		double y = 1 - 2 * (row + 0.5) / grid.rows, radius = std::sqrt(1 - y * y);
+		return bardrix::point3(radius * std::cos(longitude), y, radius * std::sin(longitude));
+	};
+
+	// The texel is only cached once it and its 4 neighbours are known and agree
+	const int column = grid.columns / 3, row = grid.rows / 4;
+	const bardrix::point3 point = texel_center(column, row);
+	ASSERT_EQ(cache.lookup(0, spheres[0], point).known, 0u);
+	for (int dy = -1; dy <= 1; dy++)
+		for (int dx = -1; dx <= 1; dx++)
+			cache.store(0, spheres[0], texel_center(column + dx, row + dy), 0, true);
+	ASSERT_EQ(cache.lookup(0, spheres[0], point).known, 1u);
+	ASSERT_EQ(cache.lookup(0, spheres[0], point).visible, 1u);
+
+	// A neighbour that disagrees means a shadow edge may run through the texel
+	cache.store(0, spheres[0], texel_center(column + 1, row), 0, false);
+	ASSERT_EQ(cache.lookup(0, spheres[0], point).known, 0u);
+
+	// Moving the light clears its bits
+	lights[0].position = { 0, 6, 0 };
+	cache.prepare(spheres, lights);
+	ASSERT_EQ(cache.get_stats().invalidated_lights, 1u);
+	cache.store(0, spheres[0], texel_center(column + 1, row), 0, true);
+	ASSERT_EQ(cache.lookup(0, spheres[0], point).known, 0u);
+}
+
+TEST(shadow_cache_test, large_sphere_test) {
+	// A floor of radius 100 would need 80k x 40k texels, it gets coarser ones instead
+	const surface_grid floor_grid(100.0, shadow_cache().texels_per_unit);
+	ASSERT_EQ(floor_grid.columns, surface_grid::max_columns);
+	ASSERT_EQ(floor_grid.rows, surface_grid::max_columns / 2);
+
+	// A ball in front of a wall of radius 100 with the shadow cache on, the second frame is mostly answered from it
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 64, 48, 60);
+	std::vector<sphere> spheres{ sphere(100.0, { 0.0, 0.0, 106.0 }), sphere(0.5, { 0.0, 0.0, 3.0 }) };
+	std::vector<bardrix::light> lights{ bardrix::light({ 1, 1, 0 }, 5, bardrix::color::white()) };
+	std::vector<area_light> area_lights;
+	thread_pool pool(2);
+	renderer r(camera, spheres, lights, area_lights, pool);
+	r.settings.cache_lighting = false;
+	std::vector<uint32_t> buffer(64 * 48);
+	r.render(buffer, 64, 48);
+	r.render(buffer, 64, 48);
+	ASSERT_GT(r.get_shadow_cache_stats().lookups, 0u);
+	ASSERT_GT(r.get_shadow_cache_stats().cached, 0u);
+}
+
+TEST(lighting_cache_test, interpolates_diffuse_light_test) {
+	std::vector<sphere> spheres{ sphere(1.0, bardrix::point3(0, 0, 0)) };
+	spheres[0].set_material(bardrix::material(0.3, 1, 0.8, 20));
+	std::vector<bardrix::light> lights{ bardrix::light({ 3, 2, 1 }, 10, bardrix::color::white()) };
+	lighting_cache cache;
+	cache.prepare(spheres, lights, false);
+
+	// Diffuse light is smooth, so the interpolated texels are close to the exact intensity
+	bardrix::point3 point = bardrix::point3(0.6, 0.48, 0.64);
+	float intensity = 0;
+	cache.lookup(0, spheres, point, nullptr, &intensity);
+	ASSERT_NEAR(intensity, calculate_diffuse_intensity(spheres[0], lights[0], point), 0.01);
+	ASSERT_EQ(cache.get_stats().filled, 4u);
+
+	// Moving the light recalculates the texels
+	lights[0].position = { -3, 2, 1 };
+	cache.prepare(spheres, lights, false);
+	cache.lookup(0, spheres, point, nullptr, &intensity);
+	ASSERT_NEAR(intensity, calculate_diffuse_intensity(spheres[0], lights[0], point), 0.01);
+	ASSERT_EQ(cache.get_stats().filled, 4u);
+}
+
+TEST(lighting_cache_test, large_sphere_test) {
+	const surface_grid wall_grid(100.0, lighting_cache().texels_per_unit);
+	ASSERT_EQ(wall_grid.size(), static_cast<std::size_t>(surface_grid::max_columns) * (surface_grid::max_columns / 2));
+
+	// The wall of the shadow cache test with only the lighting cache on, the second frame reuses every texel
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 64, 48, 60);
+	std::vector<sphere> spheres{ sphere(100.0, { 0.0, 0.0, 106.0 }), sphere(0.5, { 0.0, 0.0, 3.0 }) };
+	std::vector<bardrix::light> lights{ bardrix::light({ 1, 1, 0 }, 5, bardrix::color::white()) };
+	std::vector<area_light> area_lights;
+	thread_pool pool(2);
+	renderer r(camera, spheres, lights, area_lights, pool);
+	r.settings.cache_shadows = false;
+	std::vector<uint32_t> buffer(64 * 48);
+	r.render(buffer, 64, 48);
+	ASSERT_GT(r.get_lighting_cache_stats().filled, 0u);
+	r.render(buffer, 64, 48);
+	ASSERT_GT(r.get_lighting_cache_stats().lookups, 0u);
+	ASSERT_EQ(r.get_lighting_cache_stats().filled, 0u);
+}
+
+TEST(occluder_lists_test, incremental_update_matches_rebuild_test) {
+	std::vector<sphere> spheres;
+	for (int i = 0; i < 12; i++)
+		spheres.push_back(sphere(0.4, bardrix::point3((i % 4) * 1.5, (i / 4) * 1.5, 5.0 + (i % 3))));
+	std::vector<bardrix::light> lights{ bardrix::light({ 2, 2, 0 }, 1, bardrix::color::white()) };
+	std::vector<area_light> area_lights{ area_light(bardrix::light({ -1, 3, 2 }, 1, bardrix::color::white()), 0.5) };
+
+	occluder_lists lists;
+	lists.update(spheres, lights, area_lights);
+	ASSERT_LT(lists.get_stats().average_candidates, 11.0);
+
+	// A sphere right between the light and a receiver is always a candidate
+	spheres[4].set_position({ 2, 1.75, 2.5 });
+	lights[0].position = { 2, 1.5, 0 };
+	lists.update(spheres, lights, area_lights);
+	ASSERT_EQ(lists.get_stats().changed_spheres, 1u);
+	ASSERT_EQ(lists.get_stats().changed_lights, 1u);
+	const std::vector<uint32_t>& candidates = lists.candidates(0, 5);
+	ASSERT_NE(std::find(candidates.begin(), candidates.end(), 4u), candidates.end());
+
+	occluder_lists rebuilt;
+	rebuilt.update(spheres, lights, area_lights);
+	for (std::size_t light = 0; light < 2; light++)
+		for (std::size_t receiver = 0; receiver < spheres.size(); receiver++)
+			ASSERT_EQ(lists.candidates(light, receiver), rebuilt.candidates(light, receiver));
+}
+
+TEST(shadow_cube_maps_test, visibility_test) {
+	std::vector<sphere> spheres{ sphere(1.0, bardrix::point3(0, 0, 4)), sphere(1.0, bardrix::point3(0, 0, 8)) };
+	std::vector<bardrix::light> lights{ bardrix::light({ 0, 0, 0 }, 1, bardrix::color::white()),
+										bardrix::light({ 5, 0, 8 }, 1, bardrix::color::white()) };
+	shadow_cube_maps maps;
+	maps.update(spheres, lights);
+	ASSERT_EQ(maps.get_stats().rebuilt, 2u);
+
+	// The front of the first sphere is lit, the second sphere is in its shadow
+	ASSERT_DOUBLE_EQ(maps.visibility(0, bardrix::point3(0, 0, 3), 0), 1.0);
+	ASSERT_DOUBLE_EQ(maps.visibility(0, bardrix::point3(0, 0, 7), 1), 0.0);
+	ASSERT_DOUBLE_EQ(maps.visibility(0, bardrix::point3(0, 3, 3), 0), 1.0);
+
+	// A sphere doesn't shadow itself, the side facing the light is lit without acne
+	ASSERT_DOUBLE_EQ(maps.visibility(1, bardrix::point3(1, 0, 8), 1), 1.0);
+
+	// Only the cube map of the light that moved is rendered again
+	lights[1].position = { -5, 0, 8 };
+	maps.update(spheres, lights);
+	ASSERT_EQ(maps.get_stats().rebuilt, 1u);
+	ASSERT_DOUBLE_EQ(maps.visibility(1, bardrix::point3(-1, 0, 8), 1), 1.0);
+}
+
+TEST(tile_scheduler_test, priority_order_test) {
+	// 4x4 tiles of 16 pixels, all flat gray except a noisy tile in the top left corner
+	std::vector<uint32_t> previous(64 * 64, 0xFF808080u);
+	for (int y = 0; y < 16; y++)
+		for (int x = 0; x < 16; x++)
+			previous[y * 64 + x] = (x + y) % 2 == 0 ? 0xFFFFFFFFu : 0xFF000000u;
+
+	tile_scheduler scheduler;
+	scheduler.settings.focus_radius = 0.05;
+	scheduler.schedule(previous, 64, 64, 16, 8, 56, 0);
+
+	// The tile under the focus point comes first, then the noisy tile, and without a budget every tile is full
+	ASSERT_EQ(scheduler.order().size(), 16u);
+	ASSERT_EQ(scheduler.order()[0], 12u);
+	ASSERT_EQ(scheduler.order()[1], 0u);
+	ASSERT_EQ(scheduler.get_stats().full_tiles, 16u);
+
+	// A flat tile that changed is ahead of the static flat tiles
+	for (int y = 32; y < 48; y++)
+		for (int x = 32; x < 48; x++)
+			previous[y * 64 + x] = 0xFFFFFFFFu;
+	scheduler.schedule(previous, 64, 64, 16, 8, 56, 0);
+	ASSERT_EQ(scheduler.order()[0], 12u);
+	ASSERT_TRUE(scheduler.order()[1] == 10u || scheduler.order()[2] == 10u);
+	ASSERT_GT(scheduler.priority(10), scheduler.priority(5));
+
+	// Every tile costs 16 rays when it's coarse and 256 when it's full, so this budget refines 2 tiles
+	scheduler.schedule(previous, 64, 64, 16, 8, 56, 16 * 16 + 2 * 240);
+	ASSERT_EQ(scheduler.step(scheduler.order()[0]), 1);
+	ASSERT_EQ(scheduler.step(scheduler.order()[1]), 1);
+	ASSERT_EQ(scheduler.step(scheduler.order()[2]), 4);
+	ASSERT_EQ(scheduler.step(5), 4);
+	ASSERT_EQ(scheduler.get_stats().traced_pixels, 16u * 16u + 2u * 240u);
+}
+
+TEST(pixel_order_test, tile_traversal_test) {
+	// x = 0b011 and y = 0b101 interleave to 0b100111
+	ASSERT_EQ(morton_index(3, 5), 39u);
+
+	// Every step of the Hilbert curve moves to a neighbouring pixel
+	std::vector<uint32_t> offsets;
+	tile_traversal(16, pixel_traversal::hilbert, offsets);
+	ASSERT_EQ(offsets.size(), 256u);
+	for (std::size_t i = 1; i < offsets.size(); i++) {
+		const int dx = std::abs(static_cast<int>(offsets[i] & 0xFFFF) - static_cast<int>(offsets[i - 1] & 0xFFFF));
+		const int dy = std::abs(static_cast<int>(offsets[i] >> 16) - static_cast<int>(offsets[i - 1] >> 16));
+		ASSERT_EQ(dx + dy, 1);
+	}
+
+	// A tile that isn't a power of 2 still visits every pixel exactly once, in every order
+	for (pixel_traversal traversal : { pixel_traversal::rows, pixel_traversal::morton, pixel_traversal::hilbert }) {
+		tile_traversal(5, traversal, offsets);
+		std::vector<int> visits(25, 0);
+		for (uint32_t offset : offsets) {
+			ASSERT_LT(offset & 0xFFFF, 5u);
+			ASSERT_LT(offset >> 16, 5u);
+			visits[(offset >> 16) * 5 + (offset & 0xFFFF)]++;
+		}
+		ASSERT_EQ(std::count(visits.begin(), visits.end(), 1), 25);
+	}
+}
+
+TEST(load_balancer_test, split_and_merge_test) {
+	// Without a previous frame every tile is its own item
+	load_balancer balancer;
+	balancer.settings.items_per_thread = 4;
+	balancer.plan(4, 16, nullptr, 1, true);
+	ASSERT_EQ(balancer.items().size(), 4u);
+
+	// The first tile is a hundred times as expensive as the others
+	balancer.start();
+	const double costs[] = { 100, 1, 1, 1 };
+	for (std::size_t item = 0; item < 4; item++) {
+		balancer.measure(balancer.items()[item].first_part, costs[item]);
+		balancer.finish_item(item);
+	}
+	balancer.finish();
+
+	// 4 items of about 26 microseconds: the expensive tile is split in 4 bands, the cheap ones become one item
+	balancer.plan(4, 16, nullptr, 1, true);
+	const std::vector<tile_work>& items = balancer.items();
+	ASSERT_EQ(items.size(), 5u);
+	ASSERT_EQ(balancer.get_stats().split_tiles, 1u);
+	ASSERT_EQ(balancer.get_stats().merged_tiles, 3u);
+	for (std::size_t band = 0; band < 4; band++) {
+		ASSERT_EQ(items[band].begin, 0u);
+		ASSERT_EQ(items[band].row_begin, static_cast<int>(band) * 4);
+		ASSERT_EQ(items[band].row_end, static_cast<int>(band) * 4 + 4);
+	}
+	ASSERT_EQ(items[4].begin, 1u);
+	ASSERT_EQ(items[4].end, 4u);
+
+	// The cheap item is handed out last
+	ASSERT_EQ(balancer.dispatch_order().back(), 4u);
+}
+
+TEST(thread_placement_test, placement_policies_test) {
+	// 2 NUMA nodes of 2 cores with 2 SMT siblings, the second siblings are numbered after the first ones
+	cpu_topology topology;
+	for (int id = 0; id < 8; id++)
+		topology.processors.push_back({ id, id % 4, id % 4 / 2, id % 4 / 2 });
+	topology.cores = 4;
+	topology.packages = topology.nodes = 2;
+
+	ASSERT_TRUE(place_threads(topology, thread_placement::none).empty());
+	ASSERT_EQ(place_threads(topology, thread_placement::physical_cores), (std::vector<int>{ 0, 2, 1, 3 }));
+	ASSERT_EQ(place_threads(topology, thread_placement::physical_cores, 6), (std::vector<int>{ 0, 2, 1, 3, 4, 6 }));
+	ASSERT_EQ(place_threads(topology, thread_placement::smt_siblings, 4), (std::vector<int>{ 0, 4, 1, 5 }));
+	ASSERT_EQ(place_threads(topology, thread_placement::numa_node, 0, 1), (std::vector<int>{ 2, 3, 6, 7 }));
+
+	// A pinned pool still runs every item, and the calling thread gets its affinity back
+	const std::vector<int> affinity = current_affinity();
+	if (affinity.empty())
+		return;
+	{
+		thread_pool pool(std::vector<int>(2, affinity[0]));
+		ASSERT_EQ(pool.pinned(), 2u);
+
+		std::vector<int> visits(100, 0);
+		pool.parallel_for(visits.size(), 7, [&](std::size_t begin, std::size_t end) {
+			for (std::size_t i = begin; i < end; i++)
+				visits[i]++;
+		});
+		ASSERT_EQ(std::count(visits.begin(), visits.end(), 1), 100);
+	}
+	ASSERT_EQ(current_affinity(), affinity);
+}
+
+/// \brief The scene of make_scene in main.cpp, seen by the camera of the window in a frame of the given size
+farm_frame window_scene(int width, int height) {
+	farm_frame scene;
+	scene.camera = bardrix::camera({ 0, 0, 0 }, { 0, 0, 1 }, width, height, 60);
+	scene.width = width;
+	scene.height = height;
+	sphere s1(1.0, bardrix::point3(0.0, 0.0, 3.0));
+	s1.set_material(bardrix::material(0.3, 1, 0.8, 20));
+	sphere s2(1.0, { 0.0, 0.0, -3.0 });
+	s2.set_material(bardrix::material(0.3, 1, 0.8, 20, bardrix::color::magenta()));
+	sphere s3(1.5, { 2.0, 2.0, 4.0 });
+	s3.set_material(bardrix::material(0.3, 1, 0.8, 20, bardrix::color::white()));
+	s3.set_optics({ 0.5, 0, 1 });
+	scene.spheres = { s1, s2, s3 };
+	scene.lights = { bardrix::light({ 2, 1, 1 }, 1, bardrix::color::cyan()),
+					 bardrix::light({ -2, -1, -1 }, 5, bardrix::color::yellow()),
+					 bardrix::light({ 1, 1, 0 }, 2, bardrix::color::cyan()) };
+	scene.area_lights = { area_light(bardrix::light({ -1, 2, 1 }, 2, bardrix::color::white()), 0.5) };
+	return scene;
+}
+
+TEST(renderer_test, deterministic_frames_test) {
+	// The scene of main.cpp, the light moves every frame
+	auto render_frames = [](unsigned int threads, uint32_t first_frame) {
+		farm_frame scene = window_scene(64, 48);
+
+		thread_pool pool(threads);
+		renderer r(scene.camera, scene.spheres, scene.lights, scene.area_lights, pool);
+		r.settings.deterministic = true;
+		r.settings.pixel_order = pixel_traversal::hilbert;
+		r.settings.primary_tile_size = 8;
+
+		std::vector<std::vector<uint32_t>> frames;
+		for (uint32_t frame = 0; frame < 4; frame++) {
+			if (frame >= first_frame) {
+				r.settings.frame_number = frame;
+				frames.emplace_back(64 * 48);
+				r.render(frames.back(), 64, 48);
+			}
+			scene.lights[1].position.x += 0.05;
+		}
+		return frames;
+	};
+
+	// The same frames on 1 and 4 threads, and the last frame on its own without the frames before it
+	const std::vector<std::vector<uint32_t>> serial = render_frames(1, 0), parallel = render_frames(4, 0);
+	const std::vector<std::vector<uint32_t>> last = render_frames(3, 3);
+	ASSERT_EQ(serial, parallel);
+	ASSERT_EQ(serial.back(), last.front());
+}
+
+TEST(renderer_test, mirrors_test) {
+	// A mirror in front of the camera faces a red sphere behind it, three more mirrors reflect each other
+	bardrix::camera camera({ 0, 0, 0 }, { 0, 0, 1 }, 64, 48, 60);
+	sphere mirror(1.0, { 0.0, 0.0, 4.0 });
+	mirror.set_optics({ 1, 0, 1 });
+	sphere red(1.0, { 0.0, 0.0, -3.0 });
+	red.set_material(bardrix::material(0.3, 1, 0.8, 20, bardrix::color::red()));
+	std::vector<sphere> spheres{ mirror, red };
+	for (const double x : { -2.2, 2.2 }) {
+		spheres.emplace_back(1.0, bardrix::point3(x, 0.0, 4.0));
+		spheres.emplace_back(1.0, bardrix::point3(x, 2.0, 5.0));
+	}
+	for (std::size_t i = 2; i < spheres.size(); i++)
+		spheres[i].set_optics({ 0.9, 0, 1 });
+	std::vector<bardrix::light> lights{ bardrix::light({ 0, 1, 0 }, 5, bardrix::color::white()) };
+	std::vector<area_light> area_lights;
+
+	thread_pool pool(2);
+	const auto render_frame = [&](const std::vector<sphere>& scene, int max_depth, std::size_t budget,
+								  std::size_t& traced) {
+		renderer r(camera, scene, lights, area_lights, pool);
+		r.settings.max_depth = max_depth;
+		r.settings.secondary_ray_budget = budget;
+		std::vector<uint32_t> pixels(64 * 48);
+		r.render(pixels, 64, 48);
+		traced = r.get_secondary_rays_traced();
+		return pixels;
+	};
+
+	// The budget holds however many rays the mirrors want
+	std::size_t unlimited, limited, none;
+	const std::vector<uint32_t> reflected = render_frame(spheres, 4, 1000000, unlimited);
+	render_frame(spheres, 4, 300, limited);
+	ASSERT_GT(unlimited, 300u);
+	ASSERT_LE(limited, 300u);
+	ASSERT_GT(limited, 0u);
+
+	// Without depth the mirrors show their own color, as if they weren't mirrors
+	std::vector<sphere> matte = spheres;
+	for (sphere& s : matte)
+		s.set_optics({});
+	ASSERT_EQ(render_frame(spheres, 0, 1000000, none), render_frame(matte, 4, 1000000, unlimited));
+	ASSERT_EQ(none, 0u);
+
+	// The middle of the mirror shows the red sphere
+	const uint32_t center = reflected[24 * 64 + 32];
+	const int r = (center >> 16) & 0xFF, g = (center >> 8) & 0xFF, b = center & 0xFF;
+	ASSERT_GT(r, 40);
+	ASSERT_GT(r, 2 * g);
+	ASSERT_GT(r, 2 * b);
+
+	// A sphere thinner than the air doesn't let the grazing rays in, those keep the color of the sphere itself. The
+	// rays that do get through leave at the back and hit nothing
+	sphere glass(1.0, { 0.0, 0.0, 4.0 });
+	glass.set_optics({ 0, 1, 0.5 });
+	const std::vector<uint32_t> own = render_frame({ sphere(1.0, { 0.0, 0.0, 4.0 }) }, 4, 1000000, none);
+	const std::vector<uint32_t> seen = render_frame({ glass }, 4, 1000000, unlimited);
+	const uint32_t background = own[0];
+	std::size_t kept = 0;
+	for (std::size_t i = 0; i < own.size(); i++) {
+		if (own[i] == background)
+			continue;
+		ASSERT_TRUE(seen[i] == own[i] || seen[i] == background);
+		kept += seen[i] == own[i] ? 1 : 0;
+	}
+	ASSERT_GT(kept, 0u);
+}
+
+TEST(render_farm_test, localhost_workers_test) {
+	// Two frames of the scene of main.cpp, the light moves between them
+	farm_frame frame = window_scene(64, 48);
+	frame.settings.primary_tile_size = 8;
+	std::vector<farm_frame> frames{ frame, frame };
+	frames[1].lights[1].position.x += 0.05;
+	frames[1].settings.frame_number = 1;
+
+	render_coordinator coordinator;
+	coordinator.settings.tile_size = 16;
+	ASSERT_TRUE(coordinator.listen("127.0.0.1:0"));
+
+	// A worker that disconnects as soon as it gets a task, its tiles have to be handed out again
+	socket_stream lost = socket_stream::connect(coordinator.get_address());
+	ASSERT_TRUE(lost.valid());
+	std::thread lost_worker([&lost] {
+		uint32_t type = 0;
+		std::vector<uint8_t> payload;
+		while (type != 2 && lost.receive_message(type, payload)) {}
+		lost.close();
+	});
+
+	std::vector<std::unique_ptr<thread_pool>> pools;
+	std::vector<std::unique_ptr<render_worker>> workers;
+	std::vector<std::thread> threads;
+	std::vector<int> quit(2, 0);
+	for (std::size_t i = 0; i < 2; i++) {
+		pools.push_back(std::make_unique<thread_pool>(1));
+		workers.push_back(std::make_unique<render_worker>(*pools.back()));
+		threads.emplace_back([&, i] { quit[i] = workers[i]->run(coordinator.get_address()); });
+	}
+
+	std::vector<std::vector<uint32_t>> images;
+	ASSERT_TRUE(coordinator.render(frames, images));
+	const farm_stats stats = coordinator.get_stats();
+	coordinator.shutdown();
+	lost_worker.join();
+	for (std::thread& thread : threads)
+		thread.join();
+
+	ASSERT_EQ(stats.tasks, 2u * 4 * 3);
+	ASSERT_EQ(stats.lost_workers, 1u);
+	ASSERT_GE(stats.retried, 1u);
+	ASSERT_EQ(quit, std::vector<int>(2, 1));
+	ASSERT_GE(workers[0]->get_tasks_done() + workers[1]->get_tasks_done(), stats.tasks);
+
+	// The tiles put together are the frames rendered in one piece
+	for (std::size_t f = 0; f < frames.size(); f++) {
+		farm_frame local;
+		ASSERT_TRUE(decode_frame(encode_frame(frames[f]), local));
+		thread_pool pool(2);
+		renderer r(local.camera, local.spheres, local.lights, local.area_lights, pool);
+		r.settings = local.settings;
+		r.settings.deterministic = true;
+		std::vector<uint32_t> expected(64 * 48);
+		r.render(expected, 64, 48);
+		ASSERT_EQ(images[f], expected);
+	}
+}
+
+TEST(frame_ring_test, publish_and_read_test) {
+	frame_ring writer, reader;
+	ASSERT_TRUE(writer.create("frame-ring-test", 3, 16));
+	ASSERT_TRUE(reader.open("frame-ring-test"));
+	ASSERT_EQ(reader.get_slots(), 3u);
+	ASSERT_EQ(reader.latest().pixels, nullptr);
+	ASSERT_FALSE(reader.wait(0, 10));
+	ASSERT_FALSE(reader.publish(std::vector<uint32_t>(4), 2, 2)); // Readers can't publish
+	ASSERT_FALSE(writer.publish(std::vector<uint32_t>(25), 5, 5)); // Too big
+
+	// A reader that waits is woken up by the next frame
+	std::thread waiting([&reader] { ASSERT_TRUE(reader.wait(0, 5000)); });
+	ASSERT_TRUE(writer.publish({ 1, 2, 3, 4, 5, 6 }, 3, 2));
+	waiting.join();
+
+	const ring_frame first = reader.latest();
+	ASSERT_EQ(first.sequence, 1u);
+	ASSERT_EQ(first.width, 3);
+	ASSERT_EQ(first.height, 2);
+	ASSERT_EQ(std::vector<uint32_t>(first.pixels, first.pixels + 6), std::vector<uint32_t>({ 1, 2, 3, 4, 5, 6 }));
+
+	// The first frame stays valid until its slot is used again, 3 frames later
+	ASSERT_TRUE(writer.publish({ 7, 8 }, 2, 1));
+	ASSERT_TRUE(writer.publish({ 9, 10 }, 1, 2));
+	ASSERT_TRUE(reader.still_valid(first));
+	ASSERT_TRUE(writer.publish({ 11 }, 1, 1));
+	ASSERT_FALSE(reader.still_valid(first));
+	ASSERT_EQ(reader.latest().sequence, 4u);
+	ASSERT_EQ(reader.latest().pixels[0], 11u);
+
+	// Closing the ring ends the wait of its readers
+	writer.close();
+	ASSERT_TRUE(reader.closed());
+	ASSERT_FALSE(reader.wait(4, 5000));
+}
+
+TEST(render_server_test, local_clients_test) {
+	farm_frame scene = window_scene(32, 24);
+	scene.settings.primary_tile_size = 8;
+
+	thread_pool server_pool(2);
+	render_server server(server_pool);
+	server.settings.batch_window_ms = 100;
+	server.settings.client_timeout_ms = 200;
+	ASSERT_TRUE(server.listen("127.0.0.1:0"));
+	std::thread server_thread([&server] { server.run(); });
+
+	// A client that stops halfway through a header is dropped instead of stalling the others
+	socket_stream stalled = socket_stream::connect(server.get_address());
+	stalled.set_timeout(5000);
+	const uint8_t half_header[2] = { 3, 0 };
+	ASSERT_TRUE(stalled.send_all(half_header, sizeof(half_header)));
+
+	// Three clients ask for the same frame and one of their own at once, identical frames are rendered once. The own
+	// frame sorts before the shared one in the batch, but is answered second as it was sent second
+	std::vector<render_request> requests(3);
+	std::vector<server_image> shared(3), own(3);
+	std::vector<uint32_t> scene_ids(3);
+	std::vector<std::thread> clients;
+	for (std::size_t i = 0; i < 3; i++) {
+		clients.emplace_back([&, i] {
+			render_client client;
+			ASSERT_TRUE(client.connect(server.get_address()));
+			ASSERT_TRUE(client.load_scene(scene, scene_ids[i]));
+			render_request request;
+			request.scene = scene_ids[i];
+			request.width = 32;
+			request.height = 24;
+			request.format = image_format::ppm;
+			requests[i] = request;
+			requests[i].tag = 1;
+			requests[i].position.x = -0.1 * (i + 1.0);
+			requests[i].frame_number = static_cast<uint32_t>(i);
+			requests[i].format = image_format::raw;
+			ASSERT_TRUE(client.send_render(request));
+			ASSERT_TRUE(client.send_render(requests[i]));
+			ASSERT_TRUE(client.receive_image(shared[i]));
+			ASSERT_TRUE(client.receive_image(own[i]));
+		});
+	}
+	for (std::thread& client : clients)
+		client.join();
+	uint8_t closed;
+	ASSERT_FALSE(stalled.receive_all(&closed, 1));
+
+	// A scene that isn't loaded is an error, not a disconnect
+	render_client client;
+	ASSERT_TRUE(client.connect(server.get_address()));
+	render_request unknown;
+	unknown.scene = 42;
+	unknown.width = unknown.height = 8;
+	server_image error;
+	ASSERT_FALSE(client.render(unknown, error));
+	ASSERT_FALSE(error.error.empty());
+	render_request png = requests[0];
+	png.format = image_format::png;
+	server_image encoded;
+	ASSERT_TRUE(client.render(png, encoded));
+	ASSERT_EQ(encoded.bytes.size(), encoded_image_size(32, 24, image_format::png));
+	ASSERT_EQ(std::vector<uint8_t>(encoded.bytes.begin() + 1, encoded.bytes.begin() + 4),
+			  std::vector<uint8_t>({ 'P', 'N', 'G' }));
+	std::string metrics;
+	ASSERT_TRUE(client.get_metrics(metrics));
+	ASSERT_EQ(metrics.rfind("Render server", 0), 0u);
+
+	server.stop();
+	server_thread.join();
+	const server_stats stats = server.get_stats();
+	ASSERT_EQ(stats.requests, 8u);
+	ASSERT_EQ(stats.errors, 1u);
+	ASSERT_EQ(stats.scenes, 1u);
+	ASSERT_EQ(stats.renders + stats.shared, 7u);
+	ASSERT_GE(stats.shared, 1u);
+	ASSERT_GT(stats.p95_latency_ms, 0.0);
+
+	// Every frame is the frame rendered locally from the same camera
+	farm_frame local;
+	ASSERT_TRUE(decode_frame(encode_frame(scene), local));
+	thread_pool pool(1);
+	const auto render_locally = [&](const render_request& request) {
+		local.camera = bardrix::camera(request.position, request.direction, request.width, request.height, request.fov);
+		renderer r(local.camera, local.spheres, local.lights, local.area_lights, pool);
+		r.settings = local.settings;
+		r.settings.deterministic = true;
+		r.settings.frame_number = request.frame_number;
+		std::vector<uint32_t> pixels(32 * 24);
+		r.render(pixels, 32, 24);
+		return pixels;
+	};
+	render_request first = requests[0];
+	first.position.x = 0;
+	first.frame_number = 0;
+	std::vector<uint8_t> ppm;
+	encode_image(render_locally(first).data(), 32, 24, image_format::ppm, ppm);
+	for (std::size_t i = 0; i < 3; i++) {
+		ASSERT_EQ(scene_ids[i], scene_ids[0]);
+		ASSERT_EQ(shared[i].tag, 0u);
+		ASSERT_EQ(shared[i].format, image_format::ppm);
+		ASSERT_EQ(shared[i].bytes, ppm);
+		ASSERT_EQ(own[i].tag, 1u);
+		std::vector<uint8_t> raw;
+		encode_image(render_locally(requests[i]).data(), 32, 24, image_format::raw, raw);
+		ASSERT_EQ(own[i].bytes, raw);
+	}
+}
+
+TEST(sequence_writer_test, writes_every_frame_test) {
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "sequence-writer-test";
+	std::filesystem::remove_all(directory);
+
+	// A queue of 2 frames and one thread, submit waits whenever the thread falls behind
+	sequence_writer writer;
+	writer.settings.directory = directory.string();
+	writer.settings.format = image_format::ppm;
+	writer.settings.queue_frames = 2;
+	writer.settings.threads = 1;
+	ASSERT_FALSE(writer.submit(std::vector<uint32_t>(4), 2, 2)); // Not started
+	ASSERT_TRUE(writer.start(10));
+
+	std::vector<std::vector<uint32_t>> frames;
+	for (uint32_t f = 0; f < 12; f++) {
+		frames.emplace_back(64 * 32);
+		for (std::size_t i = 0; i < frames[f].size(); i++)
+			frames[f][i] = 0xFF000000u | static_cast<uint32_t>(i * 2654435761u + f) >> 8;
+		ASSERT_TRUE(writer.submit(frames[f], 64, 32));
+		frames[f].back() ^= 1; // The frame was copied, the buffer can be rendered into again
+	}
+	writer.finish();
+
+	const sequence_stats stats = writer.get_stats();
+	ASSERT_EQ(stats.submitted, 12u);
+	ASSERT_EQ(stats.written, 12u);
+	ASSERT_EQ(stats.dropped + stats.failed, 0u);
+	ASSERT_LE(stats.max_queued, 2u);
+	ASSERT_EQ(writer.file_name(10), (directory / "frame_000010.ppm").string());
+
+	for (uint32_t f = 0; f < 12; f++) {
+		frames[f].back() ^= 1;
+		std::vector<uint8_t> expected;
+		encode_image(frames[f].data(), 64, 32, image_format::ppm, expected);
+		std::ifstream file(writer.file_name(10 + f), std::ios::binary);
+		ASSERT_EQ(std::vector<uint8_t>(std::istreambuf_iterator<char>(file), {}), expected);
+	}
+
+	// A directory that can't be made doesn't start
+	writer.settings.directory = writer.file_name(10) + "/frames";
+	ASSERT_FALSE(writer.start());
+	std::filesystem::remove_all(directory);
+}
+
+class stalled_writer : public sequence_writer {
+public:
+	using sequence_writer::free_buffers_;
+	using sequence_writer::queue_;
+
+	/// \brief Runs with a thread that never takes a frame, as if the disk stalled
+	void stall() {
+		active_ = settings;
+		threads_.emplace_back([] {});
+	}
+};
+
+TEST(sequence_writer_test, backpressure_test) {
+	const std::vector<uint32_t> first(4, 1), second(4, 2), third(4, 3);
+	for (const queue_backpressure backpressure : { queue_backpressure::drop_newest, queue_backpressure::drop_oldest }) {
+		stalled_writer writer;
+		writer.settings.queue_frames = 1;
+		writer.settings.backpressure = backpressure;
+		writer.stall();
+		ASSERT_TRUE(writer.submit(first, 2, 2));
+		const uint32_t* buffer = writer.queue_.front().pixels.data();
+
+		// drop_newest keeps the first frame, drop_oldest replaces it in its own buffer without allocating
+		const bool oldest = backpressure == queue_backpressure::drop_oldest;
+		ASSERT_EQ(writer.submit(second, 2, 2), oldest);
+		ASSERT_EQ(writer.submit(third, 2, 2), oldest);
+		ASSERT_EQ(writer.queue_.size(), 1u);
+		ASSERT_EQ(writer.queue_.front().pixels, oldest ? third : first);
+		ASSERT_EQ(writer.queue_.front().number, oldest ? 2u : 0u);
+		ASSERT_EQ(writer.queue_.front().pixels.data(), buffer);
+		ASSERT_TRUE(writer.free_buffers_.empty());
+
+		const sequence_stats stats = writer.get_stats();
+		ASSERT_EQ(stats.submitted, 3u);
+		ASSERT_EQ(stats.dropped, 2u);
+		ASSERT_EQ(stats.written + stats.failed + stats.blocked, 0u);
+		ASSERT_EQ(stats.max_queued, 1u);
+	}
+}
+
+TEST(frame_stream_test, header_and_frames_test) {
+	const std::string path = (std::filesystem::temp_directory_path() / "frame-stream-test.raw").string();
+	{
+		frame_stream stream;
+		ASSERT_TRUE(stream.open(path, 3, 2));
+		ASSERT_FALSE(stream.zero_copy()); // A file is written, not spliced
+
+		std::vector<uint32_t>& buffer = stream.next_frame();
+		ASSERT_EQ(buffer.size(), 6u);
+		buffer = { 0xFF010203, 2, 3, 4, 5, 6 };
+		ASSERT_TRUE(stream.write_frame(buffer));
+		ASSERT_TRUE(stream.write_frame({ 7, 8, 9, 10, 11, 12 }));
+		ASSERT_FALSE(stream.write_frame({ 1, 2 })); // Not the size of the stream, it's not sent
+		ASSERT_TRUE(stream.valid());
+		ASSERT_EQ(stream.get_stats().frames, 2u);
+		ASSERT_EQ(stream.get_stats().bytes, frame_stream_header_size + 2 * 6 * 4);
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	const std::vector<uint8_t> bytes{ std::istreambuf_iterator<char>(file), {} };
+	file.close();
+	std::filesystem::remove(path);
+	ASSERT_EQ(bytes.size(), frame_stream_header_size + 2 * 6 * 4);
+	ASSERT_EQ(std::vector<uint8_t>(bytes.begin(), bytes.begin() + 16),
+			  std::vector<uint8_t>({ 'R', 'T', 'F', 'S', 1, 0, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0 }));
+
+	// The ARGB pixels as they are in memory: B, G, R, A
+	ASSERT_EQ(std::vector<uint8_t>(bytes.begin() + 16, bytes.begin() + 20), std::vector<uint8_t>({ 3, 2, 1, 0xFF }));
+	ASSERT_EQ(bytes[16 + 6 * 4], 7);
+}
+
+#if !defined(_WIN32) && defined(__linux__)
+TEST(frame_stream_test, fifo_frames_test) {
+	const std::string path = (std::filesystem::temp_directory_path() / "frame-stream-test.fifo").string();
+	std::filesystem::remove(path);
+	ASSERT_EQ(mkfifo(path.c_str(), 0600), 0);
+
+	// The reader takes everything until the stream closes the pipe, slowly, so the last frames are still in the pipe
+	// when the stream closes
+	std::vector<uint8_t> received;
+	std::thread reader([&path, &received] {
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		uint8_t chunk[4096];
+		for (ssize_t done; fd >= 0 && (done = ::read(fd, chunk, sizeof(chunk))) != 0;) {
+			if (done > 0) {
+				received.insert(received.end(), chunk, chunk + done);
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			} else if (errno != EINTR)
+				break;
+		}
+		if (fd >= 0)
+			::close(fd);
+	});
+
+	// The frames are rendered into the buffers of the stream and spliced, every one differs from the one before
+	std::vector<uint8_t> sent{ 'R', 'T', 'F', 'S', 1, 0, 0, 0, 64, 0, 0, 0, 48, 0, 0, 0 };
+	{
+		frame_stream stream;
+		ASSERT_TRUE(stream.open(path, 64, 48));
+		ASSERT_TRUE(stream.zero_copy());
+		for (uint32_t f = 0; f < 10; f++) {
+			std::vector<uint32_t>& buffer = stream.next_frame();
+			for (std::size_t i = 0; i < buffer.size(); i++)
+				buffer[i] = 0xFF000000u | static_cast<uint32_t>(i * 2654435761u + f * 40503u) >> 8;
+			const auto* bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+			sent.insert(sent.end(), bytes, bytes + buffer.size() * 4);
+			ASSERT_TRUE(stream.write_frame(buffer));
+		}
+		ASSERT_EQ(stream.get_stats().frames, 10u);
+		ASSERT_EQ(stream.get_stats().zero_copy, 10u);
+	}
+
+	// The memory of the buffers can be reused as soon as the stream is closed
+	std::vector<std::vector<uint32_t>> reused(8, std::vector<uint32_t>(64 * 48, 0));
+	reader.join();
+	std::filesystem::remove(path);
+	ASSERT_EQ(received, sent);
+}
+#endif
@@ -0,0 +1,98 @@
+//
+// accumulation.cpp
+//
+
+#include "accumulation.h"
+
+#include <bardrix/color.h>
+
+#include <algorithm>
+#include <cmath>
+
+bool accumulation_buffer::prepare(int width, int height, uint64_t view) {
+    if (width == width_ && height == height_ && view == view_)
+        return false;
+
+    width_ = width;
+    height_ = height;
+    view_ = view;
+    reset();
+    return true;
+}
+
+void accumulation_buffer::reset() {
+    const std::size_t pixels = static_cast<std::size_t>(width_) * height_;
+    sum_r_.assign(pixels, 0);
+    sum_g_.assign(pixels, 0);
+    sum_b_.assign(pixels, 0);
+    samples_ = 0;
+    last_change_ = 1;
+}
+
+float accumulation_buffer::add_pixel(std::size_t pixel, float r, float g, float b) {
+    // The first sample doesn't have an average to change, it counts as a full change
+    if (samples_ == 0) {
+        sum_r_[pixel] = r;
+        sum_g_[pixel] = g;
+        sum_b_[pixel] = b;
+        return 3;
+    }
+
+    const float n = static_cast<float>(samples_);
+    const float change = std::fabs(r - sum_r_[pixel] / n) + std::fabs(g - sum_g_[pixel] / n) +
+                         std::fabs(b - sum_b_[pixel] / n);
+    sum_r_[pixel] += r;
+    sum_g_[pixel] += g;
+    sum_b_[pixel] += b;
+    return change / (n + 1);
+}
+
+void accumulation_buffer::add(const hdr_view& frame) {
+    double change = 0;
+    for (std::size_t pixel = 0; pixel < sum_r_.size(); pixel++)
+        change += add_pixel(pixel, frame.r[pixel] * frame.scale, frame.g[pixel] * frame.scale,
+                            frame.b[pixel] * frame.scale);
+
+    samples_++;
+    last_change_ = sum_r_.empty() ? 0 : static_cast<float>(change / (3.0 * sum_r_.size()));
+}
+
+void accumulation_buffer::add(const std::vector<uint32_t>& buffer) {
+    constexpr float to_float = 1.0f / 255.0f;
+
+    double change = 0;
+    for (std::size_t pixel = 0; pixel < sum_r_.size(); pixel++) {
+        const uint32_t argb = buffer[pixel];
+        change += add_pixel(pixel, static_cast<float>((argb >> 16) & 0xFF) * to_float,
+                            static_cast<float>((argb >> 8) & 0xFF) * to_float,
+                            static_cast<float>(argb & 0xFF) * to_float);
+    }
+
+    samples_++;
+    last_change_ = sum_r_.empty() ? 0 : static_cast<float>(change / (3.0 * sum_r_.size()));
+}
+
+void accumulation_buffer::resolve(std::vector<uint32_t>& buffer) const {
+    if (samples_ == 0)
+        return;
+
+    // Round instead of truncating, so the average of identical 8 bit samples is that sample again
+    const float scale = 255.0f / static_cast<float>(samples_);
+    for (std::size_t pixel = 0; pixel < sum_r_.size(); pixel++) {
+        const auto r = static_cast<uint8_t>(std::min(255.0f, sum_r_[pixel] * scale + 0.5f));
+        const auto g = static_cast<uint8_t>(std::min(255.0f, sum_g_[pixel] * scale + 0.5f));
+        const auto b = static_cast<uint8_t>(std::min(255.0f, sum_b_[pixel] * scale + 0.5f));
+        buffer[pixel] = bardrix::color(r, g, b, 255).argb(); // ARGB is the format used by Windows API
+    }
+}
+
+bool accumulation_buffer::converged() const {
+    if (samples_ >= settings.max_samples)
+        return true;
+
+    return samples_ >= settings.min_samples && last_change_ < settings.convergence_threshold;
+}
+
+uint32_t accumulation_buffer::get_samples() const { return samples_; }
+
+float accumulation_buffer::get_last_change() const { return last_change_; }
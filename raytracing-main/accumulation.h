@@ -0,0 +1,98 @@
+//
+// accumulation.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstdint>
+#include <vector>
+
+/// \brief A frame in linear HDR colors, 1 is the brightest color the screen can show
+struct hdr_view {
+    /// \brief The red, green and blue planes, one value per pixel
+    const float* r = nullptr;
+    const float* g = nullptr;
+    const float* b = nullptr;
+
+    /// \brief Every value is multiplied by this to get the color
+    float scale = 1;
+};
+
+/// \brief When the accumulation buffer stops taking samples
+struct accumulation_settings {
+    /// \brief The image is converged once a sample changes the mean of a channel by less than this on average
+    ///        (1 = full brightness)
+    float convergence_threshold = 0.0002f;
+
+    /// \brief The minimum amount of samples before the image can be converged
+    uint32_t min_samples = 16;
+
+    /// \brief The image is always converged after this many samples
+    uint32_t max_samples = 1024;
+};
+
+/// \brief Averages the frames of a static view in HDR, so a new (jittered) sample every frame converges to an
+///        anti-aliased and noise free image
+/// \details The buffer keeps a sum per channel instead of a running average, so the average doesn't lose precision
+///          as more samples are added. A sample changes the average by (sample - average) / samples, the mean of
+///          that change over the image is used as the convergence estimate.
+class accumulation_buffer {
+public:
+    /// \brief When the buffer is converged
+    accumulation_settings settings;
+
+protected:
+    /// \brief The size of the image
+    int width_ = 0, height_ = 0;
+
+    /// \brief The sum of all samples of every pixel
+    std::vector<float> sum_r_, sum_g_, sum_b_;
+
+    /// \brief The amount of samples in the sums
+    uint32_t samples_ = 0;
+
+    /// \brief The mean change of a channel by the last sample
+    float last_change_ = 1;
+
+    /// \brief The hash of the view the samples are of
+    uint64_t view_ = 0;
+
+public:
+    /// \brief Starts over if the size or the view changed, the view is usually a fingerprint of the camera and scene
+    /// \param width The width of the image
+    /// \param height The height of the image
+    /// \param view The hash of the view that will be rendered
+    /// \return Whether the buffer was reset
+    /// \example if (accumulation.prepare(width, height, fingerprint::of(camera))) std::cout << "view changed\n";
+    bool prepare(int width, int height, uint64_t view);
+
+    /// \brief Removes all samples
+    void reset();
+
+    /// \brief Adds a sample to every pixel
+    /// \param frame The linear HDR colors of the sample
+    void add(const hdr_view& frame);
+
+    /// \brief Adds a sample to every pixel
+    /// \param buffer The colors of the sample, the format is AARRGGBB
+    void add(const std::vector<uint32_t>& buffer);
+
+    /// \brief Writes the average of every pixel to a buffer, colors above 1 are clamped
+    /// \param buffer The buffer to write to, the format is AARRGGBB
+    void resolve(std::vector<uint32_t>& buffer) const;
+
+    /// \brief Gets whether more samples won't visibly change the image anymore
+    NODISCARD bool converged() const;
+
+    /// \brief Gets the amount of samples of every pixel
+    NODISCARD uint32_t get_samples() const;
+
+    /// \brief Gets the mean change of a channel by the last sample
+    NODISCARD float get_last_change() const;
+
+protected:
+    /// \brief Adds a pixel to the sums and returns how much it changed the average
+    float add_pixel(std::size_t pixel, float r, float g, float b);
+}; // class accumulation_buffer
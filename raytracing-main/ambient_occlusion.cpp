@@ -0,0 +1,185 @@
+//
+// ambient_occlusion.cpp
+//
+
+#include "ambient_occlusion.h"
+#include "fingerprint.h"
+#include "sampling.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    /// \brief The amount of cells that are searched for a key
+    constexpr std::size_t probe_window = 8;
+
+    /// \brief The part of the table the eviction sweep visits every frame
+    constexpr std::size_t sweep_fraction = 16;
+
+    /// \brief The amount of steps a normal component is quantized to between -1 and 1
+    constexpr double normal_steps = 2;
+
+    /// \brief Moves the occlusion rays off the surface so they don't hit the sphere they start on
+    constexpr double surface_offset = 1e-6;
+
+    /// \brief Mixes a value into a hash (splitmix64 finalizer)
+    uint64_t mix(uint64_t hash, int64_t value) {
+        uint64_t z = hash + static_cast<uint64_t>(value) + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /// \brief Gets occlusion ray number sample of a cell, every ray of a cell has its own random stream
+    bardrix::ray occlusion_ray(uint64_t key, uint32_t sample, const bardrix::point3& origin,
+                               const bardrix::vector3& normal, double radius) {
+        uint32_t state = sampling::hash(static_cast<uint32_t>(key) ^ sampling::hash(sample));
+        const double u1 = sampling::next_double(state);
+        const double u2 = sampling::next_double(state);
+        return {origin, sampling::cosine_hemisphere(normal, u1, u2), radius};
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const ao_stats& stats) {
+    os << "Ambient occlusion: " << stats.lookups << " lookups (" << stats.converged_lookups << " converged), "
+       << stats.rays << " rays, " << stats.cells << " cells, " << stats.evicted << " evicted";
+    return os;
+}
+
+ao_cache::ao_cache(std::size_t capacity) {
+    std::size_t size = probe_window;
+    while (size < capacity)
+        size *= 2;
+    cells_.resize(size);
+}
+
+void ao_cache::begin_frame(const std::vector<sphere>& spheres) {
+    frame_++;
+    const std::size_t cells = stats_.cells;
+    stats_ = ao_stats();
+    stats_.cells = cells;
+
+    const uint64_t geometry = fingerprint::of(spheres);
+    if (geometry != geometry_) {
+        geometry_ = geometry;
+        clear();
+        return;
+    }
+
+    // Sweep part of the table, so every cell is checked every sweep_fraction frames without a spike
+    const std::size_t count = cells_.size() / sweep_fraction;
+    for (std::size_t i = 0; i < count; i++) {
+        cell& c = cells_[(sweep_ + i) & (cells_.size() - 1)];
+        if (c.key != 0 && frame_ - c.last_used > settings.max_age) {
+            c = cell();
+            stats_.evicted++;
+            stats_.cells--;
+        }
+    }
+    sweep_ = (sweep_ + count) & (cells_.size() - 1);
+}
+
+double ao_cache::visibility(const bardrix::point3& point, const bardrix::vector3& normal,
+                            const std::vector<sphere>& spheres) {
+    return lookup(point, normal, spheres, settings.samples_per_lookup);
+}
+
+double ao_cache::converged_visibility(const bardrix::point3& point, const bardrix::vector3& normal,
+                                     const std::vector<sphere>& spheres) {
+    return lookup(point, normal, spheres, settings.max_samples);
+}
+
+double ao_cache::lookup(const bardrix::point3& point, const bardrix::vector3& normal,
+                        const std::vector<sphere>& spheres, int max_rays) {
+    stats_.lookups++;
+
+    const uint64_t key = key_of(point, normal);
+    cell& c = find(key);
+    c.last_used = frame_;
+
+    const int samples = std::min(settings.max_samples - c.samples, max_rays);
+    if (samples <= 0) {
+        stats_.converged_lookups++;
+        return static_cast<double>(c.unoccluded) / c.samples;
+    }
+
+    // Every ray of a cell gets a different random stream, so lookups from any pixel keep adding new directions
+    const bardrix::point3 origin = point + normal * surface_offset;
+    for (int i = 0; i < samples; i++) {
+        const bardrix::ray ray = occlusion_ray(key, c.samples, origin, normal, settings.radius);
+
+        // A sphere is convex, so rays that leave the hemisphere of its surface can't hit it
+        if (!is_occluded(ray, spheres, nullptr))
+            c.unoccluded++;
+        c.samples++;
+    }
+    stats_.rays += static_cast<std::size_t>(samples);
+
+    return static_cast<double>(c.unoccluded) / c.samples;
+}
+
+double ao_cache::uncached_visibility(const bardrix::point3& point, const bardrix::vector3& normal,
+                                     const std::vector<sphere>& spheres) {
+    stats_.lookups++;
+
+    // The same rays a cell that only this point looked up would get
+    const uint64_t key = key_of(point, normal);
+    const bardrix::point3 origin = point + normal * surface_offset;
+    const int samples = std::max(1, settings.max_samples);
+    int unoccluded = 0;
+    for (int i = 0; i < samples; i++)
+        unoccluded += !is_occluded(occlusion_ray(key, static_cast<uint32_t>(i), origin, normal, settings.radius),
+                                   spheres, nullptr);
+    stats_.rays += static_cast<std::size_t>(samples);
+
+    return static_cast<double>(unoccluded) / samples;
+}
+
+void ao_cache::clear() {
+    std::fill(cells_.begin(), cells_.end(), cell());
+    stats_.cells = 0;
+}
+
+const ao_stats& ao_cache::get_stats() const { return stats_; }
+
+ao_cache::cell& ao_cache::find(uint64_t key) {
+    const std::size_t mask = cells_.size() - 1;
+    const std::size_t start = static_cast<std::size_t>(key) & mask;
+
+    // The whole window is searched, evicted cells leave holes that don't end a probe sequence
+    std::size_t free = cells_.size(), oldest = start;
+    for (std::size_t i = 0; i < probe_window; i++) {
+        const std::size_t index = (start + i) & mask;
+        const cell& c = cells_[index];
+        if (c.key == key)
+            return cells_[index];
+
+        if (c.key == 0 || frame_ - c.last_used > settings.max_age) {
+            if (free == cells_.size())
+                free = index;
+        } else if (c.last_used < cells_[oldest].last_used)
+            oldest = index;
+    }
+
+    const std::size_t index = free != cells_.size() ? free : oldest;
+    cell& c = cells_[index];
+    if (c.key == 0)
+        stats_.cells++;
+    else
+        stats_.evicted++;
+
+    c = cell();
+    c.key = key;
+    return c;
+}
+
+uint64_t ao_cache::key_of(const bardrix::point3& point, const bardrix::vector3& normal) const {
+    uint64_t key = mix(0, static_cast<int64_t>(std::floor(point.x / settings.cell_size)));
+    key = mix(key, static_cast<int64_t>(std::floor(point.y / settings.cell_size)));
+    key = mix(key, static_cast<int64_t>(std::floor(point.z / settings.cell_size)));
+    key = mix(key, static_cast<int64_t>(std::lround(normal.x * normal_steps)));
+    key = mix(key, static_cast<int64_t>(std::lround(normal.y * normal_steps)));
+    key = mix(key, static_cast<int64_t>(std::lround(normal.z * normal_steps)));
+    return key == 0 ? 1 : key;
+}
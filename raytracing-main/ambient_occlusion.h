@@ -0,0 +1,133 @@
+//
+// ambient_occlusion.h
+//
+
+#pragma once
+
+#include "sphere.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief How ambient occlusion is sampled and cached
+struct ao_settings {
+    /// \brief Spheres further away than this from a surface point don't occlude it, in world units
+    double radius = 1.0;
+
+    /// \brief The size of a cache cell, in world units
+    double cell_size = 0.05;
+
+    /// \brief The amount of rays that are added to a cell every time it's looked up, until it has max_samples
+    int samples_per_lookup = 2;
+
+    /// \brief The amount of rays after which a cell is converged and only read
+    int max_samples = 64;
+
+    /// \brief The amount of frames a cell may go unused before it's evicted
+    uint32_t max_age = 120;
+};
+
+/// \brief Lookups and rays of the ambient occlusion cache in the last frame
+struct ao_stats {
+    /// \brief The amount of lookups
+    std::size_t lookups = 0;
+
+    /// \brief The amount of lookups that found a converged cell and traced no rays
+    std::size_t converged_lookups = 0;
+
+    /// \brief The amount of occlusion rays that were traced
+    std::size_t rays = 0;
+
+    /// \brief The amount of cells that were evicted because they were too old or the table was full
+    std::size_t evicted = 0;
+
+    /// \brief The amount of cells in use at the end of the frame
+    std::size_t cells = 0;
+};
+
+/// \brief Prints the stats of the ambient occlusion cache
+std::ostream& operator<<(std::ostream& os, const ao_stats& stats);
+
+/// \brief Caches ambient occlusion in world space, so it's shared by every pixel, frame and camera position that sees
+///        the same part of a surface
+/// \details Cells are keyed by the quantized position and normal and live in a hash table with a bounded probe window.
+///          A cell gathers a couple of rays every lookup until it has enough, so the cost is spread over the frames.
+///          Cells that aren't looked up for a while are evicted by a sweep that visits part of the table every frame,
+///          and when a window is full the oldest cell in it is replaced. The cache isn't thread safe.
+class ao_cache {
+public:
+    /// \brief How occlusion is sampled and cached
+    ao_settings settings;
+
+protected:
+    /// \brief A cell of the cache, key 0 is an empty cell
+    struct cell {
+        uint64_t key = 0;
+        uint32_t last_used = 0;
+        uint16_t samples = 0;
+        uint16_t unoccluded = 0;
+    };
+
+    /// \brief The hash table, the size is a power of 2
+    std::vector<cell> cells_;
+
+    /// \brief The current frame, used as the age of the cells
+    uint32_t frame_ = 0;
+
+    /// \brief Where the eviction sweep continues next frame
+    std::size_t sweep_ = 0;
+
+    /// \brief The fingerprint of the spheres the cells were sampled with
+    uint64_t geometry_ = 0;
+
+    /// \brief The stats of the current frame
+    ao_stats stats_;
+
+public:
+    /// \brief Constructor for the cache
+    /// \param capacity The maximum amount of cells, rounded up to a power of 2
+    explicit ao_cache(std::size_t capacity = 1 << 18);
+
+    /// \brief Starts a new frame, evicts old cells and clears the cache if the spheres changed
+    /// \param spheres The spheres in the scene
+    void begin_frame(const std::vector<sphere>& spheres);
+
+    /// \brief Gets the fraction of the hemisphere above a surface point that isn't occluded by nearby spheres
+    /// \param point The surface point
+    /// \param normal The normal at the surface point, must be normalized
+    /// \param spheres The spheres that can occlude the point
+    /// \return The visibility [0, 1], 1 is not occluded at all
+    /// \example double ambient_visibility = cache.visibility(hit.point, hit.shape->normal_at(hit.point), spheres);
+    NODISCARD double visibility(const bardrix::point3& point, const bardrix::vector3& normal,
+                                const std::vector<sphere>& spheres);
+
+    /// \brief Gets the visibility of a surface point like visibility, but traces all rays its cell still needs at once
+    /// \return The converged visibility [0, 1]
+    NODISCARD double converged_visibility(const bardrix::point3& point, const bardrix::vector3& normal,
+                                          const std::vector<sphere>& spheres);
+
+    /// \brief Gets the visibility of a surface point from max_samples rays from the point itself, without the cache
+    /// \details A cell is shared by every point that falls in it, so what it holds depends on which points were looked
+    ///          up first. This only depends on the point, but traces every ray every time.
+    /// \return The visibility [0, 1]
+    NODISCARD double uncached_visibility(const bardrix::point3& point, const bardrix::vector3& normal,
+                                         const std::vector<sphere>& spheres);
+
+    /// \brief Removes all cells
+    void clear();
+
+    /// \brief Gets the stats of the current frame
+    NODISCARD const ao_stats& get_stats() const;
+
+protected:
+    /// \brief Looks up the cell of a surface point and adds at most max_rays rays to it
+    NODISCARD double lookup(const bardrix::point3& point, const bardrix::vector3& normal,
+                            const std::vector<sphere>& spheres, int max_rays);
+
+    /// \brief Finds the cell of a key or claims a free, stale or the oldest cell in its probe window
+    cell& find(uint64_t key);
+
+    /// \brief Gets the key of the cell a surface point falls in, never 0
+    NODISCARD uint64_t key_of(const bardrix::point3& point, const bardrix::vector3& normal) const;
+}; // class ao_cache
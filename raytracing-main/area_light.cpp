@@ -0,0 +1,33 @@
+//
+// area_light.cpp
+//
+
+#include "area_light.h"
+#include "sampling.h"
+
+area_light::area_light(const bardrix::light& light, double radius)
+    : light(light), shape_(area_shape::sphere), radius_(radius) {}
+
+area_light::area_light(const bardrix::light& light, const bardrix::vector3& edge_u, const bardrix::vector3& edge_v)
+    : light(light), shape_(area_shape::rectangle), edge_u_(edge_u), edge_v_(edge_v) {}
+
+area_light::area_shape area_light::get_shape() const { return shape_; }
+
+double area_light::get_radius() const { return radius_; }
+
+const bardrix::vector3& area_light::get_edge_u() const { return edge_u_; }
+
+const bardrix::vector3& area_light::get_edge_v() const { return edge_v_; }
+
+bardrix::point3 area_light::sample(const bardrix::point3& towards, double u1, double u2) const {
+    if (shape_ == area_shape::rectangle)
+        return light.position + edge_u_ * (u1 - 0.5) + edge_v_ * (u2 - 0.5);
+
+    // From far away a sphere looks like a disk, so sample the disk that faces the lit point
+    bardrix::vector3 tangent, bitangent;
+    sampling::orthonormal_basis(light.position.vector_to(towards).normalized(), tangent, bitangent);
+
+    const double radius = radius_ * std::sqrt(u1);
+    const double phi = 2 * sampling::pi * u2;
+    return light.position + tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi));
+}
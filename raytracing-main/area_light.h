@@ -0,0 +1,67 @@
+//
+// area_light.h
+//
+
+#pragma once
+
+#include <bardrix/light.h>
+
+/// \brief A light with a surface instead of a single point, it casts soft shadows
+/// \details The light itself (intensity, color and center) is a bardrix::light, so the Phong model stays the same,
+///          only the visibility is sampled over the surface.
+class area_light {
+public:
+    /// \brief The shape of the surface of an area light
+    enum class area_shape {
+        /// \brief A sphere around the light position
+        sphere,
+        /// \brief A rectangle centered on the light position
+        rectangle
+    };
+
+    /// \brief The light at the center of the surface
+    bardrix::light light;
+
+protected:
+    /// \brief The shape of the surface
+    area_shape shape_;
+
+    /// \brief The radius of a spherical light
+    double radius_ = 0;
+
+    /// \brief The edges of a rectangular light
+    bardrix::vector3 edge_u_, edge_v_;
+
+public:
+    /// \brief Constructor for a spherical area light
+    /// \param light The light at the center of the sphere
+    /// \param radius The radius of the sphere
+    /// \example area_light bulb(bardrix::light({0, 3, 0}, 2, bardrix::color::white()), 0.5);
+    area_light(const bardrix::light& light, double radius);
+
+    /// \brief Constructor for a rectangular area light
+    /// \param light The light at the center of the rectangle
+    /// \param edge_u The first edge of the rectangle
+    /// \param edge_v The second edge of the rectangle
+    /// \example area_light panel(bardrix::light({0, 3, 0}, 2, bardrix::color::white()), {1, 0, 0}, {0, 0, 1});
+    area_light(const bardrix::light& light, const bardrix::vector3& edge_u, const bardrix::vector3& edge_v);
+
+    /// \brief Gets the shape of the surface
+    NODISCARD area_shape get_shape() const;
+
+    /// \brief Gets the radius of a spherical light
+    NODISCARD double get_radius() const;
+
+    /// \brief Gets the first edge of a rectangular light
+    NODISCARD const bardrix::vector3& get_edge_u() const;
+
+    /// \brief Gets the second edge of a rectangular light
+    NODISCARD const bardrix::vector3& get_edge_v() const;
+
+    /// \brief Maps two numbers in [0, 1) to a point on the surface of the light
+    /// \param towards The point that is being lit, a spherical light is sampled on the disk that faces it
+    /// \param u1 The first number in [0, 1)
+    /// \param u2 The second number in [0, 1)
+    /// \return A point on the surface of the light
+    NODISCARD bardrix::point3 sample(const bardrix::point3& towards, double u1, double u2) const;
+}; // class area_light
@@ -0,0 +1,129 @@
+//
+// blue_noise.cpp
+//
+
+#include "blue_noise.h"
+#include "sampling.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    constexpr int pixel_count = blue_noise::size * blue_noise::size;
+
+    /// \brief The sigma of the Gaussian that measures how clustered the points are (1.5 from Ulichney's paper)
+    constexpr double sigma = 1.5;
+
+    /// \brief Keeps track of the energy of a binary pattern, high energy means a cluster, low energy a void
+    class energy_field {
+        std::vector<double> gaussian_;
+        std::vector<double> energy_;
+
+    public:
+        std::vector<uint8_t> pattern;
+
+        energy_field() : gaussian_(pixel_count), energy_(pixel_count, 0), pattern(pixel_count, 0) {
+            // Gaussian of every toroidal offset, so updates are just a table lookup
+            for (int dy = 0; dy < blue_noise::size; dy++) {
+                for (int dx = 0; dx < blue_noise::size; dx++) {
+                    const int wx = std::min(dx, blue_noise::size - dx), wy = std::min(dy, blue_noise::size - dy);
+                    gaussian_[dy * blue_noise::size + dx] = std::exp(-(wx * wx + wy * wy) / (2 * sigma * sigma));
+                }
+            }
+        }
+
+        void set(int index, bool value) {
+            pattern[index] = value;
+            const double sign = value ? 1 : -1;
+            const int px = index % blue_noise::size, py = index / blue_noise::size;
+
+            for (int y = 0; y < blue_noise::size; y++) {
+                const int dy = (y - py + blue_noise::size) % blue_noise::size;
+                for (int x = 0; x < blue_noise::size; x++) {
+                    const int dx = (x - px + blue_noise::size) % blue_noise::size;
+                    energy_[y * blue_noise::size + x] += sign * gaussian_[dy * blue_noise::size + dx];
+                }
+            }
+        }
+
+        /// \brief The set pixel with the highest energy
+        NODISCARD int tightest_cluster() const {
+            int best = -1;
+            for (int i = 0; i < pixel_count; i++)
+                if (pattern[i] && (best < 0 || energy_[i] > energy_[best]))
+                    best = i;
+            return best;
+        }
+
+        /// \brief The unset pixel with the lowest energy
+        NODISCARD int largest_void() const {
+            int best = -1;
+            for (int i = 0; i < pixel_count; i++)
+                if (!pattern[i] && (best < 0 || energy_[i] < energy_[best]))
+                    best = i;
+            return best;
+        }
+    };
+
+    /// \brief Generates the texture with the void-and-cluster method (Ulichney 1993)
+    std::vector<float> generate() {
+        energy_field initial;
+
+        // Start from ~10% random points and move the tightest cluster into the largest void until it's stable
+        for (int i = 0; i < pixel_count; i++)
+            if (sampling::hash(static_cast<uint32_t>(i)) % 10 == 0)
+                initial.set(i, true);
+
+        while (true) {
+            const int cluster = initial.tightest_cluster();
+            initial.set(cluster, false);
+            const int void_index = initial.largest_void();
+            initial.set(void_index, true);
+            if (void_index == cluster)
+                break;
+        }
+
+        std::vector<int> rank(pixel_count, 0);
+        const int initial_ones = static_cast<int>(std::count(initial.pattern.begin(), initial.pattern.end(), 1));
+
+        // Phase 1, rank the initial points by removing the tightest cluster one by one
+        energy_field field = initial;
+        for (int ones = initial_ones; ones > 0; ones--) {
+            const int cluster = field.tightest_cluster();
+            field.set(cluster, false);
+            rank[cluster] = ones - 1;
+        }
+
+        // Phase 2 and 3, fill the largest void one by one until every pixel is ranked
+        field = initial;
+        for (int ones = initial_ones; ones < pixel_count; ones++) {
+            const int void_index = field.largest_void();
+            field.set(void_index, true);
+            rank[void_index] = ones;
+        }
+
+        std::vector<float> table(pixel_count);
+        for (int i = 0; i < pixel_count; i++)
+            table[i] = (static_cast<float>(rank[i]) + 0.5f) / pixel_count;
+        return table;
+    }
+} // namespace
+
+const std::vector<float>& blue_noise::table() {
+    static const std::vector<float> table = generate();
+    return table;
+}
+
+double blue_noise::sample(int x, int y, int dimension, uint32_t frame, int sample) {
+    // Every dimension reads the texture at a different offset, so u1 and u2 aren't correlated
+    const int offset_x = dimension * 23, offset_y = dimension * 41;
+    const int tx = (x + offset_x) & (size - 1), ty = (y + offset_y) & (size - 1);
+    const double value = table()[ty * size + tx];
+
+    // Golden ratio for the frame, the R2 sequence for the sample index
+    constexpr double frame_step = 0.6180339887498949;
+    constexpr double sample_steps[2] = {0.7548776662466927, 0.5698402909980532};
+    const double rotation = frame * frame_step + sample * sample_steps[dimension & 1];
+
+    return value + rotation - std::floor(value + rotation);
+}
@@ -0,0 +1,33 @@
+//
+// blue_noise.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstdint>
+#include <vector>
+
+/// \brief A tileable blue noise texture, neighbouring pixels get values that are far apart, so a few samples per pixel
+///        already look smooth after the eye (or a small filter) averages them
+namespace blue_noise {
+    /// \brief The width and height of the texture
+    constexpr int size = 64;
+
+    /// \brief Gets the blue noise texture, it's generated with void-and-cluster on first use
+    /// \return size * size values in [0, 1), row by row
+    NODISCARD const std::vector<float>& table();
+
+    /// \brief Gets a blue noise sample for a pixel, rotated by the frame and the sample index
+    /// \details Every frame and sample adds a low discrepancy offset (Cranley-Patterson rotation), so over time every
+    ///          pixel sees well distributed values while every single frame keeps the blue noise pattern.
+    /// \param x The x coordinate of the pixel
+    /// \param y The y coordinate of the pixel
+    /// \param dimension Which random number of the pixel, different dimensions are decorrelated
+    /// \param frame The frame number
+    /// \param sample The sample index within the pixel
+    /// \return A number in [0, 1)
+    /// \example double u1 = blue_noise::sample(x, y, 0, frame, s), u2 = blue_noise::sample(x, y, 1, frame, s);
+    NODISCARD double sample(int x, int y, int dimension, uint32_t frame, int sample);
+} // namespace blue_noise
@@ -0,0 +1,271 @@
+//
+// denoiser.cpp
+//
+
+#include "denoiser.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DENOISER_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#define RESTRICT __restrict
+#else
+#define RESTRICT __restrict__
+#endif
+
+namespace {
+    /// \brief The 1D kernel of every à-trous pass (B-spline of order 1, so a 3x3 kernel per pass)
+    constexpr float kernel[3] = {1.0f / 4, 1.0f / 2, 1.0f / 4};
+
+    /// \brief The amount of rows a thread filters at once
+    constexpr int rows_per_chunk = 8;
+
+    /// \brief Inputs of fast_exp are clamped to this, exp(-80) is zero for a weight and still a normal float
+    constexpr float min_exponent = -80.0f;
+
+    /// \brief Scale and bias that turn x into the bits of a float that is close to exp(x) (Schraudolph 1999)
+    constexpr float exp_scale = 12102203.0f; // 2^23 / ln(2)
+    constexpr float exp_bias = 1064866805.0f; // 127 * 2^23, minus a bit to center the error
+
+    /// \brief exp(x) for x <= 0 within a few percent, it's only used for weights so that doesn't matter but unlike
+    ///        std::exp it's just a multiply and an add, also in SIMD
+    inline float fast_exp(float x) {
+        const auto bits = static_cast<int32_t>(std::max(min_exponent, x) * exp_scale + exp_bias);
+        float y;
+        std::memcpy(&y, &bits, sizeof(y));
+        return y;
+    }
+
+#ifdef DENOISER_SSE2
+    /// \brief fast_exp for 4 floats at once
+    inline __m128 fast_exp(__m128 x) {
+        const __m128 scaled = _mm_add_ps(_mm_mul_ps(_mm_max_ps(_mm_set1_ps(min_exponent), x), _mm_set1_ps(exp_scale)),
+                                         _mm_set1_ps(exp_bias));
+        return _mm_castsi128_ps(_mm_cvttps_epi32(scaled));
+    }
+
+    /// \brief Squared distance between two 3 component vectors stored as separate planes
+    inline __m128 distance_squared(__m128 a_x, __m128 a_y, __m128 a_z, __m128 b_x, __m128 b_y, __m128 b_z) {
+        const __m128 x = _mm_sub_ps(a_x, b_x), y = _mm_sub_ps(a_y, b_y), z = _mm_sub_ps(a_z, b_z);
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+    }
+#endif
+} // namespace
+
+void guide_buffers::reset(int width, int height) {
+    this->width = width;
+    this->height = height;
+
+    const std::size_t pixels = static_cast<std::size_t>(width) * height;
+    for (auto* buffer : {&normal_x, &normal_y, &normal_z, &albedo_r, &albedo_g, &albedo_b})
+        buffer->assign(pixels, 0);
+    depth.assign(pixels, -1);
+}
+
+denoiser::denoiser(thread_pool& pool) : pool_(pool) {}
+
+double denoiser::get_last_milliseconds() const { return last_ms_; }
+
+void denoiser::denoise(std::vector<uint32_t>& buffer, const guide_buffers& guides) {
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t pixels = static_cast<std::size_t>(guides.width) * guides.height;
+    if (pixels == 0 || buffer.size() < pixels || guides.depth.size() != pixels)
+        return;
+
+    for (auto* plane : {&color_r_, &color_g_, &color_b_, &filtered_r_, &filtered_g_, &filtered_b_})
+        plane->resize(pixels);
+
+    pool_.parallel_for(pixels, 16384, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            color_r_[i] = static_cast<float>((buffer[i] >> 16) & 0xFF) / 255.0f;
+            color_g_[i] = static_cast<float>((buffer[i] >> 8) & 0xFF) / 255.0f;
+            color_b_[i] = static_cast<float>(buffer[i] & 0xFF) / 255.0f;
+        }
+    });
+
+    // Every chunk of rows accumulates into its own row of sums, so the chunks never share one
+    const auto chunks = static_cast<std::size_t>((guides.height + rows_per_chunk - 1) / rows_per_chunk);
+    const auto width = static_cast<std::size_t>(guides.width);
+    for (auto* sums : {&sum_r_, &sum_g_, &sum_b_, &sum_weight_})
+        sums->resize(chunks * width);
+
+    float sigma_color = settings.sigma_color;
+    for (int iteration = 0; iteration < settings.iterations; iteration++) {
+        const int step = 1 << iteration;
+
+        pool_.parallel_for(chunks, 1, [&](std::size_t begin, std::size_t end) {
+            for (std::size_t chunk = begin; chunk < end; chunk++) {
+                const int first_row = static_cast<int>(chunk) * rows_per_chunk;
+                const std::size_t slice = chunk * width;
+                const row_accumulator sums{sum_r_.data() + slice, sum_g_.data() + slice, sum_b_.data() + slice,
+                                           sum_weight_.data() + slice};
+                filter_rows(guides, step, sigma_color, first_row, std::min(guides.height, first_row + rows_per_chunk),
+                            sums);
+            }
+        });
+
+        std::swap(color_r_, filtered_r_);
+        std::swap(color_g_, filtered_g_);
+        std::swap(color_b_, filtered_b_);
+
+        // Every pass removes noise, so the next pass can be stricter about color differences
+        sigma_color *= 0.5f;
+    }
+
+    pool_.parallel_for(pixels, 16384, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const auto r = static_cast<uint32_t>(std::min(1.0f, color_r_[i]) * 255.0f + 0.5f);
+            const auto g = static_cast<uint32_t>(std::min(1.0f, color_g_[i]) * 255.0f + 0.5f);
+            const auto b = static_cast<uint32_t>(std::min(1.0f, color_b_[i]) * 255.0f + 0.5f);
+            buffer[i] = (buffer[i] & 0xFF000000u) | r << 16 | g << 8 | b;
+        }
+    });
+
+    last_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void denoiser::filter_rows(const guide_buffers& guides, int step, float sigma_color, int first_row, int last_row,
+                           const row_accumulator& sums) {
+    const int width = guides.width, height = guides.height;
+
+    tap_weights weights;
+    weights.inverse_color = 1.0f / (sigma_color * sigma_color + std::numeric_limits<float>::epsilon());
+    weights.inverse_depth = 1.0f / (settings.sigma_depth * static_cast<float>(step));
+    weights.inverse_albedo = 1.0f / (settings.sigma_albedo * settings.sigma_albedo);
+    weights.sigma_normal = settings.sigma_normal;
+
+    // The sums are for one row, the taps are the outer loop so the inner loop runs over contiguous pixels
+    for (int y = first_row; y < last_row; y++) {
+        const std::size_t row = static_cast<std::size_t>(y) * width;
+        for (float* sum : {sums.r, sums.g, sums.b, sums.weight})
+            std::fill(sum, sum + width, 0.0f);
+
+        for (int ky = 0; ky < 3; ky++) {
+            const int qy = std::clamp(y + (ky - 1) * step, 0, height - 1);
+            const std::size_t tap_row = static_cast<std::size_t>(qy) * width;
+
+            for (int kx = 0; kx < 3; kx++) {
+                weights.tap = kernel[ky] * kernel[kx];
+                const int offset = (kx - 1) * step;
+
+                // The taps of the interior of the row are contiguous, only the borders have to be clamped
+                const int interior_begin = std::clamp(-offset, 0, width);
+                const int interior_end = std::clamp(width - offset, interior_begin, width);
+
+                for (int x = 0; x < interior_begin; x++)
+                    accumulate_taps(guides, weights, row, tap_row + std::clamp(x + offset, 0, width - 1), x, 1, sums);
+                accumulate_taps(guides, weights, row, tap_row + interior_begin + offset, interior_begin,
+                                interior_end - interior_begin, sums);
+                for (int x = interior_end; x < width; x++)
+                    accumulate_taps(guides, weights, row, tap_row + std::clamp(x + offset, 0, width - 1), x, 1, sums);
+            }
+        }
+
+        for (int x = 0; x < width; x++) {
+            const std::size_t p = row + x;
+            const bool filter = guides.depth[p] >= 0 && sums.weight[x] > 0;
+            filtered_r_[p] = filter ? sums.r[x] / sums.weight[x] : color_r_[p];
+            filtered_g_[p] = filter ? sums.g[x] / sums.weight[x] : color_g_[p];
+            filtered_b_[p] = filter ? sums.b[x] / sums.weight[x] : color_b_[p];
+        }
+    }
+}
+
+void denoiser::accumulate_taps(const guide_buffers& guides, const tap_weights& weights, std::size_t row,
+                               std::size_t tap, int x, int count, const row_accumulator& sums) const {
+    // Raw pointers so the compiler knows nothing aliases and can vectorize the loop
+    const float* RESTRICT color_r = color_r_.data();
+    const float* RESTRICT color_g = color_g_.data();
+    const float* RESTRICT color_b = color_b_.data();
+    const float* RESTRICT normal_x = guides.normal_x.data();
+    const float* RESTRICT normal_y = guides.normal_y.data();
+    const float* RESTRICT normal_z = guides.normal_z.data();
+    const float* RESTRICT depth = guides.depth.data();
+    const float* RESTRICT albedo_r = guides.albedo_r.data();
+    const float* RESTRICT albedo_g = guides.albedo_g.data();
+    const float* RESTRICT albedo_b = guides.albedo_b.data();
+    float* RESTRICT sum_r = sums.r + x;
+    float* RESTRICT sum_g = sums.g + x;
+    float* RESTRICT sum_b = sums.b + x;
+    float* RESTRICT sum_weight = sums.weight + x;
+
+    int i = 0;
+
+#ifdef DENOISER_SSE2
+    // 4 pixels at a time, the scalar loop below does the rest
+    const __m128 tap_weight = _mm_set1_ps(weights.tap);
+    const __m128 minus_inverse_color = _mm_set1_ps(-weights.inverse_color);
+    const __m128 minus_inverse_depth = _mm_set1_ps(-weights.inverse_depth);
+    const __m128 minus_inverse_albedo = _mm_set1_ps(-weights.inverse_albedo);
+    const __m128 sigma_normal = _mm_set1_ps(weights.sigma_normal);
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+
+    for (; i + 4 <= count; i += 4) {
+        const std::size_t p = row + x + i, q = tap + i;
+
+        const __m128 q_r = _mm_loadu_ps(color_r + q), q_g = _mm_loadu_ps(color_g + q);
+        const __m128 q_b = _mm_loadu_ps(color_b + q);
+        const __m128 color_distance = distance_squared(_mm_loadu_ps(color_r + p), _mm_loadu_ps(color_g + p),
+                                                       _mm_loadu_ps(color_b + p), q_r, q_g, q_b);
+
+        const __m128 normal_dot = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(normal_x + p), _mm_loadu_ps(normal_x + q)),
+                       _mm_mul_ps(_mm_loadu_ps(normal_y + p), _mm_loadu_ps(normal_y + q))),
+            _mm_mul_ps(_mm_loadu_ps(normal_z + p), _mm_loadu_ps(normal_z + q)));
+
+        const __m128 q_depth = _mm_loadu_ps(depth + q);
+        const __m128 depth_distance = _mm_and_ps(abs_mask, _mm_sub_ps(_mm_loadu_ps(depth + p), q_depth));
+
+        const __m128 albedo_distance = distance_squared(
+            _mm_loadu_ps(albedo_r + p), _mm_loadu_ps(albedo_g + p), _mm_loadu_ps(albedo_b + p),
+            _mm_loadu_ps(albedo_r + q), _mm_loadu_ps(albedo_g + q), _mm_loadu_ps(albedo_b + q));
+
+        // The product of the edge stopping functions is the exp of the sum of their exponents
+        const __m128 exponent = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(minus_inverse_color, color_distance),
+                       _mm_mul_ps(_mm_min_ps(zero, _mm_sub_ps(normal_dot, one)), sigma_normal)),
+            _mm_add_ps(_mm_mul_ps(minus_inverse_depth, depth_distance),
+                       _mm_mul_ps(minus_inverse_albedo, albedo_distance)));
+
+        // Pixels without a hit (the background) never mix with anything
+        const __m128 valid = _mm_and_ps(_mm_cmpge_ps(q_depth, zero), tap_weight);
+        const __m128 weight = _mm_mul_ps(fast_exp(exponent), valid);
+
+        _mm_storeu_ps(sum_r + i, _mm_add_ps(_mm_loadu_ps(sum_r + i), _mm_mul_ps(q_r, weight)));
+        _mm_storeu_ps(sum_g + i, _mm_add_ps(_mm_loadu_ps(sum_g + i), _mm_mul_ps(q_g, weight)));
+        _mm_storeu_ps(sum_b + i, _mm_add_ps(_mm_loadu_ps(sum_b + i), _mm_mul_ps(q_b, weight)));
+        _mm_storeu_ps(sum_weight + i, _mm_add_ps(_mm_loadu_ps(sum_weight + i), weight));
+    }
+#endif
+
+    for (; i < count; i++) {
+        const std::size_t p = row + x + i, q = tap + i;
+
+        const float dr = color_r[p] - color_r[q], dg = color_g[p] - color_g[q], db = color_b[p] - color_b[q];
+        const float normal_dot = normal_x[p] * normal_x[q] + normal_y[p] * normal_y[q] + normal_z[p] * normal_z[q];
+        const float ar = albedo_r[p] - albedo_r[q], ag = albedo_g[p] - albedo_g[q], ab = albedo_b[p] - albedo_b[q];
+
+        // The product of the edge stopping functions is the exp of the sum of their exponents
+        const float exponent = -(dr * dr + dg * dg + db * db) * weights.inverse_color +
+                               std::min(0.0f, normal_dot - 1.0f) * weights.sigma_normal -
+                               std::abs(depth[p] - depth[q]) * weights.inverse_depth -
+                               (ar * ar + ag * ag + ab * ab) * weights.inverse_albedo;
+
+        // Pixels without a hit (the background) never mix with anything
+        const float weight = depth[q] >= 0 ? weights.tap * fast_exp(exponent) : 0.0f;
+
+        sum_r[i] += color_r[q] * weight;
+        sum_g[i] += color_g[q] * weight;
+        sum_b[i] += color_b[q] * weight;
+        sum_weight[i] += weight;
+    }
+}
@@ -0,0 +1,113 @@
+//
+// denoiser.h
+//
+
+#pragma once
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <vector>
+
+/// \brief Per pixel surface information of the primary hits, it guides the denoiser so it doesn't blur over edges
+struct guide_buffers {
+    /// \brief The size of the buffers
+    int width = 0, height = 0;
+
+    /// \brief The normal of the primary hit of every pixel
+    std::vector<float> normal_x, normal_y, normal_z;
+
+    /// \brief The distance from the camera to the primary hit of every pixel, negative if the pixel has no hit
+    std::vector<float> depth;
+
+    /// \brief The color of the material of the primary hit of every pixel [0, 1]
+    std::vector<float> albedo_r, albedo_g, albedo_b;
+
+    /// \brief Resizes every buffer and marks all pixels as having no hit
+    /// \param width The new width
+    /// \param height The new height
+    void reset(int width, int height);
+}; // struct guide_buffers
+
+/// \brief Settings of the denoiser
+struct denoiser_settings {
+    /// \brief The amount of à-trous passes, pass i samples pixels 2^i apart, so 5 passes cover a 63x63 footprint
+    int iterations = 5;
+
+    /// \brief How different colors may be before they stop being averaged, halved after every pass
+    float sigma_color = 1.2f;
+
+    /// \brief How sharp the edges between different normals are
+    float sigma_normal = 64.0f;
+
+    /// \brief How different depths may be before they stop being averaged (per pixel of distance)
+    float sigma_depth = 0.5f;
+
+    /// \brief How different albedos may be before they stop being averaged
+    float sigma_albedo = 0.1f;
+};
+
+/// \brief Edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) for low sample counts
+/// \details Every pass is a 3x3 B-spline kernel whose taps spread out further every pass, the taps are weighted by
+///          how similar their color, normal, depth and albedo are. The filter runs tap by tap over whole rows, 4 pixels
+///          at a time with SSE2, and the rows are spread over the thread pool.
+class denoiser {
+public:
+    /// \brief The settings used for the next frame
+    denoiser_settings settings;
+
+protected:
+    /// \brief The threads that filter the rows
+    thread_pool& pool_;
+
+    /// \brief The colors being filtered and the output of the current pass
+    std::vector<float> color_r_, color_g_, color_b_, filtered_r_, filtered_g_, filtered_b_;
+
+    /// \brief The running sums of the row every chunk of rows is filtering, one row wide slice per chunk, kept so
+    ///        the passes don't allocate
+    std::vector<float> sum_r_, sum_g_, sum_b_, sum_weight_;
+
+    /// \brief Milliseconds the last call to denoise took
+    double last_ms_ = 0;
+
+public:
+    /// \brief Constructor for the denoiser
+    /// \param pool The threads that filter the rows
+    explicit denoiser(thread_pool& pool);
+
+    /// \brief Denoises a buffer in place
+    /// \param buffer The buffer to denoise, the format is AARRGGBB
+    /// \param guides The guide buffers of the frame in the buffer, if the size doesn't match nothing happens
+    /// \example renderer.render(buffer, width, height); denoiser.denoise(buffer, renderer.get_guides());
+    void denoise(std::vector<uint32_t>& buffer, const guide_buffers& guides);
+
+    /// \brief Gets the milliseconds the last call to denoise took
+    NODISCARD double get_last_milliseconds() const;
+
+protected:
+    /// \brief The constants of the edge stopping functions for one tap of a pass
+    struct tap_weights {
+        float tap, inverse_color, inverse_depth, inverse_albedo, sigma_normal;
+    };
+
+    /// \brief The running sums of one row
+    struct row_accumulator {
+        float *r, *g, *b, *weight;
+    };
+
+    /// \brief Runs one à-trous pass over a range of rows, from color_* to filtered_*
+    /// \param sums The running sums of one row, only used by this range of rows
+    void filter_rows(const guide_buffers& guides, int step, float sigma_color, int first_row, int last_row,
+                     const row_accumulator& sums);
+
+    /// \brief Adds one tap to a span of pixels of a row
+    /// \param guides The guide buffers
+    /// \param weights The constants of the edge stopping functions
+    /// \param row The index of the first pixel of the row
+    /// \param tap The index of the tap of the first pixel of the span
+    /// \param x The x coordinate of the first pixel of the span
+    /// \param count The amount of pixels in the span, their taps are contiguous
+    /// \param sums The running sums of the row
+    void accumulate_taps(const guide_buffers& guides, const tap_weights& weights, std::size_t row, std::size_t tap,
+                         int x, int count, const row_accumulator& sums) const;
+}; // class denoiser
@@ -0,0 +1,135 @@
+//
+// fingerprint.cpp
+//
+
+#include "fingerprint.h"
+
+namespace {
+    /// \brief FNV-1a, fed one value at a time
+    class hasher {
+        uint64_t hash_ = 14695981039346656037ull;
+
+    public:
+        void add(const void* data, std::size_t size) {
+            const auto* bytes = static_cast<const unsigned char*>(data);
+            for (std::size_t i = 0; i < size; i++) {
+                hash_ ^= bytes[i];
+                hash_ *= 1099511628211ull;
+            }
+        }
+
+        void add(double value) {
+            // -0 and 0 compare equal, so they should hash equal
+            if (value == 0)
+                value = 0;
+            add(&value, sizeof(value));
+        }
+
+        void add(const bardrix::vector3& vector) {
+            add(vector.x);
+            add(vector.y);
+            add(vector.z);
+        }
+
+        void add(const bardrix::point3& point) {
+            add(point.x);
+            add(point.y);
+            add(point.z);
+        }
+
+        void add(const bardrix::color& color) {
+            const uint32_t argb = color.argb();
+            add(&argb, sizeof(argb));
+        }
+
+        void add(const bardrix::light& light) {
+            add(light.position);
+            add(light.get_intensity());
+            add(light.color);
+        }
+
+        void add(const area_light& a) {
+            add(a.light);
+            add(static_cast<double>(a.get_shape()));
+            add(a.get_radius());
+            add(a.get_edge_u());
+            add(a.get_edge_v());
+        }
+
+        NODISCARD uint64_t get() const { return hash_; }
+    };
+} // namespace
+
+uint64_t fingerprint::of(const bardrix::camera& camera) {
+    hasher hash;
+    hash.add(camera.position);
+    hash.add(camera.get_direction());
+    hash.add(static_cast<double>(camera.get_width()));
+    hash.add(static_cast<double>(camera.get_height()));
+    hash.add(camera.get_fov());
+    return hash.get();
+}
+
+uint64_t fingerprint::of_geometry(const sphere& shape) {
+    hasher hash;
+    hash.add(shape.get_position());
+    hash.add(shape.get_radius());
+    return hash.get();
+}
+
+uint64_t fingerprint::of(const std::vector<sphere>& spheres) {
+    hasher hash;
+    for (const sphere& s : spheres) {
+        const bardrix::material& material = s.get_material();
+        hash.add(s.get_position());
+        hash.add(s.get_radius());
+        hash.add(material.get_ambient());
+        hash.add(material.get_diffuse());
+        hash.add(material.get_specular());
+        hash.add(material.get_shininess());
+        hash.add(material.color);
+        hash.add(s.get_optics().reflectivity);
+        hash.add(s.get_optics().transparency);
+        hash.add(s.get_optics().refractive_index);
+    }
+    return hash.get();
+}
+
+uint64_t fingerprint::of(const bardrix::point3& point) {
+    hasher hash;
+    hash.add(point);
+    return hash.get();
+}
+
+uint64_t fingerprint::of(const bardrix::light& light) {
+    hasher hash;
+    hash.add(light);
+    return hash.get();
+}
+
+uint64_t fingerprint::of(const std::vector<bardrix::light>& lights) {
+    hasher hash;
+    for (const bardrix::light& light : lights)
+        hash.add(light);
+    return hash.get();
+}
+
+uint64_t fingerprint::of(const area_light& light) {
+    hasher hash;
+    hash.add(light);
+    return hash.get();
+}
+
+uint64_t fingerprint::of(const std::vector<area_light>& area_lights) {
+    hasher hash;
+    for (const area_light& a : area_lights)
+        hash.add(a);
+    return hash.get();
+}
+
+uint64_t fingerprint::combine(uint64_t a, uint64_t b) {
+    hasher hash;
+    hash.add(&a, sizeof(a));
+    hash.add(&b, sizeof(b));
+    return hash.get();
+}
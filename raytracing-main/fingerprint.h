@@ -0,0 +1,67 @@
+//
+// fingerprint.h
+//
+
+#pragma once
+
+#include "area_light.h"
+#include "sphere.h"
+
+#include <bardrix/camera.h>
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <vector>
+
+/// \brief Hashes of the parts of a scene, caches compare them with the hash they were built for to know when they're
+///        stale
+/// \details The hashes are taken over the exact bits of every value, so any change (even the smallest move) changes
+///          the hash.
+namespace fingerprint {
+    /// \brief Hashes the position, direction, size and field of view of a camera
+    /// \param camera The camera to hash
+    /// \return The hash of the camera
+    NODISCARD uint64_t of(const bardrix::camera& camera);
+
+    /// \brief Hashes the position and radius of a sphere, only what decides where it is
+    /// \param shape The sphere to hash
+    /// \return The hash of the sphere's geometry
+    NODISCARD uint64_t of_geometry(const sphere& shape);
+
+    /// \brief Hashes the position, radius, material and optics of every sphere
+    /// \param spheres The spheres to hash
+    /// \return The hash of the spheres
+    NODISCARD uint64_t of(const std::vector<sphere>& spheres);
+
+    /// \brief Hashes a position
+    /// \param point The position to hash
+    /// \return The hash of the position
+    NODISCARD uint64_t of(const bardrix::point3& point);
+
+    /// \brief Hashes the position, intensity and color of a light
+    /// \param light The light to hash
+    /// \return The hash of the light
+    NODISCARD uint64_t of(const bardrix::light& light);
+
+    /// \brief Hashes the position, intensity and color of every light
+    /// \param lights The lights to hash
+    /// \return The hash of the lights
+    NODISCARD uint64_t of(const std::vector<bardrix::light>& lights);
+
+    /// \brief Hashes the light and the surface of an area light
+    /// \param light The area light to hash
+    /// \return The hash of the area light
+    NODISCARD uint64_t of(const area_light& light);
+
+    /// \brief Hashes the light and the surface of every area light
+    /// \param area_lights The area lights to hash
+    /// \return The hash of the area lights
+    NODISCARD uint64_t of(const std::vector<area_light>& area_lights);
+
+    /// \brief Combines two hashes into one
+    /// \param a The first hash
+    /// \param b The second hash
+    /// \return The combined hash, the order of a and b matters
+    /// \example uint64_t scene = fingerprint::combine(fingerprint::of(spheres), fingerprint::of(lights));
+    NODISCARD uint64_t combine(uint64_t a, uint64_t b);
+} // namespace fingerprint
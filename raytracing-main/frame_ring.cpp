@@ -0,0 +1,350 @@
+//
+// frame_ring.cpp
+//
+
+#include "frame_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX // This is to avoid the min and max macros from windows.h
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <ctime>
+#endif
+#endif
+
+namespace {
+    /// \brief "FRNG", the start of the shared memory of a ring
+    constexpr uint32_t ring_magic = 0x474E5246;
+
+    /// \brief The layout of the shared memory, a reader of another layout doesn't open the ring
+    constexpr uint32_t ring_version = 1;
+
+    /// \brief The header and every slot start on their own page
+    constexpr std::size_t page_size = 4096;
+
+    /// \brief The pixels of a slot start this far after its header, a cache line
+    constexpr std::size_t slot_header_size = 64;
+
+    // The atomics are shared between processes, that only works if they don't use a lock
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "The frame ring needs lock-free atomics");
+
+    /// \brief The first page of the shared memory
+    struct ring_header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t slots, max_pixels, slot_bytes;
+
+        /// \brief The sequence number of the newest frame
+        std::atomic<uint64_t> sequence;
+
+        /// \brief Changes with every frame and when the ring is closed, the readers wait on it
+        std::atomic<uint32_t> notify;
+
+        /// \brief Set when the writer closes the ring
+        std::atomic<uint32_t> closed;
+    };
+
+    /// \brief The start of every slot, followed by the pixels
+    struct slot_header {
+        /// \brief The sequence number of the frame in the slot, 0 while a frame is written into it
+        std::atomic<uint64_t> sequence;
+        int32_t width, height;
+    };
+
+    ring_header* header_of(void* memory) { return static_cast<ring_header*>(memory); }
+
+    slot_header* slot_of(void* memory, uint64_t sequence) {
+        const ring_header* header = header_of(memory);
+        return reinterpret_cast<slot_header*>(static_cast<uint8_t*>(memory) + page_size +
+                                              (sequence - 1) % header->slots * header->slot_bytes);
+    }
+
+    uint32_t* pixels_of(slot_header* slot) {
+        return reinterpret_cast<uint32_t*>(reinterpret_cast<uint8_t*>(slot) + slot_header_size);
+    }
+
+    /// \brief Wakes every reader that waits on the notify word
+    void wake_readers(std::atomic<uint32_t>& word) {
+#if !defined(_WIN32) && defined(__linux__)
+        // Not FUTEX_PRIVATE_FLAG, the readers are other processes
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+        (void) word; // The readers check the word themselves
+#endif
+    }
+
+    /// \brief Sleeps until the notify word isn't the value it had anymore, or at most a while
+    void wait_for_change(const std::atomic<uint32_t>& word, uint32_t value, int timeout_ms) {
+#if !defined(_WIN32) && defined(__linux__)
+        timespec timeout{timeout_ms / 1000, static_cast<long>(timeout_ms % 1000) * 1000000};
+        syscall(SYS_futex, reinterpret_cast<const uint32_t*>(&word), FUTEX_WAIT, value, &timeout, nullptr, 0);
+#else
+        (void) word;
+        (void) value;
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min(timeout_ms, 1)));
+#endif
+    }
+} // namespace
+
+frame_ring::~frame_ring() { close(); }
+
+bool frame_ring::create(const std::string& name, std::size_t slots, std::size_t max_pixels) {
+    close();
+    if (name.empty() || slots < 2 || max_pixels == 0)
+        return false;
+
+    const std::size_t slot_bytes = (slot_header_size + max_pixels * sizeof(uint32_t) + page_size - 1) / page_size *
+                                   page_size;
+    const std::size_t size = page_size + slots * slot_bytes;
+
+#ifdef _WIN32
+    const std::string mapping_name = "Local\\" + name;
+    HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                        static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+                                        static_cast<DWORD>(size & 0xFFFFFFFFu), mapping_name.c_str());
+    if (mapping == nullptr)
+        return false;
+
+    // A mapping that is still open somewhere can't be replaced, it may be too small
+    if (GetLastError() == ERROR_ALREADY_EXISTS) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    void* memory = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (memory == nullptr) {
+        CloseHandle(mapping);
+        return false;
+    }
+    handle_ = reinterpret_cast<std::intptr_t>(mapping);
+#else
+    const std::string shm_name = "/" + name;
+    shm_unlink(shm_name.c_str());
+    const int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        return false;
+
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        ::close(fd);
+        shm_unlink(shm_name.c_str());
+        return false;
+    }
+    handle_ = fd;
+#endif
+
+    memory_ = memory;
+    size_ = size;
+    name_ = name;
+    owner_ = true;
+
+    // The memory starts zeroed, the atomics only have to be constructed
+    new (memory) ring_header{ring_magic, ring_version, slots, max_pixels, slot_bytes, {0}, {0}, {0}};
+    for (uint64_t sequence = 1; sequence <= slots; sequence++)
+        new (slot_of(memory, sequence)) slot_header{{0}, 0, 0};
+    return true;
+}
+
+bool frame_ring::open(const std::string& name) {
+    close();
+    if (name.empty())
+        return false;
+
+#ifdef _WIN32
+    const std::string mapping_name = "Local\\" + name;
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, mapping_name.c_str());
+    if (mapping == nullptr)
+        return false;
+
+    void* memory = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION info{};
+    if (memory == nullptr || VirtualQuery(memory, &info, sizeof(info)) == 0) {
+        if (memory != nullptr)
+            UnmapViewOfFile(memory);
+        CloseHandle(mapping);
+        return false;
+    }
+    handle_ = reinterpret_cast<std::intptr_t>(mapping);
+    size_ = info.RegionSize;
+#else
+    const int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat status{};
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &status) == 0 && static_cast<std::size_t>(status.st_size) >= page_size)
+        memory = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    handle_ = fd;
+    size_ = static_cast<std::size_t>(status.st_size);
+#endif
+
+    // Readers map the memory read-only, so a broken viewer can't corrupt the frames of the others
+    memory_ = memory;
+    name_ = name;
+    owner_ = false;
+
+    const ring_header* header = header_of(memory_);
+    if (header->magic != ring_magic || header->version != ring_version || header->slots < 2 ||
+        header->slot_bytes < slot_header_size + header->max_pixels * sizeof(uint32_t) ||
+        size_ < page_size + header->slots * header->slot_bytes) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void frame_ring::close() {
+    if (memory_ == nullptr)
+        return;
+
+    if (owner_) {
+        ring_header* header = header_of(memory_);
+        header->closed.store(1, std::memory_order_release);
+        header->notify.fetch_add(1, std::memory_order_release);
+        wake_readers(header->notify);
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(memory_);
+    CloseHandle(reinterpret_cast<HANDLE>(handle_));
+#else
+    munmap(memory_, size_);
+    ::close(static_cast<int>(handle_));
+    if (owner_)
+        shm_unlink(("/" + name_).c_str());
+#endif
+
+    memory_ = nullptr;
+    size_ = 0;
+    handle_ = -1;
+    name_.clear();
+    owner_ = false;
+}
+
+bool frame_ring::valid() const { return memory_ != nullptr; }
+
+std::size_t frame_ring::get_slots() const {
+    return valid() ? static_cast<std::size_t>(header_of(memory_)->slots) : 0;
+}
+
+std::size_t frame_ring::get_max_pixels() const {
+    return valid() ? static_cast<std::size_t>(header_of(memory_)->max_pixels) : 0;
+}
+
+bool frame_ring::publish(const std::vector<uint32_t>& pixels, int width, int height) {
+    if (!owner_ || width <= 0 || height <= 0)
+        return false;
+
+    ring_header* header = header_of(memory_);
+    const std::size_t count = static_cast<std::size_t>(width) * height;
+    if (count > header->max_pixels || pixels.size() < count)
+        return false;
+
+    // A reader that still uses the oldest frame sees its sequence number change, so it knows the pixels are mixed
+    const uint64_t sequence = header->sequence.load(std::memory_order_relaxed) + 1;
+    slot_header* slot = slot_of(memory_, sequence);
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->width = width;
+    slot->height = height;
+    std::memcpy(pixels_of(slot), pixels.data(), count * sizeof(uint32_t));
+
+    slot->sequence.store(sequence, std::memory_order_release);
+    header->sequence.store(sequence, std::memory_order_release);
+    header->notify.fetch_add(1, std::memory_order_release);
+    wake_readers(header->notify);
+    return true;
+}
+
+uint64_t frame_ring::get_sequence() const {
+    return valid() ? header_of(memory_)->sequence.load(std::memory_order_acquire) : 0;
+}
+
+ring_frame frame_ring::latest() const {
+    if (!valid())
+        return {};
+
+    // The newest frame is only overwritten after slots - 1 more frames, if that happened already try again
+    const ring_header* header = header_of(memory_);
+    for (int attempt = 0; attempt < 8; attempt++) {
+        const uint64_t sequence = header->sequence.load(std::memory_order_acquire);
+        if (sequence == 0)
+            return {};
+
+        slot_header* slot = slot_of(memory_, sequence);
+        if (slot->sequence.load(std::memory_order_acquire) != sequence)
+            continue;
+
+        ring_frame frame;
+        frame.pixels = pixels_of(slot);
+        frame.width = slot->width;
+        frame.height = slot->height;
+        frame.sequence = sequence;
+        if (still_valid(frame))
+            return frame;
+    }
+    return {};
+}
+
+bool frame_ring::still_valid(const ring_frame& frame) const {
+    if (!valid() || frame.sequence == 0)
+        return false;
+
+    // The pixels were read before the sequence number is checked again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot_of(memory_, frame.sequence)->sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
+
+bool frame_ring::wait(uint64_t after, int timeout_ms) const {
+    if (!valid())
+        return false;
+
+    const ring_header* header = header_of(memory_);
+    const auto start = std::chrono::steady_clock::now();
+    while (true) {
+        // The word is read before the sequence number, a frame published in between changes it and ends the wait
+        const uint32_t notify = header->notify.load(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_acquire) > after)
+            return true;
+        if (header->closed.load(std::memory_order_acquire) != 0)
+            return false;
+
+        int left = INT_MAX;
+        if (timeout_ms >= 0) {
+            const auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            if (waited >= timeout_ms)
+                return false;
+            left = static_cast<int>(timeout_ms - waited);
+        }
+        wait_for_change(header->notify, notify, std::min(left, 1000));
+    }
+}
+
+bool frame_ring::closed() const {
+    return !valid() || header_of(memory_)->closed.load(std::memory_order_acquire) != 0;
+}
@@ -0,0 +1,118 @@
+//
+// frame_ring.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \brief A frame in a frame ring, the pixels are read straight from the shared memory
+struct ring_frame {
+    /// \brief The pixels in ARGB, row by row, nullptr if there is no frame
+    const uint32_t* pixels = nullptr;
+
+    /// \brief The size of the frame in pixels
+    int width = 0, height = 0;
+
+    /// \brief The sequence number of the frame, the first frame is 1 and 0 means no frame
+    uint64_t sequence = 0;
+};
+
+/// \brief A ring of ARGB framebuffers in named shared memory, one process publishes frames into it and any amount of
+///        processes (viewers, encoders, recorders) read them without copying
+/// \details Every frame gets the next sequence number. A frame is written into the slot of the oldest frame, so a
+///          reader has until slots - 1 more frames are published to use it, still_valid tells if it was overwritten.
+///          The writer never waits for the readers. Readers wait for a new frame with a futex on Linux, elsewhere
+///          they check the sequence number every millisecond. On Windows the memory is a named file mapping, on
+///          other systems POSIX shared memory. Errors are reported with the return values, the ring is invalid if it
+///          couldn't be created or opened.
+class frame_ring {
+protected:
+    /// \brief The start and size of the mapped memory
+    void* memory_ = nullptr;
+    std::size_t size_ = 0;
+
+    /// \brief The handle of the shared memory (a file mapping on Windows, a file descriptor elsewhere)
+    std::intptr_t handle_ = -1;
+
+    /// \brief The name of the shared memory, removed when the process that created it closes the ring
+    std::string name_;
+    bool owner_ = false;
+
+public:
+    frame_ring() = default;
+
+    /// \brief Destructor for the ring, closes it
+    ~frame_ring();
+
+    frame_ring(const frame_ring&) = delete;
+    frame_ring& operator=(const frame_ring&) = delete;
+
+    /// \brief Creates the shared memory of a ring to publish frames into
+    /// \details Elsewhere a ring with the same name is replaced, readers that still have it open keep the old one. On
+    ///          Windows a mapping can't be replaced while any process has it open, so creating a name that's in use
+    ///          (another publisher, or a reader of one that exited) fails.
+    /// \param name The name other processes open the ring with, letters, digits, '-' and '_'
+    /// \param slots The amount of framebuffers, at least 2
+    /// \param max_pixels The most pixels a frame may have
+    /// \return True if the ring was created, false if it couldn't be or the name is in use on Windows
+    /// \example ring.create("raytracing-frames", 4, 1920 * 1080);
+    bool create(const std::string& name, std::size_t slots, std::size_t max_pixels);
+
+    /// \brief Opens the ring another process created to read its frames
+    /// \param name The name the ring was created with
+    /// \return True if the ring was opened
+    /// \example frame_ring ring; if (!ring.open("raytracing-frames")) return 1;
+    bool open(const std::string& name);
+
+    /// \brief Closes the ring, a ring that was created is marked as closed for its readers and removed
+    void close();
+
+    /// \brief Checks if the ring is created or opened
+    NODISCARD bool valid() const;
+
+    /// \brief Gets the amount of framebuffers
+    NODISCARD std::size_t get_slots() const;
+
+    /// \brief Gets the most pixels a frame may have
+    NODISCARD std::size_t get_max_pixels() const;
+
+    /// \brief Writes a frame into the oldest slot and publishes it
+    /// \param pixels The pixels in ARGB, row by row
+    /// \param width The width of the frame
+    /// \param height The height of the frame
+    /// \return True if the frame was published, false if the ring wasn't created by this process or the frame is
+    ///         too big
+    /// \example ring.publish(buffer, width, height);
+    bool publish(const std::vector<uint32_t>& pixels, int width, int height);
+
+    /// \brief Gets the sequence number of the newest frame
+    /// \return The sequence number, 0 if nothing was published yet
+    NODISCARD uint64_t get_sequence() const;
+
+    /// \brief Gets the newest frame
+    /// \return The frame, without pixels if nothing was published yet
+    /// \example ring_frame frame = ring.latest();
+    NODISCARD ring_frame latest() const;
+
+    /// \brief Checks if a frame wasn't overwritten yet, call it after reading the pixels to know if they were all
+    ///        from the same frame
+    /// \param frame The frame
+    /// \return True if the pixels still belong to the frame
+    NODISCARD bool still_valid(const ring_frame& frame) const;
+
+    /// \brief Waits until a frame newer than a sequence number is published or the ring is closed
+    /// \param after The sequence number of the last frame that was read
+    /// \param timeout_ms The longest time to wait in milliseconds, negative waits forever
+    /// \return True if a newer frame was published
+    /// \example for (uint64_t seen = 0; ring.wait(seen, 1000);) { ring_frame frame = ring.latest(); ... }
+    bool wait(uint64_t after, int timeout_ms) const;
+
+    /// \brief Checks if the process that created the ring closed it
+    NODISCARD bool closed() const;
+}; // class frame_ring
@@ -0,0 +1,251 @@
+//
+// frame_stream.cpp
+//
+
+#include "frame_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+#ifdef _WIN32
+#define NOMINMAX // This is to avoid the min and max macros from windows.h
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void put_u32_le(std::vector<uint8_t>& bytes, uint32_t value) {
+        for (int i = 0; i < 4; i++)
+            bytes.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const frame_stream_stats& stats) {
+    os << "Frame stream: " << stats.frames << " frames (" << stats.zero_copy << " without copying), "
+       << stats.bytes / (1024 * 1024) << " MB, " << stats.write_ms << " ms waiting for the reader";
+    return os;
+}
+
+frame_stream::~frame_stream() { close(); }
+
+bool frame_stream::open(const std::string& path, int width, int height) {
+    close();
+    if (width <= 0 || height <= 0)
+        return false;
+
+    const std::size_t pixels = static_cast<std::size_t>(width) * height;
+    std::size_t buffer_count = 1;
+#ifdef _WIN32
+    HANDLE file;
+    if (path == "-")
+        file = GetStdHandle(STD_OUTPUT_HANDLE);
+    else if (path.rfind("\\\\.\\pipe\\", 0) == 0) {
+        // The encoder connects to the pipe as a client, the frames wait until it does
+        file = CreateNamedPipeA(path.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_WAIT, 1,
+                                static_cast<DWORD>(std::min<std::size_t>(pixels * 4, 1u << 30)), 0, 0, nullptr);
+        if (file != INVALID_HANDLE_VALUE && !ConnectNamedPipe(file, nullptr) &&
+            GetLastError() != ERROR_PIPE_CONNECTED) {
+            CloseHandle(file);
+            return false;
+        }
+    } else
+        file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == nullptr || file == INVALID_HANDLE_VALUE)
+        return false;
+
+    handle_ = reinterpret_cast<std::intptr_t>(file);
+    owned_ = path != "-";
+#else
+    // Opening a named pipe waits for the reader
+    const int file = path == "-" ? STDOUT_FILENO : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0)
+        return false;
+
+    handle_ = file;
+    owned_ = path != "-";
+#endif
+
+#if !defined(_WIN32) && defined(__linux__)
+    // A pipe holds at most its capacity, so a buffer with that many bytes spliced behind it was read. The pipe is made
+    // one frame big if it's allowed, otherwise there are more buffers
+    struct stat info{};
+    if (fstat(file, &info) == 0 && S_ISFIFO(info.st_mode)) {
+        fcntl(file, F_SETPIPE_SZ, static_cast<int>(std::min<std::size_t>(pixels * 4, INT_MAX)));
+        const int capacity = fcntl(file, F_GETPIPE_SZ);
+        if (capacity > 0) {
+            splicing_ = true;
+            buffer_count = (static_cast<std::size_t>(capacity) + pixels * 4 - 1) / (pixels * 4) + 1;
+        }
+    }
+#endif
+
+    width_ = width;
+    height_ = height;
+    buffers_.assign(buffer_count, std::vector<uint32_t>(pixels));
+    next_buffer_ = 0;
+    stats_ = frame_stream_stats();
+
+    pending_header_.clear();
+    if (header) {
+        pending_header_ = {'R', 'T', 'F', 'S'};
+        put_u32_le(pending_header_, 1);
+        put_u32_le(pending_header_, static_cast<uint32_t>(width));
+        put_u32_le(pending_header_, static_cast<uint32_t>(height));
+    }
+    return true;
+}
+
+void frame_stream::close() {
+#if !defined(_WIN32) && defined(__linux__)
+    // The pipe still refers to the pages of the last frames, the buffers can only be freed once the reader took them
+    // or went away
+    const int file = static_cast<int>(handle_);
+    for (int unread = 0; splicing_ && ioctl(file, FIONREAD, &unread) == 0 && unread > 0;) {
+        pollfd reader{file, 0, 0};
+        if (poll(&reader, 1, 1) > 0 && (reader.revents & POLLERR))
+            break;
+    }
+#endif
+
+    if (valid() && owned_) {
+#ifdef _WIN32
+        HANDLE file = reinterpret_cast<HANDLE>(handle_);
+        FlushFileBuffers(file);
+        CloseHandle(file);
+#else
+        ::close(static_cast<int>(handle_));
+#endif
+    }
+    handle_ = -1;
+    owned_ = false;
+    splicing_ = false;
+    buffers_.clear();
+}
+
+bool frame_stream::valid() const { return handle_ != -1; }
+
+bool frame_stream::zero_copy() const { return splicing_; }
+
+std::vector<uint32_t>& frame_stream::next_frame() {
+    if (buffers_.empty())
+        buffers_.emplace_back();
+    std::vector<uint32_t>& buffer = buffers_[next_buffer_];
+    next_buffer_ = (next_buffer_ + 1) % buffers_.size();
+    return buffer;
+}
+
+bool frame_stream::write_frame(const std::vector<uint32_t>& pixels) {
+    if (!valid() || pixels.size() != static_cast<std::size_t>(width_) * height_)
+        return false;
+
+    // Only the buffer handed out last may be spliced, the others can still be in the pipe
+    const std::size_t last = (next_buffer_ + buffers_.size() - 1) % buffers_.size();
+    const bool spliceable = splicing_ && &pixels == &buffers_[last];
+
+    const auto start = std::chrono::steady_clock::now();
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pixels.data());
+    bool sent;
+    if (spliceable)
+        sent = write_bytes(nullptr, 0) && splice_bytes(bytes, pixels.size() * 4);
+    else
+        sent = write_bytes(bytes, pixels.size() * 4);
+    stats_.write_ms += milliseconds_since(start);
+
+    if (!sent) {
+        close();
+        return false;
+    }
+    stats_.frames++;
+    stats_.zero_copy += spliceable && splicing_;
+    return true;
+}
+
+const frame_stream_stats& frame_stream::get_stats() const { return stats_; }
+
+bool frame_stream::write_bytes(const uint8_t* data, std::size_t size) {
+#ifdef _WIN32
+    HANDLE file = reinterpret_cast<HANDLE>(handle_);
+    const auto write_all = [file](const uint8_t* bytes, std::size_t count) {
+        for (std::size_t written = 0; written < count;) {
+            DWORD done = 0;
+            const DWORD chunk = static_cast<DWORD>(std::min<std::size_t>(count - written, 1u << 30));
+            if (!WriteFile(file, bytes + written, chunk, &done, nullptr) || done == 0)
+                return false;
+            written += done;
+        }
+        return true;
+    };
+    if (!write_all(pending_header_.data(), pending_header_.size()) || !write_all(data, size))
+        return false;
+#else
+    // The header goes out with the first frame in one call
+    iovec parts[2];
+    int count = 0;
+    if (!pending_header_.empty())
+        parts[count++] = {pending_header_.data(), pending_header_.size()};
+    if (size > 0)
+        parts[count++] = {const_cast<uint8_t*>(data), size};
+
+    iovec* part = parts;
+    while (count > 0) {
+        const ssize_t done = ::writev(static_cast<int>(handle_), part, count);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        std::size_t left = static_cast<std::size_t>(done);
+        while (count > 0 && left >= part->iov_len) {
+            left -= part->iov_len;
+            part++;
+            count--;
+        }
+        if (count > 0) {
+            part->iov_base = static_cast<uint8_t*>(part->iov_base) + left;
+            part->iov_len -= left;
+        }
+    }
+#endif
+    stats_.bytes += pending_header_.size() + size;
+    pending_header_.clear();
+    return true;
+}
+
+bool frame_stream::splice_bytes(const uint8_t* data, std::size_t size) {
+#if !defined(_WIN32) && defined(__linux__)
+    for (std::size_t spliced = 0; spliced < size;) {
+        iovec part{const_cast<uint8_t*>(data + spliced), size - spliced};
+        const ssize_t done = vmsplice(static_cast<int>(handle_), &part, 1, 0);
+        if (done < 0) {
+            if (errno == EINTR)
+                continue;
+
+            // A pipe that can't splice still takes writes, from here on every frame is copied
+            if (spliced == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                splicing_ = false;
+                return write_bytes(data, size);
+            }
+            return false;
+        }
+        spliced += static_cast<std::size_t>(done);
+    }
+    stats_.bytes += size;
+    return true;
+#else
+    return write_bytes(data, size);
+#endif
+}
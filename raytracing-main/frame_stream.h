@@ -0,0 +1,117 @@
+//
+// frame_stream.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// \brief The size of the header at the start of a frame stream in bytes
+/// \details "RTFS", then the version (1), the width and the height as 32 bit little endian. The frames follow without
+///          anything in between, each width * height * 4 bytes: the ARGB pixels of on_paint as they are in memory,
+///          which is BGRA byte order. ffmpeg reads it with
+///          -skip_initial_bytes 16 -f rawvideo -pixel_format bgra -video_size WxH -i <path>.
+constexpr std::size_t frame_stream_header_size = 16;
+
+/// \brief How a frame stream went
+struct frame_stream_stats {
+    /// \brief The amount of frames sent, and how many of them were spliced into the pipe without copying
+    std::size_t frames = 0, zero_copy = 0;
+
+    /// \brief The amount of bytes sent, the header included
+    uint64_t bytes = 0;
+
+    /// \brief Milliseconds spent waiting for the reader to take the frames
+    double write_ms = 0;
+};
+
+/// \brief Prints the stats of a frame stream
+std::ostream& operator<<(std::ostream& os, const frame_stream_stats& stats);
+
+/// \brief Streams raw frames to stdout, a file or a named pipe, for an external encoder to read
+/// \details The frames are rendered into buffers of the stream (next_frame), so sending one doesn't need a copy: on
+///          Linux a frame is spliced into a pipe with vmsplice, the pipe then refers to the pages of the buffer. A
+///          buffer is only handed out again after enough frames were sent behind it to fill the whole pipe, so the
+///          reader has taken it by then. The stream keeps as many buffers as that takes, the pipe is made one frame
+///          big if the system allows it. Anything else that isn't a pipe, and every platform without vmsplice, gets
+///          the frames with plain writes (writev for the header and the first frame together, WriteFile on
+///          Windows). A named pipe is a FIFO made with mkfifo, or on Windows a name like \\.\pipe\frames that the
+///          stream creates and waits for the reader to connect to.
+class frame_stream {
+public:
+    /// \brief Start the stream with the header, without it the stream is only the frames
+    bool header = true;
+
+protected:
+    /// \brief The file descriptor or handle written to, and whether the stream closes it
+    std::intptr_t handle_ = -1;
+    bool owned_ = false;
+
+    /// \brief Whether the frames are spliced into a pipe
+    bool splicing_ = false;
+
+    /// \brief The size of the frames
+    int width_ = 0, height_ = 0;
+
+    /// \brief The buffers the frames are rendered into, used in turn
+    std::vector<std::vector<uint32_t>> buffers_;
+    std::size_t next_buffer_ = 0;
+
+    /// \brief The header, sent together with the first frame
+    std::vector<uint8_t> pending_header_;
+
+    frame_stream_stats stats_;
+
+public:
+    frame_stream() = default;
+
+    /// \brief Destructor for the stream, closes it
+    ~frame_stream();
+
+    frame_stream(const frame_stream&) = delete;
+    frame_stream& operator=(const frame_stream&) = delete;
+
+    /// \brief Opens the output of the stream, a named pipe waits until the reader opens it
+    /// \param path "-" for stdout, the path of a file or named pipe, or \\.\pipe\<name> on Windows
+    /// \param width The width of the frames
+    /// \param height The height of the frames
+    /// \return True if the output was opened
+    /// \example frame_stream stream; if (!stream.open("-", 1280, 720)) return 1;
+    bool open(const std::string& path, int width, int height);
+
+    /// \brief Closes the output, with spliced frames it first waits until the reader took them or went away
+    void close();
+
+    /// \brief Checks if the output is open
+    NODISCARD bool valid() const;
+
+    /// \brief Checks if the frames are spliced into a pipe without copying
+    NODISCARD bool zero_copy() const;
+
+    /// \brief Gets the buffer to render the next frame into, width * height pixels
+    /// \return The buffer, it stays the stream's and is valid until the next call
+    /// \example std::vector<uint32_t>& buffer = stream.next_frame(); renderer.render(buffer, 1280, 720);
+    std::vector<uint32_t>& next_frame();
+
+    /// \brief Sends a frame, one from next_frame is sent without copying if the output is a pipe
+    /// \param pixels The pixels in ARGB, row by row, width * height of them
+    /// \return True if the frame was sent, false if the output is closed or the reader went away
+    /// \example stream.write_frame(buffer);
+    bool write_frame(const std::vector<uint32_t>& pixels);
+
+    /// \brief Gets the stats of the stream
+    NODISCARD const frame_stream_stats& get_stats() const;
+
+protected:
+    /// \brief Writes bytes in as few writes as possible, the header first if it wasn't sent yet
+    bool write_bytes(const uint8_t* data, std::size_t size);
+
+    /// \brief Splices bytes into the pipe, the pages stay referenced until the reader takes them
+    bool splice_bytes(const uint8_t* data, std::size_t size);
+}; // class frame_stream
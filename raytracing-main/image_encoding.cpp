@@ -0,0 +1,208 @@
+//
+// image_encoding.cpp
+//
+
+#include "image_encoding.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace {
+    /// \brief The most bytes a stored (uncompressed) deflate block holds
+    constexpr std::size_t max_stored_block = 65535;
+
+    /// \brief The most bytes Adler-32 can add up before the sums have to be reduced, from zlib
+    constexpr std::size_t adler_run = 5552;
+
+    void put_u32_be(uint8_t* p, uint32_t value) {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+    }
+
+    uint32_t crc32(const uint8_t* data, std::size_t size) {
+        static const std::array<uint32_t, 256> table = [] {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (std::size_t i = 0; i < size; i++)
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+    void update_adler32(uint32_t& a, uint32_t& b, const uint8_t* data, std::size_t size) {
+        while (size > 0) {
+            const std::size_t run = std::min(size, adler_run);
+            for (std::size_t i = 0; i < run; i++) {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += run;
+            size -= run;
+        }
+    }
+
+    std::string ppm_header(int width, int height) {
+        return "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    }
+
+    /// \brief Gets the size of the image data of a PNG: every row starts with its filter type
+    std::size_t png_data_size(int width, int height) {
+        return static_cast<std::size_t>(height) * (1 + static_cast<std::size_t>(width) * 3);
+    }
+
+    std::size_t stored_blocks(std::size_t size) {
+        return std::max<std::size_t>(1, (size + max_stored_block - 1) / max_stored_block);
+    }
+
+    void encode_png(const uint32_t* pixels, int width, int height, uint8_t* p) {
+        static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        std::memcpy(p, signature, sizeof(signature));
+        p += sizeof(signature);
+
+        // IHDR: 8 bit RGB, no interlacing
+        put_u32_be(p, 13);
+        std::memcpy(p + 4, "IHDR", 4);
+        put_u32_be(p + 8, static_cast<uint32_t>(width));
+        put_u32_be(p + 12, static_cast<uint32_t>(height));
+        p[16] = 8;
+        p[17] = 2;
+        p[18] = p[19] = p[20] = 0;
+        put_u32_be(p + 21, crc32(p + 4, 17));
+        p += 25;
+
+        // IDAT: a zlib stream of stored deflate blocks, every row without a filter
+        const std::size_t data_size = png_data_size(width, height);
+        uint8_t* chunk = p;
+        put_u32_be(chunk, static_cast<uint32_t>(2 + stored_blocks(data_size) * 5 + data_size + 4));
+        std::memcpy(chunk + 4, "IDAT", 4);
+        p = chunk + 8;
+        *p++ = 0x78;
+        *p++ = 0x01;
+
+        std::size_t written = 0, block_left = 0;
+        const auto start_block = [&] {
+            block_left = std::min(max_stored_block, data_size - written);
+            const uint16_t length = static_cast<uint16_t>(block_left);
+            *p++ = written + block_left == data_size ? 1 : 0;
+            *p++ = static_cast<uint8_t>(length);
+            *p++ = static_cast<uint8_t>(length >> 8);
+            *p++ = static_cast<uint8_t>(~length);
+            *p++ = static_cast<uint8_t>(~length >> 8);
+        };
+        if (data_size == 0)
+            start_block();
+
+        uint32_t a = 1, b = 0;
+        std::vector<uint8_t> row(1 + static_cast<std::size_t>(width) * 3);
+        for (int y = 0; y < height; y++) {
+            const uint32_t* source = pixels + static_cast<std::size_t>(y) * width;
+            row[0] = 0;
+            for (int x = 0; x < width; x++) {
+                row[1 + x * 3] = static_cast<uint8_t>(source[x] >> 16);
+                row[2 + x * 3] = static_cast<uint8_t>(source[x] >> 8);
+                row[3 + x * 3] = static_cast<uint8_t>(source[x]);
+            }
+            update_adler32(a, b, row.data(), row.size());
+
+            // A row can span blocks
+            for (std::size_t copied = 0; copied < row.size();) {
+                if (block_left == 0)
+                    start_block();
+                const std::size_t size = std::min(block_left, row.size() - copied);
+                std::memcpy(p, row.data() + copied, size);
+                p += size;
+                copied += size;
+                written += size;
+                block_left -= size;
+            }
+        }
+        put_u32_be(p, (b << 16) | a);
+        p += 4;
+        put_u32_be(p, crc32(chunk + 4, static_cast<std::size_t>(p - chunk - 4)));
+        p += 4;
+
+        put_u32_be(p, 0);
+        std::memcpy(p + 4, "IEND", 4);
+        put_u32_be(p + 8, crc32(p + 4, 4));
+    }
+} // namespace
+
+const char* image_extension(image_format format) {
+    switch (format) {
+    case image_format::ppm:
+        return "ppm";
+    case image_format::png:
+        return "png";
+    default:
+        return "raw";
+    }
+}
+
+bool parse_image_format(const std::string& name, image_format& format) {
+    for (const image_format f : {image_format::raw, image_format::ppm, image_format::png}) {
+        if (name == image_extension(f)) {
+            format = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::size_t encoded_image_size(int width, int height, image_format format) {
+    width = std::max(width, 0);
+    height = std::max(height, 0);
+    const std::size_t pixels = static_cast<std::size_t>(width) * height;
+    switch (format) {
+    case image_format::ppm:
+        return ppm_header(width, height).size() + pixels * 3;
+    case image_format::png: {
+        const std::size_t data_size = png_data_size(width, height);
+        return 8 + 25 + 12 + 2 + stored_blocks(data_size) * 5 + data_size + 4 + 12;
+    }
+    default:
+        return pixels * 4;
+    }
+}
+
+void encode_image(const uint32_t* pixels, int width, int height, image_format format, std::vector<uint8_t>& out) {
+    width = std::max(width, 0);
+    height = std::max(height, 0);
+    const std::size_t start = out.size();
+    const std::size_t count = static_cast<std::size_t>(width) * height;
+    out.resize(start + encoded_image_size(width, height, format));
+    uint8_t* p = out.data() + start;
+
+    switch (format) {
+    case image_format::ppm: {
+        const std::string header = ppm_header(width, height);
+        std::memcpy(p, header.data(), header.size());
+        p += header.size();
+        for (std::size_t i = 0; i < count; i++) {
+            *p++ = static_cast<uint8_t>(pixels[i] >> 16);
+            *p++ = static_cast<uint8_t>(pixels[i] >> 8);
+            *p++ = static_cast<uint8_t>(pixels[i]);
+        }
+        break;
+    }
+    case image_format::png:
+        encode_png(pixels, width, height, p);
+        break;
+    default:
+        if (count > 0)
+            std::memcpy(p, pixels, count * 4);
+        break;
+    }
+}
@@ -0,0 +1,53 @@
+//
+// image_encoding.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \brief The file formats a frame can be encoded in
+enum class image_format : uint32_t {
+    /// \brief The ARGB pixels as they are in memory, row by row, 4 bytes per pixel (B, G, R, A on little endian)
+    raw = 0,
+
+    /// \brief Binary PPM (P6), 8 bit RGB
+    ppm = 1,
+
+    /// \brief PNG, 8 bit RGB. The image data is stored without compression, so encoding costs about as much as a copy
+    png = 2
+};
+
+/// \brief Gets the file extension of a format, without the dot
+/// \param format The format
+/// \return "raw", "ppm" or "png"
+/// \example std::string name = "frame." + std::string(image_extension(image_format::png));
+NODISCARD const char* image_extension(image_format format);
+
+/// \brief Gets the format of a name like "png"
+/// \param name The name or extension of the format
+/// \param format The format (output)
+/// \return True if the name is a format
+/// \example image_format format; if (!parse_image_format(argv[2], format)) return 1;
+bool parse_image_format(const std::string& name, image_format& format);
+
+/// \brief Encodes a frame in a file format, the alpha channel is only kept in raw
+/// \param pixels The pixels in ARGB, row by row
+/// \param width The width of the frame
+/// \param height The height of the frame
+/// \param format The format to encode in
+/// \param out The bytes of the file are appended to it, so a buffer can be reused or hold a header already
+/// \example std::vector<uint8_t> file; encode_image(buffer.data(), width, height, image_format::ppm, file);
+void encode_image(const uint32_t* pixels, int width, int height, image_format format, std::vector<uint8_t>& out);
+
+/// \brief Gets the size of an encoded frame, the size of the file encode_image appends
+/// \param width The width of the frame
+/// \param height The height of the frame
+/// \param format The format
+/// \return The size in bytes
+NODISCARD std::size_t encoded_image_size(int width, int height, image_format format);
@@ -0,0 +1,72 @@
+//
+// lighting.cpp
+//
+
+#include "lighting.h"
+
+#include <bardrix/quaternion.h>
+
+#include <algorithm>
+#include <cmath>
+
+double calculate_light_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                 const bardrix::camera& camera,
+                                 const bardrix::point3& intersection_point,
+                                 double ambient_visibility)
+{
+    return calculate_light_intensity(shape, light, camera.position, intersection_point, ambient_visibility);
+}
+
+double calculate_light_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                 const bardrix::point3& viewer,
+                                 const bardrix::point3& intersection_point,
+                                 double ambient_visibility)
+{
+    const bardrix::vector3 light_intersection_vector = intersection_point.vector_to(light.position).normalized();
+
+    // Angle between the normal and the light intersection vector
+    const double angle = shape.normal_at(intersection_point).dot(light_intersection_vector);
+
+    if (angle < 0) // This means the light is behind the intersection_point
+        return 0;
+
+    // Specular reflection
+    bardrix::vector3 reflection = bardrix::quaternion::mirror(light_intersection_vector,
+                                                              shape.normal_at(intersection_point));
+    double specular_angle = reflection.dot(viewer.vector_to(intersection_point).normalized());
+    double specular = std::pow(specular_angle, shape.get_material().get_shininess());
+
+    // We're calculating phong shading (ambient + diffuse + specular), the ambient light is blocked by nearby objects
+    double intensity = shape.get_material().get_ambient() * ambient_visibility;
+    intensity += shape.get_material().get_diffuse() * angle;
+    intensity += shape.get_material().get_specular() * specular;
+
+    // Max intensity is 1
+    return std::min(1.0, intensity * light.inverse_square_law(intersection_point));
+}
+
+double calculate_diffuse_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                   const bardrix::point3& point, double ambient_visibility)
+{
+    const double angle = shape.normal_at(point).dot(point.vector_to(light.position).normalized());
+    if (angle < 0)
+        return 0;
+
+    const double intensity = shape.get_material().get_ambient() * ambient_visibility +
+                             shape.get_material().get_diffuse() * angle;
+    return intensity * light.inverse_square_law(point);
+}
+
+double calculate_specular_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                    const bardrix::point3& viewer, const bardrix::point3& point)
+{
+    const bardrix::vector3 light_vector = point.vector_to(light.position).normalized();
+    const bardrix::vector3 normal = shape.normal_at(point);
+    if (normal.dot(light_vector) < 0)
+        return 0;
+
+    const bardrix::vector3 reflection = bardrix::quaternion::mirror(light_vector, normal);
+    const double specular = std::pow(reflection.dot(viewer.vector_to(point).normalized()),
+                                     shape.get_material().get_shininess());
+    return shape.get_material().get_specular() * specular * light.inverse_square_law(point);
+}
@@ -0,0 +1,57 @@
+//
+// lighting.h
+//
+
+#pragma once
+
+#include <bardrix/camera.h>
+#include <bardrix/light.h>
+#include <bardrix/objects.h>
+
+///beeep beep beep beepo beepo beepo gleeby sqleeby
+/// \brief Calculates the light intensity at a given intersection point
+/// \param shape The shape that was intersected
+/// \param light The light source
+/// \param camera The camera
+/// \param intersection_point The intersection point of an object
+/// \param ambient_visibility The fraction of the ambient light that reaches the point [0, 1], see ao_cache
+/// \return The light intensity at the intersection point
+/// \example double intensity = calculate_light_intensity(shape, light, camera, intersection_point);
+NODISCARD double calculate_light_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                           const bardrix::camera& camera,
+                                           const bardrix::point3& intersection_point,
+                                           double ambient_visibility = 1);
+
+/// \brief Calculates the light intensity at a given intersection point as seen from any point, e.g. the origin of a
+///        reflected ray
+/// \param shape The shape that was intersected
+/// \param light The light source
+/// \param viewer The point the intersection point is seen from
+/// \param intersection_point The intersection point of an object
+/// \param ambient_visibility The fraction of the ambient light that reaches the point [0, 1], see ao_cache
+/// \return The light intensity at the intersection point
+/// \example double intensity = calculate_light_intensity(shape, light, reflection.position, intersection_point);
+NODISCARD double calculate_light_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                           const bardrix::point3& viewer,
+                                           const bardrix::point3& intersection_point,
+                                           double ambient_visibility = 1);
+
+/// \brief Calculates the view independent part (ambient + diffuse) of the light intensity at a point, before it's
+///        clamped, so it can be cached and reused for any camera position
+/// \param shape The shape the point is on
+/// \param light The light source
+/// \param point The point on the surface
+/// \param ambient_visibility The fraction of the ambient light that reaches the point [0, 1], see ao_cache
+/// \return The ambient + diffuse intensity, 0 if the light is behind the point
+/// \example double intensity = std::min(1.0, diffuse + calculate_specular_intensity(shape, light, viewer, point));
+NODISCARD double calculate_diffuse_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                             const bardrix::point3& point, double ambient_visibility = 1);
+
+/// \brief Calculates the view dependent part (specular) of the light intensity at a point, before it's clamped
+/// \param shape The shape the point is on
+/// \param light The light source
+/// \param viewer The point the surface point is seen from
+/// \param point The point on the surface
+/// \return The specular intensity, 0 if the light is behind the point
+NODISCARD double calculate_specular_intensity(const bardrix::shape& shape, const bardrix::light& light,
+                                              const bardrix::point3& viewer, const bardrix::point3& point);
@@ -0,0 +1,106 @@
+//
+// lighting_cache.cpp
+//
+
+#include "lighting_cache.h"
+#include "fingerprint.h"
+#include "lighting.h"
+
+#include <algorithm>
+#include <cmath>
+
+std::ostream& operator<<(std::ostream& os, const lighting_cache_stats& stats) {
+    os << "Lighting cache: " << stats.lookups << " lookups, " << stats.filled << " texels filled";
+    return os;
+}
+
+void lighting_cache::prepare(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights,
+                             bool ambient_occlusion) {
+    stats_ = lighting_cache_stats();
+    lights_.assign(lights.begin(), lights.begin() + static_cast<std::ptrdiff_t>(std::min(lights.size(), max_lights)));
+
+    const uint64_t geometry = fingerprint::combine(fingerprint::of(spheres), ambient_occlusion);
+    const bool resized = light_fingerprints_.size() != lights_.size();
+    if (geometry != geometry_ || surfaces_.size() != spheres.size() || resized) {
+        geometry_ = geometry;
+        surfaces_.resize(spheres.size());
+        for (std::size_t i = 0; i < spheres.size(); i++)
+            surfaces_[i].grid = surface_grid(spheres[i].get_radius(), texels_per_unit);
+        light_fingerprints_.assign(lights_.size(), 0);
+        clear();
+    }
+
+    // A light that changed only loses its own intensities
+    uint32_t changed = 0;
+    for (std::size_t l = 0; l < lights_.size(); l++) {
+        const uint64_t light = fingerprint::of(lights_[l]);
+        if (light != light_fingerprints_[l]) {
+            light_fingerprints_[l] = light;
+            changed |= 1u << l;
+        }
+    }
+
+    if (changed == 0)
+        return;
+
+    for (surface& s : surfaces_)
+        for (uint32_t& valid : s.valid)
+            valid &= ~changed;
+}
+
+void lighting_cache::lookup(std::size_t index, const std::vector<sphere>& spheres, const bardrix::point3& point,
+                            ao_cache* occlusion, float* intensities) {
+    stats_.lookups++;
+    const surface& s = surfaces_[index];
+
+    // Bilinear interpolation between the 4 texel centers around the point
+    double u, v;
+    s.grid.locate(spheres[index], point, u, v);
+    const int column = static_cast<int>(std::floor(u - 0.5)), row = static_cast<int>(std::floor(v - 0.5));
+    const auto fu = static_cast<float>(u - 0.5 - column), fv = static_cast<float>(v - 0.5 - row);
+    const float weights[] = {(1 - fu) * (1 - fv), fu * (1 - fv), (1 - fu) * fv, fu * fv};
+
+    std::fill(intensities, intensities + lights_.size(), 0.0f);
+    for (int corner = 0; corner < 4; corner++) {
+        const int c = column + (corner & 1), r = std::clamp(row + (corner >> 1), 0, s.grid.rows - 1);
+        const std::size_t texel = s.grid.index(c, r);
+        const float* texel_intensities = fill(index, spheres, texel, c, r, occlusion);
+        for (std::size_t l = 0; l < lights_.size(); l++)
+            intensities[l] += texel_intensities[l] * weights[corner];
+    }
+}
+
+void lighting_cache::clear() {
+    for (surface& s : surfaces_) {
+        s.valid.assign(s.grid.size(), 0);
+        s.intensities.assign(s.grid.size() * lights_.size(), 0.0f);
+    }
+}
+
+const lighting_cache_stats& lighting_cache::get_stats() const { return stats_; }
+
+const float* lighting_cache::fill(std::size_t index, const std::vector<sphere>& spheres, std::size_t texel,
+                                  int column, int row, ao_cache* occlusion) {
+    surface& s = surfaces_[index];
+    float* intensities = s.intensities.data() + texel * lights_.size();
+
+    const uint32_t all = lights_.size() == max_lights ? ~0u : (1u << lights_.size()) - 1;
+    if ((s.valid[texel] & all) == all)
+        return intensities;
+
+    stats_.filled++;
+    const sphere& shape = spheres[index];
+    const bardrix::point3 center = s.grid.point_at(shape, column, row);
+    const double ambient_visibility = occlusion == nullptr
+                                          ? 1
+                                          : occlusion->converged_visibility(center, shape.normal_at(center), spheres);
+
+    for (std::size_t l = 0; l < lights_.size(); l++) {
+        if (s.valid[texel] & (1u << l))
+            continue;
+
+        intensities[l] = static_cast<float>(calculate_diffuse_intensity(shape, lights_[l], center, ambient_visibility));
+        s.valid[texel] |= 1u << l;
+    }
+    return intensities;
+}
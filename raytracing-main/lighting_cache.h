@@ -0,0 +1,101 @@
+//
+// lighting_cache.h
+//
+
+#pragma once
+
+#include "ambient_occlusion.h"
+#include "sphere.h"
+#include "surface_grid.h"
+
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief Lookups of the lighting cache in the last frame
+struct lighting_cache_stats {
+    /// \brief The amount of surface points that were looked up
+    std::size_t lookups = 0;
+
+    /// \brief The amount of texels whose lighting was (re)calculated
+    std::size_t filled = 0;
+};
+
+/// \brief Prints the stats of the lighting cache
+std::ostream& operator<<(std::ostream& os, const lighting_cache_stats& stats);
+
+/// \brief Caches the view independent ambient + diffuse intensity of every light on the surface of every sphere, so
+///        a moving camera only recalculates the specular part per pixel
+/// \details Every sphere has a surface_grid atlas that stores an intensity per light per texel, calculated in the
+///          texel center (including converged ambient occlusion) the first time it's needed. A lookup interpolates
+///          the 4 nearest texel centers, diffuse lighting is smooth so a coarse grid is enough. Shadows aren't part
+///          of the cache, they're applied per pixel. Moving a light only recalculates its own intensities, moving a
+///          sphere recalculates everything.
+class lighting_cache {
+public:
+    /// \brief The amount of lights that fit in the valid bits of a texel
+    static constexpr std::size_t max_lights = 32;
+
+    /// \brief The amount of texels per world unit along the equator of a sphere, large spheres get fewer (see
+    ///        surface_grid::max_columns)
+    double texels_per_unit = 32;
+
+protected:
+    /// \brief The atlas of a sphere
+    struct surface {
+        surface_grid grid;
+
+        /// \brief The lights whose intensity is calculated, per texel
+        std::vector<uint32_t> valid;
+
+        /// \brief The intensity of every light, texel after texel
+        std::vector<float> intensities;
+    };
+
+    /// \brief The atlas of every sphere, in the same order as the spheres
+    std::vector<surface> surfaces_;
+
+    /// \brief The lights of the current frame
+    std::vector<bardrix::light> lights_;
+
+    /// \brief The fingerprint of every light the intensities were calculated with
+    std::vector<uint64_t> light_fingerprints_;
+
+    /// \brief The fingerprint of the spheres (and whether ambient occlusion was used) the atlases were made for
+    uint64_t geometry_ = 0;
+
+    /// \brief The stats of the current frame
+    lighting_cache_stats stats_;
+
+public:
+    /// \brief Starts a new frame, invalidates the intensities of the lights and spheres that changed
+    /// \param spheres The spheres in the scene
+    /// \param lights The lights to cache, at most max_lights (the others are ignored)
+    /// \param ambient_occlusion Whether the ambient light is occluded
+    void prepare(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights,
+                 bool ambient_occlusion);
+
+    /// \brief Gets the interpolated ambient + diffuse intensity of every light at a surface point
+    /// \param index The index of the sphere the point is on
+    /// \param spheres The spheres in the scene
+    /// \param point The point on the surface
+    /// \param occlusion The ambient occlusion cache, nullptr if ambient occlusion is off
+    /// \param intensities The intensity of every light (output), as many as there are lights
+    /// \example cache.lookup(index, spheres, hit.point, &occlusion, intensities.data());
+    void lookup(std::size_t index, const std::vector<sphere>& spheres, const bardrix::point3& point,
+                ao_cache* occlusion, float* intensities);
+
+    /// \brief Removes all intensities
+    void clear();
+
+    /// \brief Gets the stats of the current frame
+    NODISCARD const lighting_cache_stats& get_stats() const;
+
+protected:
+    /// \brief Calculates the missing intensities of a texel
+    /// \return The intensities of the texel
+    const float* fill(std::size_t index, const std::vector<sphere>& spheres, std::size_t texel, int column, int row,
+                      ao_cache* occlusion);
+}; // class lighting_cache
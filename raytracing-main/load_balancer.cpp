@@ -0,0 +1,140 @@
+//
+// load_balancer.cpp
+//
+
+#include "load_balancer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace {
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const load_balance_stats& stats) {
+    os << "Load balance: " << stats.items << " work items (" << stats.split_tiles << " tiles split, "
+       << stats.merged_tiles << " merged) on " << stats.threads << " threads, finished within "
+       << stats.finish_spread * 100 << "% of the " << stats.loop_ms << " ms loop";
+    return os;
+}
+
+void load_balancer::plan(std::size_t tile_count, int tile_size, const std::vector<uint32_t>* order,
+                         std::size_t threads, bool balance) {
+    stats_ = load_balance_stats();
+    tile_size = std::max(1, tile_size);
+    const bool known = balance && costs_.size() == tile_count;
+    tile_count_ = tile_count;
+    items_.clear();
+    part_tiles_.clear();
+
+    auto tile_at = [&](uint32_t position) { return order != nullptr ? (*order)[position] : position; };
+    const auto tiles = static_cast<uint32_t>(tile_count);
+    if (!known) {
+        for (uint32_t position = 0; position < tiles; position++) {
+            items_.push_back({position, position + 1, 0, tile_size, static_cast<uint32_t>(part_tiles_.size()), 0});
+            part_tiles_.push_back(tile_at(position));
+        }
+    } else {
+        // Every item should cost about the same, so the threads run out of work together
+        const double total = std::accumulate(costs_.begin(), costs_.end(), 0.0);
+        const double target = total / std::max(1.0, static_cast<double>(threads) * settings.items_per_thread);
+
+        tile_work merged;
+        auto close = [&] {
+            if (merged.end == merged.begin)
+                return;
+            items_.push_back(merged);
+            if (merged.end - merged.begin > 1)
+                stats_.merged_tiles += merged.end - merged.begin;
+            merged = tile_work();
+        };
+
+        for (uint32_t position = 0; position < tiles; position++) {
+            const uint32_t tile = tile_at(position);
+            const double cost = costs_[tile];
+
+            // An expensive tile becomes bands of rows of about one item each
+            if (target > 0 && cost > target * settings.split_threshold) {
+                close();
+                const int bands = std::clamp(static_cast<int>(std::ceil(cost / target)), 1, tile_size);
+                for (int band = 0; band < bands; band++) {
+                    items_.push_back({position, position + 1, band * tile_size / bands,
+                                      (band + 1) * tile_size / bands, static_cast<uint32_t>(part_tiles_.size()),
+                                      cost / bands});
+                    part_tiles_.push_back(tile);
+                }
+                stats_.split_tiles++;
+                continue;
+            }
+
+            // Cheap tiles are added to the current item until it's full
+            if (merged.end > merged.begin && merged.predicted + cost > target)
+                close();
+            if (merged.end == merged.begin)
+                merged = {position, position, 0, tile_size, static_cast<uint32_t>(part_tiles_.size()), 0};
+            merged.end = position + 1;
+            merged.predicted += cost;
+            part_tiles_.push_back(tile);
+        }
+        close();
+    }
+
+    // The most expensive items go first, unless the tiles have a priority order of their own
+    dispatch_.resize(items_.size());
+    std::iota(dispatch_.begin(), dispatch_.end(), 0u);
+    if (known && order == nullptr)
+        std::stable_sort(dispatch_.begin(), dispatch_.end(),
+                         [&](uint32_t a, uint32_t b) { return items_[a].predicted > items_[b].predicted; });
+
+    part_costs_.assign(part_tiles_.size(), 0);
+    item_threads_.assign(items_.size(), std::thread::id());
+    item_finishes_.assign(items_.size(), 0);
+    stats_.items = items_.size();
+}
+
+const std::vector<tile_work>& load_balancer::items() const { return items_; }
+
+const std::vector<uint32_t>& load_balancer::dispatch_order() const { return dispatch_; }
+
+void load_balancer::start() { start_ = std::chrono::steady_clock::now(); }
+
+void load_balancer::measure(std::size_t part, double microseconds) { part_costs_[part] = microseconds; }
+
+void load_balancer::finish_item(std::size_t item) {
+    item_threads_[item] = std::this_thread::get_id();
+    item_finishes_[item] = milliseconds_since(start_);
+}
+
+void load_balancer::finish() {
+    stats_.loop_ms = milliseconds_since(start_);
+
+    // A split tile costs all of its bands together
+    costs_.assign(tile_count_, 0);
+    for (std::size_t part = 0; part < part_tiles_.size(); part++)
+        costs_[part_tiles_[part]] += part_costs_[part];
+
+    // Every thread ran out of work when its last item was done
+    std::vector<std::pair<std::thread::id, double>> finishes;
+    for (std::size_t item = 0; item < item_threads_.size(); item++) {
+        auto found = std::find_if(finishes.begin(), finishes.end(),
+                                  [&](const auto& finish) { return finish.first == item_threads_[item]; });
+        if (found == finishes.end())
+            finishes.emplace_back(item_threads_[item], item_finishes_[item]);
+        else
+            found->second = std::max(found->second, item_finishes_[item]);
+    }
+
+    stats_.threads = finishes.size();
+    if (!finishes.empty() && stats_.loop_ms > 0) {
+        const auto [first, last] = std::minmax_element(finishes.begin(), finishes.end(), [](const auto& a,
+                                                                                            const auto& b) {
+            return a.second < b.second;
+        });
+        stats_.finish_spread = (last->second - first->second) / stats_.loop_ms;
+    }
+}
+
+const load_balance_stats& load_balancer::get_stats() const { return stats_; }
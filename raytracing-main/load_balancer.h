@@ -0,0 +1,132 @@
+//
+// load_balancer.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+/// \brief A piece of work of the primary ray loop: a run of whole tiles, or a band of rows of one expensive tile
+struct tile_work {
+    /// \brief The positions in the tile order [begin, end), a band always has a single tile
+    uint32_t begin = 0, end = 0;
+
+    /// \brief The rows of the tile relative to its top [row_begin, row_end), whole tiles have every row
+    int row_begin = 0, row_end = 0;
+
+    /// \brief The index of the cost of the first tile in the list of measured parts
+    uint32_t first_part = 0;
+
+    /// \brief The cost predicted from the previous frame in microseconds, 0 if nothing is known
+    double predicted = 0;
+};
+
+/// \brief How the primary ray loop of the last frame was split up and how evenly the threads finished
+struct load_balance_stats {
+    /// \brief The amount of work items, and the amount of tiles that were split or merged with other tiles
+    std::size_t items = 0, split_tiles = 0, merged_tiles = 0;
+
+    /// \brief The amount of threads that picked up work
+    std::size_t threads = 0;
+
+    /// \brief The time between the first and the last thread running out of work, as a fraction of the loop
+    double finish_spread = 0;
+
+    /// \brief Milliseconds the loop took
+    double loop_ms = 0;
+};
+
+/// \brief Prints the stats of the load balancer
+std::ostream& operator<<(std::ostream& os, const load_balance_stats& stats);
+
+/// \brief Settings of the load balancer
+struct load_balance_settings {
+    /// \brief The amount of work items per thread. The cost of a tile changes from frame to frame, many small items
+    ///        keep a wrong prediction from leaving a thread with a big item at the end
+    double items_per_thread = 256;
+
+    /// \brief A tile is split when its cost is more than this many times the cost of a work item
+    double split_threshold = 1.5;
+};
+
+/// \brief Splits the tiles of the primary ray loop into work items of about the same cost, predicted by how long
+///        every tile took in the previous frame
+/// \details Every frame measures how long every tile takes. The next frame aims for threads * items_per_thread items
+///          of equal cost: cheap tiles (empty sky) are merged with the tiles after them until an item is full, and
+///          expensive tiles are split into bands of rows. The items are handed out from the most to the least
+///          expensive (tiles with a priority order keep it), so the last items the threads pick up are small and
+///          they run out of work at about the same time. Without a previous frame every tile is its own item.
+class load_balancer {
+public:
+    /// \brief The settings used for the next plan
+    load_balance_settings settings;
+
+protected:
+    /// \brief The amount of tiles of the current frame
+    std::size_t tile_count_ = 0;
+
+    /// \brief The measured cost of every tile in the last frame in microseconds, empty if it isn't known
+    std::vector<double> costs_;
+
+    /// \brief The work items of the current frame, in tile order
+    std::vector<tile_work> items_;
+
+    /// \brief The order the work items are handed out in
+    std::vector<uint32_t> dispatch_;
+
+    /// \brief The tile and measured cost in microseconds of every part of a work item
+    std::vector<uint32_t> part_tiles_;
+    std::vector<double> part_costs_;
+
+    /// \brief The thread that ran every work item, and when it was done in milliseconds since the loop started
+    std::vector<std::thread::id> item_threads_;
+    std::vector<double> item_finishes_;
+
+    /// \brief When the loop of the current frame started
+    std::chrono::steady_clock::time_point start_;
+
+    /// \brief The stats of the last frame
+    load_balance_stats stats_;
+
+public:
+    /// \brief Splits the tiles of the next frame into work items
+    /// \param tile_count The amount of tiles
+    /// \param tile_size The size of a tile in pixels, the most bands a tile can be split in
+    /// \param order The order the tiles are traced in, nullptr for row by row
+    /// \param threads The amount of threads that run the loop
+    /// \param balance False to make every tile its own item in tile order, the costs are still measured
+    /// \example balancer.plan(tiles, 16, nullptr, pool.size(), true);
+    void plan(std::size_t tile_count, int tile_size, const std::vector<uint32_t>* order, std::size_t threads,
+              bool balance);
+
+    /// \brief Gets the work items of the current frame in tile order
+    NODISCARD const std::vector<tile_work>& items() const;
+
+    /// \brief Gets the order the work items should be handed out in
+    /// \return The indices of the work items
+    NODISCARD const std::vector<uint32_t>& dispatch_order() const;
+
+    /// \brief Marks the start of the loop, the items are timed from here
+    void start();
+
+    /// \brief Stores how long one tile of a work item took, every part is stored by one thread only
+    /// \param part The index of the part, tile_work::first_part + the position of the tile in the item
+    /// \param microseconds The time it took
+    void measure(std::size_t part, double microseconds);
+
+    /// \brief Stores that a work item is done on the calling thread
+    /// \param item The index of the work item
+    void finish_item(std::size_t item);
+
+    /// \brief Adds up the measured parts into the cost of every tile for the next frame and computes the stats
+    void finish();
+
+    /// \brief Gets the stats of the last frame
+    NODISCARD const load_balance_stats& get_stats() const;
+}; // class load_balancer
@@ -2,69 +2,108 @@
 // Created by Bardio on 22/05/2024.
 //
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
-#ifdef _WIN32
-
-#include "sphere.h"
-#include "window.h"
-#include "algorithm"
-
-#include "bardrix/quaternion.h"
-#include <bardrix/ray.h>
-#include <bardrix/light.h>
-#include <bardrix/camera.h>
-
-
-///beeep beep beep beepo beepo beepo gleeby sqleeby
-/// \brief Calculates the light intensity at a given intersection point
-/// \param shape The shape that was intersected
-/// \param light The light source
-/// \param camera The camera
-/// \param intersection_point The intersection point of an object
-/// \return The light intensity at the intersection point
-/// \example double intensity = calculate_light_intensity(shape, light, camera, intersection_point);
-double calculate_light_intensity(const bardrix::shape& shape, const bardrix::light& light,
-                                 const bardrix::camera& camera,
-                                 const bardrix::point3& intersection_point)
-{
-    const bardrix::vector3 light_intersection_vector = intersection_point.vector_to(light.position).normalized();
-
-    // Angle between the normal and the light intersection vector
-    const double angle = shape.normal_at(intersection_point).dot(light_intersection_vector);
+#include "frame_ring.h"
+#include "frame_stream.h"
+#include "render_farm.h"
+#include "render_server.h"
+#include "renderer.h"
+#include "thread_pool.h"
+
+/// \brief Runs the process as a worker of a render farm: --farm-worker <address> [threads]
+/// \return The exit code, or -1 if the process wasn't started as a worker
+int run_farm_worker(int argc, char* argv[]) {
+    if (argc < 3 || std::string(argv[1]) != "--farm-worker")
+        return -1;
 
-    if (angle < 0) // This means the light is behind the intersection_point
-        return 0;
+    thread_pool pool(argc > 3 ? static_cast<unsigned int>(std::max(1, std::atoi(argv[3]))) : 0);
+    render_worker worker(pool);
+    const bool quit = worker.run(argv[2]);
+    std::cout << "Rendered " << worker.get_tasks_done() << " tiles" << std::endl;
+    return quit ? 0 : 1;
+}
 
-    // Specular reflection
-    bardrix::vector3 reflection = bardrix::quaternion::mirror(light_intersection_vector,
-                                                              shape.normal_at(intersection_point));
-    double specular_angle = reflection.dot(camera.position.vector_to(intersection_point).normalized());
-    double specular = std::pow(specular_angle, shape.get_material().get_shininess());
+/// \brief Runs the process as a viewer of the frames another process publishes: --watch-frames <name>
+/// \return The exit code, or -1 if the process wasn't started as a viewer
+int run_frame_watcher(int argc, char* argv[]) {
+    if (argc < 3 || std::string(argv[1]) != "--watch-frames")
+        return -1;
 
-    // We're calculating phong shading (ambient + diffuse + specular)
-    double intensity = shape.get_material().get_ambient();
-    intensity += shape.get_material().get_diffuse() * angle;
-    intensity += shape.get_material().get_specular() * specular;
+    frame_ring ring;
+    if (!ring.open(argv[2])) {
+        std::cout << "No frames are published as " << argv[2] << std::endl;
+        return 1;
+    }
 
-    // Max intensity is 1
-    return std::min(1.0, intensity * light.inverse_square_law(intersection_point));
+    // Reads every frame in place and prints the frame rate once a second, until the renderer closes the ring
+    uint64_t seen = ring.get_sequence();
+    std::size_t frames = 0, skipped = 0, overwritten = 0;
+    auto second = std::chrono::steady_clock::now();
+    while (ring.wait(seen, -1)) {
+        const ring_frame frame = ring.latest();
+        if (frame.pixels == nullptr)
+            continue;
+
+        uint64_t green = 0;
+        for (std::size_t i = 0; i < static_cast<std::size_t>(frame.width) * frame.height; i++)
+            green += (frame.pixels[i] >> 8) & 0xFF;
+        overwritten += !ring.still_valid(frame);
+        skipped += frame.sequence - seen - 1;
+        seen = frame.sequence;
+        frames++;
+
+        if (std::chrono::steady_clock::now() - second >= std::chrono::seconds(1)) {
+            std::cout << "Frame " << frame.sequence << ": " << frame.width << "x" << frame.height << ", average green "
+                      << green / std::max<uint64_t>(1, static_cast<uint64_t>(frame.width) * frame.height) << ", "
+                      << frames << " frames/s, " << skipped << " skipped, " << overwritten
+                      << " overwritten while read" << std::endl;
+            frames = skipped = overwritten = 0;
+            second = std::chrono::steady_clock::now();
+        }
+    }
+    return 0;
 }
 
+/// \brief Runs the process as a render server: --serve <address> [threads]
+/// \return The exit code, or -1 if the process wasn't started as a server
+int run_render_server(int argc, char* argv[]) {
+    if (argc < 3 || std::string(argv[1]) != "--serve")
+        return -1;
 
-int main()
-{
-    int width = 600;
-    int height = 600;
-    // Create a window
-    bardrix::window window("Raytracing", width, height);
+    thread_pool pool(argc > 3 ? static_cast<unsigned int>(std::max(1, std::atoi(argv[3]))) : 0);
+    render_server server(pool);
+    if (!server.listen(argv[2])) {
+        std::cout << "Can't listen on " << argv[2] << std::endl;
+        return 1;
+    }
 
-    // Create a camera
-    bardrix::camera camera = bardrix::camera({0, 0, 0}, {0, 0, 1}, width, height, 60);
+    // The server answers until the process is stopped, the stats are printed every 10 seconds
+    std::cout << "Serving frames on " << server.get_address() << std::endl;
+    std::thread metrics([&server] {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds(10));
+            std::cout << server.get_stats() << std::endl;
+        }
+    });
+    metrics.detach();
+    server.run();
+    return 0;
+}
 
-    // Create a sphere
-    std::vector<sphere> spheres;
+/// \brief Builds the scene of the window, the frame stream renders the same scene
+/// \param spheres The spheres (output)
+/// \param lights The lights (output)
+/// \param area_lights The area lights (output)
+void make_scene(std::vector<sphere>& spheres, std::vector<bardrix::light>& lights,
+                std::vector<area_light>& area_lights) {
     sphere s1(1.0, bardrix::point3(0.0, 0.0, 3.0));
     s1.set_material(bardrix::material(0.3, 1, 0.8, 20));
 
@@ -73,75 +112,228 @@ int main()
 
     sphere s3(1.5, {2.0, 2.0, 4.0});
     s3.set_material(bardrix::material(0.3, 1, 0.8, 20, bardrix::color::white()));
+    s3.set_optics({0.5, 0, 1}); // Half mirror
 
+    spheres = {s1, s2, s3};
 
-    spheres.push_back(s1);
-    spheres.push_back(s2);
-    spheres.push_back(s3);
-
-    std::vector<bardrix::light> lights{
+    lights = {
         bardrix::light({2, 1, 1}, 1, bardrix::color::cyan()),
         bardrix::light({-2, -1, -1}, 5, bardrix::color::yellow()),
         bardrix::light({1, 1, 0}, 2, bardrix::color::cyan()),
     };
 
+    // Soft shadows, sampled with a few rays per pixel per frame
+    area_lights = {
+        area_light(bardrix::light({-1, 2, 1}, 2, bardrix::color::white()), 0.5),
+    };
+}
+
+/// \brief Moves the lights of the scene of make_scene one frame further
+/// \param lights The lights to move
+void animate_lights(std::vector<bardrix::light>& lights) {
+    //lights[0].position += 0.1;
+    lights[1].position.x += 0.01;
+    lights[1].position.y += 0.005;
+    lights[1].position.z -= 0.01;
+    //lights[2].set_intensity(lights[2].get_intensity() + 0.01);
+}
+
+/// \brief Runs the process as a frame source for an external encoder:
+///        --stream-frames <path or -> [width] [height] [frames] [threads]
+/// \details Renders the scene of the window with its animation and streams the raw frames, see frame_stream. 0 frames
+///          streams until the reader goes away. Nothing but the frames goes to stdout, the stats go to stderr.
+/// \return The exit code, or -1 if the process wasn't started as a frame source
+int run_frame_stream(int argc, char* argv[]) {
+    if (argc < 3 || std::string(argv[1]) != "--stream-frames")
+        return -1;
+
+    const int width = argc > 3 ? std::max(1, std::atoi(argv[3])) : 640;
+    const int height = argc > 4 ? std::max(1, std::atoi(argv[4])) : 360;
+    const int frames = argc > 5 ? std::max(0, std::atoi(argv[5])) : 0;
+
+#ifdef SIGPIPE
+    // A reader that goes away ends the stream instead of the process
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+    frame_stream stream;
+    if (!stream.open(argv[2], width, height)) {
+        std::cerr << "Can't stream to " << argv[2] << std::endl;
+        return 1;
+    }
+
+    // The scene of the window
+    bardrix::camera camera({0, 0, 0}, {0, 0, 1}, width, height, 60);
+    std::vector<sphere> spheres;
+    std::vector<bardrix::light> lights;
+    std::vector<area_light> area_lights;
+    make_scene(spheres, lights, area_lights);
+
+    // Every frame is rendered straight into a buffer of the stream, a pipe gets it without a copy
+    thread_pool pool(argc > 6 ? static_cast<unsigned int>(std::max(1, std::atoi(argv[6]))) : 0);
+    renderer scene_renderer(camera, spheres, lights, area_lights, pool);
+    for (int frame = 0; frames == 0 || frame < frames; frame++) {
+        std::vector<uint32_t>& buffer = stream.next_frame();
+        scene_renderer.render(buffer, width, height);
+        if (!stream.write_frame(buffer))
+            break;
+
+        animate_lights(lights);
+    }
+
+    std::cerr << stream.get_stats() << std::endl;
+    return 0;
+}
+
+#ifdef _WIN32
+
+#include "accumulation.h"
+#include "area_light.h"
+#include "denoiser.h"
+#include "fingerprint.h"
+#include "renderer.h"
+#include "sampling.h"
+#include "sequence_writer.h"
+#include "sphere.h"
+#include "thread_placement.h"
+#include "thread_pool.h"
+#include "wavefront.h"
+#include "window.h"
+
+#include "bardrix/quaternion.h"
+#include <bardrix/ray.h>
+#include <bardrix/light.h>
+#include <bardrix/camera.h>
+
+
+int main(int argc, char* argv[])
+{
+    // Workers of a render farm don't open a window
+    const int worker_exit = run_farm_worker(argc, argv);
+    if (worker_exit >= 0)
+        return worker_exit;
+    const int watcher_exit = run_frame_watcher(argc, argv);
+    if (watcher_exit >= 0)
+        return watcher_exit;
+    const int server_exit = run_render_server(argc, argv);
+    if (server_exit >= 0)
+        return server_exit;
+    const int stream_exit = run_frame_stream(argc, argv);
+    if (stream_exit >= 0)
+        return stream_exit;
+
+    int width = 600;
+    int height = 600;
+
+    // Finished frames are published to shared memory, --watch-frames raytracing-frames reads them in another process
+    frame_ring published_frames;
+    const bool publishing = published_frames.create("raytracing-frames", 4,
+        static_cast<std::size_t>(GetSystemMetrics(SM_CXSCREEN)) * GetSystemMetrics(SM_CYSCREEN));
+    if (!publishing)
+        std::cout << "Frames aren't published, raytracing-frames can't be created (is it open in another process?)"
+                  << std::endl;
+
+    // Create a window
+    bardrix::window window("Raytracing", width, height);
+    if (publishing)
+        window.set_frame_ring(&published_frames);
 
-    window.on_paint = [&camera, &spheres, &lights](bardrix::window* window, std::vector<uint32_t>& buffer)
+    // Create a camera
+    bardrix::camera camera = bardrix::camera({0, 0, 0}, {0, 0, 1}, width, height, 60);
+
+    // Create the spheres and the lights
+    std::vector<sphere> spheres;
+    std::vector<bardrix::light> lights;
+    std::vector<area_light> area_lights;
+    make_scene(spheres, lights, area_lights);
+
+    // The threads aren't pinned, J compares the placements on this machine
+    const cpu_topology topology = detect_cpu_topology();
+    thread_pool pool;
+    renderer scene_renderer(camera, spheres, lights, area_lights, pool);
+    wavefront_renderer path_tracer(camera, spheres, lights, pool);
+    denoiser image_denoiser(pool);
+    accumulation_buffer accumulation;
+    bool path_tracing = false;
+    bool denoising = true;
+    bool accumulating = true;
+    bool animating = true;
+
+    // X records the frames to numbered PNG files, the renderer only waits for the disk when 8 frames are queued
+    sequence_writer recorder;
+
+    window.on_paint = [&](bardrix::window* window, std::vector<uint32_t>& buffer)
     {
-        // Draw the sphere
-        for (int y = 0; y < window->get_height(); y++)
-        {
-            for (int x = 0; x < window->get_width(); x++)
-            {
-                bardrix::ray ray = *camera.shoot_ray(x, y, 10);
-
-                bardrix::color color = bardrix::color::black();
-
-                for (sphere& s : spheres)
-                {
-                    auto intersection = s.intersection(ray);
-                    if (intersection.has_value())
-                    {
-                        bardrix::color tmpcolor = bardrix::color::black();
-                        for (bardrix::light& l : lights)
-                        {
-                            bool is_lightblocked = false;
-                            bardrix::ray shadow = {l.position, l.position.vector_to(intersection.value()) - bardrix::epsilon};
-                            for (sphere& s2 : spheres)
-                            {
-                                if (&s == &s2)
-                                    continue;
-                                
-                                auto intersectionshadow = s2.intersection(shadow);
-                                if (intersectionshadow.has_value())
-                                {
-                                    is_lightblocked = true;
-                                    break;
-                                }
-                            }
-                            if (!is_lightblocked)
-                            {
-                                double intensity = calculate_light_intensity(s, l, camera, intersection.value());
-                                tmpcolor += s.get_material().color.blended(l.color) * intensity;
-                            }
-                        }
-                        color = tmpcolor;
-                    }
-                }
-                // If the ray intersects the sphere, paint the pixel white
-
-                buffer[y * window->get_width() + x] = color.argb(); // ARGB is the format used by Windows API
+        const int width = window->get_width(), height = window->get_height();
+
+        // A static view adds a jittered sample every frame until it converges, any change starts over
+        uint64_t view = fingerprint::combine(fingerprint::of(camera), fingerprint::of(spheres));
+        view = fingerprint::combine(view, fingerprint::of(lights));
+        view = fingerprint::combine(view, fingerprint::of(area_lights));
+        view = fingerprint::combine(view, path_tracing);
+        view = fingerprint::combine(view, scene_renderer.settings.ambient_occlusion);
+        view = fingerprint::combine(view, scene_renderer.settings.cache_lighting);
+        view = fingerprint::combine(view, static_cast<uint64_t>(scene_renderer.settings.shadows));
+        view = fingerprint::combine(view, scene_renderer.settings.prioritize_tiles);
+        if (accumulating)
+            accumulation.prepare(width, height, view);
+
+        if (!accumulating || !accumulation.converged()) {
+            // The first sample goes through the pixel centers, so a changing view looks the same as without jitter
+            const uint32_t sample = accumulating ? accumulation.get_samples() : 0;
+            const double jitter_x = sample == 0 ? 0 : sampling::halton(sample, 2) - 0.5;
+            const double jitter_y = sample == 0 ? 0 : sampling::halton(sample, 3) - 0.5;
+
+            if (path_tracing) {
+                path_tracer.settings.jitter_x = jitter_x;
+                path_tracer.settings.jitter_y = jitter_y;
+                path_tracer.render(buffer, width, height);
+                if (accumulating)
+                    accumulation.add(path_tracer.get_radiance());
+            }
+            else {
+                scene_renderer.settings.jitter_x = jitter_x;
+                scene_renderer.settings.jitter_y = jitter_y;
+
+                // The tiles around the cursor are rendered first. A changing view only gets half a ray per pixel,
+                // the least important tiles are coarse until the view stands still and accumulates
+                int cursor_x, cursor_y;
+                if (!window->get_cursor(cursor_x, cursor_y))
+                    cursor_x = cursor_y = -1;
+                scene_renderer.settings.focus_x = cursor_x;
+                scene_renderer.settings.focus_y = cursor_y;
+                scene_renderer.settings.primary_ray_budget =
+                    sample == 0 ? static_cast<std::size_t>(width) * height / 2 : 0;
+                scene_renderer.render(buffer, width, height);
+                if (accumulating)
+                    accumulation.add(buffer);
             }
         }
-        //lights[0].position += 0.1;
-        lights[1].position.x += 0.01;
-        lights[1].position.y += 0.005;
-        lights[1].position.z -= 0.01;
-     //   lights[2].set_intensity(lights[2].get_intensity() + 0.01);
-        window->redraw();
+
+        if (accumulating)
+            accumulation.resolve(buffer);
+
+        // Filter the noise of the stochastic effects before the buffer is presented. The frame itself isn't measured,
+        // it's taken as noisy from how it was rendered: by the path tracer, or with area lights that haven't converged
+        // in the accumulation yet. Other frames are clean and the denoiser would only blur them
+        const bool noisy = path_tracing || (!area_lights.empty() && (!accumulating || !accumulation.converged()));
+        if (denoising && noisy)
+            image_denoiser.denoise(buffer, path_tracing ? path_tracer.get_guides() : scene_renderer.get_guides());
+
+        if (recorder.running())
+            recorder.submit(buffer, width, height);
+
+        if (animating)
+            animate_lights(lights);
+
+        // A converged image doesn't change anymore, so stop rendering until something happens
+        if (animating || !accumulating || !accumulation.converged())
+            window->redraw();
     };
 
-    window.on_keydown = [&camera](bardrix::window* window, WPARAM key)
+    window.on_keydown = [&camera, &spheres, &lights, &area_lights, &topology, &scene_renderer, &path_tracer,
+        &image_denoiser, &accumulation, &recorder, &path_tracing, &denoising, &accumulating,
+        &animating](bardrix::window* window, WPARAM key)
     {
         constexpr double movement_speed = 0.1; // In units
         constexpr double rotation_speed = 2; // In degrees
@@ -184,6 +376,184 @@ int main()
             camera.set_direction(
                 bardrix::quaternion::rotate_degrees(camera.get_direction(), {0, 1, 0}, rotation_speed));
             break;
+        case 0x42: // B
+            // Compare tracing the shadow rays of the last frame in pixel order and binned
+            std::cout << scene_renderer.compare_binning() << std::endl;
+            return;
+        case 0x48: // H
+            // Compare tracing the primary rays row by row with tracing them along a curve through every tile
+            std::cout << scene_renderer.compare_pixel_orders() << std::endl;
+            return;
+        case 0x45: // E
+        {
+            // Render the current view in deterministic mode on 1 thread and on every thread, the frames must match
+            const int width = window->get_width(), height = window->get_height();
+            thread_pool one_thread(1), all_threads;
+            renderer serial(camera, spheres, lights, area_lights, one_thread);
+            renderer parallel(camera, spheres, lights, area_lights, all_threads);
+            std::vector<uint32_t> serial_frame(static_cast<std::size_t>(width) * height);
+            std::vector<uint32_t> parallel_frame(serial_frame.size());
+            for (renderer* r : {&serial, &parallel}) {
+                r->settings = scene_renderer.settings;
+                r->settings.deterministic = true;
+            }
+            serial.render(serial_frame, width, height);
+            parallel.render(parallel_frame, width, height);
+
+            std::size_t different = 0;
+            for (std::size_t i = 0; i < serial_frame.size(); i++)
+                different += serial_frame[i] != parallel_frame[i];
+            std::cout << "Deterministic frame: 1 thread and " << all_threads.size() << " threads differ in "
+                      << different << " pixels" << std::endl;
+            return;
+        }
+        case 0x51: // Q
+        {
+            // Render the current view on worker processes of this program and compare it with rendering it here
+            render_coordinator coordinator;
+            if (!coordinator.listen("127.0.0.1:0"))
+                return;
+
+            char path[MAX_PATH];
+            GetModuleFileNameA(nullptr, path, MAX_PATH);
+            const unsigned int worker_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+            std::string command = "\"" + std::string(path) + "\" --farm-worker " + coordinator.get_address() + " " +
+                                  std::to_string(worker_threads);
+            std::vector<PROCESS_INFORMATION> workers;
+            for (int i = 0; i < 2; i++) {
+                STARTUPINFOA startup{};
+                startup.cb = sizeof(startup);
+                PROCESS_INFORMATION process{};
+                if (CreateProcessA(nullptr, command.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup,
+                                   &process))
+                    workers.push_back(process);
+            }
+
+            farm_frame frame;
+            frame.camera = camera;
+            frame.spheres = spheres;
+            frame.lights = lights;
+            frame.area_lights = area_lights;
+            frame.settings = scene_renderer.settings;
+            frame.width = window->get_width();
+            frame.height = window->get_height();
+            std::vector<std::vector<uint32_t>> images;
+            const bool rendered = coordinator.render({frame}, images);
+            std::cout << coordinator.get_stats() << std::endl;
+            coordinator.shutdown();
+            for (const PROCESS_INFORMATION& process : workers) {
+                WaitForSingleObject(process.hProcess, 5000);
+                CloseHandle(process.hProcess);
+                CloseHandle(process.hThread);
+            }
+            if (!rendered)
+                return;
+
+            // The workers render the scene they received, so the local frame renders it too
+            farm_frame local;
+            decode_frame(encode_frame(frame), local);
+            thread_pool local_pool;
+            renderer local_renderer(local.camera, local.spheres, local.lights, local.area_lights, local_pool);
+            local_renderer.settings = local.settings;
+            local_renderer.settings.deterministic = true;
+            std::vector<uint32_t> expected(images.front().size());
+            local_renderer.render(expected, local.width, local.height);
+
+            std::size_t different = 0;
+            for (std::size_t i = 0; i < expected.size(); i++)
+                different += expected[i] != images.front()[i];
+            std::cout << "Render farm frame differs from the local frame in " << different << " pixels" << std::endl;
+            return;
+        }
+        case 0x4A: // J
+            // Compare rendering a frame on one thread per physical core placed in different ways
+            std::cout << compare_thread_placements(topology, 0, 5, [&](thread_pool& placed_pool) {
+                renderer placed(camera, spheres, lights, area_lights, placed_pool);
+                placed.settings = scene_renderer.settings;
+                std::vector<uint32_t> frame(static_cast<std::size_t>(window->get_width()) * window->get_height());
+                placed.render(frame, window->get_width(), window->get_height());
+            }) << std::endl;
+            return;
+        case 0x4E: // N
+            scene_renderer.settings.bin_secondary_rays = !scene_renderer.settings.bin_secondary_rays;
+            break;
+        case 0x50: // P
+            path_tracing = !path_tracing;
+            break;
+        case 0x49: // I
+            // Print the kernel timings of the last path traced frame
+            std::cout << path_tracer.get_stats() << std::endl;
+            std::cout << "Denoiser: " << image_denoiser.get_last_milliseconds() << " ms" << std::endl;
+            std::cout << scene_renderer.get_occlusion_stats() << std::endl;
+            std::cout << scene_renderer.get_shadow_cache_stats() << std::endl;
+            std::cout << scene_renderer.get_lighting_cache_stats() << std::endl;
+            std::cout << scene_renderer.get_occluder_stats() << std::endl;
+            std::cout << scene_renderer.get_cube_map_stats() << std::endl;
+            std::cout << scene_renderer.get_shadow_batch_stats() << std::endl;
+            std::cout << scene_renderer.get_tile_culling_stats() << std::endl;
+            std::cout << scene_renderer.get_visibility_stats() << std::endl;
+            std::cout << scene_renderer.get_tile_schedule_stats() << std::endl;
+            std::cout << scene_renderer.get_load_balance_stats() << std::endl;
+            return;
+        case 0x46: // F
+            denoising = !denoising;
+            break;
+        case 0x47: // G
+            accumulating = !accumulating;
+            accumulation.reset();
+            break;
+        case 0x4C: // L
+            // Pausing the lights makes the view static, so it can accumulate
+            animating = !animating;
+            break;
+        case 0x4F: // O
+            scene_renderer.settings.ambient_occlusion = !scene_renderer.settings.ambient_occlusion;
+            break;
+        case 0x43: // C
+            // Compare the cached ambient + diffuse light with calculating it per pixel
+            scene_renderer.settings.cache_lighting = !scene_renderer.settings.cache_lighting;
+            break;
+        case 0x4D: // M
+            // Switch the shadows of the point lights between shadow rays and cube maps
+            scene_renderer.settings.shadows = scene_renderer.settings.shadows == shadow_technique::rays
+                                                  ? shadow_technique::cube_maps
+                                                  : shadow_technique::rays;
+            break;
+        case 0x54: // T
+            // Compare tracing the shadow rays in batches per light per tile with tracing them one by one
+            scene_renderer.settings.batch_shadow_rays = !scene_renderer.settings.batch_shadow_rays;
+            break;
+        case 0x56: // V
+            // Compare culling the spheres per screen tile with testing every primary ray against every sphere
+            scene_renderer.settings.cull_tiles = !scene_renderer.settings.cull_tiles;
+            break;
+        case 0x52: // R
+            // Switch the primary visibility between ray tracing and rasterizing the spheres
+            scene_renderer.settings.rasterize_primary = !scene_renderer.settings.rasterize_primary;
+            break;
+        case 0x59: // Y
+            // Compare rendering the tiles in priority order (coarse where it matters least) with rendering them all
+            scene_renderer.settings.prioritize_tiles = !scene_renderer.settings.prioritize_tiles;
+            break;
+        case 0x55: // U
+            // Compare work items balanced by the cost of the last frame with one item per tile
+            scene_renderer.settings.balance_load = !scene_renderer.settings.balance_load;
+            break;
+        case 0x58: // X
+            if (recorder.running()) {
+                recorder.finish();
+                std::cout << recorder.get_stats() << std::endl;
+            }
+            else if (recorder.start())
+                std::cout << "Recording to " << recorder.file_name(0) << ", ..." << std::endl;
+            else
+                std::cout << "Can't write to " << recorder.settings.directory << std::endl;
+            return;
+        case 0x4B: // K
+            std::cout << "Accumulated " << accumulation.get_samples() << " samples, last change "
+                      << accumulation.get_last_change() << (accumulation.converged() ? " (converged)" : "")
+                      << std::endl;
+            return;
         default:
             return;
         }
@@ -215,7 +585,21 @@ int main()
 
 #else // _WIN32
 
-int main() {
+int main(int argc, char* argv[]) {
+    // The render farm workers run anywhere, they don't need a window
+    const int worker_exit = run_farm_worker(argc, argv);
+    if (worker_exit >= 0)
+        return worker_exit;
+    const int watcher_exit = run_frame_watcher(argc, argv);
+    if (watcher_exit >= 0)
+        return watcher_exit;
+    const int server_exit = run_render_server(argc, argv);
+    if (server_exit >= 0)
+        return server_exit;
+    const int stream_exit = run_frame_stream(argc, argv);
+    if (stream_exit >= 0)
+        return stream_exit;
+
     std::cout << "This example is only available on Windows." << std::endl;
     return 0;
 }
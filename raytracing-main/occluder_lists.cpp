@@ -0,0 +1,137 @@
+//
+// occluder_lists.cpp
+//
+
+#include "occluder_lists.h"
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    /// \brief Gets the radius of a sphere around the light position that contains the whole surface of an area light
+    double bounding_radius(const area_light& a) {
+        if (a.get_shape() == area_light::area_shape::sphere)
+            return a.get_radius();
+
+        // The rectangle is centered on the light, its farthest points are the corners
+        return 0.5 * std::max((a.get_edge_u() + a.get_edge_v()).length(), (a.get_edge_u() - a.get_edge_v()).length());
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const occluder_stats& stats) {
+    os << "Occluder lists: " << stats.rebuilt_lists << " rebuilt (" << stats.changed_lights << " lights, "
+       << stats.changed_spheres << " spheres changed), " << stats.average_candidates << " candidates on average";
+    return os;
+}
+
+void occluder_lists::update(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights,
+                            const std::vector<area_light>& area_lights) {
+    stats_ = occluder_stats();
+
+    const std::size_t light_count = lights.size() + area_lights.size();
+    if (light_count != light_count_ || spheres.size() != sphere_count_) {
+        // Everything is different, all lights and spheres count as changed
+        light_count_ = light_count;
+        sphere_count_ = spheres.size();
+        lists_.assign(light_count_ * sphere_count_, {});
+        light_fingerprints_.assign(light_count_, 0);
+        sphere_fingerprints_.assign(sphere_count_, 0);
+        light_positions_.resize(light_count_);
+        light_radii_.resize(light_count_);
+    }
+
+    std::vector<uint8_t> light_changed(light_count_, 0), sphere_changed(sphere_count_, 0);
+    for (std::size_t l = 0; l < light_count_; l++) {
+        const uint64_t light = l < lights.size() ? fingerprint::of(lights[l])
+                                                 : fingerprint::of(area_lights[l - lights.size()]);
+        if (light == light_fingerprints_[l])
+            continue;
+
+        light_fingerprints_[l] = light;
+        light_positions_[l] = l < lights.size() ? lights[l].position : area_lights[l - lights.size()].light.position;
+        light_radii_[l] = l < lights.size() ? 0 : bounding_radius(area_lights[l - lights.size()]);
+        light_changed[l] = 1;
+        stats_.changed_lights++;
+    }
+
+    for (std::size_t s = 0; s < sphere_count_; s++) {
+        const uint64_t geometry = fingerprint::of_geometry(spheres[s]);
+        if (geometry != sphere_fingerprints_[s]) {
+            sphere_fingerprints_[s] = geometry;
+            sphere_changed[s] = 1;
+            stats_.changed_spheres++;
+        }
+    }
+
+    std::size_t candidates = 0;
+    for (std::size_t l = 0; l < light_count_; l++) {
+        for (std::size_t r = 0; r < sphere_count_; r++) {
+            std::vector<uint32_t>& list = lists_[l * sphere_count_ + r];
+
+            // The list of a changed light or receiver is rebuilt, the others only update the spheres that moved
+            if (light_changed[l] || sphere_changed[r])
+                rebuild(l, r, spheres);
+            else if (stats_.changed_spheres > 0) {
+                list.erase(std::remove_if(list.begin(), list.end(), [&](uint32_t o) { return sphere_changed[o]; }),
+                           list.end());
+                for (std::size_t o = 0; o < sphere_count_; o++) {
+                    if (sphere_changed[o] && o != r && can_occlude(l, spheres[r], spheres[o]))
+                        list.insert(std::lower_bound(list.begin(), list.end(), static_cast<uint32_t>(o)),
+                                    static_cast<uint32_t>(o));
+                }
+            }
+            candidates += list.size();
+        }
+    }
+
+    if (!lists_.empty())
+        stats_.average_candidates = static_cast<double>(candidates) / static_cast<double>(lists_.size());
+}
+
+const std::vector<uint32_t>& occluder_lists::candidates(std::size_t light, std::size_t receiver) const {
+    return lists_[light * sphere_count_ + receiver];
+}
+
+const occluder_stats& occluder_lists::get_stats() const { return stats_; }
+
+bool occluder_lists::can_occlude(std::size_t light, const sphere& receiver, const sphere& occluder) const {
+    const bardrix::point3& origin = light_positions_[light];
+    const double light_radius = light_radii_[light];
+
+    const bardrix::vector3 to_receiver = origin.vector_to(receiver.get_position());
+    const bardrix::vector3 to_occluder = origin.vector_to(occluder.get_position());
+    const double receiver_distance = to_receiver.length(), occluder_distance = to_occluder.length();
+
+    // A light inside (or touching) either sphere can be blocked by anything
+    if (receiver_distance <= receiver.get_radius() + light_radius ||
+        occluder_distance <= occluder.get_radius() + light_radius)
+        return true;
+
+    // The occluder has to start before the receiver ends
+    if (occluder_distance - occluder.get_radius() >= receiver_distance + receiver.get_radius() + light_radius)
+        return false;
+
+    if (light_radius > 0) {
+        // Capsule test: the distance from the occluder to the segment between the light and the receiver
+        const double t = std::clamp(to_occluder.dot(to_receiver) / (receiver_distance * receiver_distance), 0.0, 1.0);
+        const double distance = (to_receiver * t - to_occluder).length();
+        return distance <= occluder.get_radius() + std::max(light_radius, receiver.get_radius());
+    }
+
+    // Cone test: the angle to the occluder can't be more than the cone's half angle plus the occluder's angular radius
+    const double cone = std::asin(receiver.get_radius() / receiver_distance);
+    const double spread = std::asin(occluder.get_radius() / occluder_distance);
+    const double cosine = std::clamp(to_occluder.dot(to_receiver) / (occluder_distance * receiver_distance), -1.0, 1.0);
+    return std::acos(cosine) <= cone + spread;
+}
+
+void occluder_lists::rebuild(std::size_t light, std::size_t receiver, const std::vector<sphere>& spheres) {
+    std::vector<uint32_t>& list = lists_[light * sphere_count_ + receiver];
+    list.clear();
+    for (std::size_t o = 0; o < sphere_count_; o++) {
+        if (o != receiver && can_occlude(light, spheres[receiver], spheres[o]))
+            list.push_back(static_cast<uint32_t>(o));
+    }
+    stats_.rebuilt_lists++;
+}
@@ -0,0 +1,79 @@
+//
+// occluder_lists.h
+//
+
+#pragma once
+
+#include "area_light.h"
+#include "sphere.h"
+
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief How much of the occluder lists was rebuilt in the last frame and how long the lists are
+struct occluder_stats {
+    /// \brief The amount of (light, receiver) lists that were rebuilt from scratch
+    std::size_t rebuilt_lists = 0;
+
+    /// \brief The amount of lights and spheres that changed
+    std::size_t changed_lights = 0, changed_spheres = 0;
+
+    /// \brief The average amount of candidates per list, compared to testing every other sphere
+    double average_candidates = 0;
+};
+
+/// \brief Prints the stats of the occluder lists
+std::ostream& operator<<(std::ostream& os, const occluder_stats& stats);
+
+/// \brief For every light and every sphere that receives its light, the spheres that can possibly cast a shadow on it
+/// \details A shadow ray from a point light to a point on a receiver lies inside the cone from the light around the
+///          receiver, so only spheres that intersect that cone (and start before the receiver) are candidates. Area
+///          lights have an extent, for them the test is whether the sphere touches the capsule around the segment
+///          between the light and the receiver. Both tests are conservative, culling never changes a shadow. The
+///          lists are rebuilt incrementally: a light that changed rebuilds its row, a sphere that changed rebuilds
+///          its own lists and updates its membership in all others.
+class occluder_lists {
+protected:
+    /// \brief The amount of lights (point lights, then area lights) and spheres the lists are for
+    std::size_t light_count_ = 0, sphere_count_ = 0;
+
+    /// \brief The candidates of every (light, receiver), light after light
+    std::vector<std::vector<uint32_t>> lists_;
+
+    /// \brief The fingerprint of every light and every sphere's geometry the lists were built with
+    std::vector<uint64_t> light_fingerprints_, sphere_fingerprints_;
+
+    /// \brief The position and radius of every light, the radius bounds the surface of area lights (0 for points)
+    std::vector<bardrix::point3> light_positions_;
+    std::vector<double> light_radii_;
+
+    /// \brief The stats of the last update
+    occluder_stats stats_;
+
+public:
+    /// \brief Brings the lists up to date with the scene, only what changed is rebuilt
+    /// \param spheres The spheres in the scene
+    /// \param lights The point lights in the scene
+    /// \param area_lights The area lights in the scene, their index comes after the point lights
+    void update(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights,
+                const std::vector<area_light>& area_lights);
+
+    /// \brief Gets the spheres that can block a light from reaching a receiver
+    /// \param light The index of the light, area lights come after the point lights
+    /// \param receiver The index of the sphere the light falls on
+    /// \return The indices of the candidates, never the receiver itself
+    NODISCARD const std::vector<uint32_t>& candidates(std::size_t light, std::size_t receiver) const;
+
+    /// \brief Gets the stats of the last update
+    NODISCARD const occluder_stats& get_stats() const;
+
+protected:
+    /// \brief Checks if a sphere can block the light between a light and a receiver
+    NODISCARD bool can_occlude(std::size_t light, const sphere& receiver, const sphere& occluder) const;
+
+    /// \brief Rebuilds the list of a light and a receiver from scratch
+    void rebuild(std::size_t light, std::size_t receiver, const std::vector<sphere>& spheres);
+}; // class occluder_lists
@@ -0,0 +1,228 @@
+//
+// pixel_order.cpp
+//
+
+#include "pixel_order.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    /// \brief The size of a modelled cache: 16 lines of 64 bytes, only the data of the last few rays fits, like a
+    ///        first level cache that also holds everything else the frame touches
+    constexpr std::size_t model_cache_lines = 16;
+
+    /// \brief The size of a cache line in bytes
+    constexpr std::size_t cache_line_size = 64;
+
+    /// \brief The cache lines of the hit records and pixels are told apart by these tags in the upper bits
+    constexpr uint64_t hit_lines = 1ull << 60, pixel_lines = 2ull << 60;
+
+    /// \brief A fully associative cache that evicts the least recently used line
+    class lru_cache {
+        std::vector<uint64_t> lines_;
+        std::size_t misses_ = 0;
+
+    public:
+        /// \brief Touches a line, it becomes the most recently used line
+        void touch(uint64_t line) {
+            auto found = std::find(lines_.begin(), lines_.end(), line);
+            if (found == lines_.end()) {
+                misses_++;
+                if (lines_.size() == model_cache_lines)
+                    lines_.pop_back();
+                lines_.insert(lines_.begin(), line);
+            } else
+                std::rotate(lines_.begin(), found, found + 1);
+        }
+
+        NODISCARD std::size_t misses() const { return misses_; }
+    };
+
+    /// \brief Gets every pixel of the image in the order of a traversal, index = y * width + x
+    std::vector<uint32_t> frame_order(const tile_culling& tiles, int width, int height, bool tiled,
+                                      pixel_traversal traversal) {
+        std::vector<uint32_t> pixels;
+        pixels.reserve(static_cast<std::size_t>(width) * height);
+        if (!tiled) {
+            for (uint32_t pixel = 0; pixel < static_cast<uint32_t>(width * height); pixel++)
+                pixels.push_back(pixel);
+            return pixels;
+        }
+
+        std::vector<uint32_t> offsets;
+        const int tile_size = tiles.get_tile_size();
+        tile_traversal(tile_size, traversal, offsets);
+        for (int tile_y = 0; tile_y < tiles.get_tiles_y(); tile_y++) {
+            for (int tile_x = 0; tile_x < tiles.get_tiles_x(); tile_x++) {
+                for (const uint32_t offset : offsets) {
+                    const int x = tile_x * tile_size + static_cast<int>(offset & 0xFFFF);
+                    const int y = tile_y * tile_size + static_cast<int>(offset >> 16);
+                    if (x < width && y < height)
+                        pixels.push_back(static_cast<uint32_t>(y * width + x));
+                }
+            }
+        }
+        return pixels;
+    }
+
+    /// \brief Collects the spheres a pixel tests, the same as renderer::trace_primary_rays
+    void covering_spheres(const tile_culling& tiles, int x, int y, std::vector<uint32_t>& covering) {
+        const std::size_t tile = static_cast<std::size_t>(y / tiles.get_tile_size()) * tiles.get_tiles_x() +
+                                 static_cast<std::size_t>(x / tiles.get_tile_size());
+        covering.clear();
+        if (!tiles.covered(tile).contains(x, y))
+            return;
+
+        for (uint32_t index : tiles.candidates(tile)) {
+            if (tiles.sphere_bounds(index).contains(x, y))
+                covering.push_back(index);
+        }
+    }
+
+    /// \brief Traces the rays of the pixels in order, models the cache they touch and measures how long it takes
+    pixel_order_result trace_in_order(const ray_generator& generator, const std::vector<sphere>& spheres,
+                                      const tile_culling& tiles, int width, const std::vector<uint32_t>& pixels) {
+        pixel_order_result result;
+        std::vector<uint32_t> covering, previous_covering;
+        const sphere* previous_hit = nullptr;
+
+        // The model first, a ray reads the spheres it tests and writes its hit record and its pixel
+        lru_cache scene, frame;
+        std::size_t coherent = 0;
+        for (std::size_t i = 0; i < pixels.size(); i++) {
+            const int x = static_cast<int>(pixels[i] % width), y = static_cast<int>(pixels[i] / width);
+            covering_spheres(tiles, x, y, covering);
+            const hit_record hit = covering.empty() ? hit_record()
+                                                    : closest_hit(generator.shoot(x, y), spheres, covering);
+
+            for (uint32_t s : covering) {
+                for (std::size_t byte = 0; byte < sizeof(sphere); byte += cache_line_size)
+                    scene.touch((s * sizeof(sphere) + byte) / cache_line_size);
+            }
+            frame.touch(hit_lines | pixels[i] * sizeof(hit_record) / cache_line_size);
+            frame.touch(pixel_lines | pixels[i] * sizeof(uint32_t) / cache_line_size);
+
+            coherent += i > 0 && hit.shape == previous_hit && covering == previous_covering;
+            previous_hit = hit.shape;
+            std::swap(covering, previous_covering);
+        }
+        result.scene_misses = scene.misses();
+        result.frame_misses = frame.misses();
+        if (pixels.size() > 1)
+            result.coherence = static_cast<double>(coherent) / static_cast<double>(pixels.size() - 1);
+
+        // Then the timing, without the model. The hits are counted so the compiler can't optimize the trace away
+        const auto start = std::chrono::steady_clock::now();
+        for (const uint32_t pixel : pixels) {
+            const int x = static_cast<int>(pixel % width), y = static_cast<int>(pixel / width);
+            covering_spheres(tiles, x, y, covering);
+            if (!covering.empty())
+                result.hit_count += closest_hit(generator.shoot(x, y), spheres, covering).shape != nullptr;
+        }
+        result.trace_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+} // namespace
+
+uint32_t morton_index(uint32_t x, uint32_t y) {
+    // Spread the 16 bits of a coordinate over the even bits
+    auto spread = [](uint32_t v) {
+        v &= 0xFFFF;
+        v = (v | (v << 8)) & 0x00FF00FF;
+        v = (v | (v << 4)) & 0x0F0F0F0F;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | spread(y) << 1;
+}
+
+void hilbert_position(uint32_t side, uint32_t index, uint32_t& x, uint32_t& y) {
+    // Every level picks the quadrant from 2 bits of the index and rotates the quadrant so the curve stays connected
+    x = y = 0;
+    for (uint32_t s = 1; s < side; s *= 2) {
+        const uint32_t rx = 1 & (index / 2), ry = 1 & (index ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        index /= 4;
+    }
+}
+
+void tile_traversal(int tile_size, pixel_traversal traversal, std::vector<uint32_t>& offsets) {
+    const auto size = static_cast<uint32_t>(std::clamp(tile_size, 1, 4096));
+    offsets.clear();
+    offsets.reserve(static_cast<std::size_t>(size) * size);
+
+    if (traversal == pixel_traversal::rows) {
+        for (uint32_t y = 0; y < size; y++)
+            for (uint32_t x = 0; x < size; x++)
+                offsets.push_back(y << 16 | x);
+        return;
+    }
+
+    if (traversal == pixel_traversal::morton) {
+        // Sorting the positions by their index is simpler than decoding every index of the bigger square
+        for (uint32_t y = 0; y < size; y++)
+            for (uint32_t x = 0; x < size; x++)
+                offsets.push_back(y << 16 | x);
+        std::sort(offsets.begin(), offsets.end(), [](uint32_t a, uint32_t b) {
+            return morton_index(a & 0xFFFF, a >> 16) < morton_index(b & 0xFFFF, b >> 16);
+        });
+        return;
+    }
+
+    uint32_t side = 1;
+    while (side < size)
+        side *= 2;
+
+    for (uint32_t index = 0; index < side * side; index++) {
+        uint32_t x, y;
+        hilbert_position(side, index, x, y);
+        if (x < size && y < size)
+            offsets.push_back(y << 16 | x);
+    }
+}
+
+pixel_order_report compare_pixel_orders(const ray_generator& generator, const std::vector<sphere>& spheres,
+                                        const tile_culling& tiles, int width, int height) {
+    pixel_order_report report;
+    report.ray_count = static_cast<std::size_t>(width) * height;
+    report.cache_lines = model_cache_lines;
+
+    report.image_rows = trace_in_order(generator, spheres, tiles, width,
+                                       frame_order(tiles, width, height, false, pixel_traversal::rows));
+    report.tile_rows = trace_in_order(generator, spheres, tiles, width,
+                                      frame_order(tiles, width, height, true, pixel_traversal::rows));
+    report.morton = trace_in_order(generator, spheres, tiles, width,
+                                   frame_order(tiles, width, height, true, pixel_traversal::morton));
+    report.hilbert = trace_in_order(generator, spheres, tiles, width,
+                                    frame_order(tiles, width, height, true, pixel_traversal::hilbert));
+    return report;
+}
+
+std::ostream& operator<<(std::ostream& os, const pixel_order_report& report) {
+    auto line = [&](const char* name, const pixel_order_result& result) {
+        os << "\n  " << name << "coherence " << result.coherence * 100 << "%, " << result.scene_misses
+           << " scene + " << result.frame_misses << " frame cache misses, " << result.hit_count << " hits in "
+           << result.trace_ms << " ms";
+    };
+
+    os << "Primary rays: " << report.ray_count << ", cache models of " << report.cache_lines << " lines";
+    line("image rows:   ", report.image_rows);
+    line("tile rows:    ", report.tile_rows);
+    line("tile Morton:  ", report.morton);
+    line("tile Hilbert: ", report.hilbert);
+    if (report.hilbert.scene_misses > 0)
+        os << "\n  Hilbert tiles have " << static_cast<double>(report.image_rows.scene_misses) /
+                                            static_cast<double>(report.hilbert.scene_misses)
+           << "x fewer scene misses than image rows";
+    return os;
+}
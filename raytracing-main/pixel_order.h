@@ -0,0 +1,92 @@
+//
+// pixel_order.h
+//
+
+#pragma once
+
+#include "sphere.h"
+#include "tile_culling.h"
+#include "tracing.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief The order the pixels of a screen tile are traced in
+enum class pixel_traversal {
+    /// \brief Row by row, consecutive rows are a whole tile apart
+    rows,
+    /// \brief Along a Morton (Z-order) curve, every aligned 2^k x 2^k block is finished before the next one starts
+    morton,
+    /// \brief Along a Hilbert curve, like Morton but every pixel is next to the one before it
+    hilbert
+};
+
+/// \brief Interleaves the bits of a position, x in the even bits and y in the odd bits
+/// \param x The x position, at most 16 bits
+/// \param y The y position, at most 16 bits
+/// \return The index of the position on the Morton curve
+/// \example uint32_t index = morton_index(3, 5);
+NODISCARD uint32_t morton_index(uint32_t x, uint32_t y);
+
+/// \brief Gets the position of an index on the Hilbert curve through a square
+/// \param side The size of the square, a power of 2
+/// \param index The index on the curve [0, side * side)
+/// \param x The x position (output)
+/// \param y The y position (output)
+/// \example uint32_t x, y; hilbert_position(16, 42, x, y);
+void hilbert_position(uint32_t side, uint32_t index, uint32_t& x, uint32_t& y);
+
+/// \brief Builds the order the pixels of a tile are traced in
+/// \details The curves only fill squares with a power of 2 as size, a tile of another size takes the curve of the
+///          next power of 2 and skips the pixels outside the tile. The tiles at the right and bottom edge of the image
+///          may be smaller, they skip the pixels outside the image in the same way.
+/// \param tile_size The size of a tile in pixels, at most 4096
+/// \param traversal The order
+/// \param offsets The position of every pixel in the tile, x in the low 16 bits and y in the high 16 bits (output)
+/// \example tile_traversal(16, pixel_traversal::hilbert, offsets);
+void tile_traversal(int tile_size, pixel_traversal traversal, std::vector<uint32_t>& offsets);
+
+/// \brief Coherence, modelled cache misses and timing of tracing the primary rays of a frame in one pixel order
+struct pixel_order_result {
+    /// \brief The fraction of consecutive rays that test the same spheres and hit the same sphere [0, 1]
+    double coherence = 0;
+
+    /// \brief The amount of sphere cache lines the rays read that weren't in a small LRU cache of the lines the rays
+    ///        before read, the scene data is what consecutive rays can share
+    std::size_t scene_misses = 0;
+
+    /// \brief The same for the hit records and pixels the rays write, in a cache of its own. Every pixel is written
+    ///        once, so these only miss more often when an order leaves a cache line before it's filled
+    std::size_t frame_misses = 0;
+
+    /// \brief The amount of rays that hit a sphere
+    std::size_t hit_count = 0;
+
+    /// \brief Milliseconds it took to trace the rays
+    double trace_ms = 0;
+};
+
+/// \brief A microbenchmark of the pixel orders: the rays of a frame are traced row by row over the whole image (the
+///        order without tiles) and tile by tile in every traversal
+struct pixel_order_report {
+    /// \brief The amount of primary rays in the frame and the amount of cache lines both cache models hold
+    std::size_t ray_count = 0, cache_lines = 0;
+
+    /// \brief The results of the image rows and of the rows, Morton and Hilbert traversal of the tiles
+    pixel_order_result image_rows, tile_rows, morton, hilbert;
+};
+
+/// \brief Traces the primary rays of a frame in every pixel order and reports the difference
+/// \param generator The generator of the primary rays
+/// \param spheres The spheres in the scene
+/// \param tiles The culled tiles of the frame, the rays only test the candidates of their tile
+/// \param width The width of the frame
+/// \param height The height of the frame
+/// \return The report with the coherence, cache misses and timing of every order
+/// \example std::cout << compare_pixel_orders(generator, spheres, tiles, width, height) << std::endl;
+NODISCARD pixel_order_report compare_pixel_orders(const ray_generator& generator, const std::vector<sphere>& spheres,
+                                                  const tile_culling& tiles, int width, int height);
+
+/// \brief Writes a pixel order report in a human readable format
+std::ostream& operator<<(std::ostream& os, const pixel_order_report& report);
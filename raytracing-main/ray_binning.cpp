@@ -0,0 +1,123 @@
+//
+// ray_binning.cpp
+//
+
+#include "ray_binning.h"
+#include "tracing.h"
+
+#include <chrono>
+#include <cmath>
+
+namespace {
+    /// \brief The amount of bits the hashed origin cell uses, 2^12 cells * 8 octants = 32768 bins
+    constexpr unsigned int origin_cell_bits = 12;
+
+    /// \brief Traces the rays in the given order and counts how many are blocked
+    /// \return The amount of blocked rays, it's returned so the compiler can't optimize the trace away
+    std::size_t trace_in_order(const std::vector<secondary_ray>& rays, const std::vector<uint32_t>& order,
+                               const std::vector<sphere>& spheres) {
+        std::size_t blocked = 0;
+        for (std::size_t i = 0; i < rays.size(); i++) {
+            const secondary_ray& r = rays[order.empty() ? i : order[i]];
+            blocked += is_occluded(r.ray, spheres, r.shape);
+        }
+        return blocked;
+    }
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace
+
+double ray_binning_report::mrays_per_second(double ms) const {
+    return ms > 0 ? static_cast<double>(ray_count) / (ms * 1000.0) : 0;
+}
+
+uint32_t ray_bin_key(const bardrix::ray& ray, double cell_size, unsigned int cell_bits) {
+    const bardrix::vector3& direction = ray.get_direction();
+    const uint32_t octant = (direction.x < 0 ? 1u : 0u) | (direction.y < 0 ? 2u : 0u) | (direction.z < 0 ? 4u : 0u);
+
+    // Quantize the origin and hash the cell (the primes are the ones commonly used for spatial hashing)
+    const auto cx = static_cast<int64_t>(std::floor(ray.position.x / cell_size));
+    const auto cy = static_cast<int64_t>(std::floor(ray.position.y / cell_size));
+    const auto cz = static_cast<int64_t>(std::floor(ray.position.z / cell_size));
+    const auto hash = static_cast<uint32_t>((cx * 73856093) ^ (cy * 19349663) ^ (cz * 83492791));
+
+    const uint32_t cell = hash & ((1u << cell_bits) - 1);
+    return cell << 3 | octant;
+}
+
+void bin_rays(const std::vector<secondary_ray>& rays, double cell_size, std::vector<uint32_t>& order) {
+    constexpr uint32_t bin_count = 1u << (origin_cell_bits + 3);
+
+    std::vector<uint32_t> keys(rays.size());
+    std::vector<uint32_t> offsets(bin_count + 1, 0);
+
+    // Histogram of the bins
+    for (std::size_t i = 0; i < rays.size(); i++) {
+        keys[i] = ray_bin_key(rays[i].ray, cell_size, origin_cell_bits);
+        offsets[keys[i] + 1]++;
+    }
+
+    // Prefix sum turns the histogram into the start of every bin
+    for (uint32_t bin = 0; bin < bin_count; bin++)
+        offsets[bin + 1] += offsets[bin];
+
+    order.resize(rays.size());
+    for (std::size_t i = 0; i < rays.size(); i++)
+        order[offsets[keys[i]]++] = static_cast<uint32_t>(i);
+}
+
+double ray_coherence(const std::vector<secondary_ray>& rays, const std::vector<uint32_t>& order, double cell_size) {
+    if (rays.size() < 2)
+        return 1;
+
+    std::size_t shared = 0;
+    uint32_t previous = ray_bin_key(rays[order.empty() ? 0 : order[0]].ray, cell_size, origin_cell_bits);
+    for (std::size_t i = 1; i < rays.size(); i++) {
+        const uint32_t key = ray_bin_key(rays[order.empty() ? i : order[i]].ray, cell_size, origin_cell_bits);
+        shared += key == previous;
+        previous = key;
+    }
+
+    return static_cast<double>(shared) / static_cast<double>(rays.size() - 1);
+}
+
+ray_binning_report compare_ray_binning(const std::vector<secondary_ray>& rays, const std::vector<sphere>& spheres,
+                                       double cell_size) {
+    ray_binning_report report;
+    report.ray_count = rays.size();
+
+    const std::vector<uint32_t> pixel_order;
+    std::vector<uint32_t> binned_order;
+
+    auto start = std::chrono::steady_clock::now();
+    report.blocked_count = trace_in_order(rays, pixel_order, spheres);
+    report.pixel_order_ms = milliseconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    bin_rays(rays, cell_size, binned_order);
+    report.binning_ms = milliseconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    report.blocked_count = trace_in_order(rays, binned_order, spheres);
+    report.binned_ms = milliseconds_since(start);
+
+    report.pixel_order_coherence = ray_coherence(rays, pixel_order, cell_size);
+    report.binned_coherence = ray_coherence(rays, binned_order, cell_size);
+
+    return report;
+}
+
+std::ostream& operator<<(std::ostream& os, const ray_binning_report& report) {
+    os << "Secondary rays: " << report.ray_count << " (" << report.blocked_count << " blocked)\n"
+       << "  pixel order: coherence " << report.pixel_order_coherence * 100 << "%, "
+       << report.pixel_order_ms << " ms (" << report.mrays_per_second(report.pixel_order_ms) << " Mrays/s)\n"
+       << "  binned:      coherence " << report.binned_coherence * 100 << "%, "
+       << report.binned_ms << " ms + " << report.binning_ms << " ms binning ("
+       << report.mrays_per_second(report.binned_ms + report.binning_ms) << " Mrays/s)\n"
+       << "  coherence gain: " << (report.binned_coherence - report.pixel_order_coherence) * 100 << "%, speedup: "
+       << (report.binned_ms + report.binning_ms > 0
+           ? report.pixel_order_ms / (report.binned_ms + report.binning_ms) : 0) << "x";
+    return os;
+}
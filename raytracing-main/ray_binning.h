@@ -0,0 +1,91 @@
+//
+// ray_binning.h
+//
+
+#pragma once
+
+#include "sphere.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief A ray that is spawned from a primary hit, e.g. a shadow ray between a light and a surface point
+struct secondary_ray {
+    /// \brief The ray itself
+    bardrix::ray ray;
+
+    /// \brief The index of the pixel the ray contributes to
+    uint32_t pixel;
+
+    /// \brief The index of the light the ray belongs to
+    uint32_t light;
+
+    /// \brief The sphere the ray belongs to, it's skipped when tracing (nullptr to test all spheres)
+    const sphere* shape;
+};
+
+/// \brief Timings and coherence of tracing the same secondary rays in pixel order and in binned order
+struct ray_binning_report {
+    /// \brief The amount of rays that were traced
+    std::size_t ray_count = 0;
+
+    /// \brief The amount of rays that were blocked by a sphere
+    std::size_t blocked_count = 0;
+
+    /// \brief The fraction of consecutive rays that fall in the same bin when traced in pixel order [0, 1]
+    double pixel_order_coherence = 0;
+
+    /// \brief The fraction of consecutive rays that fall in the same bin when traced in binned order [0, 1]
+    double binned_coherence = 0;
+
+    /// \brief Milliseconds it took to trace the rays in pixel order
+    double pixel_order_ms = 0;
+
+    /// \brief Milliseconds it took to bin the rays
+    double binning_ms = 0;
+
+    /// \brief Milliseconds it took to trace the rays in binned order (without binning)
+    double binned_ms = 0;
+
+    /// \brief Gets the throughput of a trace
+    /// \param ms The milliseconds the trace took
+    /// \return Millions of rays per second
+    NODISCARD double mrays_per_second(double ms) const;
+};
+
+/// \brief Computes the bin of a ray, the origin cell is hashed into the upper bits and the direction octant
+///        is stored in the lowest 3 bits
+/// \param ray The ray to compute the bin of
+/// \param cell_size The size of an origin cell in world units
+/// \param cell_bits The amount of bits the hashed origin cell may use
+/// \return The bin of the ray in the range [0, 2^(cell_bits + 3))
+/// \example uint32_t bin = ray_bin_key(ray, 1.0, 12);
+NODISCARD uint32_t ray_bin_key(const bardrix::ray& ray, double cell_size, unsigned int cell_bits);
+
+/// \brief Sorts rays by their bin using a counting sort, the sort is stable so rays keep their pixel order within a bin
+/// \param rays The rays to bin
+/// \param cell_size The size of an origin cell in world units
+/// \param order The indices of rays in binned order (output)
+/// \example bin_rays(rays, 1.0, order); for (uint32_t i : order) { trace(rays[i]); }
+void bin_rays(const std::vector<secondary_ray>& rays, double cell_size, std::vector<uint32_t>& order);
+
+/// \brief Calculates the coherence of a ray order, which is the fraction of consecutive rays that share a bin
+/// \param rays The rays
+/// \param order The order the rays are traced in, an empty order means pixel order
+/// \param cell_size The size of an origin cell in world units
+/// \return The coherence [0, 1], 1 means every ray shares the bin of the ray before it
+NODISCARD double ray_coherence(const std::vector<secondary_ray>& rays, const std::vector<uint32_t>& order,
+                               double cell_size);
+
+/// \brief Traces the rays in pixel order and in binned order and reports the difference
+/// \param rays The rays to trace
+/// \param spheres The spheres that can block the rays
+/// \param cell_size The size of an origin cell in world units
+/// \return The report with coherence and timings of both orders
+/// \example std::cout << compare_ray_binning(rays, spheres, 1.0) << std::endl;
+NODISCARD ray_binning_report compare_ray_binning(const std::vector<secondary_ray>& rays,
+                                                 const std::vector<sphere>& spheres, double cell_size);
+
+/// \brief Writes a ray binning report in a human readable format
+std::ostream& operator<<(std::ostream& os, const ray_binning_report& report);
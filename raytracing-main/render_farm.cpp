@@ -0,0 +1,542 @@
+//
+// render_farm.cpp
+//
+
+#include "render_farm.h"
+#include "wire_format.h"
+
+#include <algorithm>
+
+namespace {
+    /// \brief The messages between the coordinator and the workers
+    enum class farm_message : uint32_t {
+        /// \brief Coordinator to worker: a scene id followed by an encoded frame
+        scene = 1,
+        /// \brief Coordinator to worker: a task id, the scene id and the region of the tile
+        task = 2,
+        /// \brief Coordinator to worker: a task id, the task was taken away
+        cancel = 3,
+        /// \brief Coordinator to worker: stop working
+        quit = 4,
+        /// \brief Worker to coordinator: a task id followed by the pixels of its tile, row by row
+        result = 5
+    };
+
+    /// \brief The largest frame the workers accept, so a broken coordinator can't make them allocate anything
+    constexpr int max_frame_size = 16384;
+
+    /// \brief How long the coordinator waits for a message before it checks for new workers and timeouts
+    constexpr int poll_ms = 10;
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void add_rect(message_writer& writer, const pixel_rect& rect) {
+        writer.add(rect.left);
+        writer.add(rect.top);
+        writer.add(rect.right);
+        writer.add(rect.bottom);
+    }
+
+    pixel_rect read_rect(message_reader& reader) {
+        pixel_rect rect;
+        rect.left = reader.read_int();
+        rect.top = reader.read_int();
+        rect.right = reader.read_int();
+        rect.bottom = reader.read_int();
+        return rect;
+    }
+
+    void add_settings(message_writer& writer, const render_settings& s) {
+        writer.add(s.bin_secondary_rays);
+        writer.add(s.bin_cell_size);
+        writer.add(s.max_depth);
+        writer.add(s.min_contribution);
+        writer.add(static_cast<uint64_t>(s.secondary_ray_budget), 8);
+        writer.add(s.area_light_samples);
+        writer.add(static_cast<double>(s.area_light_blend));
+        writer.add(s.jitter_x);
+        writer.add(s.jitter_y);
+        writer.add(s.ambient_occlusion);
+        writer.add(s.cache_shadows);
+        writer.add(s.cache_lighting);
+        writer.add(s.cull_occluders);
+        writer.add(static_cast<uint32_t>(s.shadows));
+        writer.add(s.batch_shadow_rays);
+        writer.add(s.shadow_tile_size);
+        writer.add(s.cull_tiles);
+        writer.add(s.primary_tile_size);
+        writer.add(static_cast<uint32_t>(s.pixel_order));
+        writer.add(s.rasterize_primary);
+        writer.add(s.balance_load);
+        writer.add(s.prioritize_tiles);
+        writer.add(s.focus_x);
+        writer.add(s.focus_y);
+        writer.add(static_cast<uint64_t>(s.primary_ray_budget), 8);
+        writer.add(s.coarse_step);
+        writer.add(s.deterministic);
+        writer.add(s.frame_number);
+    }
+
+    render_settings read_settings(message_reader& reader) {
+        render_settings s;
+        s.bin_secondary_rays = reader.read_bool();
+        s.bin_cell_size = reader.read_double();
+        s.max_depth = reader.read_int();
+        s.min_contribution = reader.read_double();
+        s.secondary_ray_budget = static_cast<std::size_t>(reader.read(8));
+        s.area_light_samples = std::clamp(reader.read_int(), 0, 255);
+        s.area_light_blend = static_cast<float>(reader.read_double());
+        s.jitter_x = reader.read_double();
+        s.jitter_y = reader.read_double();
+        s.ambient_occlusion = reader.read_bool();
+        s.cache_shadows = reader.read_bool();
+        s.cache_lighting = reader.read_bool();
+        s.cull_occluders = reader.read_bool();
+        s.shadows = reader.read_u32() == static_cast<uint32_t>(shadow_technique::cube_maps)
+                        ? shadow_technique::cube_maps
+                        : shadow_technique::rays;
+        s.batch_shadow_rays = reader.read_bool();
+        s.shadow_tile_size = reader.read_int();
+        s.cull_tiles = reader.read_bool();
+        s.primary_tile_size = reader.read_int();
+        s.pixel_order = static_cast<pixel_traversal>(std::min<uint32_t>(reader.read_u32(), 2));
+        s.rasterize_primary = reader.read_bool();
+        s.balance_load = reader.read_bool();
+        s.prioritize_tiles = reader.read_bool();
+        s.focus_x = reader.read_double();
+        s.focus_y = reader.read_double();
+        s.primary_ray_budget = static_cast<std::size_t>(reader.read(8));
+        s.coarse_step = reader.read_int();
+        s.deterministic = reader.read_bool();
+        s.frame_number = reader.read_u32();
+        return s;
+    }
+
+    /// \brief Gets the amount of pixels in a region
+    std::size_t region_size(const pixel_rect& region) {
+        return region.empty() ? 0
+                              : static_cast<std::size_t>(region.right - region.left + 1) *
+                                    (region.bottom - region.top + 1);
+    }
+} // namespace
+
+std::vector<uint8_t> encode_frame(const farm_frame& frame) {
+    message_writer writer;
+    writer.add(frame.width);
+    writer.add(frame.height);
+
+    writer.add(frame.camera.position);
+    writer.add(frame.camera.get_direction());
+    writer.add(frame.camera.get_width());
+    writer.add(frame.camera.get_height());
+    writer.add(frame.camera.get_fov());
+
+    writer.add(static_cast<uint32_t>(frame.spheres.size()));
+    for (const sphere& s : frame.spheres) {
+        const bardrix::material& material = s.get_material();
+        writer.add(s.get_radius());
+        writer.add(s.get_position());
+        writer.add(material.get_ambient());
+        writer.add(material.get_diffuse());
+        writer.add(material.get_specular());
+        writer.add(material.get_shininess());
+        writer.add(material.color);
+        writer.add(s.get_optics().reflectivity);
+        writer.add(s.get_optics().transparency);
+        writer.add(s.get_optics().refractive_index);
+    }
+
+    writer.add(static_cast<uint32_t>(frame.lights.size()));
+    for (const bardrix::light& light : frame.lights)
+        writer.add(light);
+
+    writer.add(static_cast<uint32_t>(frame.area_lights.size()));
+    for (const area_light& a : frame.area_lights) {
+        writer.add(a.light);
+        writer.add(static_cast<uint32_t>(a.get_shape()));
+        writer.add(a.get_radius());
+        writer.add(a.get_edge_u());
+        writer.add(a.get_edge_v());
+    }
+
+    add_settings(writer, frame.settings);
+    return std::move(writer.bytes());
+}
+
+bool decode_frame(const std::vector<uint8_t>& bytes, farm_frame& frame) {
+    message_reader reader(bytes);
+    farm_frame decoded;
+    decoded.width = reader.read_int();
+    decoded.height = reader.read_int();
+    if (decoded.width <= 0 || decoded.height <= 0 || decoded.width > max_frame_size ||
+        decoded.height > max_frame_size)
+        return false;
+
+    const bardrix::point3 position = reader.read_point();
+    const bardrix::vector3 direction = reader.read_vector();
+    const int camera_width = reader.read_int(), camera_height = reader.read_int();
+    decoded.camera = bardrix::camera(position, direction, camera_width, camera_height, reader.read_double());
+
+    // The smallest encoding of a sphere, light and area light, only used to reject counts that can't be right
+    const std::size_t sphere_count = reader.read_count(8 * 11 + 4);
+    for (std::size_t i = 0; i < sphere_count; i++) {
+        const double radius = reader.read_double();
+        const bardrix::point3 center = reader.read_point();
+        const double ambient = reader.read_double(), diffuse = reader.read_double();
+        const double specular = reader.read_double(), shininess = reader.read_double();
+        sphere s(radius, center, bardrix::material(ambient, diffuse, specular, shininess, reader.read_color()));
+        optics o;
+        o.reflectivity = reader.read_double();
+        o.transparency = reader.read_double();
+        o.refractive_index = reader.read_double();
+        s.set_optics(o);
+        decoded.spheres.push_back(s);
+    }
+
+    const std::size_t light_count = reader.read_count(8 * 4 + 4);
+    for (std::size_t i = 0; i < light_count; i++)
+        decoded.lights.push_back(reader.read_light());
+
+    const std::size_t area_light_count = reader.read_count(8 * 11 + 8);
+    for (std::size_t i = 0; i < area_light_count; i++) {
+        const bardrix::light light = reader.read_light();
+        const bool rectangle = reader.read_u32() == static_cast<uint32_t>(area_light::area_shape::rectangle);
+        const double radius = reader.read_double();
+        const bardrix::vector3 edge_u = reader.read_vector(), edge_v = reader.read_vector();
+        decoded.area_lights.push_back(rectangle ? area_light(light, edge_u, edge_v) : area_light(light, radius));
+    }
+
+    decoded.settings = read_settings(reader);
+    if (!reader.ok())
+        return false;
+
+    frame = std::move(decoded);
+    return true;
+}
+
+std::ostream& operator<<(std::ostream& os, const farm_stats& stats) {
+    os << "Render farm: " << stats.frames << " frames in " << stats.tasks << " tiles on " << stats.workers
+       << " workers (" << stats.lost_workers << " lost), " << stats.retried << " tiles retried, " << stats.stolen
+       << " stolen, " << stats.duplicates << " duplicate results in " << stats.render_ms << " ms";
+    return os;
+}
+
+render_coordinator::~render_coordinator() { shutdown(); }
+
+bool render_coordinator::listen(const std::string& address) { return listener_.listen(address); }
+
+const std::string& render_coordinator::get_address() const { return listener_.address(); }
+
+std::size_t render_coordinator::get_worker_count() const { return workers_.size(); }
+
+bool render_coordinator::render(const std::vector<farm_frame>& frames,
+                                std::vector<std::vector<uint32_t>>& images) {
+    const auto start = std::chrono::steady_clock::now();
+    stats_ = farm_stats();
+    stats_.frames = frames.size();
+
+    // The scenes are encoded once, every worker gets the scene of a task before its first task of that frame
+    std::vector<std::vector<uint8_t>> scenes;
+    std::vector<task> tasks;
+    images.resize(frames.size());
+    const int tile_size = std::max(1, settings.tile_size);
+    for (std::size_t f = 0; f < frames.size(); f++) {
+        farm_frame frame = frames[f];
+        frame.settings.deterministic = true;
+        message_writer scene;
+        scene.add(first_scene_ + static_cast<uint32_t>(f));
+        std::vector<uint8_t> encoded = encode_frame(frame);
+        scene.bytes().insert(scene.bytes().end(), encoded.begin(), encoded.end());
+        scenes.push_back(std::move(scene.bytes()));
+        images[f].assign(static_cast<std::size_t>(std::max(0, frame.width)) * std::max(0, frame.height), 0);
+
+        for (int y = 0; y < frame.height; y += tile_size) {
+            for (int x = 0; x < frame.width; x += tile_size) {
+                task t;
+                t.frame = static_cast<uint32_t>(f);
+                t.region = {x, y, std::min(x + tile_size, frame.width) - 1, std::min(y + tile_size, frame.height) - 1};
+                tasks.push_back(t);
+            }
+        }
+    }
+    stats_.tasks = tasks.size();
+
+    // Tasks of an earlier render that are still queued on a worker are dropped there
+    for (connection& worker : workers_) {
+        for (const uint32_t id : worker.tasks) {
+            message_writer cancel;
+            cancel.add(id);
+            worker.stream.send_message(static_cast<uint32_t>(farm_message::cancel), cancel.bytes());
+        }
+        worker.tasks.clear();
+    }
+
+    std::vector<uint32_t> pending(tasks.size());
+    for (std::size_t i = 0; i < tasks.size(); i++)
+        pending[i] = static_cast<uint32_t>(tasks.size() - 1 - i);
+
+    std::size_t done = 0;
+    std::vector<bool> took_part;
+    auto without_workers = std::chrono::steady_clock::now();
+    while (done < tasks.size()) {
+        accept_workers();
+        took_part.resize(std::max(took_part.size(), workers_.size()), false);
+        if (workers_.empty()) {
+            if (milliseconds_since(without_workers) > settings.worker_wait_ms)
+                break;
+        } else
+            without_workers = std::chrono::steady_clock::now();
+
+        // A worker that can't be reached is lost, its tasks are handed out again
+        for (std::size_t w = 0; w < workers_.size(); w++) {
+            if (workers_[w].stream.valid())
+                dispatch(workers_[w], tasks, pending, scenes);
+        }
+
+        std::vector<const socket_stream*> streams;
+        for (const connection& worker : workers_)
+            streams.push_back(&worker.stream);
+        for (const std::size_t w : wait_readable(streams, poll_ms)) {
+            connection& worker = workers_[w];
+            uint32_t type;
+            std::vector<uint8_t> payload;
+            if (!worker.stream.receive_message(type, payload) ||
+                type != static_cast<uint32_t>(farm_message::result)) {
+                worker.stream.close();
+                continue;
+            }
+
+            message_reader reader(payload);
+            const uint32_t id = reader.read_u32();
+            worker.tasks.erase(std::remove(worker.tasks.begin(), worker.tasks.end(), id), worker.tasks.end());
+            took_part[w] = true;
+
+            // Results of an earlier render, or of a task another worker finished first, are dropped
+            const uint32_t index = id - first_task_;
+            if (!reader.ok() || index >= tasks.size() || tasks[index].done) {
+                stats_.duplicates++;
+                continue;
+            }
+
+            task& t = tasks[index];
+            const std::size_t pixels = region_size(t.region);
+            if (payload.size() != reader.position() + pixels * 4) {
+                worker.stream.close();
+                continue;
+            }
+
+            const int width = frames[t.frame].width;
+            for (int y = t.region.top; y <= t.region.bottom; y++)
+                for (int x = t.region.left; x <= t.region.right; x++)
+                    images[t.frame][static_cast<std::size_t>(y) * width + x] = reader.read_u32();
+            t.done = true;
+            done++;
+        }
+
+        // Lost workers
+        for (std::size_t w = 0; w < workers_.size();) {
+            if (workers_[w].stream.valid()) {
+                w++;
+                continue;
+            }
+            for (const uint32_t id : workers_[w].tasks) {
+                const uint32_t index = id - first_task_;
+                if (index < tasks.size() && !tasks[index].done) {
+                    pending.push_back(index);
+                    stats_.retried++;
+                }
+            }
+            stats_.lost_workers++;
+            stats_.workers += took_part[w];
+            workers_.erase(workers_.begin() + static_cast<std::ptrdiff_t>(w));
+            took_part.erase(took_part.begin() + static_cast<std::ptrdiff_t>(w));
+        }
+
+        // Tasks that take too long are handed out again, the worker that has them may still finish first
+        for (connection& worker : workers_) {
+            for (const uint32_t id : worker.tasks) {
+                task& t = tasks[id - first_task_];
+                if (!t.done && milliseconds_since(t.sent) > settings.task_timeout_ms) {
+                    t.sent = std::chrono::steady_clock::now();
+                    pending.push_back(id - first_task_);
+                    stats_.retried++;
+                }
+            }
+        }
+    }
+
+    for (std::size_t w = 0; w < workers_.size(); w++)
+        stats_.workers += took_part[w];
+    first_task_ += static_cast<uint32_t>(tasks.size());
+    first_scene_ += static_cast<uint32_t>(frames.size());
+    stats_.render_ms = milliseconds_since(start);
+    return done == tasks.size();
+}
+
+void render_coordinator::shutdown() {
+    for (connection& worker : workers_)
+        worker.stream.send_message(static_cast<uint32_t>(farm_message::quit), {});
+    workers_.clear();
+}
+
+const farm_stats& render_coordinator::get_stats() const { return stats_; }
+
+void render_coordinator::accept_workers() {
+    for (socket_stream stream = listener_.accept(0); stream.valid(); stream = listener_.accept(0)) {
+        connection worker;
+        worker.stream = std::move(stream);
+        workers_.push_back(std::move(worker));
+    }
+}
+
+bool render_coordinator::dispatch(connection& worker, std::vector<task>& tasks, std::vector<uint32_t>& pending,
+                                  const std::vector<std::vector<uint8_t>>& scenes) {
+    while (worker.tasks.size() < std::max<std::size_t>(1, settings.tasks_per_worker)) {
+        // The next task that isn't done and that the worker doesn't have already (a retried task may be its own)
+        uint32_t id = 0;
+        bool found = false;
+        while (!found && !pending.empty()) {
+            const uint32_t index = pending.back();
+            pending.pop_back();
+            id = first_task_ + index;
+            found = !tasks[index].done &&
+                    std::find(worker.tasks.begin(), worker.tasks.end(), id) == worker.tasks.end();
+        }
+
+        if (!found && (!settings.steal || !worker.tasks.empty() || !steal(worker, id)))
+            return true;
+
+        task& t = tasks[id - first_task_];
+        const uint32_t scene = first_scene_ + t.frame;
+        if (!worker.has_scene || worker.scene != scene) {
+            if (!worker.stream.send_message(static_cast<uint32_t>(farm_message::scene), scenes[t.frame]))
+                return false;
+            worker.scene = scene;
+            worker.has_scene = true;
+        }
+
+        message_writer message;
+        message.add(id);
+        message.add(scene);
+        add_rect(message, t.region);
+        if (!worker.stream.send_message(static_cast<uint32_t>(farm_message::task), message.bytes()))
+            return false;
+
+        // The task is lost with the worker if the send fails, the worker's tasks are handed out again then
+        worker.tasks.push_back(id);
+        t.sent = std::chrono::steady_clock::now();
+    }
+    return true;
+}
+
+bool render_coordinator::steal(const connection& thief, uint32_t& id) {
+    connection* victim = nullptr;
+    for (connection& worker : workers_) {
+        if (&worker != &thief && worker.stream.valid() && worker.tasks.size() > 1 &&
+            (victim == nullptr || worker.tasks.size() > victim->tasks.size()))
+            victim = &worker;
+    }
+    if (victim == nullptr)
+        return false;
+
+    // The victim drops the task if it hasn't started it, if it has, the first result wins
+    id = victim->tasks.back();
+    victim->tasks.pop_back();
+    message_writer cancel;
+    cancel.add(id);
+    victim->stream.send_message(static_cast<uint32_t>(farm_message::cancel), cancel.bytes());
+    stats_.stolen++;
+    return true;
+}
+
+render_worker::render_worker(thread_pool& pool) : pool_(pool) {}
+
+bool render_worker::run(const std::string& address) {
+    socket_stream stream = socket_stream::connect(address);
+    if (!stream.valid())
+        return false;
+
+    struct queued_task {
+        uint32_t id = 0;
+        pixel_rect region;
+        std::shared_ptr<const farm_frame> scene;
+    };
+    std::vector<queued_task> queue;
+
+    while (true) {
+        // Every waiting message is read before the next task starts, a cancel may be among them
+        while (queue.empty() || stream.wait_readable(0)) {
+            uint32_t type;
+            std::vector<uint8_t> payload;
+            if (!stream.receive_message(type, payload))
+                return false;
+
+            message_reader reader(payload);
+            switch (static_cast<farm_message>(type)) {
+            case farm_message::scene: {
+                const uint32_t id = reader.read_u32();
+                auto frame = std::make_shared<farm_frame>();
+                if (!reader.ok() ||
+                    !decode_frame(std::vector<uint8_t>(payload.begin() + 4, payload.end()), *frame))
+                    return false;
+
+                scene_ = std::move(frame);
+                scene_id_ = id;
+                break;
+            }
+            case farm_message::task: {
+                queued_task t;
+                t.id = reader.read_u32();
+                const uint32_t scene = reader.read_u32();
+                t.region = read_rect(reader);
+                if (!reader.ok() || scene_ == nullptr || scene != scene_id_)
+                    return false;
+                t.scene = scene_;
+                queue.push_back(t);
+                break;
+            }
+            case farm_message::cancel: {
+                const uint32_t id = reader.read_u32();
+                queue.erase(std::remove_if(queue.begin(), queue.end(),
+                                           [id](const queued_task& t) { return t.id == id; }),
+                            queue.end());
+                break;
+            }
+            case farm_message::quit:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        const queued_task t = queue.front();
+        queue.erase(queue.begin());
+
+        // The renderer keeps references to the scene, so it's made again for another one
+        const farm_frame& scene = *t.scene;
+        if (rendered_scene_ != t.scene) {
+            rendered_scene_ = t.scene;
+            renderer_ = std::make_unique<renderer>(scene.camera, scene.spheres, scene.lights, scene.area_lights,
+                                                   pool_);
+            renderer_->settings = scene.settings;
+            buffer_.assign(static_cast<std::size_t>(scene.width) * scene.height, 0);
+        }
+
+        const pixel_rect region{std::max(t.region.left, 0), std::max(t.region.top, 0),
+                                std::min(t.region.right, scene.width - 1), std::min(t.region.bottom, scene.height - 1)};
+        renderer_->render(buffer_, scene.width, scene.height, region);
+
+        message_writer result;
+        result.add(t.id);
+        for (int y = region.top; y <= region.bottom; y++)
+            for (int x = region.left; x <= region.right; x++)
+                result.add(buffer_[static_cast<std::size_t>(y) * scene.width + x]);
+        if (!stream.send_message(static_cast<uint32_t>(farm_message::result), result.bytes()))
+            return false;
+        tasks_done_++;
+    }
+}
+
+std::size_t render_worker::get_tasks_done() const { return tasks_done_; }
@@ -0,0 +1,232 @@
+//
+// render_farm.h
+//
+
+#pragma once
+
+#include "area_light.h"
+#include "renderer.h"
+#include "socket_stream.h"
+#include "sphere.h"
+#include "thread_pool.h"
+
+#include <bardrix/camera.h>
+#include <bardrix/light.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// \brief Everything a process needs to render a frame: the scene, the camera and the settings
+struct farm_frame {
+    /// \brief The camera to render from
+    bardrix::camera camera = bardrix::camera({0, 0, 0}, {0, 0, 1}, 1, 1, 60);
+
+    /// \brief The spheres, lights and area lights in the scene
+    std::vector<sphere> spheres;
+    std::vector<bardrix::light> lights;
+    std::vector<area_light> area_lights;
+
+    /// \brief The settings of the renderer, settings.frame_number picks the random streams of the frame
+    render_settings settings;
+
+    /// \brief The size of the frame in pixels
+    int width = 0, height = 0;
+};
+
+/// \brief Writes a frame into bytes that can be sent to another process, the numbers are stored bit for bit
+/// \param frame The frame
+/// \return The bytes
+/// \example stream.send_message(1, encode_frame(frame));
+NODISCARD std::vector<uint8_t> encode_frame(const farm_frame& frame);
+
+/// \brief Reads a frame written by encode_frame
+/// \param bytes The bytes
+/// \param frame The frame (output)
+/// \return True if the bytes were a whole frame
+/// \example farm_frame frame; if (!decode_frame(payload, frame)) return false;
+bool decode_frame(const std::vector<uint8_t>& bytes, farm_frame& frame);
+
+/// \brief Settings of the render farm
+struct farm_settings {
+    /// \brief The size of the tiles the frames are split into in pixels, every tile is a task for one worker
+    int tile_size = 64;
+
+    /// \brief The amount of tasks a worker has at once: the one it renders and the ones it gets next, so it never
+    ///        waits for the coordinator between tasks
+    std::size_t tasks_per_worker = 2;
+
+    /// \brief A task that isn't done after this many milliseconds is given to another worker as well, the first
+    ///        result wins. This is how a worker that hangs is handled, one that disconnects loses its tasks at once
+    int task_timeout_ms = 30000;
+
+    /// \brief How long a render waits for a worker to connect when there are none before it gives up, in
+    ///        milliseconds
+    int worker_wait_ms = 10000;
+
+    /// \brief Let a worker without tasks take over a task another worker hasn't started yet, when there are no
+    ///        tasks left to hand out
+    bool steal = true;
+};
+
+/// \brief How the tasks of the last render were spread over the workers
+struct farm_stats {
+    /// \brief The amount of frames and tasks (tiles) that were rendered
+    std::size_t frames = 0, tasks = 0;
+
+    /// \brief The amount of workers that took part, and the amount that disconnected
+    std::size_t workers = 0, lost_workers = 0;
+
+    /// \brief The amount of tasks given to another worker because their worker was lost or too slow
+    std::size_t retried = 0;
+
+    /// \brief The amount of tasks an idle worker took over from another worker
+    std::size_t stolen = 0;
+
+    /// \brief The amount of results that came in for a task that was already done
+    std::size_t duplicates = 0;
+
+    /// \brief Milliseconds the render took
+    double render_ms = 0;
+};
+
+/// \brief Prints the stats of the render farm
+std::ostream& operator<<(std::ostream& os, const farm_stats& stats);
+
+/// \brief Splits frames into tiles and has worker processes render them
+/// \details Workers connect to the coordinator over TCP or a Unix domain socket and stay connected between renders.
+///          Every frame is cut into tiles of settings.tile_size, and every worker is kept tasks_per_worker tiles
+///          ahead. A worker that disconnects has its tiles handed out again, a tile that takes too long is handed out
+///          a second time, and a worker that runs out of work steals a tile another worker hasn't started. The frames
+///          are rendered in deterministic mode, so every tile is the same whichever worker renders it, and the
+///          results are copied into the frames as they come in.
+class render_coordinator {
+public:
+    /// \brief The settings used for the next render
+    farm_settings settings;
+
+protected:
+    /// \brief A connected worker and the tasks it has
+    struct connection {
+        socket_stream stream;
+
+        /// \brief The ids of the tasks that were sent to the worker and aren't done or taken away
+        std::vector<uint32_t> tasks;
+
+        /// \brief The id of the scene the worker has, so a scene is only sent once per worker
+        uint32_t scene = 0;
+        bool has_scene = false;
+    };
+
+    /// \brief A tile of a frame
+    struct task {
+        uint32_t frame = 0;
+        pixel_rect region;
+
+        /// \brief When the task was last handed out, and whether it's done
+        std::chrono::steady_clock::time_point sent;
+        bool done = false;
+    };
+
+    /// \brief The socket the workers connect to
+    socket_listener listener_;
+
+    /// \brief The connected workers
+    std::vector<connection> workers_;
+
+    /// \brief The id of the first task and scene of the current render, ids keep counting between renders so a late
+    ///        result of an earlier render is never mistaken for a task of this one
+    uint32_t first_task_ = 0, first_scene_ = 0;
+
+    /// \brief The stats of the last render
+    farm_stats stats_;
+
+public:
+    render_coordinator() = default;
+
+    /// \brief Destructor for the coordinator, tells the workers to quit
+    ~render_coordinator();
+
+    render_coordinator(const render_coordinator&) = delete;
+    render_coordinator& operator=(const render_coordinator&) = delete;
+
+    /// \brief Starts listening for workers
+    /// \param address "host:port" or "unix:path", port 0 picks a free port
+    /// \return True if the coordinator is listening
+    /// \example coordinator.listen("0.0.0.0:7000");
+    bool listen(const std::string& address);
+
+    /// \brief Gets the address the workers connect to
+    NODISCARD const std::string& get_address() const;
+
+    /// \brief Gets the amount of connected workers
+    NODISCARD std::size_t get_worker_count() const;
+
+    /// \brief Renders frames on the workers
+    /// \param frames The frames, they're rendered in deterministic mode
+    /// \param images Every frame in ARGB (output)
+    /// \return True if every frame was rendered, false if there were no workers for settings.worker_wait_ms
+    /// \example std::vector<std::vector<uint32_t>> images; coordinator.render({frame}, images);
+    bool render(const std::vector<farm_frame>& frames, std::vector<std::vector<uint32_t>>& images);
+
+    /// \brief Tells the workers to quit and disconnects them
+    void shutdown();
+
+    /// \brief Gets the stats of the last render
+    NODISCARD const farm_stats& get_stats() const;
+
+protected:
+    /// \brief Accepts the workers that are waiting to connect
+    void accept_workers();
+
+    /// \brief Gives a worker tasks until it has settings.tasks_per_worker
+    /// \return False if the worker couldn't be reached
+    bool dispatch(connection& worker, std::vector<task>& tasks, std::vector<uint32_t>& pending,
+                  const std::vector<std::vector<uint8_t>>& scenes);
+
+    /// \brief Takes the last task of the worker with the most tasks, it's the one most likely not started yet
+    /// \return The id of the task, or false if no worker has a task to spare
+    bool steal(const connection& thief, uint32_t& id);
+}; // class render_coordinator
+
+/// \brief Renders the tasks a coordinator sends it, the same way on_paint renders a frame
+/// \details A worker keeps the scenes of its queued tasks and renders only the tile of every task with the renderer
+///          in deterministic mode. It reads every waiting message before it starts a task, so a task that was taken
+///          away is dropped instead of rendered.
+class render_worker {
+protected:
+    /// \brief The threads a tile is rendered with
+    thread_pool& pool_;
+
+    /// \brief The last scene that was sent and its id, the tasks that come after it are tasks of this scene. Queued
+    ///        tasks keep the scene they belong to
+    std::shared_ptr<const farm_frame> scene_;
+    uint32_t scene_id_ = 0;
+
+    /// \brief The renderer and the scene it renders, the renderer is made again when a task has another scene
+    std::shared_ptr<const farm_frame> rendered_scene_;
+    std::unique_ptr<renderer> renderer_;
+
+    /// \brief The frame the tiles are rendered into
+    std::vector<uint32_t> buffer_;
+
+    /// \brief The amount of tasks that were rendered
+    std::size_t tasks_done_ = 0;
+
+public:
+    /// \brief Constructor for the worker
+    /// \param pool The threads to render with
+    explicit render_worker(thread_pool& pool);
+
+    /// \brief Connects to a coordinator and renders its tasks until it says to quit
+    /// \param address The address of the coordinator
+    /// \return True if the coordinator said to quit, false if it couldn't be reached or disconnected
+    /// \example thread_pool pool; render_worker worker(pool); worker.run("127.0.0.1:7000");
+    bool run(const std::string& address);
+
+    /// \brief Gets the amount of tasks that were rendered
+    NODISCARD std::size_t get_tasks_done() const;
+}; // class render_worker
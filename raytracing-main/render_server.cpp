@@ -0,0 +1,431 @@
+//
+// render_server.cpp
+//
+
+#include "render_server.h"
+#include "wire_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <tuple>
+
+namespace {
+    /// \brief The messages between a client and the server
+    enum class server_message : uint32_t {
+        /// \brief Client to server: an encoded farm_frame
+        load_scene = 1,
+        /// \brief Server to client: the id of the loaded scene, 0 if it wasn't a scene
+        scene = 2,
+        /// \brief Client to server: a render_request
+        render = 3,
+        /// \brief Server to client: the tag, size and format of a frame followed by the encoded frame
+        image = 4,
+        /// \brief Server to client: the tag of a request and why it wasn't rendered
+        error = 5,
+        /// \brief Client to server: nothing, server to client: the stats as text
+        metrics = 6
+    };
+
+    /// \brief The largest frame side the server renders, the same as a render farm worker
+    constexpr int max_frame_size = 16384;
+
+    /// \brief How long the server waits for a message before it checks for new clients
+    constexpr int poll_ms = 5;
+
+    /// \brief The amount of latencies the percentiles are taken over
+    constexpr std::size_t latency_window = 1024;
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// \brief Gets what makes two requests render the same frame, the tag and format don't
+    auto frame_key(const render_request& r) {
+        return std::make_tuple(r.scene, r.position.x, r.position.y, r.position.z, r.direction.x, r.direction.y,
+                               r.direction.z, r.fov, r.width, r.height, r.frame_number);
+    }
+
+    bool finite(const bardrix::vector3& v) { return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z); }
+
+    bool finite(const bardrix::point3& p) { return std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z); }
+
+    double percentile(std::vector<double>& values, double fraction) {
+        const std::size_t index = std::min(values.size() - 1, static_cast<std::size_t>(fraction * values.size()));
+        std::nth_element(values.begin(), values.begin() + static_cast<std::ptrdiff_t>(index), values.end());
+        return values[index];
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const server_stats& stats) {
+    os << "Render server: " << stats.clients << " clients, " << stats.scenes << " scenes, " << stats.requests
+       << " requests (" << stats.errors << " errors) in " << stats.batches << " batches, " << stats.renders
+       << " frames rendered, " << stats.shared << " shared, " << stats.requests_per_second
+       << " requests/s, latency mean " << stats.mean_latency_ms << " ms, p50 " << stats.p50_latency_ms << " ms, p95 "
+       << stats.p95_latency_ms << " ms, max " << stats.max_latency_ms << " ms, " << stats.render_ms
+       << " ms rendering, " << stats.encode_ms << " ms encoding";
+    return os;
+}
+
+render_server::render_server(thread_pool& pool) : pool_(pool) {}
+
+bool render_server::listen(const std::string& address) { return listener_.listen(address); }
+
+const std::string& render_server::get_address() const { return listener_.address(); }
+
+void render_server::run() {
+    while (!stopping_) {
+        // A client that stops halfway through a message, or doesn't take its frames, would stall everyone
+        for (socket_stream stream = listener_.accept(0); stream.valid(); stream = listener_.accept(0)) {
+            stream.set_timeout(settings.client_timeout_ms);
+            clients_.push_back(std::make_unique<socket_stream>(std::move(stream)));
+        }
+
+        // Waits for messages, but not past the end of the batch window of the waiting requests
+        int timeout = poll_ms;
+        if (!pending_.empty())
+            timeout = std::clamp(static_cast<int>(std::ceil(settings.batch_window_ms -
+                                                            milliseconds_since(pending_.front().received))),
+                                 0, poll_ms);
+
+        std::vector<const socket_stream*> streams;
+        for (const auto& client : clients_)
+            streams.push_back(client.get());
+        for (const std::size_t c : wait_readable(streams, timeout)) {
+            if (!read_client(*clients_[c]))
+                clients_[c]->close();
+        }
+
+        if (!pending_.empty() && (pending_.size() >= settings.max_batch ||
+                                  milliseconds_since(pending_.front().received) >= settings.batch_window_ms))
+            render_batch();
+
+        // The requests of a client that disconnected are dropped with it
+        for (std::size_t c = 0; c < clients_.size();) {
+            if (clients_[c]->valid()) {
+                c++;
+                continue;
+            }
+            const socket_stream* client = clients_[c].get();
+            pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+                                          [client](const pending_request& p) { return p.client == client; }),
+                           pending_.end());
+            clients_.erase(clients_.begin() + static_cast<std::ptrdiff_t>(c));
+        }
+
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.clients = clients_.size();
+        stats_.scenes = scenes_.size();
+    }
+    stopping_ = false;
+}
+
+void render_server::stop() { stopping_ = true; }
+
+server_stats render_server::get_stats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    server_stats stats = stats_;
+    if (stats.requests > 0) {
+        stats.requests_per_second = stats.requests / std::max(1e-3, milliseconds_since(first_request_) / 1000);
+    }
+    if (!latencies_.empty()) {
+        std::vector<double> latencies = latencies_;
+        double sum = 0;
+        for (const double latency : latencies) {
+            sum += latency;
+            stats.max_latency_ms = std::max(stats.max_latency_ms, latency);
+        }
+        stats.mean_latency_ms = sum / latencies.size();
+        stats.p50_latency_ms = percentile(latencies, 0.5);
+        stats.p95_latency_ms = percentile(latencies, 0.95);
+    }
+    return stats;
+}
+
+bool render_server::read_client(socket_stream& client) {
+    // A client may send many requests at once, they all join the batch
+    for (std::size_t messages = 0; messages < settings.max_batch && client.wait_readable(0); messages++) {
+        uint32_t type;
+        std::vector<uint8_t> payload;
+        if (!client.receive_message(type, payload))
+            return false;
+
+        switch (static_cast<server_message>(type)) {
+        case server_message::load_scene: {
+            const resident_scene* scene = load_scene(payload);
+            message_writer reply;
+            reply.add(scene == nullptr ? 0u : scene->id);
+            if (!client.send_message(static_cast<uint32_t>(server_message::scene), reply.bytes()))
+                return false;
+            break;
+        }
+        case server_message::render: {
+            message_reader reader(payload);
+            pending_request pending;
+            pending.client = &client;
+            pending.received = std::chrono::steady_clock::now();
+            render_request& r = pending.request;
+            r.tag = reader.read_u32();
+            r.scene = reader.read_u32();
+            r.position = reader.read_point();
+            r.direction = reader.read_vector();
+            r.fov = reader.read_double();
+            r.width = reader.read_int();
+            r.height = reader.read_int();
+            r.frame_number = reader.read_u32();
+            const uint32_t format = reader.read_u32();
+            if (!reader.ok())
+                return false;
+
+            // A request that can't be rendered waits in the batch as well, its error mustn't overtake the frames the
+            // client asked for before it
+            r.format = static_cast<image_format>(format);
+            if (r.width <= 0 || r.height <= 0 || r.width > max_frame_size || r.height > max_frame_size ||
+                static_cast<std::size_t>(r.width) * r.height > settings.max_pixels)
+                pending.error = "The frame is too big or empty";
+            else if (format > static_cast<uint32_t>(image_format::png))
+                pending.error = "Unknown image format";
+            else if (!finite(r.position) || !finite(r.direction) || !std::isfinite(r.fov) ||
+                     r.direction.length() == 0)
+                pending.error = "The camera isn't valid";
+            pending_.push_back(pending);
+            break;
+        }
+        case server_message::metrics: {
+            std::ostringstream text;
+            text << get_stats();
+            message_writer reply;
+            reply.add(text.str());
+            if (!client.send_message(static_cast<uint32_t>(server_message::metrics), reply.bytes()))
+                return false;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+render_server::resident_scene* render_server::load_scene(const std::vector<uint8_t>& encoded) {
+    for (const auto& scene : scenes_) {
+        if (scene->encoded == encoded) {
+            scene->last_used = batch_;
+            return scene.get();
+        }
+    }
+
+    auto scene = std::make_unique<resident_scene>();
+    if (!decode_frame(encoded, scene->frame))
+        return nullptr;
+
+    scene->id = next_scene_++;
+    scene->encoded = encoded;
+    scene->last_used = batch_;
+    scene->scene_renderer = std::make_unique<renderer>(scene->frame.camera, scene->frame.spheres,
+                                                       scene->frame.lights, scene->frame.area_lights, pool_);
+
+    // The scene that was used least recently makes room, requests that still wait for it get an error
+    if (!scenes_.empty() && scenes_.size() >= std::max<std::size_t>(1, settings.max_scenes)) {
+        const auto oldest = std::min_element(scenes_.begin(), scenes_.end(), [](const auto& a, const auto& b) {
+            return a->last_used < b->last_used;
+        });
+        scenes_.erase(oldest);
+    }
+    scenes_.push_back(std::move(scene));
+    return scenes_.back().get();
+}
+
+void render_server::render_batch() {
+    batch_++;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.batches++;
+    }
+
+    // The requests of a scene are rendered next to each other, and identical requests among them once. The answers
+    // are encoded right after their frame, because the next frame of the scene overwrites it
+    std::vector<uint32_t> types(pending_.size());
+    std::vector<std::vector<uint8_t>> replies(pending_.size());
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < pending_.size(); i++) {
+        if (pending_[i].error.empty())
+            order.push_back(i);
+        else
+            replies[i] = make_reply(pending_[i], nullptr, types[i]);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+        return frame_key(pending_[a].request) < frame_key(pending_[b].request);
+    });
+
+    for (std::size_t first = 0; first < order.size();) {
+        const render_request& r = pending_[order[first]].request;
+        std::size_t last = first + 1;
+        while (last < order.size() && frame_key(pending_[order[last]].request) == frame_key(r))
+            last++;
+
+        resident_scene* scene = find_scene(r.scene);
+        if (scene == nullptr) {
+            for (std::size_t i = first; i < last; i++) {
+                pending_[order[i]].error = "Unknown scene";
+                replies[order[i]] = make_reply(pending_[order[i]], nullptr, types[order[i]]);
+            }
+            first = last;
+            continue;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        scene->last_used = batch_;
+        scene->frame.camera = bardrix::camera(r.position, r.direction, r.width, r.height, r.fov);
+        renderer& scene_renderer = *scene->scene_renderer;
+        scene_renderer.settings = scene->frame.settings;
+        scene_renderer.settings.deterministic = true;
+        scene_renderer.settings.frame_number = r.frame_number;
+        scene->buffer.resize(static_cast<std::size_t>(r.width) * r.height);
+        scene_renderer.render(scene->buffer, r.width, r.height);
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.renders++;
+            stats_.shared += last - first - 1;
+            stats_.render_ms += milliseconds_since(start);
+        }
+
+        for (std::size_t i = first; i < last; i++)
+            replies[order[i]] = make_reply(pending_[order[i]], scene, types[order[i]]);
+        first = last;
+    }
+
+    // Every client gets its answers in the order it sent the requests
+    for (std::size_t i = 0; i < pending_.size(); i++)
+        send_reply(pending_[i], types[i], replies[i]);
+    pending_.clear();
+}
+
+std::vector<uint8_t> render_server::make_reply(const pending_request& pending, const resident_scene* scene,
+                                               uint32_t& type) {
+    const render_request& r = pending.request;
+    message_writer message;
+    message.add(r.tag);
+    if (scene == nullptr) {
+        type = static_cast<uint32_t>(server_message::error);
+        message.add(pending.error);
+        return std::move(message.bytes());
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    type = static_cast<uint32_t>(server_message::image);
+    message.add(r.width);
+    message.add(r.height);
+    message.add(static_cast<uint32_t>(r.format));
+    encode_image(scene->buffer.data(), r.width, r.height, r.format, message.bytes());
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.encode_ms += milliseconds_since(start);
+    return std::move(message.bytes());
+}
+
+void render_server::send_reply(const pending_request& pending, uint32_t type, const std::vector<uint8_t>& payload) {
+    // A client that can't be reached or doesn't take its frames in time is dropped after the batch
+    if (!pending.client->send_message(type, payload))
+        pending.client->close();
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    if (stats_.requests == 0)
+        first_request_ = pending.received;
+    stats_.requests++;
+    stats_.errors += type == static_cast<uint32_t>(server_message::error);
+
+    const double latency = milliseconds_since(pending.received);
+    if (latencies_.size() < latency_window)
+        latencies_.push_back(latency);
+    else
+        latencies_[next_latency_] = latency;
+    next_latency_ = (next_latency_ + 1) % latency_window;
+}
+
+render_server::resident_scene* render_server::find_scene(uint32_t id) const {
+    for (const auto& scene : scenes_)
+        if (scene->id == id)
+            return scene.get();
+    return nullptr;
+}
+
+bool render_client::connect(const std::string& address) {
+    stream_ = socket_stream::connect(address);
+    return stream_.valid();
+}
+
+bool render_client::load_scene(const farm_frame& scene, uint32_t& id) {
+    // What the server ignores is left out, so the same scene from another camera is the same scene to the server
+    farm_frame frame = scene;
+    frame.camera = farm_frame().camera;
+    frame.width = frame.height = 1;
+    frame.settings.frame_number = 0;
+
+    uint32_t type;
+    std::vector<uint8_t> payload;
+    if (!stream_.send_message(static_cast<uint32_t>(server_message::load_scene), encode_frame(frame)) ||
+        !stream_.receive_message(type, payload) || type != static_cast<uint32_t>(server_message::scene))
+        return false;
+
+    message_reader reader(payload);
+    id = reader.read_u32();
+    return reader.ok() && id != 0;
+}
+
+bool render_client::render(const render_request& request, server_image& image) {
+    return send_render(request) && receive_image(image);
+}
+
+bool render_client::send_render(const render_request& request) {
+    message_writer message;
+    message.add(request.tag);
+    message.add(request.scene);
+    message.add(request.position);
+    message.add(request.direction);
+    message.add(request.fov);
+    message.add(request.width);
+    message.add(request.height);
+    message.add(request.frame_number);
+    message.add(static_cast<uint32_t>(request.format));
+    return stream_.send_message(static_cast<uint32_t>(server_message::render), message.bytes());
+}
+
+bool render_client::receive_image(server_image& image) {
+    uint32_t type;
+    std::vector<uint8_t> payload;
+    image = server_image();
+    if (!stream_.receive_message(type, payload)) {
+        image.error = "Disconnected";
+        return false;
+    }
+
+    message_reader reader(payload);
+    image.tag = reader.read_u32();
+    if (type == static_cast<uint32_t>(server_message::error)) {
+        image.error = reader.read_string();
+        return false;
+    }
+
+    image.width = reader.read_int();
+    image.height = reader.read_int();
+    image.format = static_cast<image_format>(reader.read_u32());
+    if (type != static_cast<uint32_t>(server_message::image) || !reader.ok()) {
+        image.error = "Not an image";
+        return false;
+    }
+    image.bytes.assign(payload.begin() + static_cast<std::ptrdiff_t>(reader.position()), payload.end());
+    return true;
+}
+
+bool render_client::get_metrics(std::string& text) {
+    uint32_t type;
+    std::vector<uint8_t> payload;
+    if (!stream_.send_message(static_cast<uint32_t>(server_message::metrics), {}) ||
+        !stream_.receive_message(type, payload) || type != static_cast<uint32_t>(server_message::metrics))
+        return false;
+
+    message_reader reader(payload);
+    text = reader.read_string();
+    return reader.ok();
+}
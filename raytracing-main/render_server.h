@@ -0,0 +1,278 @@
+//
+// render_server.h
+//
+
+#pragma once
+
+#include "image_encoding.h"
+#include "render_farm.h"
+#include "renderer.h"
+#include "socket_stream.h"
+#include "thread_pool.h"
+
+#include <bardrix/camera.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/// \brief A frame a client asks the render server for
+struct render_request {
+    /// \brief A number the client picks, the image that answers the request has the same tag
+    uint32_t tag = 0;
+
+    /// \brief The id of the scene, from render_client::load_scene
+    uint32_t scene = 0;
+
+    /// \brief The camera: its position, the direction it looks in and its field of view in degrees
+    bardrix::point3 position{0, 0, 0};
+    bardrix::vector3 direction{0, 0, 1};
+    double fov = 60;
+
+    /// \brief The size of the frame in pixels
+    int width = 0, height = 0;
+
+    /// \brief The frame number the random streams are derived from, see render_settings::frame_number
+    uint32_t frame_number = 0;
+
+    /// \brief The format the frame is sent back in
+    image_format format = image_format::raw;
+};
+
+/// \brief A frame the render server sent back
+struct server_image {
+    /// \brief The tag of the request
+    uint32_t tag = 0;
+
+    /// \brief The size of the frame in pixels and the format it's encoded in
+    int width = 0, height = 0;
+    image_format format = image_format::raw;
+
+    /// \brief The encoded frame, a whole file in format
+    std::vector<uint8_t> bytes;
+
+    /// \brief Why the frame wasn't rendered, empty if it was
+    std::string error;
+};
+
+/// \brief Settings of the render server
+struct server_settings {
+    /// \brief How long the server waits for more requests after the first one arrives before it renders, in
+    ///        milliseconds. Requests that arrive together are rendered together, see render_server
+    int batch_window_ms = 2;
+
+    /// \brief The most requests rendered in one batch, a batch starts at once when it has this many
+    std::size_t max_batch = 64;
+
+    /// \brief The most scenes kept loaded, the scene that was used least recently is dropped to load another one
+    std::size_t max_scenes = 8;
+
+    /// \brief The most pixels a frame may have
+    std::size_t max_pixels = 4096 * 4096;
+
+    /// \brief The longest a client may take to send the rest of a message or to take a frame, in milliseconds. A
+    ///        client that takes longer is disconnected, so it can hold up the other clients for at most this long. 0 for
+    ///        no limit
+    int client_timeout_ms = 5000;
+};
+
+/// \brief The throughput and latency of the render server
+struct server_stats {
+    /// \brief The amount of connected clients and loaded scenes
+    std::size_t clients = 0, scenes = 0;
+
+    /// \brief The amount of frames that were asked for and answered, and how many of those were an error
+    std::size_t requests = 0, errors = 0;
+
+    /// \brief The amount of batches and frames that were rendered, and the amount of requests answered with the
+    ///        frame of an identical request in the same batch
+    std::size_t batches = 0, renders = 0, shared = 0;
+
+    /// \brief The amount of requests answered per second since the first one
+    double requests_per_second = 0;
+
+    /// \brief The time from receiving a request to sending its frame in milliseconds, over the last 1024 requests
+    double mean_latency_ms = 0, p50_latency_ms = 0, p95_latency_ms = 0, max_latency_ms = 0;
+
+    /// \brief Milliseconds spent rendering and encoding
+    double render_ms = 0, encode_ms = 0;
+};
+
+/// \brief Prints the stats of the render server
+std::ostream& operator<<(std::ostream& os, const server_stats& stats);
+
+/// \brief Renders frames for clients that connect over TCP or a Unix domain socket
+/// \details A client loads a scene once (an encoded farm_frame, the camera and size in it are ignored) and then asks
+///          for frames of it from any camera, at any size, in raw, PPM or PNG. The scenes stay loaded between
+///          requests and clients, each with its own renderer, so what a renderer keeps across frames (the occluder
+///          lists, the shadow cube maps, the ambient occlusion of the surfaces) is built once per scene instead of
+///          per request. A scene that's loaded again by any client gets the id it already has.
+///
+///          Requests that arrive within settings.batch_window_ms of each other are rendered as a batch: grouped by
+///          scene so every scene is set up once per batch and its frames are rendered back to back, and identical
+///          requests (same scene, camera, size and frame number) are rendered once and sent to every client that
+///          asked. Frames are rendered in deterministic mode, so a frame never depends on the frames rendered before
+///          it or on how requests were batched. The threads of the pool render every frame, one frame at a time.
+class render_server {
+public:
+    /// \brief The settings of the server, changed before run
+    server_settings settings;
+
+protected:
+    /// \brief A loaded scene and the renderer that keeps its structures between frames
+    struct resident_scene {
+        uint32_t id = 0;
+
+        /// \brief The encoded scene, to find a scene that's loaded again
+        std::vector<uint8_t> encoded;
+
+        /// \brief The scene, the camera is set for every frame. The renderer references it, so it never moves
+        farm_frame frame;
+        std::unique_ptr<renderer> scene_renderer;
+
+        /// \brief The frame that's rendered into
+        std::vector<uint32_t> buffer;
+
+        /// \brief The batch the scene was last used in, the scene with the lowest is dropped first
+        uint64_t last_used = 0;
+    };
+
+    /// \brief A request that waits for its batch
+    struct pending_request {
+        socket_stream* client = nullptr;
+        render_request request;
+        std::chrono::steady_clock::time_point received;
+
+        /// \brief Why the request can't be rendered, empty if it can
+        std::string error;
+    };
+
+    /// \brief The threads the frames are rendered with
+    thread_pool& pool_;
+
+    /// \brief The socket the clients connect to and the connected clients, the clients never move so the pending
+    ///        requests can point to them
+    socket_listener listener_;
+    std::vector<std::unique_ptr<socket_stream>> clients_;
+
+    /// \brief The loaded scenes, they never move because their renderers reference them
+    std::vector<std::unique_ptr<resident_scene>> scenes_;
+    uint32_t next_scene_ = 1;
+
+    /// \brief The requests of the next batch
+    std::vector<pending_request> pending_;
+
+    /// \brief The amount of batches rendered
+    uint64_t batch_ = 0;
+
+    /// \brief Set by stop, run returns when it sees it
+    std::atomic<bool> stopping_{false};
+
+    /// \brief The stats and the latencies of the last requests, get_stats may be called from another thread
+    mutable std::mutex stats_mutex_;
+    server_stats stats_;
+    std::vector<double> latencies_;
+    std::size_t next_latency_ = 0;
+    std::chrono::steady_clock::time_point first_request_;
+
+public:
+    /// \brief Constructor for the server
+    /// \param pool The threads to render with
+    explicit render_server(thread_pool& pool);
+
+    render_server(const render_server&) = delete;
+    render_server& operator=(const render_server&) = delete;
+
+    /// \brief Starts listening for clients
+    /// \param address "host:port" or "unix:path", port 0 picks a free port
+    /// \return True if the server is listening
+    /// \example server.listen("unix:/tmp/raytracing.sock");
+    bool listen(const std::string& address);
+
+    /// \brief Gets the address the clients connect to
+    NODISCARD const std::string& get_address() const;
+
+    /// \brief Answers clients until stop is called
+    /// \example std::thread thread([&] { server.run(); }); ... server.stop(); thread.join();
+    void run();
+
+    /// \brief Makes run return, it may be called from any thread
+    void stop();
+
+    /// \brief Gets the stats of the server, it may be called from any thread
+    NODISCARD server_stats get_stats() const;
+
+protected:
+    /// \brief Reads and handles every message a client has waiting, render requests wait in pending_
+    /// \return False if the client broke the protocol or disconnected
+    bool read_client(socket_stream& client);
+
+    /// \brief Loads a scene, or finds it if it's loaded already
+    /// \return The scene, nullptr if the bytes aren't a scene
+    resident_scene* load_scene(const std::vector<uint8_t>& encoded);
+
+    /// \brief Renders the pending requests and sends their frames
+    void render_batch();
+
+    /// \brief Encodes the frame that answers a request, or the error of the request if there is no scene
+    /// \param type The type of the message (output)
+    /// \return The payload of the message
+    std::vector<uint8_t> make_reply(const pending_request& pending, const resident_scene* scene, uint32_t& type);
+
+    /// \brief Sends the answer to the client of a request and counts it
+    void send_reply(const pending_request& pending, uint32_t type, const std::vector<uint8_t>& payload);
+
+    /// \brief Gets the loaded scene with an id
+    /// \return The scene, nullptr if it isn't loaded
+    NODISCARD resident_scene* find_scene(uint32_t id) const;
+}; // class render_server
+
+/// \brief Connects to a render server and asks it for frames
+/// \details Requests can be sent ahead with send_render and answered in order with receive_image, so one client can
+///          have a batch of frames rendered at once. The server renders a batch in its own order but answers the
+///          requests of a client in the order they were sent, an error included. load_scene and get_metrics wait for
+///          their own answer, so they're only called when every frame that was sent ahead was received.
+class render_client {
+protected:
+    socket_stream stream_;
+
+public:
+    /// \brief Connects to a render server
+    /// \param address The address of the server
+    /// \return True if the client connected
+    /// \example render_client client; if (!client.connect("unix:/tmp/raytracing.sock")) return 1;
+    bool connect(const std::string& address);
+
+    /// \brief Loads a scene on the server, the camera, size and frame number in it are ignored
+    /// \param scene The scene
+    /// \param id The id to render the scene with (output)
+    /// \return True if the scene was loaded
+    /// \example uint32_t scene; client.load_scene(frame, scene);
+    bool load_scene(const farm_frame& scene, uint32_t& id);
+
+    /// \brief Renders a frame and waits for it
+    /// \param request The frame
+    /// \param image The frame (output), with an error if it couldn't be rendered
+    /// \return True if the frame was rendered
+    /// \example server_image image; if (client.render(request, image)) write(image.bytes);
+    bool render(const render_request& request, server_image& image);
+
+    /// \brief Asks for a frame without waiting for it
+    /// \return True if the request was sent
+    bool send_render(const render_request& request);
+
+    /// \brief Waits for the frame of the oldest request that wasn't received yet
+    /// \param image The frame (output), with an error if it couldn't be rendered
+    /// \return True if the frame was rendered
+    bool receive_image(server_image& image);
+
+    /// \brief Gets the stats of the server as text
+    /// \param text The stats (output)
+    /// \return True if the server answered
+    bool get_metrics(std::string& text);
+}; // class render_client
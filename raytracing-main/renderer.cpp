@@ -0,0 +1,722 @@
+//
+// renderer.cpp
+//
+
+#include "renderer.h"
+#include "blue_noise.h"
+#include "lighting.h"
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+namespace {
+    /// \brief Reflected and refracted rays start this far from the surface so they don't hit the sphere they start on
+    constexpr double surface_offset = 1e-6;
+
+    /// \brief The length of reflected and refracted rays
+    constexpr double secondary_ray_length = 100;
+
+    /// \brief The maximum amount of total internal reflections inside a sphere before the ray is dropped
+    constexpr int max_internal_reflections = 4;
+
+    /// \brief The visibility of a shadow ray that wasn't answered by the shadow cache and still has to be traced
+    constexpr uint8_t unresolved = 2;
+
+    /// \brief Makes room for count items, a new allocation is touched by the threads of the pool first so its pages are
+    ///        on their NUMA nodes and not on the node of the calling thread. The items are lost if it has to grow
+    template <typename T>
+    void reserve_local(std::vector<T>& items, std::size_t count, thread_pool& pool) {
+        if (items.capacity() >= count)
+            return;
+
+        std::vector<T> local;
+        local.reserve(count);
+        first_touch(pool, local.data(), count * sizeof(T));
+        items.swap(local);
+    }
+
+    /// \brief Gets the visibility of a light from the shadow cache: 1 if it's visible, 0 if it's blocked or unresolved
+    uint8_t visibility(const shadow_cache::bits& cached, std::size_t light) {
+        if (light >= shadow_cache::max_lights || (cached.known & (1u << light)) == 0)
+            return unresolved;
+        return (cached.visible >> light) & 1u;
+    }
+
+    /// \brief Writes the normal, depth and albedo of a hit to the guide buffers
+    void store_guides(guide_buffers& guides, std::size_t pixel, const hit_record& hit) {
+        const bardrix::vector3 normal = hit.shape->normal_at(hit.point);
+        const bardrix::color& albedo = hit.shape->get_material().color;
+        guides.normal_x[pixel] = static_cast<float>(normal.x);
+        guides.normal_y[pixel] = static_cast<float>(normal.y);
+        guides.normal_z[pixel] = static_cast<float>(normal.z);
+        guides.depth[pixel] = static_cast<float>(hit.distance);
+        guides.albedo_r[pixel] = static_cast<float>(albedo.r()) / 255.0f;
+        guides.albedo_g[pixel] = static_cast<float>(albedo.g()) / 255.0f;
+        guides.albedo_b[pixel] = static_cast<float>(albedo.b()) / 255.0f;
+    }
+
+    /// \brief Mirrors a direction on a surface
+    bardrix::vector3 reflect(const bardrix::vector3& direction, const bardrix::vector3& normal) {
+        return direction - normal * (2 * direction.dot(normal));
+    }
+
+    /// \brief Refracts a direction through a surface (Snell's law)
+    /// \param direction The normalized incoming direction
+    /// \param normal The normalized normal, facing against the incoming direction
+    /// \param eta The index of refraction of the side the ray comes from divided by the other side
+    /// \return The refracted direction, std::nullopt on total internal reflection
+    std::optional<bardrix::vector3> refract(const bardrix::vector3& direction, const bardrix::vector3& normal,
+                                            double eta) {
+        const double cos_incoming = -direction.dot(normal);
+        const double k = 1 - eta * eta * (1 - cos_incoming * cos_incoming);
+        if (k < 0)
+            return std::nullopt;
+
+        return (direction * eta + normal * (eta * cos_incoming - std::sqrt(k))).normalized();
+    }
+
+    /// \brief Refracts a ray into a sphere, through its inside and back out again
+    /// \param s The sphere
+    /// \param point The point where the ray enters the sphere
+    /// \param direction The direction of the ray that hit the sphere
+    /// \return The ray that leaves the sphere, std::nullopt if it keeps reflecting on the inside
+    std::optional<bardrix::ray> refract_through(const sphere& s, const bardrix::point3& point,
+                                                const bardrix::vector3& direction) {
+        const double index = s.get_optics().refractive_index;
+        auto inside = refract(direction, s.normal_at(point), 1 / index);
+        if (!inside.has_value())
+            return std::nullopt;
+
+        bardrix::point3 entry = point;
+        bardrix::vector3 inside_direction = inside.value();
+        for (int i = 0; i <= max_internal_reflections; i++) {
+            // The ray starts on the sphere, so the chord to the other side is 2 * -(center_to_entry . direction)
+            const double chord = -2 * s.get_position().vector_to(entry).dot(inside_direction);
+            const bardrix::point3 exit = entry + inside_direction * chord;
+            const bardrix::vector3 normal = s.normal_at(exit);
+
+            auto outside = refract(inside_direction, -normal, index);
+            if (outside.has_value())
+                return bardrix::ray(exit + normal * surface_offset, outside.value(), secondary_ray_length);
+
+            // Total internal reflection, bounce to another point on the inside
+            entry = exit;
+            inside_direction = reflect(inside_direction, normal);
+        }
+
+        return std::nullopt;
+    }
+} // namespace
+
+renderer::renderer(const bardrix::camera& camera, const std::vector<sphere>& spheres,
+                   const std::vector<bardrix::light>& lights, const std::vector<area_light>& area_lights,
+                   thread_pool& pool)
+    : camera_(camera), spheres_(spheres), lights_(lights), area_lights_(area_lights), pool_(pool) {}
+
+void renderer::render(std::vector<uint32_t>& buffer, int width, int height) {
+    render(buffer, width, height, pixel_rect{0, 0, width - 1, height - 1});
+}
+
+void renderer::render(std::vector<uint32_t>& buffer, int width, int height, const pixel_rect& region) {
+    region_ = {std::max(region.left, 0), std::max(region.top, 0), std::min(region.right, width - 1),
+               std::min(region.bottom, height - 1)};
+    partial_region_ = region_.left > 0 || region_.top > 0 || region_.right < width - 1 || region_.bottom < height - 1;
+
+    // How far a budget gets depends on the order of the pixels and on which part of the image is rendered
+    secondary_ray_budget_ = settings.deterministic ? std::numeric_limits<std::size_t>::max()
+                                                   : settings.secondary_ray_budget;
+    secondary_rays_left_ = secondary_ray_budget_;
+    area_light_samples_ = std::clamp(settings.area_light_samples, 0, 255); // The visible samples are counted in a byte
+    frame_ = settings.deterministic ? settings.frame_number : frame_ + 1;
+
+    if (settings.ambient_occlusion)
+        occlusion_.begin_frame(spheres_);
+    if (caching_shadows())
+        shadow_cache_.prepare(spheres_, lights_);
+    if (settings.cull_occluders)
+        occluders_.update(spheres_, lights_, area_lights_);
+    if (settings.shadows == shadow_technique::cube_maps)
+        cube_maps_.update(spheres_, lights_);
+    if (caching_lighting()) {
+        // Area lights are shaded from their center, so they're cached like point lights after the point lights
+        shading_lights_.assign(lights_.begin(), lights_.end());
+        for (const area_light& a : area_lights_)
+            shading_lights_.push_back(a.light);
+        lighting_cache_.prepare(spheres_, shading_lights_, settings.ambient_occlusion);
+    }
+    validate_area_history();
+    trace_primary_rays(buffer, width, height);
+    generate_shadow_rays();
+
+    if (settings.batch_shadow_rays) {
+        shadow_batches_.build(shadow_rays_, width, settings.shadow_tile_size, lights_.size() + area_lights_.size());
+        shadow_order_.clear();
+    } else if (settings.bin_secondary_rays)
+        bin_rays(shadow_rays_, settings.bin_cell_size, shadow_order_);
+    else
+        shadow_order_.clear();
+
+    trace_shadow_rays();
+    shade(buffer);
+    shade_secondary(buffer);
+    if (prioritizing_tiles())
+        fill_coarse_tiles(buffer);
+
+    secondary_rays_traced_ = secondary_ray_budget_ - secondary_rays_left_;
+}
+
+ray_binning_report renderer::compare_binning() const {
+    return compare_ray_binning(shadow_rays_, spheres_, settings.bin_cell_size);
+}
+
+pixel_order_report renderer::compare_pixel_orders() const {
+    const ray_generator generator(camera_, 10);
+    tile_culling tiles;
+    tiles.build(generator, 0, 0, width_, height_, std::max(1, settings.primary_tile_size), spheres_, pool_);
+    return ::compare_pixel_orders(generator, spheres_, tiles, width_, height_);
+}
+
+const guide_buffers& renderer::get_guides() const {
+    return guides_;
+}
+
+std::size_t renderer::get_secondary_rays_traced() const {
+    return secondary_rays_traced_;
+}
+
+const ao_stats& renderer::get_occlusion_stats() const {
+    return occlusion_.get_stats();
+}
+
+const shadow_cache_stats& renderer::get_shadow_cache_stats() const {
+    return shadow_cache_.get_stats();
+}
+
+const lighting_cache_stats& renderer::get_lighting_cache_stats() const {
+    return lighting_cache_.get_stats();
+}
+
+const occluder_stats& renderer::get_occluder_stats() const {
+    return occluders_.get_stats();
+}
+
+const cube_map_stats& renderer::get_cube_map_stats() const {
+    return cube_maps_.get_stats();
+}
+
+const shadow_batch_stats& renderer::get_shadow_batch_stats() const {
+    return shadow_batches_.get_stats();
+}
+
+const tile_culling_stats& renderer::get_tile_culling_stats() const {
+    return tiles_.get_stats();
+}
+
+const visibility_stats& renderer::get_visibility_stats() const {
+    return visibility_.get_stats();
+}
+
+const load_balance_stats& renderer::get_load_balance_stats() const {
+    return balancer_.get_stats();
+}
+
+const tile_schedule_stats& renderer::get_tile_schedule_stats() const {
+    return scheduler_.get_stats();
+}
+
+void renderer::validate_area_history() {
+    area_history_valid_ = camera_.position == history_camera_position_ &&
+                          camera_.get_direction() == history_camera_direction_ &&
+                          area_lights_.size() == history_area_light_positions_.size();
+    for (std::size_t a = 0; area_history_valid_ && a < area_lights_.size(); a++)
+        area_history_valid_ = area_lights_[a].light.position == history_area_light_positions_[a];
+
+    history_camera_position_ = camera_.position;
+    history_camera_direction_ = camera_.get_direction();
+    history_area_light_positions_.clear();
+    for (const area_light& a : area_lights_)
+        history_area_light_positions_.push_back(a.light.position);
+}
+
+void renderer::trace_primary_rays(std::vector<uint32_t>& buffer, int width, int height) {
+    const std::size_t visibility_size = static_cast<std::size_t>(width) * height * area_lights_.size();
+    if (width != width_ || height != height_ || area_visibility_.size() != visibility_size) {
+        reserve_local(area_visibility_, visibility_size, pool_);
+        area_visibility_.assign(visibility_size, 0);
+        area_history_valid_ = false;
+    }
+    width_ = width;
+    height_ = height;
+
+    reserve_local(hits_, static_cast<std::size_t>(width) * height, pool_);
+    hits_.resize(static_cast<std::size_t>(width) * height);
+    guides_.reset(width, height);
+
+    const ray_generator generator(camera_, 10);
+    const int tile_size = std::max(1, settings.primary_tile_size);
+    const bool rasterize = settings.rasterize_primary, cull = settings.cull_tiles && !rasterize;
+    if (rasterize)
+        visibility_.render(generator, settings.jitter_x, settings.jitter_y, width, height, spheres_, pool_);
+    else if (cull)
+        tiles_.build(generator, settings.jitter_x, settings.jitter_y, width, height, tile_size, spheres_, pool_);
+
+    if (tile_size != traversal_size_ || settings.pixel_order != traversal_order_) {
+        tile_traversal(tile_size, settings.pixel_order, traversal_);
+        traversal_ranks_.assign(traversal_.size(), 0);
+        for (std::size_t rank = 0; rank < traversal_.size(); rank++)
+            traversal_ranks_[(traversal_[rank] >> 16) * tile_size + (traversal_[rank] & 0xFFFF)] =
+                static_cast<uint32_t>(rank);
+        traversal_size_ = tile_size;
+        traversal_order_ = settings.pixel_order;
+    }
+
+    // The buffer still holds the frame that was presented last, the scheduler measures its tiles
+    const bool prioritize = prioritizing_tiles();
+    if (prioritize) {
+        scheduler_.settings.coarse_step = settings.coarse_step;
+        scheduler_.schedule(buffer, width, height, tile_size, settings.focus_x, settings.focus_y,
+                            settings.primary_ray_budget);
+    }
+
+    // The tiles are split into work items of about the same cost, predicted from the last frame
+    const int tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+    const std::vector<uint32_t>* order = prioritize ? &scheduler_.order() : nullptr;
+    balancer_.plan(static_cast<std::size_t>(tiles_x) * tiles_y, tile_size, order, pool_.size(),
+                   settings.balance_load);
+    const std::vector<tile_work>& items = balancer_.items();
+
+    // Work items don't share pixels, so they're traced in parallel. The threads take the items in dispatch order, so
+    // the expensive (or the high priority) items are done first
+    const uint32_t background = bardrix::color::black().argb();
+    const std::vector<uint32_t> no_pixels;
+    work_hits_.resize(items.size());
+    balancer_.start();
+    pool_.parallel_for(items.size(), 1, [&](std::size_t begin, std::size_t end) {
+        std::vector<uint32_t> covering;
+        for (std::size_t i = begin; i < end; i++) {
+            const std::size_t item = balancer_.dispatch_order()[i];
+            const tile_work& work = items[item];
+            work_hits_[item].clear();
+
+            for (uint32_t position = work.begin; position < work.end; position++) {
+                const auto tile_start = std::chrono::steady_clock::now();
+                const std::size_t tile = order != nullptr ? (*order)[position] : position;
+                const int step = prioritize ? scheduler_.step(tile) : 1;
+                const int x0 = static_cast<int>(tile % tiles_x) * tile_size;
+                const int y0 = static_cast<int>(tile / tiles_x) * tile_size;
+                const int x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+                const int row_begin = y0 + work.row_begin, row_end = std::min(y1, y0 + work.row_end);
+                const std::vector<uint32_t>* candidates = cull ? &tiles_.candidates(tile) : nullptr;
+                const bool inside = x0 >= region_.left && x1 - 1 <= region_.right && row_begin >= region_.top &&
+                                    row_end - 1 <= region_.bottom;
+                const bool outside = x1 - 1 < region_.left || x0 > region_.right || row_end - 1 < region_.top ||
+                                     row_begin > region_.bottom;
+
+                // The pixels are traced in the order of the traversal, a band only traces its own rows. A coarse
+                // tile only traces the top left pixel of every block, fill_coarse_tiles copies it to the rest. Only the
+                // pixels in the region are traced for a part of a frame
+                for (const uint32_t offset : outside ? no_pixels : traversal_) {
+                    const int x = x0 + static_cast<int>(offset & 0xFFFF), y = y0 + static_cast<int>(offset >> 16);
+                    if (x >= x1 || y < row_begin || y >= row_end || (x - x0) % step != 0 ||
+                        (y - y0) % step != 0 || (!inside && !region_.contains(x, y)))
+                        continue;
+
+                    const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                    if (rasterize) {
+                        // The visibility buffer knows the sphere, one intersection gives the same hit as tracing
+                        const uint32_t id = visibility_.id(pixel);
+                        hits_[pixel] = hit_record();
+                        if (id != visibility_buffer::none) {
+                            const bardrix::ray ray = generator.shoot(x + settings.jitter_x,
+                                                                     y + settings.jitter_y);
+                            const bardrix::point3 point = spheres_[id].intersection(ray).value();
+                            hits_[pixel] = {&spheres_[id], point, ray.position.distance(point)};
+                        }
+                    } else if (candidates == nullptr) {
+                        hits_[pixel] = closest_hit(generator.shoot(x + settings.jitter_x,
+                                                                   y + settings.jitter_y), spheres_);
+                    } else {
+                        // Only the spheres whose projection contains the pixel can be hit, pixels outside the
+                        // covered part of the tile (all pixels of an empty tile) are background without any test
+                        covering.clear();
+                        if (tiles_.covered(tile).contains(x, y)) {
+                            for (uint32_t index : *candidates) {
+                                if (tiles_.sphere_bounds(index).contains(x, y))
+                                    covering.push_back(index);
+                            }
+                        }
+                        hits_[pixel] = covering.empty() ? hit_record()
+                                                        : closest_hit(generator.shoot(x + settings.jitter_x,
+                                                                                      y + settings.jitter_y),
+                                                                      spheres_, covering);
+                    }
+
+                    if (hits_[pixel].shape != nullptr) {
+                        store_guides(guides_, pixel, hits_[pixel]);
+                        work_hits_[item].push_back(static_cast<uint32_t>(pixel));
+                    } else
+                        buffer[pixel] = background;
+                }
+
+                balancer_.measure(work.first_part + (position - work.begin),
+                                  std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                            tile_start).count());
+            }
+            balancer_.finish_item(item);
+        }
+    });
+    balancer_.finish();
+
+    // The later stages only visit the pixels that hit something, so the background costs nothing there either. The
+    // items are in tile order (priority order when prioritized), so the secondary ray budget is spent on the
+    // important tiles first. The bands of a split tile are merged back into the order of the traversal, so the caches
+    // and the budget see the same order however the tiles were split (and on any amount of threads)
+    auto rank_of = [&](uint32_t pixel) {
+        const uint32_t x = pixel % static_cast<uint32_t>(width), y = pixel / static_cast<uint32_t>(width);
+        const auto size = static_cast<uint32_t>(tile_size);
+        return traversal_ranks_[(y % size) * size + x % size];
+    };
+    hit_pixels_.clear();
+    std::size_t tile_start = 0;
+    for (std::size_t item = 0; item < items.size(); item++) {
+        if (item == 0 || items[item].begin != items[item - 1].begin)
+            tile_start = hit_pixels_.size();
+
+        const std::size_t band_start = hit_pixels_.size();
+        hit_pixels_.insert(hit_pixels_.end(), work_hits_[item].begin(), work_hits_[item].end());
+        if (band_start != tile_start)
+            std::inplace_merge(hit_pixels_.begin() + static_cast<std::ptrdiff_t>(tile_start),
+                               hit_pixels_.begin() + static_cast<std::ptrdiff_t>(band_start), hit_pixels_.end(),
+                               [&](uint32_t a, uint32_t b) { return rank_of(a) < rank_of(b); });
+    }
+}
+
+void renderer::generate_shadow_rays() {
+    shadow_rays_.clear();
+
+    const std::size_t stride = lights_.size() + area_lights_.size();
+    reserve_local(shadow_results_, hits_.size() * stride, pool_);
+    shadow_results_.assign(hits_.size() * stride, 0);
+
+    const bool cube_maps = settings.shadows == shadow_technique::cube_maps;
+    reserve_local(light_coverage_, cube_maps ? hits_.size() * lights_.size() : 0, pool_);
+    light_coverage_.assign(cube_maps ? hits_.size() * lights_.size() : 0, 0.0f);
+
+    for (const uint32_t pixel : hit_pixels_) {
+        const hit_record& hit = hits_[pixel];
+
+        // The point lights are looked up in their cube maps, only the area lights need rays
+        for (std::size_t l = 0; cube_maps && l < lights_.size(); l++) {
+            const auto coverage = static_cast<float>(
+                cube_maps_.visibility(l, hit.point, static_cast<std::size_t>(hit.shape - spheres_.data())));
+            light_coverage_[pixel * lights_.size() + l] = coverage;
+            shadow_results_[pixel * stride + l] = coverage > 0;
+        }
+
+        // The rays go from the light to the hit, so all shadow rays of a light share their origin. Lights that the
+        // shadow cache knows about don't get a ray at all
+        const shadow_cache::bits cached = cube_maps ? shadow_cache::bits() : cached_shadows(hit);
+        for (std::size_t l = 0; !cube_maps && l < lights_.size(); l++) {
+            shadow_results_[pixel * stride + l] = visibility(cached, l);
+            if (shadow_results_[pixel * stride + l] != unresolved)
+                continue;
+
+            const bardrix::vector3 to_hit = lights_[l].position.vector_to(hit.point);
+            shadow_rays_.push_back({bardrix::ray(lights_[l].position, to_hit.normalized(),
+                                                 to_hit.length() - bardrix::epsilon),
+                                    static_cast<uint32_t>(pixel), static_cast<uint32_t>(l), hit.shape});
+        }
+
+        // A few rays per area light, from a blue noise point on its surface
+        const int x = static_cast<int>(pixel % width_), y = static_cast<int>(pixel / width_);
+        for (std::size_t a = 0; a < area_lights_.size(); a++) {
+            for (int sample = 0; sample < area_light_samples_; sample++) {
+                const double u1 = blue_noise::sample(x, y, 0, frame_, sample);
+                const double u2 = blue_noise::sample(x, y, 1, frame_, sample);
+                const bardrix::point3 origin = area_lights_[a].sample(hit.point, u1, u2);
+                const bardrix::vector3 to_hit = origin.vector_to(hit.point);
+                shadow_rays_.push_back({bardrix::ray(origin, to_hit.normalized(), to_hit.length() - bardrix::epsilon),
+                                        static_cast<uint32_t>(pixel),
+                                        static_cast<uint32_t>(lights_.size() + a), hit.shape});
+            }
+        }
+    }
+}
+
+void renderer::trace_shadow_rays() {
+    const std::size_t stride = lights_.size() + area_lights_.size();
+
+    // Batches are traced all at once, only their results are stored below
+    if (settings.batch_shadow_rays)
+        shadow_batches_.trace(shadow_rays_, spheres_, shadow_blocked_, settings.cull_occluders ? &occluders_ : nullptr);
+
+    for (std::size_t i = 0; i < shadow_rays_.size(); i++) {
+        const uint32_t index = shadow_order_.empty() ? static_cast<uint32_t>(i) : shadow_order_[i];
+        const secondary_ray& r = shadow_rays_[index];
+        const bool visible = settings.batch_shadow_rays ? !shadow_blocked_[index]
+                                                        : !shadow_blocked(r.ray, r.light, *r.shape);
+
+        // Area light samples are counted, point lights are stored in the cache for the next frames
+        uint8_t& result = shadow_results_[r.pixel * stride + r.light];
+        if (r.light >= lights_.size()) {
+            result += visible;
+            continue;
+        }
+
+        result = visible;
+        if (caching_shadows())
+            shadow_cache_.store(static_cast<std::size_t>(r.shape - spheres_.data()), *r.shape,
+                                hits_[r.pixel].point, r.light, visible);
+    }
+}
+
+void renderer::shade(std::vector<uint32_t>& buffer) {
+    const float blend = area_history_valid_ && !settings.deterministic ? settings.area_light_blend : 1.0f;
+    const float samples = static_cast<float>(std::max(1, area_light_samples_));
+    const std::size_t stride = lights_.size() + area_lights_.size();
+
+    const std::size_t cached_lights = caching_lighting() ? std::min(stride, lighting_cache::max_lights) : 0;
+    std::vector<float> diffuse(cached_lights);
+
+    for (const uint32_t pixel : hit_pixels_) {
+        const hit_record& hit = hits_[pixel];
+
+        // The ambient + diffuse part comes from the lighting cache, only the specular part depends on the camera
+        if (cached_lights > 0)
+            lighting_cache_.lookup(static_cast<std::size_t>(hit.shape - spheres_.data()), spheres_, hit.point,
+                                   settings.ambient_occlusion ? &occlusion_ : nullptr, diffuse.data());
+        const double ambient = cached_lights == stride ? 1 : ambient_visibility(hit);
+        auto intensity_of = [&](const bardrix::light& light, std::size_t l) {
+            if (l >= cached_lights)
+                return calculate_light_intensity(*hit.shape, light, camera_, hit.point, ambient);
+            return std::min(1.0, diffuse[l] + calculate_specular_intensity(*hit.shape, light, camera_.position,
+                                                                            hit.point));
+        };
+
+        const uint8_t* results = shadow_results_.data() + pixel * stride;
+        bardrix::color color = bardrix::color::black();
+        for (std::size_t l = 0; l < lights_.size(); l++) {
+            if (!results[l])
+                continue;
+
+            const bardrix::light& light = lights_[l];
+            double intensity = intensity_of(light, l);
+            if (!light_coverage_.empty())
+                intensity *= light_coverage_[pixel * lights_.size() + l];
+            color += hit.shape->get_material().color.blended(light.color) * intensity;
+        }
+
+        // Area lights are shaded like a point light in their center, scaled by the visibility that is accumulated
+        // over the frames, so a couple of rays per frame converge to a smooth penumbra
+        for (std::size_t a = 0; a < area_lights_.size(); a++) {
+            float& visibility = area_visibility_[pixel * area_lights_.size() + a];
+            visibility += (static_cast<float>(results[lights_.size() + a]) / samples - visibility) * blend;
+            if (visibility <= 0)
+                continue;
+
+            const bardrix::light& light = area_lights_[a].light;
+            double intensity = intensity_of(light, lights_.size() + a);
+            color += hit.shape->get_material().color.blended(light.color) * (intensity * visibility);
+        }
+
+        buffer[pixel] = color.argb(); // ARGB is the format used by Windows API
+    }
+}
+
+void renderer::shade_secondary(std::vector<uint32_t>& buffer) {
+    const std::size_t count = hit_pixels_.size();
+    if (count == 0)
+        return;
+
+    // The budget is spent in tile order, start somewhere else every frame so it doesn't always run out at the bottom.
+    // Prioritized tiles always start at the most important tile instead
+    const std::size_t start = prioritizing_tiles() ? 0 : (frame_ * 7919) % count;
+    for (std::size_t i = 0; i < count; i++) {
+        const std::size_t pixel = hit_pixels_[start + i < count ? start + i : start + i - count];
+        const hit_record& hit = hits_[pixel];
+
+        const optics& o = hit.shape->get_optics();
+        if (o.reflectivity <= 0 && o.transparency <= 0)
+            continue;
+
+        // The local color is already in the buffer, it was shaded with the batched shadow rays
+        const uint32_t argb = buffer[pixel];
+        const bardrix::color local(static_cast<uint8_t>(argb >> 16), static_cast<uint8_t>(argb >> 8),
+                                   static_cast<uint8_t>(argb), 255);
+        const bardrix::vector3 direction = camera_.position.vector_to(hit.point).normalized();
+
+        buffer[pixel] = mix_secondary(hit, direction, local, 0, 1).argb();
+    }
+}
+
+void renderer::fill_coarse_tiles(std::vector<uint32_t>& buffer) {
+    const int tile_size = std::max(1, settings.primary_tile_size);
+    const int tiles_x = (width_ + tile_size - 1) / tile_size;
+    const int width = width_, height = height_;
+
+    const std::size_t tiles = static_cast<std::size_t>(tiles_x) * ((height_ + tile_size - 1) / tile_size);
+
+    pool_.parallel_for(tiles, 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t tile = begin; tile < end; tile++) {
+            const int step = scheduler_.step(tile);
+            if (step == 1)
+                continue;
+
+            const int x0 = static_cast<int>(tile % tiles_x) * tile_size;
+            const int y0 = static_cast<int>(tile / tiles_x) * tile_size;
+            const int x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    const int traced_x = x0 + (x - x0) / step * step, traced_y = y0 + (y - y0) / step * step;
+                    if (traced_x == x && traced_y == y)
+                        continue;
+
+                    const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                    const std::size_t traced = static_cast<std::size_t>(traced_y) * width + traced_x;
+                    buffer[pixel] = buffer[traced];
+                    for (std::vector<float>* guide : {&guides_.normal_x, &guides_.normal_y, &guides_.normal_z,
+                                                      &guides_.depth, &guides_.albedo_r, &guides_.albedo_g,
+                                                      &guides_.albedo_b})
+                        (*guide)[pixel] = (*guide)[traced];
+                }
+            }
+        }
+    });
+}
+
+bardrix::color renderer::shade_hit(const hit_record& hit, const bardrix::point3& viewer) {
+    const double ambient = ambient_visibility(hit);
+    bardrix::color color = bardrix::color::black();
+
+    const shadow_cache::bits cached = cached_shadows(hit);
+    for (std::size_t l = 0; l < lights_.size(); l++) {
+        const bardrix::light& light = lights_[l];
+        if (settings.shadows == shadow_technique::cube_maps) {
+            const double coverage =
+                cube_maps_.visibility(l, hit.point, static_cast<std::size_t>(hit.shape - spheres_.data()));
+            if (coverage > 0)
+                color += hit.shape->get_material().color.blended(light.color) *
+                         (calculate_light_intensity(*hit.shape, light, viewer, hit.point, ambient) * coverage);
+            continue;
+        }
+
+        uint8_t visible = visibility(cached, l);
+        if (visible == unresolved) {
+            const bardrix::vector3 to_hit = light.position.vector_to(hit.point);
+            const bardrix::ray shadow(light.position, to_hit.normalized(), to_hit.length() - bardrix::epsilon);
+            visible = !shadow_blocked(shadow, l, *hit.shape);
+            if (caching_shadows())
+                shadow_cache_.store(static_cast<std::size_t>(hit.shape - spheres_.data()), *hit.shape, hit.point,
+                                    l, visible != 0);
+        }
+        if (!visible)
+            continue;
+
+        double intensity = calculate_light_intensity(*hit.shape, light, viewer, hit.point, ambient);
+        color += hit.shape->get_material().color.blended(light.color) * intensity;
+    }
+
+    // Reflections are small and blurry already, one shadow ray to the center of an area light is enough
+    for (std::size_t i = 0; i < area_lights_.size(); i++) {
+        const area_light& a = area_lights_[i];
+        const bardrix::vector3 to_hit = a.light.position.vector_to(hit.point);
+        const bardrix::ray shadow(a.light.position, to_hit.normalized(), to_hit.length() - bardrix::epsilon);
+        if (shadow_blocked(shadow, lights_.size() + i, *hit.shape))
+            continue;
+
+        double intensity = calculate_light_intensity(*hit.shape, a.light, viewer, hit.point, ambient);
+        color += hit.shape->get_material().color.blended(a.light.color) * intensity;
+    }
+
+    return color;
+}
+
+bardrix::color renderer::trace(const bardrix::ray& ray, int depth, double contribution) {
+    const hit_record hit = closest_hit(ray, spheres_);
+    if (hit.shape == nullptr)
+        return bardrix::color::black();
+
+    return mix_secondary(hit, ray.get_direction(), shade_hit(hit, ray.position), depth, contribution);
+}
+
+bardrix::color renderer::mix_secondary(const hit_record& hit, const bardrix::vector3& direction,
+                                       const bardrix::color& local, int depth, double contribution) {
+    const optics& o = hit.shape->get_optics();
+    if (o.reflectivity <= 0 && o.transparency <= 0)
+        return local;
+
+    // Rays that are cut off (depth, contribution or budget) fall back to the local color, so the energy stays the same.
+    // The local color is weighted once, so a surface without any secondary rays keeps exactly its own color
+    double local_weight = std::max(0.0, 1 - o.reflectivity - o.transparency);
+    bardrix::color traced = bardrix::color::black();
+    if (o.reflectivity > 0) {
+        if (take_secondary_ray(depth, contribution * o.reflectivity)) {
+            const bardrix::vector3 normal = hit.shape->normal_at(hit.point);
+            const bardrix::ray reflection(hit.point + normal * surface_offset, reflect(direction, normal),
+                                          secondary_ray_length);
+            traced += trace(reflection, depth + 1, contribution * o.reflectivity) * o.reflectivity;
+        } else
+            local_weight += o.reflectivity;
+    }
+
+    if (o.transparency > 0) {
+        if (take_secondary_ray(depth, contribution * o.transparency)) {
+            auto refraction = refract_through(*hit.shape, hit.point, direction);
+            if (refraction.has_value())
+                traced += trace(refraction.value(), depth + 1, contribution * o.transparency) * o.transparency;
+            else
+                local_weight += o.transparency; // Total internal reflection, nothing gets through
+        } else
+            local_weight += o.transparency;
+    }
+
+    return local * std::min(1.0, local_weight) + traced;
+}
+
+bool renderer::shadow_blocked(const bardrix::ray& ray, std::size_t light, const sphere& receiver) const {
+    if (!settings.cull_occluders)
+        return is_occluded(ray, spheres_, &receiver);
+
+    const auto index = static_cast<std::size_t>(&receiver - spheres_.data());
+    return is_occluded(ray, spheres_, occluders_.candidates(light, index));
+}
+
+bool renderer::caching_shadows() const {
+    return settings.cache_shadows && !settings.deterministic;
+}
+
+bool renderer::caching_lighting() const {
+    return settings.cache_lighting && !settings.deterministic;
+}
+
+bool renderer::prioritizing_tiles() const {
+    return settings.prioritize_tiles && !settings.deterministic && !partial_region_;
+}
+
+shadow_cache::bits renderer::cached_shadows(const hit_record& hit) {
+    if (!caching_shadows())
+        return {};
+
+    return shadow_cache_.lookup(static_cast<std::size_t>(hit.shape - spheres_.data()), *hit.shape, hit.point);
+}
+
+double renderer::ambient_visibility(const hit_record& hit) {
+    if (!settings.ambient_occlusion)
+        return 1;
+
+    // A cell depends on the points that were looked up in it before, so a deterministic frame traces its own rays
+    if (settings.deterministic)
+        return occlusion_.uncached_visibility(hit.point, hit.shape->normal_at(hit.point), spheres_);
+    return occlusion_.visibility(hit.point, hit.shape->normal_at(hit.point), spheres_);
+}
+
+bool renderer::take_secondary_ray(int depth, double contribution) {
+    if (depth >= settings.max_depth || contribution < settings.min_contribution || secondary_rays_left_ == 0)
+        return false;
+
+    secondary_rays_left_--;
+    return true;
+}
@@ -0,0 +1,417 @@
+//
+// renderer.h
+//
+
+#pragma once
+
+#include "ambient_occlusion.h"
+#include "area_light.h"
+#include "denoiser.h"
+#include "lighting_cache.h"
+#include "load_balancer.h"
+#include "occluder_lists.h"
+#include "pixel_order.h"
+#include "ray_binning.h"
+#include "shadow_batches.h"
+#include "shadow_cache.h"
+#include "shadow_cube_maps.h"
+#include "sphere.h"
+#include "thread_pool.h"
+#include "tile_culling.h"
+#include "tile_scheduler.h"
+#include "tracing.h"
+#include "visibility_buffer.h"
+
+#include <bardrix/camera.h>
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <vector>
+
+/// \brief How the renderer finds out whether a point light reaches a surface point
+enum class shadow_technique {
+    /// \brief Trace a shadow ray (exact)
+    rays,
+    /// \brief Look the point up in the light's shadow cube map (approximate, but independent of the amount of spheres)
+    cube_maps
+};
+
+/// \brief Settings of the renderer, these can be changed between frames
+struct render_settings {
+    /// \brief Bin the shadow rays by origin cell and direction octant before tracing them
+    bool bin_secondary_rays = true;
+
+    /// \brief The size of an origin cell used for binning, in world units
+    double bin_cell_size = 1.0;
+
+    /// \brief The maximum amount of reflections/refractions a camera ray may go through
+    int max_depth = 4;
+
+    /// \brief Reflected and refracted rays that contribute less than this to their pixel aren't traced [0, 1]
+    double min_contribution = 0.02;
+
+    /// \brief The maximum amount of reflected and refracted rays per frame, this bounds the frame time no matter how
+    ///        many mirrors are in view
+    std::size_t secondary_ray_budget = 250000;
+
+    /// \brief The amount of shadow rays per pixel for every area light, at most 255
+    int area_light_samples = 2;
+
+    /// \brief How much a new frame adds to the accumulated area light visibility [0, 1], 1 disables accumulation
+    float area_light_blend = 0.2f;
+
+    /// \brief The offset of every primary ray from the pixel center in pixels [-0.5, 0.5], a different offset every
+    ///        frame anti-aliases the accumulated image
+    double jitter_x = 0, jitter_y = 0;
+
+    /// \brief Darken the ambient light where other spheres are close, the occlusion is cached in world space
+    bool ambient_occlusion = true;
+
+    /// \brief Remember which lights reach the surfaces, so a moving camera only traces shadow rays for new surface
+    ///        points and near shadow edges. Approximate, shadows smaller than a few texels can be missed
+    bool cache_shadows = true;
+
+    /// \brief Remember the ambient + diffuse light on the surfaces, so only the specular light is calculated per
+    ///        pixel
+    bool cache_lighting = true;
+
+    /// \brief Only test the spheres that can be between a light and the sphere a shadow ray ends on
+    bool cull_occluders = true;
+
+    /// \brief How the shadows of the point lights are found, area lights always use rays
+    shadow_technique shadows = shadow_technique::rays;
+
+    /// \brief Trace the shadow rays in batches of one light per screen tile, every batch culls the spheres against its
+    ///        frustum (and the occluder lists) once and tests its rays in SIMD packets, this replaces binning
+    bool batch_shadow_rays = true;
+
+    /// \brief The size of the screen tiles of the shadow batches in pixels
+    int shadow_tile_size = 16;
+
+    /// \brief Only test a primary ray against the spheres inside its tile's frustum whose projection contains its
+    ///        pixel, pixels outside the bounds of the scene are written as background without a ray
+    bool cull_tiles = true;
+
+    /// \brief The size of the screen tiles of the primary rays in pixels
+    int primary_tile_size = 16;
+
+    /// \brief The order the pixels of a screen tile are traced in. Along a curve more consecutive rays test the same
+    ///        spheres, but the tiles already keep the spheres in cache and rows fill the cache lines of the frame
+    ///        one after the other, so rows are slightly faster here (see compare_pixel_orders)
+    pixel_traversal pixel_order = pixel_traversal::rows;
+
+    /// \brief Find the sphere every pixel shows by rasterizing the spheres into a visibility buffer instead of
+    ///        tracing the primary rays, the hits are the same. Shading and shadows are still ray traced
+    bool rasterize_primary = false;
+
+    /// \brief Split expensive tiles and merge cheap ones, based on how long every tile took in the previous frame,
+    ///        so the threads run out of primary rays at about the same time
+    bool balance_load = true;
+
+    /// \brief Trace the screen tiles in priority order: the tiles around the focus point first, then the tiles that
+    ///        were noisy or changed in the previous frame. With a primary ray budget the lowest priority tiles only
+    ///        trace one ray per block of coarse_step x coarse_step pixels
+    bool prioritize_tiles = false;
+
+    /// \brief The position the viewer looks at in pixels (the cursor), negative for the center of the screen
+    double focus_x = -1, focus_y = -1;
+
+    /// \brief The maximum amount of primary rays per frame when the tiles are prioritized, 0 traces every pixel
+    std::size_t primary_ray_budget = 0;
+
+    /// \brief The size of the blocks that share one primary ray in a coarse tile in pixels
+    int coarse_step = 4;
+
+    /// \brief Make every pixel a function of the scene, the camera, the settings and frame_number only, so a frame
+    ///        is byte identical on any amount of threads, in any tile order and in a process that only renders part
+    ///        of it. What depends on earlier frames or on the other pixels is off: the shadow and lighting caches, the
+    ///        area light accumulation, the secondary ray budget and the tile priorities. Ambient occlusion is traced
+    ///        per pixel, which makes a frame several times slower
+    bool deterministic = false;
+
+    /// \brief The frame number the random streams are derived from in deterministic mode, otherwise the renderer
+    ///        counts its own frames
+    uint32_t frame_number = 0;
+};
+
+/// \brief Renders the spheres and lights as seen from a camera into an ARGB buffer
+/// \details A frame is rendered in stages: all primary rays are traced first (tile by tile, in parallel), then the
+///          shadow rays of every hit are generated, batched and traced, and finally the pixels are shaded.
+class renderer {
+public:
+    /// \brief The settings used for the next frame
+    render_settings settings;
+
+protected:
+    /// \brief The camera to render from
+    const bardrix::camera& camera_;
+
+    /// \brief The spheres in the scene
+    const std::vector<sphere>& spheres_;
+
+    /// \brief The lights in the scene
+    const std::vector<bardrix::light>& lights_;
+
+    /// \brief The area lights in the scene
+    const std::vector<area_light>& area_lights_;
+
+    /// \brief The threads the primary rays are traced with
+    thread_pool& pool_;
+
+    /// \brief The size of the current frame
+    int width_ = 0, height_ = 0;
+
+    /// \brief The pixels of the current frame that are rendered, and whether that's less than the whole frame
+    pixel_rect region_;
+    bool partial_region_ = false;
+
+    /// \brief The closest hit of every pixel's primary ray
+    std::vector<hit_record> hits_;
+
+    /// \brief The pixels whose primary ray hit a sphere, tile by tile
+    std::vector<uint32_t> hit_pixels_;
+
+    /// \brief The pixels whose primary ray hit a sphere of every work item, merged into hit_pixels_
+    std::vector<std::vector<uint32_t>> work_hits_;
+
+    /// \brief Splits the tiles of the primary rays into work items of about the same cost
+    load_balancer balancer_;
+
+    /// \brief The position of every pixel in a screen tile in the order they're traced, see tile_traversal
+    std::vector<uint32_t> traversal_;
+
+    /// \brief The position of every pixel of a screen tile in traversal_, y * tile size + x
+    std::vector<uint32_t> traversal_ranks_;
+
+    /// \brief The tile size and order traversal_ was built for
+    int traversal_size_ = 0;
+    pixel_traversal traversal_order_ = pixel_traversal::rows;
+
+    /// \brief The spheres in the frustum of every screen tile, only used with settings.cull_tiles
+    tile_culling tiles_;
+
+    /// \brief The order and sampling rate of the screen tiles, only used with settings.prioritize_tiles
+    tile_scheduler scheduler_;
+
+    /// \brief The sphere and depth of every pixel, only used with settings.rasterize_primary
+    visibility_buffer visibility_;
+
+    /// \brief The normal, depth and albedo of every pixel's primary hit, for the denoiser
+    guide_buffers guides_;
+
+    /// \brief The shadow rays of the current frame that aren't answered by the shadow cache, in pixel order
+    std::vector<secondary_ray> shadow_rays_;
+
+    /// \brief The order the shadow rays are traced in, empty for pixel order
+    std::vector<uint32_t> shadow_order_;
+
+    /// \brief The shadow rays grouped per light per tile, only used with settings.batch_shadow_rays
+    shadow_batches shadow_batches_;
+
+    /// \brief Whether every shadow ray is blocked, filled by the shadow batches
+    std::vector<uint8_t> shadow_blocked_;
+
+    /// \brief Per pixel, whether every light reaches the hit (from the shadow cache or traced) followed by the amount
+    ///        of visible samples of every area light
+    std::vector<uint8_t> shadow_results_;
+
+    /// \brief The visibility of the point lights on the surfaces, kept across frames and camera moves
+    shadow_cache shadow_cache_;
+
+    /// \brief The amount of reflected and refracted rays that may still be traced this frame
+    std::size_t secondary_rays_left_ = 0;
+
+    /// \brief The amount of reflected and refracted rays that were traced in the last frame
+    std::size_t secondary_rays_traced_ = 0;
+
+    /// \brief The frame number, used to rotate where the secondary ray budget starts and the blue noise
+    uint32_t frame_ = 0;
+
+    /// \brief The amount of reflected and refracted rays the current frame may trace
+    std::size_t secondary_ray_budget_ = 0;
+
+    /// \brief The amount of shadow rays per pixel for every area light this frame, at most what shadow_results_ counts
+    int area_light_samples_ = 0;
+
+    /// \brief The accumulated visibility of every area light for every pixel [0, 1]
+    std::vector<float> area_visibility_;
+
+    /// \brief Whether area_visibility_ belongs to the current view, if not it's overwritten instead of blended
+    bool area_history_valid_ = false;
+
+    /// \brief The ambient occlusion of the surfaces, kept across frames and camera moves
+    ao_cache occlusion_;
+
+    /// \brief The ambient + diffuse light on the surfaces, kept across frames and camera moves
+    lighting_cache lighting_cache_;
+
+    /// \brief The spheres that can cast a shadow from every light on every sphere
+    occluder_lists occluders_;
+
+    /// \brief The shadow cube maps of the point lights, only used with shadow_technique::cube_maps
+    shadow_cube_maps cube_maps_;
+
+    /// \brief Per pixel, the fraction of every point light that reaches the hit according to the cube maps
+    std::vector<float> light_coverage_;
+
+    /// \brief The lights and the centers of the area lights, the lights of the lighting cache
+    std::vector<bardrix::light> shading_lights_;
+
+    /// \brief The camera and area lights the accumulated visibility was rendered with
+    bardrix::point3 history_camera_position_;
+    bardrix::vector3 history_camera_direction_;
+    std::vector<bardrix::point3> history_area_light_positions_;
+
+public:
+    /// \brief Constructor for the renderer, the scene is referenced and not copied
+    /// \param camera The camera to render from
+    /// \param spheres The spheres in the scene
+    /// \param lights The lights in the scene
+    /// \param area_lights The area lights in the scene
+    /// \param pool The threads to trace the primary rays with
+    renderer(const bardrix::camera& camera, const std::vector<sphere>& spheres,
+             const std::vector<bardrix::light>& lights, const std::vector<area_light>& area_lights,
+             thread_pool& pool);
+
+    /// \brief Renders a frame
+    /// \param buffer The buffer to render to, the format is AARRGGBB
+    /// \param width The width of the buffer
+    /// \param height The height of the buffer
+    /// \example window.on_paint = [&](bardrix::window* window, std::vector<uint32_t>& buffer) {  \n
+    ///         renderer.render(buffer, window->get_width(), window->get_height());                 \n
+    ///     };
+    void render(std::vector<uint32_t>& buffer, int width, int height);
+
+    /// \brief Renders part of a frame, the pixels outside the region are left as they are
+    /// \details The pixels inside are the same as in the whole frame in deterministic mode, so processes that render
+    ///          different regions of a frame can put it together. Tiles are never prioritized for a part of a frame
+    /// \param buffer The buffer of the whole frame, the format is AARRGGBB
+    /// \param width The width of the frame
+    /// \param height The height of the frame
+    /// \param region The pixels to render, clipped to the frame
+    /// \example renderer.render(buffer, 640, 480, pixel_rect{0, 0, 63, 63});
+    void render(std::vector<uint32_t>& buffer, int width, int height, const pixel_rect& region);
+
+    /// \brief Traces the shadow rays of the last frame in pixel order and in binned order
+    /// \return The coherence and throughput of both orders
+    /// \example std::cout << renderer.compare_binning() << std::endl;
+    NODISCARD ray_binning_report compare_binning() const;
+
+    /// \brief Traces the primary rays of the current view row by row and along every traversal of the tiles
+    /// \return The coherence, modelled cache misses and timing of every order
+    /// \example std::cout << renderer.compare_pixel_orders() << std::endl;
+    NODISCARD pixel_order_report compare_pixel_orders() const;
+
+    /// \brief Gets the normal, depth and albedo of the primary hits of the last frame
+    /// \return The guide buffers for the denoiser
+    NODISCARD const guide_buffers& get_guides() const;
+
+    /// \brief Gets the amount of reflected and refracted rays that were traced in the last frame
+    /// \return The amount of rays, at most settings.secondary_ray_budget
+    NODISCARD std::size_t get_secondary_rays_traced() const;
+
+    /// \brief Gets the lookups and rays of the ambient occlusion cache in the last frame
+    NODISCARD const ao_stats& get_occlusion_stats() const;
+
+    /// \brief Gets the lookups of the shadow cache in the last frame
+    NODISCARD const shadow_cache_stats& get_shadow_cache_stats() const;
+
+    /// \brief Gets the lookups of the lighting cache in the last frame
+    NODISCARD const lighting_cache_stats& get_lighting_cache_stats() const;
+
+    /// \brief Gets how much of the occluder lists was rebuilt in the last frame
+    NODISCARD const occluder_stats& get_occluder_stats() const;
+
+    /// \brief Gets how many shadow cube maps were rendered in the last frame
+    NODISCARD const cube_map_stats& get_cube_map_stats() const;
+
+    /// \brief Gets how the shadow rays of the last frame were batched
+    NODISCARD const shadow_batch_stats& get_shadow_batch_stats() const;
+
+    /// \brief Gets how many screen tiles of the last frame were empty
+    NODISCARD const tile_culling_stats& get_tile_culling_stats() const;
+
+    /// \brief Gets how much work rasterizing the primary visibility was in the last frame
+    NODISCARD const visibility_stats& get_visibility_stats() const;
+
+    /// \brief Gets how evenly the threads shared the primary rays of the last frame
+    NODISCARD const load_balance_stats& get_load_balance_stats() const;
+
+    /// \brief Gets how the screen tiles of the last frame were ordered and sampled
+    NODISCARD const tile_schedule_stats& get_tile_schedule_stats() const;
+
+protected:
+    /// \brief Traces the primary ray of every pixel and stores the closest hit, pixels without a hit are written as
+    ///        background
+    void trace_primary_rays(std::vector<uint32_t>& buffer, int width, int height);
+
+    /// \brief Generates a shadow ray from every light, and a few from every area light, to every hit
+    void generate_shadow_rays();
+
+    /// \brief Checks if the accumulated area light visibility still belongs to the current view and lights
+    void validate_area_history();
+
+    /// \brief Traces all shadow rays, in batches or in the order of shadow_order_
+    void trace_shadow_rays();
+
+    /// \brief Shades every pixel with a hit using the traced shadow rays
+    void shade(std::vector<uint32_t>& buffer);
+
+    /// \brief Adds the reflections and refractions to every pixel that shows a mirror or transparent sphere
+    void shade_secondary(std::vector<uint32_t>& buffer);
+
+    /// \brief Copies the color and guides of every traced pixel of a coarse tile to the rest of its block
+    void fill_coarse_tiles(std::vector<uint32_t>& buffer);
+
+    /// \brief Calculates the Phong color of a hit, testing its shadow rays one by one
+    /// \param hit The hit to shade
+    /// \param viewer The point the hit is seen from
+    /// \return The color of the hit without reflections and refractions
+    NODISCARD bardrix::color shade_hit(const hit_record& hit, const bardrix::point3& viewer);
+
+    /// \brief Traces a shadow ray against the spheres that can block it
+    /// \param ray The shadow ray, going from the light to the surface point
+    /// \param light The index of the light, area lights come after the point lights
+    /// \param receiver The sphere the shadow ray ends on
+    /// \return True if the ray is blocked
+    NODISCARD bool shadow_blocked(const bardrix::ray& ray, std::size_t light, const sphere& receiver) const;
+
+    /// \brief Checks if the shadow cache is used this frame, it never is in deterministic mode
+    NODISCARD bool caching_shadows() const;
+
+    /// \brief Checks if the lighting cache is used this frame, it never is in deterministic mode
+    NODISCARD bool caching_lighting() const;
+
+    /// \brief Checks if the tiles are prioritized this frame, they never are in deterministic mode or for a part of a
+    ///        frame
+    NODISCARD bool prioritizing_tiles() const;
+
+    /// \brief Looks up which point lights reach a hit in the shadow cache, nothing is known if the cache is off
+    NODISCARD shadow_cache::bits cached_shadows(const hit_record& hit);
+
+    /// \brief Gets the fraction of the ambient light that reaches a hit, 1 if ambient occlusion is off
+    NODISCARD double ambient_visibility(const hit_record& hit);
+
+    /// \brief Traces a reflected or refracted ray and shades whatever it hits (recursively)
+    /// \param ray The ray to trace
+    /// \param depth The amount of reflections/refractions before this ray
+    /// \param contribution How much this ray contributes to its pixel [0, 1]
+    /// \return The color seen along the ray, black if nothing is hit
+    NODISCARD bardrix::color trace(const bardrix::ray& ray, int depth, double contribution);
+
+    /// \brief Mixes the local color of a hit with its reflection and refraction
+    /// \param hit The hit
+    /// \param direction The direction of the ray that hit
+    /// \param local The Phong color of the hit
+    /// \param depth The amount of reflections/refractions before this hit
+    /// \param contribution How much this hit contributes to its pixel [0, 1]
+    /// \return The final color of the hit
+    NODISCARD bardrix::color mix_secondary(const hit_record& hit, const bardrix::vector3& direction,
+                                           const bardrix::color& local, int depth, double contribution);
+
+    /// \brief Checks if another reflected or refracted ray may be traced and takes it from the budget
+    /// \param depth The amount of reflections/refractions before the ray
+    /// \param contribution How much the ray would contribute to its pixel
+    /// \return True if the ray may be traced
+    bool take_secondary_ray(int depth, double contribution);
+}; // class renderer
@@ -0,0 +1,95 @@
+//
+// sampling.h
+//
+
+#pragma once
+
+#include <bardrix/vector3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/// \brief Small, fast helpers for generating random samples, every random stream is a single uint32_t state
+namespace sampling {
+    /// \brief Pi, used for converting random numbers to angles
+    constexpr double pi = 3.14159265358979323846;
+
+    /// \brief Hashes a value (PCG output permutation), good enough to seed a random stream from e.g. a pixel index
+    /// \param value The value to hash
+    /// \return The hashed value
+    /// \example uint32_t state = sampling::hash(pixel ^ sampling::hash(frame));
+    inline uint32_t hash(uint32_t value) {
+        const uint32_t state = value * 747796405u + 2891336453u;
+        const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    /// \brief Advances a random stream and returns a number in [0, 1)
+    /// \param state The state of the random stream
+    /// \return A uniformly distributed number in [0, 1)
+    inline double next_double(uint32_t& state) {
+        state = hash(state);
+        return (state >> 8) * (1.0 / 16777216.0);
+    }
+
+    /// \brief Gets an element of the Halton sequence, a low discrepancy sequence that's used for subpixel jitter
+    /// \param index The index of the element, starting at 1
+    /// \param base The base of the sequence, use a different prime per dimension
+    /// \return The element in [0, 1)
+    /// \example double jitter_x = sampling::halton(frame, 2) - 0.5, jitter_y = sampling::halton(frame, 3) - 0.5;
+    inline double halton(uint32_t index, uint32_t base) {
+        double result = 0, fraction = 1;
+        while (index > 0) {
+            fraction /= base;
+            result += fraction * (index % base);
+            index /= base;
+        }
+        return result;
+    }
+
+    /// \brief Builds two tangents that form an orthonormal basis together with a normal
+    /// \param normal The normal, must be normalized
+    /// \param tangent The first tangent (output)
+    /// \param bitangent The second tangent (output)
+    inline void orthonormal_basis(const bardrix::vector3& normal, bardrix::vector3& tangent,
+                                  bardrix::vector3& bitangent) {
+        // Branchless basis by Duff et al. 2017
+        const double sign = std::copysign(1.0, normal.z);
+        const double a = -1.0 / (sign + normal.z);
+        const double b = normal.x * normal.y * a;
+        tangent = bardrix::vector3(1.0 + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+        bitangent = bardrix::vector3(b, sign + normal.y * normal.y * a, -normal.y);
+    }
+
+    /// \brief Maps two uniform numbers to a cosine weighted direction on the hemisphere around a normal
+    /// \param normal The normal of the hemisphere, must be normalized
+    /// \param u1 A uniform number in [0, 1)
+    /// \param u2 A uniform number in [0, 1)
+    /// \return A normalized direction, its pdf is cos(theta) / pi
+    inline bardrix::vector3 cosine_hemisphere(const bardrix::vector3& normal, double u1, double u2) {
+        bardrix::vector3 tangent, bitangent;
+        orthonormal_basis(normal, tangent, bitangent);
+
+        const double radius = std::sqrt(u1);
+        const double phi = 2 * pi * u2;
+        return tangent * (radius * std::cos(phi)) + bitangent * (radius * std::sin(phi)) +
+               normal * std::sqrt(std::max(0.0, 1 - u1));
+    }
+
+    /// \brief Maps two uniform numbers to a direction inside a Phong lobe around an axis
+    /// \param axis The axis of the lobe (e.g. the mirror direction), must be normalized
+    /// \param exponent The Phong exponent, higher is narrower
+    /// \param u1 A uniform number in [0, 1)
+    /// \param u2 A uniform number in [0, 1)
+    /// \return A normalized direction, its pdf is (exponent + 1) / (2 * pi) * cos(alpha)^exponent
+    inline bardrix::vector3 phong_lobe(const bardrix::vector3& axis, double exponent, double u1, double u2) {
+        bardrix::vector3 tangent, bitangent;
+        orthonormal_basis(axis, tangent, bitangent);
+
+        const double cos_alpha = std::pow(u1, 1.0 / (exponent + 1));
+        const double sin_alpha = std::sqrt(std::max(0.0, 1 - cos_alpha * cos_alpha));
+        const double phi = 2 * pi * u2;
+        return tangent * (sin_alpha * std::cos(phi)) + bitangent * (sin_alpha * std::sin(phi)) + axis * cos_alpha;
+    }
+} // namespace sampling
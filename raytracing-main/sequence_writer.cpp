@@ -0,0 +1,231 @@
+//
+// sequence_writer.cpp
+//
+
+#include "sequence_writer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+
+#ifdef _WIN32
+#define NOMINMAX // This is to avoid the min and max macros from windows.h
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// \brief Writes a whole file in writes of at most write_size bytes, replacing the file if it exists
+    /// \return True if every byte was written
+    bool write_file(const std::string& path, const std::vector<uint8_t>& bytes, std::size_t write_size) {
+        write_size = std::max<std::size_t>(write_size, 4096);
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+                                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+
+        // The size is known up front, so the file system can give the file one contiguous extent. Sequential scan
+        // only tells the cache how the file is used
+        if (!bytes.empty()) {
+            FILE_ALLOCATION_INFO allocation{};
+            allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(bytes.size());
+            SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation));
+        }
+
+        bool ok = true;
+        for (std::size_t written = 0; ok && written < bytes.size();) {
+            DWORD done = 0;
+            const DWORD size = static_cast<DWORD>(std::min(write_size, bytes.size() - written));
+            ok = WriteFile(file, bytes.data() + written, size, &done, nullptr) && done > 0;
+            written += done;
+        }
+        return CloseHandle(file) && ok;
+#else
+        const int file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (file < 0)
+            return false;
+
+#ifdef __linux__
+        // The size is known up front, so the file system can give the file one contiguous extent
+        if (!bytes.empty())
+            posix_fallocate(file, 0, static_cast<off_t>(bytes.size()));
+#endif
+
+        bool ok = true;
+        for (std::size_t written = 0; ok && written < bytes.size();) {
+            const ssize_t done = ::write(file, bytes.data() + written, std::min(write_size, bytes.size() - written));
+            if (done > 0)
+                written += static_cast<std::size_t>(done);
+            else
+                ok = done < 0 && errno == EINTR;
+        }
+        return ::close(file) == 0 && ok;
+#endif
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const sequence_stats& stats) {
+    os << "Sequence writer: " << stats.written << " of " << stats.submitted << " frames written (" << stats.dropped
+       << " dropped, " << stats.failed << " failed), " << stats.bytes / (1024 * 1024) << " MB, waited "
+       << stats.blocked << " times for " << stats.blocked_ms << " ms, at most " << stats.max_queued
+       << " frames queued, " << stats.encode_ms << " ms encoding, " << stats.write_ms << " ms writing";
+    return os;
+}
+
+sequence_writer::~sequence_writer() { finish(); }
+
+bool sequence_writer::start(uint64_t first_frame) {
+    finish();
+
+    std::error_code error;
+    std::filesystem::create_directories(settings.directory, error);
+    if (!std::filesystem::is_directory(settings.directory, error))
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    active_ = settings;
+    next_frame_ = first_frame;
+    stats_ = sequence_stats();
+    for (std::size_t i = 0; i < std::max<std::size_t>(1, active_.threads); i++)
+        threads_.emplace_back(&sequence_writer::write_frames, this);
+    return true;
+}
+
+bool sequence_writer::running() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !threads_.empty();
+}
+
+bool sequence_writer::submit(const std::vector<uint32_t>& pixels, int width, int height) {
+    const std::size_t size = static_cast<std::size_t>(std::max(width, 0)) * std::max(height, 0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (threads_.empty() || stopping_ || size == 0 || pixels.size() < size)
+        return false;
+
+    stats_.submitted++;
+    const uint64_t number = next_frame_++;
+    const std::size_t capacity = std::max<std::size_t>(1, active_.queue_frames);
+    if (queue_.size() >= capacity) {
+        switch (active_.backpressure) {
+        case queue_backpressure::drop_newest:
+            stats_.dropped++;
+            return false;
+        case queue_backpressure::drop_oldest:
+            free_buffers_.push_back(std::move(queue_.front().pixels));
+            queue_.pop_front();
+            stats_.dropped++;
+            break;
+        default: {
+            const auto start = std::chrono::steady_clock::now();
+            stats_.blocked++;
+            frame_taken_.wait(lock, [&] { return queue_.size() < capacity || stopping_; });
+            stats_.blocked_ms += milliseconds_since(start);
+            if (stopping_) {
+                stats_.dropped++;
+                return false;
+            }
+            break;
+        }
+        }
+    }
+
+    queued_frame frame;
+    if (!free_buffers_.empty()) {
+        frame.pixels = std::move(free_buffers_.back());
+        free_buffers_.pop_back();
+    }
+    frame.pixels.assign(pixels.begin(), pixels.begin() + static_cast<std::ptrdiff_t>(size));
+    frame.width = width;
+    frame.height = height;
+    frame.number = number;
+    queue_.push_back(std::move(frame));
+    stats_.max_queued = std::max(stats_.max_queued, queue_.size());
+    lock.unlock();
+
+    frame_queued_.notify_one();
+    return true;
+}
+
+void sequence_writer::flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frame_taken_.wait(lock, [this] { return threads_.empty() || (queue_.empty() && in_progress_ == 0); });
+}
+
+void sequence_writer::finish() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (threads_.empty())
+            return;
+        stopping_ = true;
+    }
+    frame_queued_.notify_all();
+    frame_taken_.notify_all();
+
+    // The threads write what's left in the queue before they return
+    for (std::thread& thread : threads_)
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.clear();
+    stopping_ = false;
+}
+
+sequence_stats sequence_writer::get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+std::string sequence_writer::file_name(uint64_t number) const {
+    char digits[32];
+    std::snprintf(digits, sizeof(digits), "%06llu", static_cast<unsigned long long>(number));
+    return (std::filesystem::path(active_.directory) /
+            (active_.prefix + digits + "." + image_extension(active_.format)))
+        .string();
+}
+
+void sequence_writer::write_frames() {
+    // Every thread encodes into its own buffer, it grows to the size of a file once
+    std::vector<uint8_t> file;
+    while (true) {
+        queued_frame frame;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            frame_queued_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            frame = std::move(queue_.front());
+            queue_.pop_front();
+            in_progress_++;
+        }
+        frame_taken_.notify_all();
+
+        auto start = std::chrono::steady_clock::now();
+        file.clear();
+        encode_image(frame.pixels.data(), frame.width, frame.height, active_.format, file);
+        const double encode_ms = milliseconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        const bool written = write_file(file_name(frame.number), file, active_.write_size);
+        const double write_ms = milliseconds_since(start);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_progress_--;
+            stats_.written += written;
+            stats_.failed += !written;
+            stats_.bytes += written ? file.size() : 0;
+            stats_.encode_ms += encode_ms;
+            stats_.write_ms += write_ms;
+            free_buffers_.push_back(std::move(frame.pixels));
+        }
+        frame_taken_.notify_all();
+    }
+}
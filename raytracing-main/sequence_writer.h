@@ -0,0 +1,170 @@
+//
+// sequence_writer.h
+//
+
+#pragma once
+
+#include "image_encoding.h"
+
+#include <bardrix/bardrix.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// \brief What submitting a frame does when the queue is full
+enum class queue_backpressure {
+    /// \brief Wait until a frame is taken out of the queue, no frame is lost
+    block,
+
+    /// \brief Drop the new frame, the renderer never waits
+    drop_newest,
+
+    /// \brief Drop the oldest frame in the queue to make room, the renderer never waits and the newest frames are kept
+    drop_oldest
+};
+
+/// \brief Settings of the sequence writer, changed before start
+struct sequence_settings {
+    /// \brief The directory the frames are written to, it's made if it doesn't exist
+    std::string directory = "frames";
+
+    /// \brief The start of the file names, followed by the number of the frame and the extension
+    std::string prefix = "frame_";
+
+    /// \brief The format the frames are written in
+    image_format format = image_format::png;
+
+    /// \brief The most frames that wait in the queue, every one holds a copy of the frame
+    std::size_t queue_frames = 8;
+
+    /// \brief The amount of threads that encode and write the frames
+    std::size_t threads = 2;
+
+    /// \brief What happens to a frame that's submitted when the queue is full
+    queue_backpressure backpressure = queue_backpressure::block;
+
+    /// \brief The size of every write in bytes, a file is written in as few writes as this allows
+    std::size_t write_size = 4u << 20;
+};
+
+/// \brief How the frames of the sequence writer went
+struct sequence_stats {
+    /// \brief The amount of frames that were submitted, written, dropped because the queue was full, and couldn't be
+    ///        written
+    std::size_t submitted = 0, written = 0, dropped = 0, failed = 0;
+
+    /// \brief The amount of times submit waited for room in the queue, and for how long in milliseconds
+    std::size_t blocked = 0;
+    double blocked_ms = 0;
+
+    /// \brief The most frames that were in the queue at once
+    std::size_t max_queued = 0;
+
+    /// \brief The amount of bytes written, and milliseconds spent encoding and writing over all threads
+    uint64_t bytes = 0;
+    double encode_ms = 0, write_ms = 0;
+};
+
+/// \brief Prints the stats of the sequence writer
+std::ostream& operator<<(std::ostream& os, const sequence_stats& stats);
+
+/// \brief Writes a sequence of frames to numbered image files without making the renderer wait for the disk
+/// \details submit copies a frame into a buffer of a pool and queues it, the copy is the only work the renderer does.
+///          Dedicated threads take the frames out of the queue, encode every frame into one contiguous buffer and write
+///          it with a few large sequential writes. The queue holds at most settings.queue_frames frames, so the memory
+///          stays bounded when the disk can't keep up, and settings.backpressure decides if the renderer then waits
+///          or frames are dropped. Errors are counted in the stats, a file that can't be written doesn't stop the
+///          sequence.
+class sequence_writer {
+public:
+    /// \brief The settings used from the next start
+    sequence_settings settings;
+
+protected:
+    /// \brief A frame that waits to be written
+    struct queued_frame {
+        std::vector<uint32_t> pixels;
+        int width = 0, height = 0;
+        uint64_t number = 0;
+    };
+
+    /// \brief Guards everything below
+    mutable std::mutex mutex_;
+
+    /// \brief Wakes the threads when a frame is queued or the writer stops
+    std::condition_variable frame_queued_;
+
+    /// \brief Wakes submit and flush when a frame is taken out of the queue or written
+    std::condition_variable frame_taken_;
+
+    /// \brief The frames that wait, oldest first
+    std::deque<queued_frame> queue_;
+
+    /// \brief Buffers of frames that were written, reused so submit doesn't allocate
+    std::vector<std::vector<uint32_t>> free_buffers_;
+
+    /// \brief The amount of frames the threads are encoding or writing
+    std::size_t in_progress_ = 0;
+
+    /// \brief The number of the next frame
+    uint64_t next_frame_ = 0;
+
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+
+    /// \brief The directory, prefix and format of the running threads
+    sequence_settings active_;
+
+    sequence_stats stats_;
+
+public:
+    sequence_writer() = default;
+
+    /// \brief Destructor for the writer, writes the queued frames first
+    ~sequence_writer();
+
+    sequence_writer(const sequence_writer&) = delete;
+    sequence_writer& operator=(const sequence_writer&) = delete;
+
+    /// \brief Makes the directory and starts the threads, a writer that's running is finished first
+    /// \param first_frame The number of the first frame, the files are numbered from it
+    /// \return True if the directory exists and the threads started
+    /// \example sequence_writer writer; writer.settings.format = image_format::ppm; writer.start();
+    bool start(uint64_t first_frame = 0);
+
+    /// \brief Checks if the threads are running
+    NODISCARD bool running() const;
+
+    /// \brief Queues a frame to be written, it's copied so the buffer can be rendered into right away
+    /// \param pixels The pixels in ARGB, row by row
+    /// \param width The width of the frame
+    /// \param height The height of the frame
+    /// \return True if the frame was queued, false if it was dropped or the writer isn't running
+    /// \example writer.submit(buffer, width, height);
+    bool submit(const std::vector<uint32_t>& pixels, int width, int height);
+
+    /// \brief Waits until every queued frame is written
+    void flush();
+
+    /// \brief Writes the queued frames and stops the threads
+    void finish();
+
+    /// \brief Gets the stats since the writer started
+    NODISCARD sequence_stats get_stats() const;
+
+    /// \brief Gets the name of the file of a frame
+    /// \param number The number of the frame
+    /// \return The path, e.g. frames/frame_000042.png
+    NODISCARD std::string file_name(uint64_t number) const;
+
+protected:
+    /// \brief Takes frames out of the queue, encodes and writes them until the writer stops
+    void write_frames();
+}; // class sequence_writer
@@ -0,0 +1,246 @@
+//
+// shadow_batches.cpp
+//
+
+#include "shadow_batches.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHADOW_BATCHES_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+    /// \brief The receiver of a ray that doesn't end on a sphere
+    constexpr uint32_t no_receiver = std::numeric_limits<uint32_t>::max();
+
+    /// \brief Culling is widened by this fraction of the distance, so rounding can't cull a sphere a ray grazes
+    constexpr double cull_slack = 1e-9;
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const shadow_batch_stats& stats) {
+    os << "Shadow batches: " << stats.batches << " batches of " << stats.rays << " rays, "
+       << stats.average_candidates << " candidates on average";
+    return os;
+}
+
+void shadow_batches::build(const std::vector<secondary_ray>& rays, int width, int tile_size, std::size_t lights) {
+    stats_ = shadow_batch_stats();
+    stats_.rays = rays.size();
+    order_.resize(rays.size());
+    batches_.clear();
+    if (rays.empty() || width <= 0 || lights == 0)
+        return;
+
+    // The key of a ray is its tile followed by its light, so the rays of a tile stay close together
+    const auto tile = static_cast<uint32_t>(std::max(1, tile_size));
+    const auto tiles_x = (static_cast<uint32_t>(width) + tile - 1) / tile;
+    const auto light_count = static_cast<uint32_t>(lights), columns = static_cast<uint32_t>(width);
+    keys_.resize(rays.size());
+    uint32_t key_count = 0;
+    for (std::size_t i = 0; i < rays.size(); i++) {
+        const uint32_t x = rays[i].pixel % columns, y = rays[i].pixel / columns;
+        keys_[i] = ((y / tile) * tiles_x + x / tile) * light_count + rays[i].light;
+        key_count = std::max(key_count, keys_[i] + 1);
+    }
+
+    // Counting sort, every non-empty key is a batch
+    std::vector<uint32_t> offsets(static_cast<std::size_t>(key_count) + 1, 0);
+    for (uint32_t key : keys_)
+        offsets[key + 1]++;
+    for (uint32_t k = 0; k < key_count; k++) {
+        if (offsets[k + 1] > 0)
+            batches_.push_back({offsets[k], offsets[k] + offsets[k + 1]});
+        offsets[k + 1] += offsets[k];
+    }
+    for (std::size_t i = 0; i < rays.size(); i++)
+        order_[offsets[keys_[i]]++] = static_cast<uint32_t>(i);
+
+    stats_.batches = batches_.size();
+}
+
+void shadow_batches::trace(const std::vector<secondary_ray>& rays, const std::vector<sphere>& spheres,
+                           std::vector<uint8_t>& blocked, const occluder_lists* occluders) {
+    blocked.assign(rays.size(), 0);
+
+    std::size_t candidates = 0;
+    for (const batch& b : batches_) {
+        prepare(b, rays, spheres, occluders);
+        candidates += candidates_.size();
+        occlude(spheres);
+
+        for (uint32_t i = b.begin; i < b.end; i++)
+            blocked[order_[i]] = blocked_[i - b.begin];
+    }
+
+    if (!batches_.empty())
+        stats_.average_candidates = static_cast<double>(candidates) / static_cast<double>(batches_.size());
+}
+
+const std::vector<uint32_t>& shadow_batches::get_order() const { return order_; }
+
+const shadow_batch_stats& shadow_batches::get_stats() const { return stats_; }
+
+void shadow_batches::prepare(const batch& b, const std::vector<secondary_ray>& rays,
+                             const std::vector<sphere>& spheres, const occluder_lists* occluders) {
+    // The planes are padded to a whole packet, padding has no length so it never hits anything
+    count_ = b.end - b.begin;
+    const std::size_t count = count_, padded = (count + 1) & ~static_cast<std::size_t>(1);
+    for (std::vector<double>* plane : {&origin_x_, &origin_y_, &origin_z_, &direction_x_, &direction_y_,
+                                       &direction_z_, &length_})
+        plane->assign(padded, 0);
+    receivers_.assign(padded, no_receiver);
+    blocked_.assign(padded, 0);
+
+    bardrix::point3 low = rays[order_[b.begin]].ray.position, high = low;
+    bardrix::vector3 axis(0, 0, 0);
+    double max_length = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        const secondary_ray& r = rays[order_[b.begin + i]];
+        const bardrix::vector3& direction = r.ray.get_direction();
+        origin_x_[i] = r.ray.position.x;
+        origin_y_[i] = r.ray.position.y;
+        origin_z_[i] = r.ray.position.z;
+        direction_x_[i] = direction.x;
+        direction_y_[i] = direction.y;
+        direction_z_[i] = direction.z;
+        length_[i] = r.ray.get_length();
+        if (r.shape != nullptr)
+            receivers_[i] = static_cast<uint32_t>(r.shape - spheres.data());
+
+        low = {std::min(low.x, r.ray.position.x), std::min(low.y, r.ray.position.y),
+               std::min(low.z, r.ray.position.z)};
+        high = {std::max(high.x, r.ray.position.x), std::max(high.y, r.ray.position.y),
+                std::max(high.z, r.ray.position.z)};
+        axis += direction;
+        max_length = std::max(max_length, length_[i]);
+    }
+
+    // The frustum is a cone from the center of the origins (the light for point lights) around the average direction,
+    // widened by how far the origins are apart. Area light rays start on the light's surface
+    const bardrix::point3 apex((low.x + high.x) / 2, (low.y + high.y) / 2, (low.z + high.z) / 2);
+    double spread = 0;
+    for (std::size_t i = 0; i < count; i++)
+        spread = std::max(spread, apex.distance(bardrix::point3(origin_x_[i], origin_y_[i], origin_z_[i])));
+
+    // Without occluder lists every sphere is listed, else only the spheres that can shadow one of the receivers
+    listed_.assign(spheres.size(), occluders == nullptr);
+    for (std::size_t i = 0; occluders != nullptr && i < count; i++) {
+        if (i > 0 && receivers_[i] == receivers_[i - 1])
+            continue;
+        if (receivers_[i] == no_receiver) {
+            listed_.assign(spheres.size(), 1);
+            break;
+        }
+        for (uint32_t o : occluders->candidates(rays[order_[b.begin]].light, receivers_[i]))
+            listed_[o] = 1;
+    }
+
+    candidates_.clear();
+    const double axis_length = axis.length();
+    if (axis_length <= bardrix::epsilon) {
+        // The rays point everywhere, nothing can be culled by the frustum
+        for (std::size_t s = 0; s < spheres.size(); s++) {
+            if (listed_[s])
+                candidates_.push_back(static_cast<uint32_t>(s));
+        }
+        return;
+    }
+    axis = axis / axis_length;
+
+    double min_cosine = 1;
+    for (std::size_t i = 0; i < count; i++)
+        min_cosine = std::min(min_cosine,
+                              axis.x * direction_x_[i] + axis.y * direction_y_[i] + axis.z * direction_z_[i]);
+    const double cone = std::acos(std::clamp(min_cosine, -1.0, 1.0));
+
+    for (std::size_t s = 0; s < spheres.size(); s++) {
+        if (!listed_[s])
+            continue;
+
+        const bardrix::vector3 to_sphere = apex.vector_to(spheres[s].get_position());
+        const double distance = to_sphere.length();
+        const double radius = spheres[s].get_radius() + spread + cull_slack * (1 + distance);
+
+        // The sphere contains the apex, or lies within the cone before the rays end
+        bool candidate = distance <= radius;
+        if (!candidate && to_sphere.dot(axis) <= max_length + radius) {
+            const double angle = std::acos(std::clamp(to_sphere.dot(axis) / distance, -1.0, 1.0));
+            candidate = angle <= cone + std::asin(radius / distance);
+        }
+
+        if (candidate)
+            candidates_.push_back(static_cast<uint32_t>(s));
+    }
+}
+
+void shadow_batches::occlude(const std::vector<sphere>& spheres) {
+    const std::size_t padded = length_.size();
+    std::size_t remaining = count_;
+
+    // The same test as sphere::intersection: the ray is blocked if it enters the sphere between its start and end
+    for (uint32_t s : candidates_) {
+        if (remaining == 0)
+            break;
+
+        const bardrix::point3& center = spheres[s].get_position();
+        const double radius_squared = spheres[s].get_radius() * spheres[s].get_radius();
+
+#ifdef SHADOW_BATCHES_SSE2
+        const __m128d center_x = _mm_set1_pd(center.x), center_y = _mm_set1_pd(center.y),
+                      center_z = _mm_set1_pd(center.z), radius2 = _mm_set1_pd(radius_squared);
+        const __m128d zero = _mm_setzero_pd();
+        for (std::size_t i = 0; i < padded; i += 2) {
+            const __m128d direction_x = _mm_loadu_pd(&direction_x_[i]), direction_y = _mm_loadu_pd(&direction_y_[i]),
+                          direction_z = _mm_loadu_pd(&direction_z_[i]);
+            const __m128d to_x = _mm_sub_pd(center_x, _mm_loadu_pd(&origin_x_[i]));
+            const __m128d to_y = _mm_sub_pd(center_y, _mm_loadu_pd(&origin_y_[i]));
+            const __m128d to_z = _mm_sub_pd(center_z, _mm_loadu_pd(&origin_z_[i]));
+
+            const __m128d dot = _mm_add_pd(_mm_add_pd(_mm_mul_pd(to_x, direction_x), _mm_mul_pd(to_y, direction_y)),
+                                           _mm_mul_pd(to_z, direction_z));
+            const __m128d offset_x = _mm_sub_pd(_mm_mul_pd(direction_x, dot), to_x);
+            const __m128d offset_y = _mm_sub_pd(_mm_mul_pd(direction_y, dot), to_y);
+            const __m128d offset_z = _mm_sub_pd(_mm_mul_pd(direction_z, dot), to_z);
+            const __m128d distance2 = _mm_add_pd(
+                _mm_add_pd(_mm_mul_pd(offset_x, offset_x), _mm_mul_pd(offset_y, offset_y)),
+                _mm_mul_pd(offset_z, offset_z));
+
+            const __m128d inside = _mm_cmple_pd(distance2, radius2);
+            const __m128d distance = _mm_sub_pd(dot, _mm_sqrt_pd(_mm_max_pd(_mm_sub_pd(radius2, distance2), zero)));
+            const __m128d hit = _mm_and_pd(_mm_and_pd(inside, _mm_cmplt_pd(distance, _mm_loadu_pd(&length_[i]))),
+                                           _mm_cmpgt_pd(distance, zero));
+
+            const int mask = _mm_movemask_pd(hit);
+            for (int lane = 0; mask != 0 && lane < 2; lane++) {
+                if ((mask >> lane) & 1 && receivers_[i + lane] != s && !blocked_[i + lane]) {
+                    blocked_[i + lane] = 1;
+                    remaining--;
+                }
+            }
+        }
+#else
+        for (std::size_t i = 0; i < padded; i++) {
+            if (blocked_[i] || receivers_[i] == s)
+                continue;
+
+            const double to_x = center.x - origin_x_[i], to_y = center.y - origin_y_[i], to_z = center.z - origin_z_[i];
+            const double dot = to_x * direction_x_[i] + to_y * direction_y_[i] + to_z * direction_z_[i];
+            const double offset_x = direction_x_[i] * dot - to_x, offset_y = direction_y_[i] * dot - to_y,
+                         offset_z = direction_z_[i] * dot - to_z;
+            const double distance2 = offset_x * offset_x + offset_y * offset_y + offset_z * offset_z;
+            if (distance2 > radius_squared)
+                continue;
+
+            const double distance = dot - std::sqrt(radius_squared - distance2);
+            if (distance < length_[i] && distance > 0) {
+                blocked_[i] = 1;
+                remaining--;
+            }
+        }
+#endif
+    }
+}
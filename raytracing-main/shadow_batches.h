@@ -0,0 +1,102 @@
+//
+// shadow_batches.h
+//
+
+#pragma once
+
+#include "occluder_lists.h"
+#include "ray_binning.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief How the shadow rays of the last frame were batched and how many spheres every batch had to test
+struct shadow_batch_stats {
+    /// \brief The amount of batches and rays
+    std::size_t batches = 0, rays = 0;
+
+    /// \brief The average amount of spheres left after culling against the frustum of a batch
+    double average_candidates = 0;
+};
+
+/// \brief Prints the stats of the shadow batches
+std::ostream& operator<<(std::ostream& os, const shadow_batch_stats& stats);
+
+/// \brief Groups shadow rays per light per screen tile and traces every group as one packet
+/// \details The shadow rays of one light that end in one tile start at (or close to) the light and point into a
+///          narrow cone. The spheres are culled against that cone once per batch, the rays of the batch are then
+///          tested against the few spheres that are left in SoA packets, 2 rays at a time with SSE2. The culling is
+///          conservative and the packet test is the same as sphere::intersection, so the result is the same as
+///          tracing every ray by itself.
+class shadow_batches {
+protected:
+    /// \brief A run of rays in order_ that belong to one light and one tile
+    struct batch {
+        uint32_t begin, end;
+    };
+
+    /// \brief The batch key of every ray
+    std::vector<uint32_t> keys_;
+
+    /// \brief The indices of the rays, batch after batch
+    std::vector<uint32_t> order_;
+
+    /// \brief The batches in order_
+    std::vector<batch> batches_;
+
+    /// \brief The amount of rays in the batch that is traced, the planes are padded to a whole packet
+    std::size_t count_ = 0;
+
+    /// \brief The rays of the batch that is traced, as separate planes so they can be loaded into SIMD registers
+    std::vector<double> origin_x_, origin_y_, origin_z_, direction_x_, direction_y_, direction_z_, length_;
+
+    /// \brief The index of the sphere every ray of the batch ends on, it can't block its own ray
+    std::vector<uint32_t> receivers_;
+
+    /// \brief Whether every ray of the batch is blocked
+    std::vector<uint8_t> blocked_;
+
+    /// \brief The spheres that can block a ray of the batch that is traced
+    std::vector<uint32_t> candidates_;
+
+    /// \brief Per sphere, whether it's in the occluder list of a receiver of the batch that is traced
+    std::vector<uint8_t> listed_;
+
+    /// \brief The stats of the last frame
+    shadow_batch_stats stats_;
+
+public:
+    /// \brief Sorts rays into batches of one light in one tile, the sort is stable so a batch is in pixel order
+    /// \param rays The rays to batch
+    /// \param width The width of the frame, to find the tile of a ray's pixel
+    /// \param tile_size The size of a tile in pixels
+    /// \param lights The amount of lights, including area lights
+    /// \example batches.build(shadow_rays, width, 16, lights.size() + area_lights.size());
+    void build(const std::vector<secondary_ray>& rays, int width, int tile_size, std::size_t lights);
+
+    /// \brief Traces every batch, the rays must be the ones the batches were built from
+    /// \param rays The rays
+    /// \param spheres The spheres that can block the rays, a ray's own shape (if any) is skipped
+    /// \param blocked Whether every ray is blocked, in the order of rays (output)
+    /// \param occluders The occluder lists of the lights and spheres, if given a batch only tests the spheres that are
+    ///        both in its frustum and in the list of one of its receivers
+    /// \example batches.trace(shadow_rays, spheres, blocked, &occluders); if (!blocked[i]) { ... }
+    void trace(const std::vector<secondary_ray>& rays, const std::vector<sphere>& spheres,
+               std::vector<uint8_t>& blocked, const occluder_lists* occluders = nullptr);
+
+    /// \brief Gets the indices of the rays in batched order
+    NODISCARD const std::vector<uint32_t>& get_order() const;
+
+    /// \brief Gets how the rays of the last frame were batched
+    NODISCARD const shadow_batch_stats& get_stats() const;
+
+protected:
+    /// \brief Loads the rays of a batch into the planes and finds the spheres inside its frustum
+    void prepare(const batch& b, const std::vector<secondary_ray>& rays, const std::vector<sphere>& spheres,
+                 const occluder_lists* occluders);
+
+    /// \brief Tests the loaded rays against the candidates, sets blocked_
+    void occlude(const std::vector<sphere>& spheres);
+}; // class shadow_batches
@@ -0,0 +1,94 @@
+//
+// shadow_cache.cpp
+//
+
+#include "shadow_cache.h"
+#include "fingerprint.h"
+
+#include <algorithm>
+
+std::ostream& operator<<(std::ostream& os, const shadow_cache_stats& stats) {
+    const double percentage = stats.lookups == 0 ? 0 : 100.0 * static_cast<double>(stats.cached) / stats.lookups;
+    os << "Shadow cache: " << stats.cached << " of " << stats.lookups << " lookups cached (" << percentage
+       << "%), " << stats.invalidated_lights << " lights invalidated";
+    return os;
+}
+
+void shadow_cache::prepare(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights) {
+    stats_ = shadow_cache_stats();
+
+    const uint64_t geometry = fingerprint::of(spheres);
+    if (geometry != geometry_ || surfaces_.size() != spheres.size()) {
+        geometry_ = geometry;
+        surfaces_.resize(spheres.size());
+        for (std::size_t i = 0; i < spheres.size(); i++)
+            surfaces_[i].grid = surface_grid(spheres[i].get_radius(), texels_per_unit);
+        clear();
+    }
+
+    // A light that changed only loses its own bit, the other lights stay cached
+    lights_.resize(std::min(lights.size(), max_lights), 0);
+    uint32_t changed = 0;
+    for (std::size_t l = 0; l < lights_.size(); l++) {
+        const uint64_t light = fingerprint::of(lights[l]);
+        if (light != lights_[l]) {
+            lights_[l] = light;
+            changed |= 1u << l;
+            stats_.invalidated_lights++;
+        }
+    }
+
+    if (changed == 0)
+        return;
+
+    for (surface& s : surfaces_)
+        for (uint32_t& known : s.known)
+            known &= ~changed;
+}
+
+shadow_cache::bits shadow_cache::lookup(std::size_t index, const sphere& shape, const bardrix::point3& point) {
+    stats_.lookups += lights_.size();
+    if (index >= surfaces_.size() || lights_.empty())
+        return {};
+
+    const surface& s = surfaces_[index];
+    int column, row;
+    s.grid.locate(shape, point, column, row);
+
+    const std::size_t center = s.grid.index(column, row);
+    const std::size_t neighbours[] = {s.grid.index(column - 1, row), s.grid.index(column + 1, row),
+                                      s.grid.index(column, row - 1), s.grid.index(column, row + 1)};
+
+    // The texel and its neighbours have to be known and agree, otherwise a shadow edge may run through the texel
+    bits result{s.known[center], s.visible[center]};
+    for (std::size_t texel : neighbours)
+        result.known &= s.known[texel] & ~(s.visible[texel] ^ result.visible);
+
+    for (uint32_t known = result.known; known != 0; known &= known - 1)
+        stats_.cached++;
+    return result;
+}
+
+void shadow_cache::store(std::size_t index, const sphere& shape, const bardrix::point3& point, std::size_t light,
+                         bool visible) {
+    if (light >= lights_.size() || index >= surfaces_.size())
+        return;
+
+    surface& s = surfaces_[index];
+    int column, row;
+    s.grid.locate(shape, point, column, row);
+
+    const std::size_t texel = s.grid.index(column, row);
+    const uint32_t bit = 1u << light;
+    s.known[texel] |= bit;
+    s.visible[texel] = visible ? s.visible[texel] | bit : s.visible[texel] & ~bit;
+}
+
+void shadow_cache::clear() {
+    for (surface& s : surfaces_) {
+        s.known.assign(s.grid.size(), 0);
+        s.visible.assign(s.grid.size(), 0);
+    }
+}
+
+const shadow_cache_stats& shadow_cache::get_stats() const { return stats_; }
@@ -0,0 +1,103 @@
+//
+// shadow_cache.h
+//
+
+#pragma once
+
+#include "sphere.h"
+#include "surface_grid.h"
+
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief Lookups of the shadow cache in the last frame
+struct shadow_cache_stats {
+    /// \brief The amount of lookups, one per light per surface point
+    std::size_t lookups = 0;
+
+    /// \brief The amount of lookups that were answered without tracing a shadow ray
+    std::size_t cached = 0;
+
+    /// \brief The amount of lights whose visibility was cleared because they changed
+    std::size_t invalidated_lights = 0;
+};
+
+/// \brief Prints the stats of the shadow cache
+std::ostream& operator<<(std::ostream& os, const shadow_cache_stats& stats);
+
+/// \brief Caches whether the lights reach the surface of every sphere, the camera doesn't matter for shadows so the
+///        cache stays valid while the camera moves
+/// \details Every sphere has a surface_grid with a known and a visible bit per light per texel (the first 32 lights
+///          only). A lookup is only answered from the cache if the texel and its 4 neighbours are known and agree,
+///          so points near the edge of a shadow are traced and the shadows stay sharp. It's an approximation: a
+///          texel stands for every point inside it, so a shadow smaller than a texel and its neighbours (a thin
+///          sliver, a small far occluder) can be missed, and a cached frame can differ from a traced one in such
+///          pixels. Moving a light clears its bits, moving a sphere clears everything.
+class shadow_cache {
+public:
+    /// \brief The amount of lights that fit in the bits of a texel
+    static constexpr std::size_t max_lights = 32;
+
+    /// \brief The amount of texels per world unit along the equator of a sphere, large spheres get fewer (see
+    ///        surface_grid::max_columns)
+    double texels_per_unit = 128;
+
+    /// \brief What the cache knows about the lights at a surface point, bit l belongs to light l
+    struct bits {
+        /// \brief The lights that are cached, the others are unknown (or near a shadow edge) and have to be traced
+        uint32_t known = 0;
+
+        /// \brief The lights that reach the point, only valid for the known lights
+        uint32_t visible = 0;
+    };
+
+protected:
+    /// \brief The bits of a sphere
+    struct surface {
+        surface_grid grid;
+        std::vector<uint32_t> known, visible;
+    };
+
+    /// \brief The bits of every sphere, in the same order as the spheres
+    std::vector<surface> surfaces_;
+
+    /// \brief The fingerprint of the spheres the bits were stored with
+    uint64_t geometry_ = 0;
+
+    /// \brief The fingerprint of every light the bits were stored with
+    std::vector<uint64_t> lights_;
+
+    /// \brief The stats of the current frame
+    shadow_cache_stats stats_;
+
+public:
+    /// \brief Starts a new frame, clears the bits of the lights and spheres that changed
+    /// \param spheres The spheres in the scene
+    /// \param lights The lights in the scene
+    void prepare(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights);
+
+    /// \brief Looks up which lights reach a surface point
+    /// \param index The index of the sphere the point is on
+    /// \param shape The sphere the point is on
+    /// \param point The point on the surface
+    /// \return The known and visible lights
+    /// \example if ((cache.lookup(index, *hit.shape, hit.point).known & (1u << l)) == 0) { /* trace */ }
+    NODISCARD bits lookup(std::size_t index, const sphere& shape, const bardrix::point3& point);
+
+    /// \brief Stores whether a light reaches a surface point, after its shadow ray was traced
+    /// \param index The index of the sphere the point is on
+    /// \param shape The sphere the point is on
+    /// \param point The point on the surface
+    /// \param light The index of the light
+    /// \param visible Whether the light reaches the point
+    void store(std::size_t index, const sphere& shape, const bardrix::point3& point, std::size_t light, bool visible);
+
+    /// \brief Removes everything from the cache
+    void clear();
+
+    /// \brief Gets the stats of the current frame
+    NODISCARD const shadow_cache_stats& get_stats() const;
+}; // class shadow_cache
@@ -0,0 +1,155 @@
+//
+// shadow_cube_maps.cpp
+//
+
+#include "shadow_cube_maps.h"
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+namespace {
+    /// \brief The length of the rays that render the cube maps, nothing further away casts a shadow
+    constexpr double max_depth = 1000;
+
+    /// \brief Gets the direction through a point on a face, s and t are in [-1, 1]
+    bardrix::vector3 direction_of(int face, double s, double t) {
+        switch (face) {
+        case 0: return {1, -t, -s};
+        case 1: return {-1, -t, s};
+        case 2: return {s, 1, t};
+        case 3: return {s, -1, -t};
+        case 4: return {s, -t, 1};
+        default: return {-s, -t, -1};
+        }
+    }
+
+    /// \brief Gets the face a direction points at and the position on that face, the inverse of direction_of
+    void locate(const bardrix::vector3& d, int& face, double& s, double& t) {
+        const double ax = std::fabs(d.x), ay = std::fabs(d.y), az = std::fabs(d.z);
+        if (ax >= ay && ax >= az) {
+            face = d.x > 0 ? 0 : 1;
+            s = (d.x > 0 ? -d.z : d.z) / ax;
+            t = -d.y / ax;
+        } else if (ay >= az) {
+            face = d.y > 0 ? 2 : 3;
+            s = d.x / ay;
+            t = d.y > 0 ? d.z / ay : -d.z / ay;
+        } else {
+            face = d.z > 0 ? 4 : 5;
+            s = (d.z > 0 ? d.x : -d.x) / az;
+            t = -d.y / az;
+        }
+    }
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const cube_map_stats& stats) {
+    os << "Shadow cube maps: " << stats.rebuilt << " rebuilt in " << stats.build_ms << " ms, " << stats.lookups
+       << " lookups";
+    return os;
+}
+
+void shadow_cube_maps::update(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights) {
+    stats_ = cube_map_stats();
+
+    const uint64_t geometry = fingerprint::of(spheres);
+    if (geometry != geometry_ || lights.size() != maps_.size() || settings.resolution != resolution_) {
+        geometry_ = geometry;
+        resolution_ = settings.resolution;
+        maps_.assign(lights.size(), {});
+        positions_.resize(lights.size());
+        light_fingerprints_.assign(lights.size(), 0);
+    }
+
+    // The intensity and color of a light don't change its shadows, only its position does
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t l = 0; l < lights.size(); l++) {
+        const uint64_t position = fingerprint::of(lights[l].position);
+        if (position == light_fingerprints_[l])
+            continue;
+
+        light_fingerprints_[l] = position;
+        positions_[l] = lights[l].position;
+        render(l, spheres);
+        stats_.rebuilt++;
+    }
+    if (stats_.rebuilt > 0)
+        stats_.build_ms = milliseconds_since(start);
+}
+
+double shadow_cube_maps::visibility(std::size_t light, const bardrix::point3& point, std::size_t receiver) {
+    stats_.lookups++;
+
+    const bardrix::vector3 direction = positions_[light].vector_to(point);
+    const double distance = direction.length();
+
+    int face;
+    double s, t;
+    locate(direction, face, s, t);
+
+    const int size = resolution_;
+    const texel* texels = maps_[light].data() + static_cast<std::size_t>(face) * size * size;
+    const int column = std::clamp(static_cast<int>((s + 1) * 0.5 * size), 0, size - 1);
+    const int row = std::clamp(static_cast<int>((t + 1) * 0.5 * size), 0, size - 1);
+
+    // A texel covers about 2 / size radians, the bias grows with the distance so it's the same amount of texels
+    const double bias = settings.bias * distance * 2.0 / size;
+    const auto compare = static_cast<float>(distance - bias);
+
+    // Percentage-closer filtering, texels outside the face are clamped to its edge
+    int lit = 0, count = 0;
+    for (int dy = -settings.pcf_radius; dy <= settings.pcf_radius; dy++) {
+        const int y = std::clamp(row + dy, 0, size - 1);
+        for (int dx = -settings.pcf_radius; dx <= settings.pcf_radius; dx++) {
+            const int x = std::clamp(column + dx, 0, size - 1);
+            const texel& sample = texels[static_cast<std::size_t>(y) * size + x];
+            lit += (sample.first_sphere == receiver ? sample.second : sample.first) >= compare;
+            count++;
+        }
+    }
+
+    return static_cast<double>(lit) / count;
+}
+
+const cube_map_stats& shadow_cube_maps::get_stats() const { return stats_; }
+
+void shadow_cube_maps::render(std::size_t light, const std::vector<sphere>& spheres) {
+    const int size = resolution_;
+    std::vector<texel>& texels = maps_[light];
+    texels.resize(6 * static_cast<std::size_t>(size) * size);
+
+    constexpr float nothing = std::numeric_limits<float>::max();
+    std::size_t index = 0;
+    for (int face = 0; face < 6; face++) {
+        for (int row = 0; row < size; row++) {
+            const double t = (row + 0.5) * 2.0 / size - 1;
+            for (int column = 0; column < size; column++) {
+                const double s = (column + 0.5) * 2.0 / size - 1;
+                const bardrix::ray ray(positions_[light], direction_of(face, s, t).normalized(), max_depth);
+
+                // Keep the 2 closest spheres
+                texel result{nothing, nothing, static_cast<uint32_t>(spheres.size())};
+                for (std::size_t i = 0; i < spheres.size(); i++) {
+                    auto intersection = spheres[i].intersection(ray);
+                    if (!intersection.has_value())
+                        continue;
+
+                    const auto distance = static_cast<float>(ray.position.distance(intersection.value()));
+                    if (distance < result.first) {
+                        result.second = result.first;
+                        result.first = distance;
+                        result.first_sphere = static_cast<uint32_t>(i);
+                    } else if (distance < result.second)
+                        result.second = distance;
+                }
+                texels[index++] = result;
+            }
+        }
+    }
+}
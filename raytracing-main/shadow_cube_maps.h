@@ -0,0 +1,104 @@
+//
+// shadow_cube_maps.h
+//
+
+#pragma once
+
+#include "sphere.h"
+
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief The resolution and filtering of the shadow cube maps
+struct cube_map_settings {
+    /// \brief The amount of texels along the edge of every face
+    int resolution = 256;
+
+    /// \brief A point is only shadowed if it's further than the stored depth plus this bias, in texels at the point's
+    ///        distance
+    double bias = 0.5;
+
+    /// \brief Percentage-closer filtering compares this many texels around the point in every direction, 0 is a
+    ///        single hard comparison
+    int pcf_radius = 1;
+};
+
+/// \brief Timings of the cube maps in the last frame
+struct cube_map_stats {
+    /// \brief The amount of cube maps that were rendered because their light or the spheres changed
+    std::size_t rebuilt = 0;
+
+    /// \brief The time it took to render them
+    double build_ms = 0;
+
+    /// \brief The amount of lookups
+    std::size_t lookups = 0;
+};
+
+/// \brief Prints the stats of the cube maps
+std::ostream& operator<<(std::ostream& os, const cube_map_stats& stats);
+
+/// \brief Omnidirectional shadow maps, the distance to the closest sphere in every direction around every point light
+/// \details A cube map is rendered by casting a ray through every texel of its 6 faces. Shading then compares the
+///          distance of a point to the light with the depth in the direction of the point, with percentage-closer
+///          filtering for soft edges, instead of tracing a shadow ray. Every texel stores the closest sphere and the
+///          depth of the closest other sphere too: a sphere can't shadow itself (it's convex, the back is handled by
+///          the lighting), so a point on the closest sphere compares with the other depth. That removes shadow acne
+///          without a large bias. The shadows are approximate (their edges follow the texels), in exchange a lookup
+///          doesn't depend on the amount of spheres. Only the cube maps of lights that moved are rendered again, all
+///          of them if a sphere changed.
+class shadow_cube_maps {
+public:
+    /// \brief The resolution and filtering
+    cube_map_settings settings;
+
+protected:
+    /// \brief A texel of a cube map
+    struct texel {
+        /// \brief The distance to the closest sphere and to the closest sphere that isn't that one
+        float first = 0, second = 0;
+
+        /// \brief The index of the closest sphere
+        uint32_t first_sphere = 0;
+    };
+
+    /// \brief The texels of the 6 faces of every light, face after face
+    std::vector<std::vector<texel>> maps_;
+
+    /// \brief The positions of the lights
+    std::vector<bardrix::point3> positions_;
+
+    /// \brief The fingerprint of every light and of the spheres the maps were rendered with
+    std::vector<uint64_t> light_fingerprints_;
+    uint64_t geometry_ = 0;
+
+    /// \brief The resolution the maps were rendered with
+    int resolution_ = 0;
+
+    /// \brief The stats of the current frame
+    cube_map_stats stats_;
+
+public:
+    /// \brief Renders the cube maps of the lights that changed
+    /// \param spheres The spheres in the scene
+    /// \param lights The point lights in the scene
+    void update(const std::vector<sphere>& spheres, const std::vector<bardrix::light>& lights);
+
+    /// \brief Gets the fraction of a light that reaches a point
+    /// \param light The index of the light
+    /// \param point The point that is lit
+    /// \param receiver The index of the sphere the point is on
+    /// \return The visibility [0, 1], filtered over the texels around the point
+    /// \example double intensity = calculate_light_intensity(...) * cube_maps.visibility(l, hit.point, index);
+    NODISCARD double visibility(std::size_t light, const bardrix::point3& point, std::size_t receiver);
+
+    /// \brief Gets the stats of the current frame
+    NODISCARD const cube_map_stats& get_stats() const;
+
+protected:
+    /// \brief Renders the cube map of a light
+    void render(std::size_t light, const std::vector<sphere>& spheres);
+}; // class shadow_cube_maps
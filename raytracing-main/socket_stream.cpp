@@ -0,0 +1,429 @@
+//
+// socket_stream.cpp
+//
+
+#include "socket_stream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX // This is to avoid the min and max macros from windows.h
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <afunix.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    /// \brief The header of a message: the type and the size of the payload, both little endian
+    constexpr std::size_t header_size = 8;
+
+#ifdef _WIN32
+    using native_socket = SOCKET;
+    using pollfd = WSAPOLLFD;
+    constexpr native_socket invalid_native = INVALID_SOCKET;
+
+    /// \brief Winsock has to be started once before any socket is made
+    void start_sockets() {
+        static std::once_flag started;
+        std::call_once(started, [] {
+            WSADATA data;
+            WSAStartup(MAKEWORD(2, 2), &data);
+        });
+    }
+
+    void close_native(native_socket socket) { closesocket(socket); }
+
+    int poll_native(pollfd* fds, std::size_t count, int timeout_ms) {
+        return WSAPoll(fds, static_cast<ULONG>(count), timeout_ms);
+    }
+
+    /// \brief Sends at most a chunk, a single send of a huge buffer can fail on Windows
+    int send_some(native_socket socket, const char* data, std::size_t bytes) {
+        return send(socket, data, static_cast<int>(std::min<std::size_t>(bytes, 1 << 20)), 0);
+    }
+
+    int receive_some(native_socket socket, char* data, std::size_t bytes) {
+        return recv(socket, data, static_cast<int>(std::min<std::size_t>(bytes, 1 << 20)), 0);
+    }
+#else
+    using native_socket = int;
+    constexpr native_socket invalid_native = -1;
+
+    void start_sockets() {}
+
+    void close_native(native_socket socket) { ::close(socket); }
+
+    int poll_native(pollfd* fds, std::size_t count, int timeout_ms) {
+        return ::poll(fds, static_cast<nfds_t>(count), timeout_ms);
+    }
+
+    /// \brief Sends without raising SIGPIPE when the peer is gone, the failed send is enough
+    ssize_t send_some(native_socket socket, const char* data, std::size_t bytes) {
+#ifdef MSG_NOSIGNAL
+        return send(socket, data, bytes, MSG_NOSIGNAL);
+#else
+        return send(socket, data, bytes, 0);
+#endif
+    }
+
+    ssize_t receive_some(native_socket socket, char* data, std::size_t bytes) {
+        return recv(socket, data, bytes, 0);
+    }
+#endif
+
+    native_socket native(std::intptr_t handle) { return static_cast<native_socket>(handle); }
+
+    /// \brief Waits for a single socket, accept and wait_readable both need it
+    bool wait_native(std::intptr_t handle, int timeout_ms) {
+        pollfd fd{};
+        fd.fd = native(handle);
+        fd.events = POLLIN;
+        return poll_native(&fd, 1, timeout_ms) > 0;
+    }
+
+    /// \brief Makes a TCP socket send small messages right away instead of waiting for more to send with them
+    void set_no_delay(native_socket socket) {
+        int flag = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag));
+    }
+
+    /// \brief A socket address parsed from "host:port" or "unix:path"
+    struct parsed_address {
+        bool is_unix = false;
+        std::string host, port, path;
+    };
+
+    bool parse_address(const std::string& address, parsed_address& parsed) {
+        if (address.rfind("unix:", 0) == 0) {
+            parsed.is_unix = true;
+            parsed.path = address.substr(5);
+            return !parsed.path.empty() && parsed.path.size() < sizeof(sockaddr_un::sun_path);
+        }
+
+        const std::size_t colon = address.rfind(':');
+        if (colon == std::string::npos || colon + 1 == address.size())
+            return false;
+
+        parsed.host = address.substr(0, colon);
+        parsed.port = address.substr(colon + 1);
+        // [::1]:5000 is an IPv6 host with a port
+        if (parsed.host.size() >= 2 && parsed.host.front() == '[' && parsed.host.back() == ']')
+            parsed.host = parsed.host.substr(1, parsed.host.size() - 2);
+        return true;
+    }
+
+    sockaddr_un unix_address(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    void write_u32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; i++)
+            out[i] = static_cast<uint8_t>(value >> (i * 8));
+    }
+
+    uint32_t read_u32(const uint8_t* in) {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; i++)
+            value |= static_cast<uint32_t>(in[i]) << (i * 8);
+        return value;
+    }
+} // namespace
+
+socket_stream::socket_stream(std::intptr_t handle) : handle_(handle) {}
+
+socket_stream::~socket_stream() { close(); }
+
+socket_stream::socket_stream(socket_stream&& other) noexcept : handle_(other.handle_) { other.handle_ = -1; }
+
+socket_stream& socket_stream::operator=(socket_stream&& other) noexcept {
+    if (this != &other) {
+        close();
+        handle_ = other.handle_;
+        other.handle_ = -1;
+    }
+    return *this;
+}
+
+socket_stream socket_stream::connect(const std::string& address) {
+    start_sockets();
+
+    parsed_address parsed;
+    if (!parse_address(address, parsed))
+        return {};
+
+    if (parsed.is_unix) {
+        const native_socket socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket == invalid_native)
+            return {};
+
+        const sockaddr_un target = unix_address(parsed.path);
+        if (::connect(socket, reinterpret_cast<const sockaddr*>(&target), sizeof(target)) != 0) {
+            close_native(socket);
+            return {};
+        }
+        return socket_stream(static_cast<std::intptr_t>(socket));
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results = nullptr;
+    if (getaddrinfo(parsed.host.c_str(), parsed.port.c_str(), &hints, &results) != 0)
+        return {};
+
+    // The first address that accepts the connection wins, localhost may resolve to IPv6 and IPv4
+    socket_stream stream;
+    for (const addrinfo* result = results; result != nullptr && !stream.valid(); result = result->ai_next) {
+        const native_socket socket = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (socket == invalid_native)
+            continue;
+
+        if (::connect(socket, result->ai_addr, static_cast<int>(result->ai_addrlen)) != 0) {
+            close_native(socket);
+            continue;
+        }
+        set_no_delay(socket);
+        stream = socket_stream(static_cast<std::intptr_t>(socket));
+    }
+    freeaddrinfo(results);
+    return stream;
+}
+
+bool socket_stream::valid() const { return handle_ != -1; }
+
+std::intptr_t socket_stream::handle() const { return handle_; }
+
+bool socket_stream::send_all(const void* data, std::size_t bytes) {
+    const char* bytes_left = static_cast<const char*>(data);
+    while (valid() && bytes > 0) {
+        const auto sent = send_some(native(handle_), bytes_left, bytes);
+        if (sent <= 0) {
+            close();
+            return false;
+        }
+        bytes_left += sent;
+        bytes -= static_cast<std::size_t>(sent);
+    }
+    return valid();
+}
+
+bool socket_stream::receive_all(void* data, std::size_t bytes) {
+    char* bytes_left = static_cast<char*>(data);
+    while (valid() && bytes > 0) {
+        const auto received = receive_some(native(handle_), bytes_left, bytes);
+        if (received <= 0) {
+            close();
+            return false;
+        }
+        bytes_left += received;
+        bytes -= static_cast<std::size_t>(received);
+    }
+    return valid();
+}
+
+bool socket_stream::send_message(uint32_t type, const std::vector<uint8_t>& payload) {
+    uint8_t header[header_size];
+    write_u32(header, type);
+    write_u32(header + 4, static_cast<uint32_t>(payload.size()));
+    return send_all(header, header_size) && send_all(payload.data(), payload.size());
+}
+
+bool socket_stream::receive_message(uint32_t& type, std::vector<uint8_t>& payload, std::size_t max_size) {
+    uint8_t header[header_size];
+    if (!receive_all(header, header_size))
+        return false;
+
+    type = read_u32(header);
+    const std::size_t size = read_u32(header + 4);
+    if (size > max_size) {
+        close();
+        return false;
+    }
+
+    payload.resize(size);
+    return receive_all(payload.data(), size);
+}
+
+bool socket_stream::wait_readable(int timeout_ms) const {
+    return valid() && wait_native(handle_, timeout_ms);
+}
+
+void socket_stream::set_timeout(int timeout_ms) {
+    if (!valid())
+        return;
+
+#ifdef _WIN32
+    const DWORD timeout = static_cast<DWORD>(timeout_ms);
+#else
+    timeval timeout{};
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+#endif
+    setsockopt(native(handle_), SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    setsockopt(native(handle_), SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+void socket_stream::close() {
+    if (!valid())
+        return;
+
+    close_native(native(handle_));
+    handle_ = -1;
+}
+
+socket_listener::~socket_listener() { close(); }
+
+bool socket_listener::listen(const std::string& address) {
+    close();
+    start_sockets();
+
+    parsed_address parsed;
+    if (!parse_address(address, parsed))
+        return false;
+
+    native_socket socket = invalid_native;
+    if (parsed.is_unix) {
+        socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket == invalid_native)
+            return false;
+
+        // A socket file left behind by a listener that crashed would make the bind fail
+#ifdef _WIN32
+        DeleteFileA(parsed.path.c_str());
+#else
+        unlink(parsed.path.c_str());
+#endif
+        const sockaddr_un local = unix_address(parsed.path);
+        if (bind(socket, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0) {
+            close_native(socket);
+            return false;
+        }
+        unix_path_ = parsed.path;
+        address_ = address;
+    }
+    else {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo* results = nullptr;
+        if (getaddrinfo(parsed.host.empty() ? nullptr : parsed.host.c_str(), parsed.port.c_str(), &hints,
+                        &results) != 0)
+            return false;
+
+        for (const addrinfo* result = results; result != nullptr; result = result->ai_next) {
+            socket = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+            if (socket == invalid_native)
+                continue;
+
+            int reuse = 1;
+            setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+            if (bind(socket, result->ai_addr, static_cast<int>(result->ai_addrlen)) == 0)
+                break;
+
+            close_native(socket);
+            socket = invalid_native;
+        }
+        freeaddrinfo(results);
+        if (socket == invalid_native)
+            return false;
+
+        // Port 0 lets the system pick a free port, the address has to tell the other side which one
+        sockaddr_storage local{};
+        socklen_t length = sizeof(local);
+        getsockname(socket, reinterpret_cast<sockaddr*>(&local), &length);
+        const uint16_t port = local.ss_family == AF_INET6
+                                  ? reinterpret_cast<const sockaddr_in6*>(&local)->sin6_port
+                                  : reinterpret_cast<const sockaddr_in*>(&local)->sin_port;
+        const std::string host = parsed.host.empty() ? "127.0.0.1" : parsed.host;
+        const bool bracket = host.find(':') != std::string::npos;
+        address_ = (bracket ? "[" + host + "]" : host) + ":" + std::to_string(ntohs(port));
+    }
+
+    if (::listen(socket, SOMAXCONN) != 0) {
+        close_native(socket);
+        unix_path_.clear();
+        address_.clear();
+        return false;
+    }
+    handle_ = static_cast<std::intptr_t>(socket);
+    return true;
+}
+
+const std::string& socket_listener::address() const { return address_; }
+
+socket_stream socket_listener::accept(int timeout_ms) {
+    if (handle_ == -1 || !wait_native(handle_, timeout_ms))
+        return {};
+
+    const native_socket socket = ::accept(native(handle_), nullptr, nullptr);
+    if (socket == invalid_native)
+        return {};
+
+    if (unix_path_.empty())
+        set_no_delay(socket);
+    return socket_stream(static_cast<std::intptr_t>(socket));
+}
+
+void socket_listener::close() {
+    if (handle_ != -1) {
+        close_native(native(handle_));
+        handle_ = -1;
+    }
+    if (!unix_path_.empty()) {
+#ifdef _WIN32
+        DeleteFileA(unix_path_.c_str());
+#else
+        unlink(unix_path_.c_str());
+#endif
+        unix_path_.clear();
+    }
+    address_.clear();
+}
+
+std::vector<std::size_t> wait_readable(const std::vector<const socket_stream*>& sockets, int timeout_ms) {
+    std::vector<pollfd> fds;
+    std::vector<std::size_t> indices;
+    for (std::size_t i = 0; i < sockets.size(); i++) {
+        if (sockets[i] == nullptr || !sockets[i]->valid())
+            continue;
+
+        pollfd fd{};
+        fd.fd = native(sockets[i]->handle());
+        fd.events = POLLIN;
+        fds.push_back(fd);
+        indices.push_back(i);
+    }
+
+    std::vector<std::size_t> readable;
+    if (fds.empty()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return readable;
+    }
+
+    if (poll_native(fds.data(), fds.size(), timeout_ms) <= 0)
+        return readable;
+
+    for (std::size_t i = 0; i < fds.size(); i++)
+        if (fds[i].revents != 0)
+            readable.push_back(indices[i]);
+    return readable;
+}
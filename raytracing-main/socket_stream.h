@@ -0,0 +1,128 @@
+//
+// socket_stream.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \brief A connected stream socket, TCP or Unix domain, closed when it's destroyed
+/// \details Addresses are "host:port" for TCP and "unix:path" for a Unix domain socket. Errors aren't thrown: a
+///          failed connect gives a socket that isn't valid, and a failed send or receive returns false and closes
+///          the socket.
+class socket_stream {
+protected:
+    /// \brief The socket handle (a SOCKET on Windows, a file descriptor elsewhere), -1 when closed
+    std::intptr_t handle_ = -1;
+
+public:
+    socket_stream() = default;
+
+    /// \brief Constructor for a socket stream that takes over a connected socket
+    /// \param handle The socket handle
+    explicit socket_stream(std::intptr_t handle);
+
+    /// \brief Destructor for the socket stream, closes the socket
+    ~socket_stream();
+
+    socket_stream(socket_stream&& other) noexcept;
+    socket_stream& operator=(socket_stream&& other) noexcept;
+    socket_stream(const socket_stream&) = delete;
+    socket_stream& operator=(const socket_stream&) = delete;
+
+    /// \brief Connects to a listening socket
+    /// \param address "host:port" or "unix:path"
+    /// \return The connected socket, not valid if the connection failed
+    /// \example socket_stream stream = socket_stream::connect("127.0.0.1:5000");
+    NODISCARD static socket_stream connect(const std::string& address);
+
+    /// \brief Checks if the socket is connected
+    NODISCARD bool valid() const;
+
+    /// \brief Gets the socket handle, for waiting on several sockets at once
+    NODISCARD std::intptr_t handle() const;
+
+    /// \brief Sends every byte of a buffer
+    /// \return True if everything was sent
+    bool send_all(const void* data, std::size_t bytes);
+
+    /// \brief Receives exactly the size of a buffer
+    /// \return True if the buffer was filled, false if the peer closed the connection or on an error
+    bool receive_all(void* data, std::size_t bytes);
+
+    /// \brief Sends a message: a header with the type and size, followed by the payload
+    /// \param type What kind of message it is, up to the protocol
+    /// \param payload The bytes of the message
+    /// \return True if the message was sent
+    bool send_message(uint32_t type, const std::vector<uint8_t>& payload);
+
+    /// \brief Receives a message sent with send_message
+    /// \param type The type of the message (output)
+    /// \param payload The bytes of the message (output)
+    /// \param max_size Messages bigger than this close the connection, so a broken peer can't make us allocate
+    ///                 anything it likes
+    /// \return True if a whole message was received
+    bool receive_message(uint32_t& type, std::vector<uint8_t>& payload, std::size_t max_size = 1u << 28);
+
+    /// \brief Waits until the socket has data to read or the peer closed it
+    /// \param timeout_ms The longest time to wait in milliseconds, 0 only checks
+    /// \return True if a read won't block (it may still fail)
+    NODISCARD bool wait_readable(int timeout_ms) const;
+
+    /// \brief Limits how long a send or receive may block, so a peer that hangs doesn't hang us
+    /// \param timeout_ms The limit in milliseconds, 0 for no limit
+    void set_timeout(int timeout_ms);
+
+    /// \brief Closes the socket
+    void close();
+}; // class socket_stream
+
+/// \brief A socket that accepts connections, closed (and a Unix socket file removed) when it's destroyed
+class socket_listener {
+protected:
+    /// \brief The socket handle, -1 when closed
+    std::intptr_t handle_ = -1;
+
+    /// \brief The address the listener is bound to, with the port that was picked for port 0
+    std::string address_;
+
+    /// \brief The path of a Unix domain socket, removed when the listener closes
+    std::string unix_path_;
+
+public:
+    socket_listener() = default;
+
+    /// \brief Destructor for the listener, closes it
+    ~socket_listener();
+
+    socket_listener(const socket_listener&) = delete;
+    socket_listener& operator=(const socket_listener&) = delete;
+
+    /// \brief Starts listening
+    /// \param address "host:port" or "unix:path", port 0 picks a free port
+    /// \return True if the listener is listening
+    /// \example listener.listen("127.0.0.1:0"); std::cout << listener.address() << std::endl;
+    bool listen(const std::string& address);
+
+    /// \brief Gets the address other processes connect to
+    NODISCARD const std::string& address() const;
+
+    /// \brief Accepts the next connection
+    /// \param timeout_ms The longest time to wait in milliseconds, 0 only checks, negative waits forever
+    /// \return The connection, not valid if nobody connected in time
+    NODISCARD socket_stream accept(int timeout_ms);
+
+    /// \brief Stops listening
+    void close();
+}; // class socket_listener
+
+/// \brief Waits until at least one of the sockets has data to read or was closed by its peer
+/// \param sockets The sockets to wait for, invalid sockets are skipped
+/// \param timeout_ms The longest time to wait in milliseconds
+/// \return The indices of the sockets that won't block on a read
+NODISCARD std::vector<std::size_t> wait_readable(const std::vector<const socket_stream*>& sockets, int timeout_ms);
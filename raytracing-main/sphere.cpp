@@ -21,6 +21,14 @@ void sphere::set_position(const bardrix::point3& position) { this->position_ = p
 
 const bardrix::point3& sphere::get_position() const { return position_; }
 
+double sphere::get_radius() const { return radius_; }
+
+void sphere::set_radius(double radius) { this->radius_ = radius; }
+
+const optics& sphere::get_optics() const { return optics_; }
+
+void sphere::set_optics(const optics& optics) { this->optics_ = optics; }
+
 bardrix::vector3 sphere::normal_at(const bardrix::point3& intersection) const {
     return position_.vector_to(intersection).normalized();
 }
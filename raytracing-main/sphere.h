@@ -6,6 +6,18 @@
 
 #include <bardrix/objects.h>
 
+/// \brief How much of the light is reflected and refracted by a surface, bardrix::material only has the Phong terms
+struct optics {
+    /// \brief The fraction of light that is mirrored [0, 1]
+    double reflectivity = 0;
+
+    /// \brief The fraction of light that is refracted through the surface [0, 1]
+    double transparency = 0;
+
+    /// \brief The index of refraction of the inside, e.g. 1.5 for glass
+    double refractive_index = 1;
+};
+
 /// \brief Sphere shape
 class sphere : public bardrix::shape {
 protected:
@@ -18,6 +30,9 @@ protected:
     /// \brief Center of the sphere
     bardrix::point3 position_;
 
+    /// \brief Reflection and refraction of the sphere (default is neither)
+    optics optics_;
+
 public:
     // CONSTRUCTORS
 
@@ -44,6 +59,10 @@ public:
     NODISCARD const bardrix::point3& get_position() const override;
     void set_material(const bardrix::material& material) override;
     void set_position(const bardrix::point3& position) override;
+    NODISCARD double get_radius() const;
+    void set_radius(double radius);
+    NODISCARD const optics& get_optics() const;
+    void set_optics(const optics& optics);
 
     // RAYTRACING
 
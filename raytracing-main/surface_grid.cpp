@@ -0,0 +1,65 @@
+//
+// surface_grid.cpp
+//
+
+#include "surface_grid.h"
+#include "sampling.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    /// \brief Approximates atan2 with a polynomial, the error is below 1e-5 radians
+    double fast_atan2(double y, double x) {
+        const double ax = std::fabs(x), ay = std::fabs(y);
+        const double a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-300);
+        const double s = a * a;
+        double r = ((-0.0464964749 * s + 0.15931422) * s - 0.327622764) * s * a + a;
+        if (ay > ax)
+            r = sampling::pi / 2 - r;
+        if (x < 0)
+            r = sampling::pi - r;
+        return y < 0 ? -r : r;
+    }
+} // namespace
+
+surface_grid::surface_grid(double radius, double texels_per_unit) {
+    const double around = std::ceil(2 * sampling::pi * radius * texels_per_unit);
+    columns = static_cast<int>(std::clamp(around, 4.0, static_cast<double>(max_columns)));
+    rows = std::max(2, columns / 2);
+}
+
+std::size_t surface_grid::size() const {
+    return static_cast<std::size_t>(columns) * rows;
+}
+
+void surface_grid::locate(const sphere& shape, const bardrix::point3& point, int& column, int& row) const {
+    double u, v;
+    locate(shape, point, u, v);
+    column = static_cast<int>(u);
+    row = static_cast<int>(v);
+}
+
+void surface_grid::locate(const sphere& shape, const bardrix::point3& point, double& u, double& v) const {
+    const bardrix::vector3 direction = shape.get_position().vector_to(point) / shape.get_radius();
+
+    const double longitude = fast_atan2(direction.z, direction.x) + sampling::pi; // [0, 2 pi]
+    u = longitude * (columns / (2 * sampling::pi));
+    v = (1 - direction.y) * 0.5 * rows;
+}
+
+bardrix::point3 surface_grid::point_at(const sphere& shape, int column, int row) const {
+    const double longitude = (column + 0.5) * (2 * sampling::pi / columns) - sampling::pi;
+    const double y = 1 - 2 * (row + 0.5) / rows;
+    const double ring = std::sqrt(std::max(0.0, 1 - y * y));
+    const bardrix::vector3 direction(ring * std::cos(longitude), y, ring * std::sin(longitude));
+    return shape.get_position() + direction * shape.get_radius();
+}
+
+std::size_t surface_grid::index(int column, int row) const {
+    column %= columns;
+    if (column < 0)
+        column += columns;
+    row = std::clamp(row, 0, rows - 1);
+    return static_cast<std::size_t>(row) * columns + column;
+}
@@ -0,0 +1,61 @@
+//
+// surface_grid.h
+//
+
+#pragma once
+
+#include "sphere.h"
+
+#include <cstddef>
+
+/// \brief A grid of texels over the surface of a sphere in spherical coordinates, for caches that store something per
+///        surface point
+/// \details Columns follow the longitude (around the y axis) and wrap around, rows go linearly from the top (+y) to
+///          the bottom (-y). That is Lambert's cylindrical projection, so every texel covers the same area, and
+///          locating a point only needs an atan2 (which is approximated, the grid doesn't need exact angles).
+struct surface_grid {
+    /// \brief The most columns a grid has, so a huge sphere (a floor) gets coarser texels instead of gigabytes of them
+    static constexpr int max_columns = 2048;
+
+    /// \brief The amount of texels around and from top to bottom
+    int columns = 0, rows = 0;
+
+    /// \brief Default constructor, an empty grid
+    surface_grid() = default;
+
+    /// \brief Constructor for a grid with (about) the same texel size on every sphere, up to max_columns texels around
+    /// \param radius The radius of the sphere
+    /// \param texels_per_unit The amount of texels per world unit along the equator
+    surface_grid(double radius, double texels_per_unit);
+
+    /// \brief Gets the amount of texels
+    NODISCARD std::size_t size() const;
+
+    /// \brief Gets the column and row of the texel a surface point falls in
+    /// \param shape The sphere the point is on
+    /// \param point The point on the surface
+    /// \param column The column (output)
+    /// \param row The row (output)
+    void locate(const sphere& shape, const bardrix::point3& point, int& column, int& row) const;
+
+    /// \brief Gets the position of a surface point in texels, for interpolating between texel centers
+    /// \param shape The sphere the point is on
+    /// \param point The point on the surface
+    /// \param u The position along the columns (output), the center of column c is at c + 0.5
+    /// \param v The position along the rows (output), the center of row r is at r + 0.5
+    void locate(const sphere& shape, const bardrix::point3& point, double& u, double& v) const;
+
+    /// \brief Gets the point on the surface in the center of a texel
+    /// \param shape The sphere to get the point on
+    /// \param column The column of the texel
+    /// \param row The row of the texel
+    /// \return The center of the texel
+    NODISCARD bardrix::point3 point_at(const sphere& shape, int column, int row) const;
+
+    /// \brief Gets the index of a texel, columns wrap around and rows are clamped
+    /// \param column The column, may be outside the grid
+    /// \param row The row, may be outside the grid
+    /// \return The index of the texel
+    /// \example uint32_t right = data[grid.index(column + 1, row)];
+    NODISCARD std::size_t index(int column, int row) const;
+}; // struct surface_grid
@@ -0,0 +1,349 @@
+//
+// thread_placement.cpp
+//
+
+#include "thread_placement.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#ifdef _WIN32
+#define NOMINMAX // This is to avoid the min and max macros from windows.h
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+    /// \brief The size of a memory page in bytes, the smallest one is enough to touch every page
+    constexpr std::size_t page_size = 4096;
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// \brief Counts the sockets and nodes of a topology and sorts its processors by id
+    void finish_topology(cpu_topology& topology) {
+        std::sort(topology.processors.begin(), topology.processors.end(),
+                  [](const logical_processor& a, const logical_processor& b) { return a.id < b.id; });
+
+        std::set<int> cores, packages, nodes;
+        for (const logical_processor& processor : topology.processors) {
+            cores.insert(processor.core);
+            packages.insert(processor.package);
+            nodes.insert(processor.node);
+        }
+        topology.cores = cores.size();
+        topology.packages = packages.size();
+        topology.nodes = nodes.size();
+    }
+
+    /// \brief Every processor of std::thread::hardware_concurrency is its own core in one node
+    cpu_topology flat_topology() {
+        cpu_topology topology;
+        const int count = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int id = 0; id < count; id++)
+            topology.processors.push_back({id, id, 0, 0});
+        finish_topology(topology);
+        return topology;
+    }
+
+#ifdef __linux__
+    /// \brief Reads a list of processors like "0-3,8-11" from a file in /sys
+    std::vector<int> read_cpu_list(const std::string& path) {
+        std::ifstream file(path);
+        std::string text;
+        std::vector<int> ids;
+        if (!std::getline(file, text))
+            return ids;
+
+        std::stringstream ranges(text);
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            const std::size_t dash = range.find('-');
+            try {
+                const int first = std::stoi(range.substr(0, dash));
+                const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int id = first; id <= last; id++)
+                    ids.push_back(id);
+            } catch (const std::exception&) {
+                return {};
+            }
+        }
+        return ids;
+    }
+
+    /// \brief Reads a number from a file in /sys, -1 if it can't be read
+    int read_number(const std::string& path) {
+        std::ifstream file(path);
+        int number = -1;
+        file >> number;
+        return file ? number : -1;
+    }
+#endif
+} // namespace
+
+cpu_topology detect_cpu_topology() {
+    cpu_topology topology;
+
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+    std::vector<char> buffer(length);
+    auto* first = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data());
+    if (length == 0 || !GetLogicalProcessorInformationEx(RelationAll, first, &length))
+        return flat_topology();
+
+    // Every relation lists the processors it holds as a mask per processor group
+    std::map<int, logical_processor> processors;
+    int core = 0, package = 0;
+    auto for_each_processor = [](const GROUP_AFFINITY& affinity, auto&& function) {
+        for (int bit = 0; bit < 64; bit++) {
+            if ((affinity.Mask >> bit) & 1)
+                function(affinity.Group * 64 + bit);
+        }
+    };
+    for (DWORD offset = 0; offset < length;) {
+        const auto* info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data() + offset);
+        if (info->Relationship == RelationProcessorCore || info->Relationship == RelationProcessorPackage) {
+            const bool is_core = info->Relationship == RelationProcessorCore;
+            for (WORD group = 0; group < info->Processor.GroupCount; group++) {
+                for_each_processor(info->Processor.GroupMask[group], [&](int id) {
+                    processors[id].id = id;
+                    if (is_core)
+                        processors[id].core = core;
+                    else
+                        processors[id].package = package;
+                });
+            }
+            if (is_core)
+                core++;
+            else
+                package++;
+        } else if (info->Relationship == RelationNumaNode) {
+            for_each_processor(info->NumaNode.GroupMask,
+                               [&](int id) { processors[id].node = static_cast<int>(info->NumaNode.NodeNumber); });
+        }
+        offset += info->Size;
+    }
+
+    for (const auto& [id, processor] : processors)
+        topology.processors.push_back(processor);
+#elif defined(__linux__)
+    // The core ids are only unique within a socket
+    const std::string cpu_path = "/sys/devices/system/cpu/cpu";
+    std::map<std::pair<int, int>, int> cores;
+    for (const int id : read_cpu_list("/sys/devices/system/cpu/online")) {
+        const std::string path = cpu_path + std::to_string(id) + "/topology/";
+        const int package = std::max(0, read_number(path + "physical_package_id"));
+        const int core_id = read_number(path + "core_id");
+        const auto core = cores.emplace(std::make_pair(package, core_id < 0 ? id : core_id),
+                                        static_cast<int>(cores.size())).first->second;
+        topology.processors.push_back({id, core, package, 0});
+    }
+
+    for (const int node : read_cpu_list("/sys/devices/system/node/online")) {
+        for (const int id : read_cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist")) {
+            for (logical_processor& processor : topology.processors) {
+                if (processor.id == id)
+                    processor.node = node;
+            }
+        }
+    }
+#endif
+
+    if (topology.processors.empty())
+        return flat_topology();
+
+    finish_topology(topology);
+    return topology;
+}
+
+std::vector<int> place_threads(const cpu_topology& topology, thread_placement placement, std::size_t thread_count,
+                               int node) {
+    if (placement == thread_placement::none || topology.processors.empty())
+        return {};
+
+    // The sibling index of a processor is how many processors of its core come before it, the rank of a core is how
+    // many cores of its node come before it
+    std::vector<std::tuple<int, int, int, int, int>> keys; // The sort key first, the id last
+    std::map<int, int> siblings, ranks, cores_per_node;
+    for (const logical_processor& processor : topology.processors) {
+        const int sibling = siblings[processor.core]++;
+        if (ranks.find(processor.core) == ranks.end())
+            ranks[processor.core] = cores_per_node[processor.node]++;
+        const int rank = ranks[processor.core];
+
+        switch (placement) {
+        case thread_placement::physical_cores:
+            // The first sibling of every core, taking the cores from the nodes in turn
+            keys.emplace_back(sibling, rank, processor.node, processor.core, processor.id);
+            break;
+        case thread_placement::smt_siblings:
+            keys.emplace_back(processor.node, processor.core, sibling, 0, processor.id);
+            break;
+        case thread_placement::numa_node:
+            if (processor.node == node)
+                keys.emplace_back(sibling, processor.core, 0, 0, processor.id);
+            break;
+        case thread_placement::none:
+            break;
+        }
+    }
+    if (keys.empty())
+        return {};
+    std::sort(keys.begin(), keys.end());
+
+    // Without a thread count every core, every processor or every processor of the node gets a thread
+    if (thread_count == 0) {
+        thread_count = keys.size();
+        if (placement == thread_placement::physical_cores)
+            thread_count = std::max<std::size_t>(1, topology.cores);
+    }
+
+    std::vector<int> processors(thread_count);
+    for (std::size_t i = 0; i < thread_count; i++)
+        processors[i] = std::get<4>(keys[i % keys.size()]);
+    return processors;
+}
+
+std::vector<int> current_affinity() {
+    std::vector<int> processors;
+#ifdef _WIN32
+    GROUP_AFFINITY affinity{};
+    if (!GetThreadGroupAffinity(GetCurrentThread(), &affinity))
+        return processors;
+    for (int bit = 0; bit < 64; bit++) {
+        if ((affinity.Mask >> bit) & 1)
+            processors.push_back(affinity.Group * 64 + bit);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return processors;
+    for (int id = 0; id < CPU_SETSIZE; id++) {
+        if (CPU_ISSET(id, &set))
+            processors.push_back(id);
+    }
+#endif
+    return processors;
+}
+
+bool set_current_affinity(const std::vector<int>& processors) {
+    if (processors.empty())
+        return false;
+
+#ifdef _WIN32
+    GROUP_AFFINITY affinity{};
+    affinity.Group = static_cast<WORD>(processors[0] / 64);
+    for (const int id : processors) {
+        if (id < 0 || id / 64 != affinity.Group)
+            return false;
+        affinity.Mask |= static_cast<KAFFINITY>(1) << (id % 64);
+    }
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const int id : processors) {
+        if (id < 0 || id >= CPU_SETSIZE)
+            return false;
+        CPU_SET(id, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+void first_touch(thread_pool& pool, void* data, std::size_t bytes) {
+    if (data == nullptr || bytes == 0)
+        return;
+
+    // The first page may start before the data, it's touched at the start of the data
+    const auto begin = reinterpret_cast<std::uintptr_t>(data), end = begin + bytes;
+    const std::uintptr_t first_page = begin / page_size;
+    const std::size_t pages = (end - 1) / page_size - first_page + 1;
+    pool.parallel_for(pages, 16, [&](std::size_t page_begin, std::size_t page_end) {
+        for (std::size_t page = page_begin; page < page_end; page++) {
+            const std::uintptr_t address = std::max(begin, (first_page + page) * page_size);
+            *reinterpret_cast<volatile char*>(address) = 0;
+        }
+    });
+}
+
+placement_report compare_thread_placements(const cpu_topology& topology, std::size_t thread_count, int runs,
+                                            const std::function<void(thread_pool&)>& workload) {
+    placement_report report;
+    report.processors = topology.processors.size();
+    report.cores = topology.cores;
+    report.packages = topology.packages;
+    report.nodes = topology.nodes;
+    report.runs = std::max(1, runs);
+    if (thread_count == 0)
+        thread_count = std::max<std::size_t>(1, topology.cores);
+
+    for (const thread_placement placement : {thread_placement::none, thread_placement::physical_cores,
+                                             thread_placement::smt_siblings, thread_placement::numa_node}) {
+        placement_result result;
+        result.placement = placement;
+        result.threads = thread_count;
+
+        const std::vector<int> processors = place_threads(topology, placement, thread_count);
+        std::set<int> used_processors, used_cores, used_nodes;
+        for (const int id : processors) {
+            used_processors.insert(id);
+            for (const logical_processor& processor : topology.processors) {
+                if (processor.id == id) {
+                    used_cores.insert(processor.core);
+                    used_nodes.insert(processor.node);
+                }
+            }
+        }
+        result.processors = used_processors.size();
+        result.cores = used_cores.size();
+        result.nodes = used_nodes.size();
+
+        // A pool without placement is the one every other pool is compared to
+        const bool pinned = placement != thread_placement::none && !processors.empty();
+        thread_pool pool = pinned ? thread_pool(processors) : thread_pool(static_cast<unsigned int>(thread_count));
+        result.pinned = pool.pinned();
+
+        workload(pool);
+        result.best_ms = -1;
+        for (int run = 0; run < report.runs; run++) {
+            const auto start = std::chrono::steady_clock::now();
+            workload(pool);
+            const double ms = milliseconds_since(start);
+            result.best_ms = result.best_ms < 0 ? ms : std::min(result.best_ms, ms);
+            result.average_ms += ms / report.runs;
+        }
+        report.results.push_back(result);
+    }
+    return report;
+}
+
+std::ostream& operator<<(std::ostream& os, const placement_report& report) {
+    static const char* names[] = {"none:           ", "physical cores: ", "SMT siblings:   ", "NUMA node 0:    "};
+
+    os << "Thread placement: " << report.processors << " processors, " << report.cores << " cores, "
+       << report.packages << " sockets, " << report.nodes << " NUMA nodes, " << report.runs << " runs";
+    for (const placement_result& result : report.results) {
+        os << "\n  " << names[static_cast<int>(result.placement)] << result.threads << " threads";
+        if (result.placement != thread_placement::none)
+            os << " (" << result.pinned << " pinned to " << result.processors << " processors on " << result.cores
+               << " cores, " << result.nodes << " nodes)";
+        os << ", best " << result.best_ms << " ms, average " << result.average_ms << " ms";
+    }
+    return os;
+}
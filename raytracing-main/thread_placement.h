@@ -0,0 +1,124 @@
+//
+// thread_placement.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+/// \brief How the threads of a pool are pinned to logical processors
+enum class thread_placement {
+    /// \brief Not pinned, the operating system moves the threads around
+    none,
+    /// \brief One thread per physical core, spread over the NUMA nodes. More threads than cores go on the SMT
+    ///        siblings in the same order
+    physical_cores,
+    /// \brief Every SMT sibling of a core is filled before the next core, so the threads share as few cores as
+    ///        possible with other programs
+    smt_siblings,
+    /// \brief Only the logical processors of one NUMA node, physical cores before their SMT siblings
+    numa_node
+};
+
+/// \brief A logical processor (hardware thread) and where it is in the machine
+struct logical_processor {
+    /// \brief The number the operating system uses for the processor (on Windows group * 64 + number in the group)
+    int id = 0;
+
+    /// \brief The physical core it belongs to, unique over the whole machine
+    int core = 0;
+
+    /// \brief The socket and the NUMA node it belongs to
+    int package = 0, node = 0;
+};
+
+/// \brief The logical processors of the machine
+struct cpu_topology {
+    /// \brief The processors, ordered by id
+    std::vector<logical_processor> processors;
+
+    /// \brief The amount of physical cores, sockets and NUMA nodes
+    std::size_t cores = 0, packages = 0, nodes = 0;
+};
+
+/// \brief Reads the processors, cores, sockets and NUMA nodes of the machine from the operating system
+/// \return The topology, if it can't be read every processor of std::thread::hardware_concurrency is its own core
+///         in one node
+/// \example cpu_topology topology = detect_cpu_topology();
+NODISCARD cpu_topology detect_cpu_topology();
+
+/// \brief Picks the logical processor of every thread of a pool
+/// \param topology The processors of the machine
+/// \param placement How the threads are placed
+/// \param thread_count The amount of threads, 0 for one per processor the placement allows (every core, every
+///                     processor or every processor of the node). More threads than processors share them
+/// \param node The NUMA node for thread_placement::numa_node
+/// \return The processor id of every thread, empty for thread_placement::none
+/// \example thread_pool pool(place_threads(topology, thread_placement::physical_cores));
+NODISCARD std::vector<int> place_threads(const cpu_topology& topology, thread_placement placement,
+                                         std::size_t thread_count = 0, int node = 0);
+
+/// \brief Gets the logical processors the calling thread may run on
+/// \return The processor ids, empty if they can't be read
+NODISCARD std::vector<int> current_affinity();
+
+/// \brief Lets the calling thread only run on some logical processors
+/// \param processors The processor ids, on Windows they must be in the same processor group
+/// \return True if the affinity was set
+bool set_current_affinity(const std::vector<int>& processors);
+
+/// \brief Writes to every page of a new allocation from the threads of a pool
+/// \details Pages are put on the NUMA node of the thread that touches them first. A buffer the threads of a pool
+///          fill should be touched first by those threads, not by the thread that allocated it, else the whole
+///          buffer ends up on the node of the allocating thread. The pages are spread over the threads as they
+///          pick up chunks, like the work of the buffer.
+/// \param pool The threads that will use the memory
+/// \param data The start of the memory, nothing may be constructed in it yet
+/// \param bytes The size of the memory in bytes
+/// \example std::vector<hit_record> hits; hits.reserve(n); first_touch(pool, hits.data(), n * sizeof(hit_record));
+void first_touch(thread_pool& pool, void* data, std::size_t bytes);
+
+/// \brief The timing of a workload on a pool of one placement
+struct placement_result {
+    /// \brief The placement and the amount of threads
+    thread_placement placement = thread_placement::none;
+    std::size_t threads = 0;
+
+    /// \brief The amount of threads that were pinned, and the amount of processors, cores and nodes they're pinned to
+    std::size_t pinned = 0, processors = 0, cores = 0, nodes = 0;
+
+    /// \brief The fastest and the average time of the runs in milliseconds
+    double best_ms = 0, average_ms = 0;
+};
+
+/// \brief A benchmark of the placements: the same workload on a pool of every placement with the same thread count
+struct placement_report {
+    /// \brief The processors, cores, sockets and NUMA nodes of the machine
+    std::size_t processors = 0, cores = 0, packages = 0, nodes = 0;
+
+    /// \brief The amount of timed runs per placement
+    int runs = 0;
+
+    /// \brief The result of every placement
+    std::vector<placement_result> results;
+};
+
+/// \brief Runs a workload on a pool of every placement and times it
+/// \param topology The processors of the machine
+/// \param thread_count The amount of threads of every pool, 0 for one per physical core
+/// \param runs The amount of timed runs per placement, after one untimed run that warms up the pool
+/// \param workload The work, it gets the pool to run on
+/// \return The report with the timing of every placement
+/// \example std::cout << compare_thread_placements(topology, 0, 5, [&](thread_pool& pool) { /* ... */ });
+NODISCARD placement_report compare_thread_placements(const cpu_topology& topology, std::size_t thread_count,
+                                                     int runs, const std::function<void(thread_pool&)>& workload);
+
+/// \brief Writes a placement report in a human readable format
+std::ostream& operator<<(std::ostream& os, const placement_report& report);
@@ -0,0 +1,134 @@
+//
+// thread_pool.cpp
+//
+
+#include "thread_pool.h"
+
+#include "thread_placement.h"
+
+#include <algorithm>
+
+thread_pool::thread_pool(unsigned int thread_count) {
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    // The calling thread is the first thread
+    for (unsigned int i = 1; i < thread_count; i++)
+        workers_.emplace_back(&thread_pool::worker_loop, this, -1);
+}
+
+thread_pool::thread_pool(const std::vector<int>& processors) {
+    if (processors.empty()) {
+        const unsigned int thread_count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int i = 1; i < thread_count; i++)
+            workers_.emplace_back(&thread_pool::worker_loop, this, -1);
+        return;
+    }
+
+    caller_affinity_ = current_affinity();
+    if (set_current_affinity({processors[0]}))
+        pinned_++;
+
+    for (std::size_t i = 1; i < processors.size(); i++)
+        workers_.emplace_back(&thread_pool::worker_loop, this, processors[i]);
+
+    // The workers pin themselves, wait for them so pinned() is known
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return started_workers_ == workers_.size(); });
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    for (std::thread& worker : workers_)
+        worker.join();
+
+    if (!caller_affinity_.empty())
+        set_current_affinity(caller_affinity_);
+}
+
+std::size_t thread_pool::size() const {
+    return workers_.size() + 1;
+}
+
+std::size_t thread_pool::pinned() const {
+    return pinned_;
+}
+
+void thread_pool::parallel_for(std::size_t count, std::size_t grain, const range_function& function) {
+    if (count == 0)
+        return;
+
+    grain = std::max<std::size_t>(1, grain);
+    const std::size_t chunks = (count + grain - 1) / grain;
+
+    // Not worth waking anybody up
+    if (workers_.empty() || chunks == 1) {
+        for (std::size_t begin = 0; begin < count; begin += grain)
+            function(begin, std::min(count, begin + grain));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &function;
+        job_count_ = count;
+        job_grain_ = grain;
+        next_chunk_ = 0;
+        chunks_left_ = chunks;
+        generation_++;
+    }
+    wake_.notify_all();
+
+    run_chunks();
+
+    // Workers only pick up a job while job_ is set, so after this nobody touches the job anymore
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return chunks_left_ == 0 && busy_workers_ == 0; });
+    job_ = nullptr;
+}
+
+void thread_pool::worker_loop(int processor) {
+    std::size_t seen_generation = 0;
+    const bool pinned = processor >= 0 && set_current_affinity({processor});
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    pinned_ += pinned;
+    started_workers_++;
+    done_.notify_all();
+
+    while (true) {
+        wake_.wait(lock, [&] { return stopping_ || (job_ != nullptr && generation_ != seen_generation); });
+        if (stopping_)
+            return;
+
+        seen_generation = generation_;
+        busy_workers_++;
+
+        lock.unlock();
+        run_chunks();
+        lock.lock();
+
+        if (--busy_workers_ == 0 && chunks_left_ == 0)
+            done_.notify_all();
+    }
+}
+
+void thread_pool::run_chunks() {
+    while (true) {
+        const std::size_t begin = next_chunk_.fetch_add(1) * job_grain_;
+        if (begin >= job_count_)
+            return;
+
+        (*job_)(begin, std::min(job_count_, begin + job_grain_));
+
+        if (chunks_left_.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,107 @@
+//
+// thread_pool.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// \brief A fixed set of worker threads that run data parallel loops
+/// \details The calling thread helps with the work, so a pool of 1 thread doesn't spawn any workers.
+class thread_pool {
+public:
+    /// \brief The function that is run for every chunk, it gets the range [begin, end)
+    using range_function = std::function<void(std::size_t begin, std::size_t end)>;
+
+protected:
+    /// \brief The worker threads (the calling thread isn't in here)
+    std::vector<std::thread> workers_;
+
+    /// \brief Guards the job and wakes the workers
+    std::mutex mutex_;
+
+    /// \brief Signalled when a new job is available or the pool is stopping
+    std::condition_variable wake_;
+
+    /// \brief Signalled when the last chunk of a job is done
+    std::condition_variable done_;
+
+    /// \brief The function of the current job, nullptr when there's no job
+    const range_function* job_ = nullptr;
+
+    /// \brief The amount of items and the amount of items per chunk of the current job
+    std::size_t job_count_ = 0, job_grain_ = 1;
+
+    /// \brief Incremented for every job, so workers don't run the same job twice
+    std::size_t generation_ = 0;
+
+    /// \brief The amount of workers that are working on the current job
+    std::size_t busy_workers_ = 0;
+
+    /// \brief The next chunk that will be picked up
+    std::atomic<std::size_t> next_chunk_{0};
+
+    /// \brief The amount of chunks that aren't done yet
+    std::atomic<std::size_t> chunks_left_{0};
+
+    /// \brief Whether the workers should exit
+    bool stopping_ = false;
+
+    /// \brief The amount of workers that started, and the amount of threads that were pinned to their processor
+    std::size_t started_workers_ = 0, pinned_ = 0;
+
+    /// \brief The processors the calling thread could run on before the pool pinned it, restored by the destructor
+    std::vector<int> caller_affinity_;
+
+public:
+    /// \brief Constructor for the thread pool
+    /// \param thread_count The amount of threads that run a job including the calling thread, 0 means one per
+    ///        hardware thread
+    explicit thread_pool(unsigned int thread_count = 0);
+
+    /// \brief Constructor for a thread pool that pins every thread to a logical processor
+    /// \details The calling thread is the first thread, it's pinned to the first processor until the pool is
+    ///          destroyed. A thread that can't be pinned still runs, unpinned.
+    /// \param processors The processor id of every thread, see place_threads. Empty means one unpinned thread per
+    ///        hardware thread
+    /// \example thread_pool pool(place_threads(detect_cpu_topology(), thread_placement::physical_cores));
+    explicit thread_pool(const std::vector<int>& processors);
+
+    /// \brief Destructor for the thread pool, waits for the workers to exit
+    ~thread_pool();
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /// \brief Gets the amount of threads that run a job (including the calling thread)
+    /// \return The amount of threads
+    NODISCARD std::size_t size() const;
+
+    /// \brief Gets the amount of threads that are pinned to a processor (including the calling thread)
+    /// \return The amount of pinned threads, 0 if the pool isn't pinned
+    NODISCARD std::size_t pinned() const;
+
+    /// \brief Runs a function over [0, count) in chunks of grain items and waits until every chunk is done
+    /// \param count The amount of items
+    /// \param grain The amount of items per chunk
+    /// \param function The function that's called for every chunk
+    /// \note This function is not reentrant, don't call parallel_for from within a job
+    /// \example pool.parallel_for(pixels.size(), 1024, [&](std::size_t begin, std::size_t end) { /* ... */ });
+    void parallel_for(std::size_t count, std::size_t grain, const range_function& function);
+
+protected:
+    /// \brief The loop of every worker thread
+    /// \param processor The processor the worker pins itself to, -1 to not pin it
+    void worker_loop(int processor);
+
+    /// \brief Picks up chunks of the current job until there are none left
+    void run_chunks();
+}; // class thread_pool
@@ -0,0 +1,158 @@
+//
+// tile_culling.cpp
+//
+
+#include "tile_culling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+    /// \brief The frustum is widened by this, so rounding can't cull a sphere that a ray grazes
+    constexpr double cull_slack = 1e-9;
+
+    /// \brief The bounds of a sphere are widened by this many pixels, for the same reason
+    constexpr double bounds_slack = 1e-3;
+
+    /// \brief Gets the intersection of 2 rectangles
+    pixel_rect intersect(const pixel_rect& a, const pixel_rect& b) {
+        return {std::max(a.left, b.left), std::max(a.top, b.top), std::min(a.right, b.right),
+                std::min(a.bottom, b.bottom)};
+    }
+
+    /// \brief Gets the pixels of a tile, tiles at the right and bottom edge may be smaller
+    pixel_rect tile_rect(std::size_t tile, int tiles_x, int tile_size, int width, int height) {
+        const int x0 = static_cast<int>(tile % tiles_x) * tile_size, y0 = static_cast<int>(tile / tiles_x) * tile_size;
+        return {x0, y0, std::min(x0 + tile_size, width) - 1, std::min(y0 + tile_size, height) - 1};
+    }
+
+    /// \brief Gets the box around 2 rectangles, an empty rectangle doesn't add anything
+    pixel_rect unite(const pixel_rect& a, const pixel_rect& b) {
+        if (a.empty())
+            return b;
+        if (b.empty())
+            return a;
+        return {std::min(a.left, b.left), std::min(a.top, b.top), std::max(a.right, b.right),
+                std::max(a.bottom, b.bottom)};
+    }
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace
+
+pixel_rect pixel_bounds(const ray_generator& generator, const sphere& s, double jitter_x, double jitter_y,
+                        int width, int height) {
+    const pixel_rect image{0, 0, width - 1, height - 1};
+    double left, top, right, bottom;
+    if (!generator.bounds(s.get_position(), s.get_radius(), left, top, right, bottom))
+        return image;
+
+    // Pixel x shows position x + jitter_x, so it's inside the projection if the position is. Far outside the image the
+    // bounds don't fit in an int, they're clamped to just outside it
+    auto pixel = [](double position, double limit) { return std::clamp(position, -2.0, limit + 2.0); };
+    return intersect(image, {static_cast<int>(std::ceil(pixel(left - jitter_x - bounds_slack, width))),
+                             static_cast<int>(std::ceil(pixel(top - jitter_y - bounds_slack, height))),
+                             static_cast<int>(std::floor(pixel(right - jitter_x + bounds_slack, width))),
+                             static_cast<int>(std::floor(pixel(bottom - jitter_y + bounds_slack, height)))});
+}
+
+std::ostream& operator<<(std::ostream& os, const tile_culling_stats& stats) {
+    os << "Tile culling: " << stats.empty_tiles << " of " << stats.tiles << " tiles empty (" << stats.skipped_tiles
+       << " outside the scene bounds), " << stats.average_candidates << " candidates on average, "
+       << stats.covered_pixels << " covered pixels, built in " << stats.build_ms << " ms";
+    return os;
+}
+
+void tile_culling::build(const ray_generator& generator, double jitter_x, double jitter_y, int width, int height,
+                         int tile_size, const std::vector<sphere>& spheres, thread_pool& pool) {
+    const auto start = std::chrono::steady_clock::now();
+    stats_ = tile_culling_stats();
+    tile_size_ = std::max(1, tile_size);
+    tiles_x_ = (width + tile_size_ - 1) / tile_size_;
+    tiles_y_ = (height + tile_size_ - 1) / tile_size_;
+    candidates_.resize(static_cast<std::size_t>(tiles_x_) * tiles_y_);
+    covered_.assign(candidates_.size(), pixel_rect());
+
+    sphere_bounds_.resize(spheres.size());
+    scene_bounds_ = pixel_rect();
+    for (std::size_t s = 0; s < spheres.size(); s++) {
+        sphere_bounds_[s] = pixel_bounds(generator, spheres[s], jitter_x, jitter_y, width, height);
+        scene_bounds_ = unite(scene_bounds_, sphere_bounds_[s]);
+    }
+
+    pool.parallel_for(candidates_.size(), 1, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t tile = begin; tile < end; tile++) {
+            std::vector<uint32_t>& list = candidates_[tile];
+            list.clear();
+
+            // A tile outside the scene bounds can't show anything
+            const pixel_rect pixels = tile_rect(tile, tiles_x_, tile_size_, width, height);
+            if (intersect(pixels, scene_bounds_).empty())
+                continue;
+
+            // The rays through the outer edges of the tile's outer pixels, so the frustum is never degenerate
+            const double left = pixels.left + jitter_x - 0.5, right = pixels.right + jitter_x + 0.5;
+            const double top = pixels.top + jitter_y - 0.5, bottom = pixels.bottom + jitter_y + 0.5;
+            const bardrix::ray corners[4] = {generator.shoot(left, top), generator.shoot(right, top),
+                                             generator.shoot(right, bottom), generator.shoot(left, bottom)};
+            const bardrix::point3& origin = corners[0].position;
+            const bardrix::vector3 center = corners[0].get_direction() + corners[2].get_direction();
+
+            // The side planes go through the camera, their normals point into the frustum
+            bardrix::vector3 planes[4];
+            for (int i = 0; i < 4; i++) {
+                planes[i] = corners[i].get_direction().cross(corners[(i + 1) % 4].get_direction()).normalized();
+                if (planes[i].dot(center) < 0)
+                    planes[i] = -planes[i];
+            }
+
+            for (std::size_t s = 0; s < spheres.size(); s++) {
+                const bardrix::vector3 to_sphere = origin.vector_to(spheres[s].get_position());
+                const double radius = spheres[s].get_radius() + cull_slack * (1 + to_sphere.length());
+                bool inside = !intersect(pixels, sphere_bounds_[s]).empty() &&
+                              to_sphere.length() - radius < generator.get_length();
+                for (int i = 0; inside && i < 4; i++)
+                    inside = planes[i].dot(to_sphere) >= -radius;
+
+                if (inside) {
+                    list.push_back(static_cast<uint32_t>(s));
+                    covered_[tile] = unite(covered_[tile], intersect(pixels, sphere_bounds_[s]));
+                }
+            }
+        }
+    });
+
+    std::size_t candidates = 0;
+    for (std::size_t tile = 0; tile < candidates_.size(); tile++) {
+        candidates += candidates_[tile].size();
+        stats_.empty_tiles += candidates_[tile].empty();
+        stats_.skipped_tiles += intersect(tile_rect(tile, tiles_x_, tile_size_, width, height), scene_bounds_).empty();
+
+        const pixel_rect& covered = covered_[tile];
+        if (!covered.empty())
+            stats_.covered_pixels += static_cast<std::size_t>(covered.right - covered.left + 1) *
+                                     static_cast<std::size_t>(covered.bottom - covered.top + 1);
+    }
+    stats_.tiles = candidates_.size();
+    if (!candidates_.empty())
+        stats_.average_candidates = static_cast<double>(candidates) / static_cast<double>(candidates_.size());
+    stats_.build_ms = milliseconds_since(start);
+}
+
+int tile_culling::get_tile_size() const { return tile_size_; }
+
+int tile_culling::get_tiles_x() const { return tiles_x_; }
+
+int tile_culling::get_tiles_y() const { return tiles_y_; }
+
+const std::vector<uint32_t>& tile_culling::candidates(std::size_t tile) const { return candidates_[tile]; }
+
+const pixel_rect& tile_culling::covered(std::size_t tile) const { return covered_[tile]; }
+
+const pixel_rect& tile_culling::sphere_bounds(std::size_t sphere) const { return sphere_bounds_[sphere]; }
+
+const pixel_rect& tile_culling::scene_bounds() const { return scene_bounds_; }
+
+const tile_culling_stats& tile_culling::get_stats() const { return stats_; }
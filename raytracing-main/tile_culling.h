@@ -0,0 +1,130 @@
+//
+// tile_culling.h
+//
+
+#pragma once
+
+#include "sphere.h"
+#include "thread_pool.h"
+#include "tracing.h"
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief A rectangle of pixels, both ends are inclusive
+struct pixel_rect {
+    int left = 0, top = 0, right = -1, bottom = -1;
+
+    /// \brief Checks if a pixel is inside the rectangle
+    NODISCARD bool contains(int x, int y) const { return x >= left && x <= right && y >= top && y <= bottom; }
+
+    /// \brief Checks if the rectangle doesn't contain any pixel
+    NODISCARD bool empty() const { return left > right || top > bottom; }
+};
+
+/// \brief Gets the pixels whose primary ray may hit a sphere
+/// \param generator The generator of the primary rays
+/// \param s The sphere
+/// \param jitter_x The offset of the primary rays from the pixel centers in pixels
+/// \param jitter_y The offset of the primary rays from the pixel centers in pixels
+/// \param width The width of the frame
+/// \param height The height of the frame
+/// \return The pixels inside the projection of the sphere, the whole frame if it isn't in front of the camera
+/// \example pixel_rect footprint = pixel_bounds(generator, spheres[i], 0, 0, width, height);
+NODISCARD pixel_rect pixel_bounds(const ray_generator& generator, const sphere& s, double jitter_x, double jitter_y,
+                                  int width, int height);
+
+/// \brief How many tiles of the last frame were empty and how many spheres the others had to test
+struct tile_culling_stats {
+    /// \brief The amount of tiles and the amount of tiles without any sphere in their frustum
+    std::size_t tiles = 0, empty_tiles = 0;
+
+    /// \brief The amount of tiles outside the bounds of the scene, these didn't test a single sphere
+    std::size_t skipped_tiles = 0;
+
+    /// \brief The amount of pixels inside the covered part of their tile, the other pixels aren't traced
+    std::size_t covered_pixels = 0;
+
+    /// \brief The average amount of spheres in the frustum of a tile
+    double average_candidates = 0;
+
+    /// \brief Milliseconds it took to build the lists
+    double build_ms = 0;
+};
+
+/// \brief Prints the stats of the tile culling
+std::ostream& operator<<(std::ostream& os, const tile_culling_stats& stats);
+
+/// \brief For every screen tile, the spheres that a primary ray of that tile can hit
+/// \details The primary rays of a tile start at the camera and pass through the tile, so they lie inside the frustum
+///          spanned by the rays through the corners of the tile. A sphere is a candidate if it's on the inner side
+///          of the 4 side planes of that frustum (within its radius) and starts before the rays end. The test is
+///          conservative, so tracing against the candidates gives the same hits as tracing against all spheres.
+///          Every sphere in front of the camera also gets the bounding box of its projection on the image, the scene
+///          bounds are the box around all of them. Tiles outside the scene bounds are empty without testing any
+///          sphere, and a pixel only needs to test the spheres whose box contains it, so the pixels that show the
+///          background cost no intersection at all.
+class tile_culling {
+protected:
+    /// \brief The size of a tile in pixels and the amount of tiles in both directions
+    int tile_size_ = 16, tiles_x_ = 0, tiles_y_ = 0;
+
+    /// \brief The indices of the spheres in the frustum of every tile in ascending order, row by row
+    std::vector<std::vector<uint32_t>> candidates_;
+
+    /// \brief The pixels of every tile that are inside the box of one of its candidates (a box around them)
+    std::vector<pixel_rect> covered_;
+
+    /// \brief The pixels of every sphere's projection, the whole image for spheres that aren't in front of the camera
+    std::vector<pixel_rect> sphere_bounds_;
+
+    /// \brief The box around the projections of all spheres
+    pixel_rect scene_bounds_;
+
+    /// \brief The stats of the last frame
+    tile_culling_stats stats_;
+
+public:
+    /// \brief Builds the candidates of every tile, the tiles are culled in parallel
+    /// \param generator The generator of the primary rays
+    /// \param jitter_x The offset of the primary rays from the pixel centers in pixels
+    /// \param jitter_y The offset of the primary rays from the pixel centers in pixels
+    /// \param width The width of the frame
+    /// \param height The height of the frame
+    /// \param tile_size The size of a tile in pixels
+    /// \param spheres The spheres in the scene
+    /// \param pool The threads to cull the tiles with
+    /// \example tiles.build(generator, 0, 0, width, height, 16, spheres, pool);
+    void build(const ray_generator& generator, double jitter_x, double jitter_y, int width, int height, int tile_size,
+               const std::vector<sphere>& spheres, thread_pool& pool);
+
+    /// \brief Gets the size of a tile in pixels
+    NODISCARD int get_tile_size() const;
+
+    /// \brief Gets the amount of tiles in a row
+    NODISCARD int get_tiles_x() const;
+
+    /// \brief Gets the amount of tiles in a column
+    NODISCARD int get_tiles_y() const;
+
+    /// \brief Gets the spheres a primary ray of a tile can hit
+    /// \param tile The index of the tile, row by row
+    /// \return The indices of the spheres in ascending order, empty if the tile only shows the background
+    NODISCARD const std::vector<uint32_t>& candidates(std::size_t tile) const;
+
+    /// \brief Gets the pixels of a tile that may show a sphere, the other pixels show the background
+    /// \param tile The index of the tile, row by row
+    /// \return The pixels, empty if the tile only shows the background
+    NODISCARD const pixel_rect& covered(std::size_t tile) const;
+
+    /// \brief Gets the pixels a sphere may cover, a ray of any other pixel misses it
+    /// \param sphere The index of the sphere
+    NODISCARD const pixel_rect& sphere_bounds(std::size_t sphere) const;
+
+    /// \brief Gets the pixels that may show any sphere
+    NODISCARD const pixel_rect& scene_bounds() const;
+
+    /// \brief Gets the stats of the last frame
+    NODISCARD const tile_culling_stats& get_stats() const;
+}; // class tile_culling
@@ -0,0 +1,150 @@
+//
+// tile_scheduler.cpp
+//
+
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+    /// \brief Tiles around the focus point get this added to their priority, the other tiles are at most 1
+    constexpr double focus_priority = 2;
+
+    /// \brief Gets the luminance of an AARRGGBB pixel [0, 1]
+    double luminance(uint32_t argb) {
+        return (0.2126 * ((argb >> 16) & 0xFF) + 0.7152 * ((argb >> 8) & 0xFF) + 0.0722 * (argb & 0xFF)) / 255.0;
+    }
+
+    /// \brief Gets the amount of primary rays a tile of width x height pixels traces with a step
+    std::size_t rays_of(int width, int height, int step) {
+        return static_cast<std::size_t>((width + step - 1) / step) *
+               static_cast<std::size_t>((height + step - 1) / step);
+    }
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const tile_schedule_stats& stats) {
+    os << "Tile schedule: " << stats.tiles << " tiles, " << stats.focus_tiles << " around the focus, "
+       << stats.full_tiles << " full and " << stats.coarse_tiles << " coarse, " << stats.traced_pixels
+       << " primary rays, scheduled in " << stats.schedule_ms << " ms";
+    return os;
+}
+
+void tile_scheduler::schedule(const std::vector<uint32_t>& previous, int width, int height, int tile_size,
+                              double focus_x, double focus_y, std::size_t ray_budget) {
+    const auto start = std::chrono::steady_clock::now();
+    stats_ = tile_schedule_stats();
+
+    // A different grid has no history
+    tile_size = std::max(1, tile_size);
+    const int tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+    const std::size_t tiles = static_cast<std::size_t>(tiles_x) * tiles_y;
+    if (tile_size != tile_size_ || tiles_x != tiles_x_ || tiles_y != tiles_y_ || means_.size() != tiles) {
+        means_.assign(tiles, 0);
+        changes_.assign(tiles, 0);
+        history_ = false;
+    }
+    tile_size_ = tile_size;
+    tiles_x_ = tiles_x;
+    tiles_y_ = tiles_y;
+    variances_.assign(tiles, 0);
+    priorities_.assign(tiles, 0);
+
+    // Measure the tiles in the frame that was presented last
+    const bool measured = previous.size() == static_cast<std::size_t>(width) * height;
+    double max_variance = 0, max_change = 0;
+    for (std::size_t tile = 0; measured && tile < tiles; tile++) {
+        const int x0 = static_cast<int>(tile % tiles_x) * tile_size, y0 = static_cast<int>(tile / tiles_x) * tile_size;
+        const int x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+
+        double sum = 0, sum_squared = 0;
+        for (int y = y0; y < y1; y++) {
+            for (int x = x0; x < x1; x++) {
+                const double l = luminance(previous[static_cast<std::size_t>(y) * width + x]);
+                sum += l;
+                sum_squared += l * l;
+            }
+        }
+
+        const double count = static_cast<double>((x1 - x0) * (y1 - y0));
+        const double mean = sum / count;
+        variances_[tile] = std::max(0.0, sum_squared / count - mean * mean);
+        const double change = history_ ? std::abs(mean - means_[tile]) : 0;
+        changes_[tile] = std::max(change, changes_[tile] * settings.change_decay);
+        means_[tile] = mean;
+
+        max_variance = std::max(max_variance, variances_[tile]);
+        max_change = std::max(max_change, changes_[tile]);
+    }
+    history_ = history_ || measured;
+
+    // The tiles around the focus point come first, closest first, the others by their variance and recent change
+    if (focus_x < 0 || focus_y < 0) {
+        focus_x = width / 2.0;
+        focus_y = height / 2.0;
+    }
+    const double radius = settings.focus_radius * std::sqrt(static_cast<double>(width) * width +
+                                                            static_cast<double>(height) * height);
+    for (std::size_t tile = 0; tile < tiles; tile++) {
+        const double center_x = (static_cast<double>(tile % tiles_x) + 0.5) * tile_size;
+        const double center_y = (static_cast<double>(tile / tiles_x) + 0.5) * tile_size;
+        const double distance = std::hypot(center_x - focus_x, center_y - focus_y);
+        if (distance <= radius) {
+            priorities_[tile] = focus_priority + 1 - distance / std::max(radius, 1.0);
+            stats_.focus_tiles++;
+            continue;
+        }
+
+        if (max_variance > 0)
+            priorities_[tile] += 0.5 * variances_[tile] / max_variance;
+        if (max_change > 0)
+            priorities_[tile] += 0.5 * changes_[tile] / max_change;
+    }
+
+    order_.resize(tiles);
+    for (std::size_t tile = 0; tile < tiles; tile++)
+        order_[tile] = static_cast<uint32_t>(tile);
+    std::stable_sort(order_.begin(), order_.end(),
+                     [&](uint32_t a, uint32_t b) { return priorities_[a] > priorities_[b]; });
+
+    // Every tile gets at least one ray per block, then the tiles are refined in priority order until the budget is
+    // spent. The first tile that doesn't fit stops the refinement, so a tile is never coarser than a later one
+    const int coarse = std::clamp(settings.coarse_step, 1, 255);
+    steps_.assign(tiles, static_cast<uint8_t>(coarse));
+    std::size_t rays = 0;
+    for (std::size_t tile = 0; tile < tiles; tile++) {
+        const int x0 = static_cast<int>(tile % tiles_x) * tile_size, y0 = static_cast<int>(tile / tiles_x) * tile_size;
+        rays += rays_of(std::min(tile_size, width - x0), std::min(tile_size, height - y0), coarse);
+    }
+    for (const uint32_t tile : order_) {
+        const int x0 = static_cast<int>(tile % tiles_x) * tile_size, y0 = static_cast<int>(tile / tiles_x) * tile_size;
+        const int w = std::min(tile_size, width - x0), h = std::min(tile_size, height - y0);
+        const std::size_t extra = rays_of(w, h, 1) - rays_of(w, h, coarse);
+        if (ray_budget != 0 && rays + extra > ray_budget)
+            break;
+
+        steps_[tile] = 1;
+        rays += extra;
+    }
+
+    for (const uint8_t step : steps_) {
+        stats_.full_tiles += step == 1;
+        stats_.coarse_tiles += step != 1;
+    }
+    stats_.tiles = tiles;
+    stats_.traced_pixels = rays;
+    stats_.schedule_ms = milliseconds_since(start);
+}
+
+const std::vector<uint32_t>& tile_scheduler::order() const { return order_; }
+
+int tile_scheduler::step(std::size_t tile) const { return steps_[tile]; }
+
+double tile_scheduler::priority(std::size_t tile) const { return priorities_[tile]; }
+
+const tile_schedule_stats& tile_scheduler::get_stats() const { return stats_; }
@@ -0,0 +1,112 @@
+//
+// tile_scheduler.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief How the tiles of the last frame were ordered and sampled
+struct tile_schedule_stats {
+    /// \brief The amount of tiles and the amount of tiles around the focus point
+    std::size_t tiles = 0, focus_tiles = 0;
+
+    /// \brief The amount of tiles that trace every pixel and the amount that only trace one pixel per block
+    std::size_t full_tiles = 0, coarse_tiles = 0;
+
+    /// \brief The amount of primary rays the schedule traces
+    std::size_t traced_pixels = 0;
+
+    /// \brief Milliseconds it took to measure the previous frame and order the tiles
+    double schedule_ms = 0;
+};
+
+/// \brief Prints the stats of the tile schedule
+std::ostream& operator<<(std::ostream& os, const tile_schedule_stats& stats);
+
+/// \brief Settings of the tile scheduler
+struct tile_schedule_settings {
+    /// \brief The radius around the focus point that is rendered first, as a fraction of the screen diagonal
+    double focus_radius = 0.2;
+
+    /// \brief How much of a tile's recent change is kept every frame [0, 1]
+    double change_decay = 0.75;
+
+    /// \brief The size of the blocks that share one primary ray in a coarse tile in pixels, at most 255
+    int coarse_step = 4;
+};
+
+/// \brief Orders the screen tiles by how much they matter to the viewer, and lets the least important ones trace
+///        fewer primary rays when a frame has a ray budget
+/// \details The tiles around the focus point (the cursor, or the center of the screen) come first, closest first.
+///          The other tiles are ordered by the luminance variance of their pixels in the previous frame plus how
+///          much their average luminance changed recently, so edges, noise and moving parts come before flat and
+///          static regions. Every tile starts at the coarsest step (one primary ray per step x step block), then
+///          the tiles are upgraded to every pixel in priority order as long as the ray budget allows.
+class tile_scheduler {
+public:
+    /// \brief The settings used for the next schedule
+    tile_schedule_settings settings;
+
+protected:
+    /// \brief The size of a tile in pixels and the amount of tiles in both directions
+    int tile_size_ = 16, tiles_x_ = 0, tiles_y_ = 0;
+
+    /// \brief The tiles from the highest to the lowest priority
+    std::vector<uint32_t> order_;
+
+    /// \brief The step between the traced pixels of every tile, 1 traces every pixel
+    std::vector<uint8_t> steps_;
+
+    /// \brief The priority of every tile, higher is rendered earlier
+    std::vector<double> priorities_;
+
+    /// \brief The average luminance of every tile in the previous frame
+    std::vector<double> means_;
+
+    /// \brief How much the average luminance of every tile changed recently, decays every frame
+    std::vector<double> changes_;
+
+    /// \brief Whether means_ was measured in an earlier frame, so the next frame can tell how much the tiles changed
+    bool history_ = false;
+
+    /// \brief The luminance variance of every tile in the previous frame
+    std::vector<double> variances_;
+
+    /// \brief The stats of the last schedule
+    tile_schedule_stats stats_;
+
+public:
+    /// \brief Orders the tiles of the next frame and picks their sampling rate
+    /// \param previous The frame that was presented last (AARRGGBB), if its size doesn't match nothing is known about
+    ///                 the tiles and only the focus point orders them
+    /// \param width The width of the frame
+    /// \param height The height of the frame
+    /// \param tile_size The size of a tile in pixels
+    /// \param focus_x The x position the viewer looks at in pixels, negative for the center of the screen
+    /// \param focus_y The y position the viewer looks at in pixels, negative for the center of the screen
+    /// \param ray_budget The maximum amount of primary rays, 0 traces every pixel of every tile
+    /// \example scheduler.schedule(buffer, width, height, 16, -1, -1, width * height / 2);
+    void schedule(const std::vector<uint32_t>& previous, int width, int height, int tile_size, double focus_x,
+                  double focus_y, std::size_t ray_budget);
+
+    /// \brief Gets the tiles from the highest to the lowest priority
+    /// \return The indices of the tiles, row by row
+    NODISCARD const std::vector<uint32_t>& order() const;
+
+    /// \brief Gets the step between the traced pixels of a tile
+    /// \param tile The index of the tile, row by row
+    /// \return 1 if every pixel is traced, else only the top left pixel of every step x step block is traced
+    NODISCARD int step(std::size_t tile) const;
+
+    /// \brief Gets the priority of a tile, higher is rendered earlier
+    /// \param tile The index of the tile, row by row
+    NODISCARD double priority(std::size_t tile) const;
+
+    /// \brief Gets the stats of the last schedule
+    NODISCARD const tile_schedule_stats& get_stats() const;
+}; // class tile_scheduler
@@ -0,0 +1,130 @@
+//
+// tracing.cpp
+//
+
+#include "tracing.h"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+    /// \brief Gets the direction of a camera ray, scaled so its component along the camera direction is 1
+    bardrix::vector3 plane_direction(const bardrix::camera& camera, int x, int y) {
+        auto ray = camera.shoot_ray(x, y, 1);
+        if (!ray.has_value())
+            return {0, 0, 0};
+
+        const double forward = ray->get_direction().dot(camera.get_direction().normalized());
+        return ray->get_direction() / forward;
+    }
+} // namespace
+
+ray_generator::ray_generator(const bardrix::camera& camera, double length) : origin_(camera.position), length_(length) {
+    corner_ = plane_direction(camera, 0, 0);
+
+    // Use the other neighbour if the image is only 1 pixel wide/high, the step stays zero if both are outside
+    step_x_ = camera.get_width() > 1 ? plane_direction(camera, 1, 0) - corner_ : bardrix::vector3(0, 0, 0);
+    step_y_ = camera.get_height() > 1 ? plane_direction(camera, 0, 1) - corner_ : bardrix::vector3(0, 0, 0);
+
+    auto ray = camera.shoot_ray(0, 0, length);
+    if (ray.has_value())
+        origin_ = ray->position;
+
+    // The steps lie in the image plane, the duals are perpendicular to the other step and to forward
+    forward_ = step_x_.cross(step_y_).normalized();
+    if (forward_.dot(corner_) < 0)
+        forward_ = -forward_;
+    const bardrix::vector3 across_y = step_y_.cross(forward_), across_x = forward_.cross(step_x_);
+    dual_x_ = across_y / step_x_.dot(across_y);
+    dual_y_ = across_x / step_y_.dot(across_x);
+    projectable_ = std::isfinite(dual_x_.x + dual_x_.y + dual_x_.z + dual_y_.x + dual_y_.y + dual_y_.z);
+}
+
+bardrix::ray ray_generator::shoot(double x, double y) const {
+    return {origin_, (corner_ + step_x_ * x + step_y_ * y).normalized(), length_};
+}
+
+double ray_generator::get_length() const { return length_; }
+
+bool ray_generator::bounds(const bardrix::point3& center, double radius, double& left, double& top, double& right,
+                           double& bottom) const {
+    const bardrix::vector3 to_center = origin_.vector_to(center);
+    const double depth = forward_.dot(to_center);
+    const double denominator = depth * depth - radius * radius;
+    if (projectable_ && depth + radius <= 0) {
+        // Behind the camera, no ray of the image points that way
+        left = top = std::numeric_limits<double>::infinity();
+        right = bottom = -std::numeric_limits<double>::infinity();
+        return true;
+    }
+    if (!projectable_ || depth <= radius || denominator <= 0)
+        return false;
+
+    // The planes through the origin that touch the sphere: a plane with normal dual - t * forward touches it where
+    // (dual . c - t * depth)^2 = radius^2 * |dual - t * forward|^2, the 2 solutions for t are the extremes
+    auto extremes = [&](const bardrix::vector3& dual, double& low, double& high) {
+        const double along = dual.dot(to_center);
+        const double root = radius * std::sqrt(dual.dot(dual) * denominator + along * along);
+        const double offset = dual.dot(corner_);
+        low = (along * depth - root) / denominator - offset;
+        high = (along * depth + root) / denominator - offset;
+    };
+
+    extremes(dual_x_, left, right);
+    extremes(dual_y_, top, bottom);
+    return true;
+}
+
+hit_record closest_hit(const bardrix::ray& ray, const std::vector<sphere>& spheres) {
+    hit_record closest;
+
+    for (const sphere& s : spheres) {
+        auto intersection = s.intersection(ray);
+        if (!intersection.has_value())
+            continue;
+
+        const double distance = ray.position.distance(intersection.value());
+        if (closest.shape == nullptr || distance < closest.distance)
+            closest = {&s, intersection.value(), distance};
+    }
+
+    return closest;
+}
+
+hit_record closest_hit(const bardrix::ray& ray, const std::vector<sphere>& spheres,
+                       const std::vector<uint32_t>& candidates) {
+    hit_record closest;
+
+    for (uint32_t index : candidates) {
+        auto intersection = spheres[index].intersection(ray);
+        if (!intersection.has_value())
+            continue;
+
+        const double distance = ray.position.distance(intersection.value());
+        if (closest.shape == nullptr || distance < closest.distance)
+            closest = {&spheres[index], intersection.value(), distance};
+    }
+
+    return closest;
+}
+
+bool is_occluded(const bardrix::ray& ray, const std::vector<sphere>& spheres, const sphere* ignore) {
+    for (const sphere& s : spheres) {
+        if (&s == ignore)
+            continue;
+
+        if (s.intersection(ray).has_value())
+            return true;
+    }
+
+    return false;
+}
+
+bool is_occluded(const bardrix::ray& ray, const std::vector<sphere>& spheres, const std::vector<uint32_t>& candidates) {
+    for (uint32_t index : candidates) {
+        if (spheres[index].intersection(ray).has_value())
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,109 @@
+//
+// tracing.h
+//
+
+#pragma once
+
+#include "sphere.h"
+
+#include <bardrix/camera.h>
+
+#include <cstdint>
+#include <vector>
+
+/// \brief The closest intersection of a ray with the scene
+struct hit_record {
+    /// \brief The sphere that was hit, nullptr if the ray didn't hit anything
+    const sphere* shape = nullptr;
+
+    /// \brief The intersection point on the sphere
+    bardrix::point3 point;
+
+    /// \brief The distance from the ray origin to the intersection point
+    double distance = 0;
+};
+
+/// \brief Generates camera rays for any position on the image, bardrix::camera::shoot_ray only takes whole pixels
+/// \details The camera is a pinhole, so the unnormalized ray directions are an affine function of the pixel position.
+///          That function is recovered from 3 rays of the camera, so a subpixel ray costs a normalize instead of a
+///          call to shoot_ray.
+class ray_generator {
+protected:
+    /// \brief The origin of every ray
+    bardrix::point3 origin_;
+
+    /// \brief The direction of pixel (0, 0) and how the direction changes per pixel, scaled so direction . forward = 1
+    bardrix::vector3 corner_, step_x_, step_y_;
+
+    /// \brief The normalized forward direction, and the vectors that give the pixel position of a direction on the
+    ///        image plane: x = dual_x . (direction - corner)
+    bardrix::vector3 forward_, dual_x_, dual_y_;
+
+    /// \brief Whether the image has a size in both directions, so the duals exist
+    bool projectable_ = false;
+
+    /// \brief The length of every ray
+    double length_;
+
+public:
+    /// \brief Constructor for the ray generator, it's only valid as long as the camera doesn't change
+    /// \param camera The camera to generate rays for
+    /// \param length The length of every ray
+    ray_generator(const bardrix::camera& camera, double length);
+
+    /// \brief Generates the ray through a position on the image
+    /// \param x The x position in pixels, x = 1 is the same ray as camera.shoot_ray(1, y)
+    /// \param y The y position in pixels
+    /// \return The ray through the position
+    /// \example bardrix::ray ray = generator.shoot(x + jitter_x, y + jitter_y);
+    NODISCARD bardrix::ray shoot(double x, double y) const;
+
+    /// \brief Gets the length of every ray
+    NODISCARD double get_length() const;
+
+    /// \brief Gets the part of the image a sphere covers, the projection of a sphere is an ellipse and this is its
+    ///        exact bounding box. A sphere behind the camera gets an empty box (left > right)
+    /// \param center The center of the sphere
+    /// \param radius The radius of the sphere
+    /// \param left The smallest x position of the sphere in pixels (output)
+    /// \param top The smallest y position of the sphere in pixels (output)
+    /// \param right The largest x position of the sphere in pixels (output)
+    /// \param bottom The largest y position of the sphere in pixels (output)
+    /// \return False if the sphere isn't completely in front of the camera, it can cover anything then
+    /// \example if (generator.bounds(s.get_position(), s.get_radius(), left, top, right, bottom)) { ... }
+    bool bounds(const bardrix::point3& center, double radius, double& left, double& top, double& right,
+                double& bottom) const;
+}; // class ray_generator
+
+/// \brief Finds the closest sphere that is hit by a ray
+/// \param ray The ray to trace
+/// \param spheres The spheres to test against
+/// \return The closest hit, hit_record::shape is nullptr if nothing was hit
+/// \example hit_record hit = closest_hit(ray, spheres);
+NODISCARD hit_record closest_hit(const bardrix::ray& ray, const std::vector<sphere>& spheres);
+
+/// \brief Finds the closest sphere of a list of spheres that is hit by a ray
+/// \param ray The ray to trace
+/// \param spheres The spheres in the scene
+/// \param candidates The indices of the spheres that can be hit in ascending order, see tile_culling
+/// \return The closest hit, hit_record::shape is nullptr if nothing was hit
+/// \example hit_record hit = closest_hit(ray, spheres, tiles.candidates(tile));
+NODISCARD hit_record closest_hit(const bardrix::ray& ray, const std::vector<sphere>& spheres,
+                                 const std::vector<uint32_t>& candidates);
+
+/// \brief Checks if a shadow ray is blocked by any sphere
+/// \param ray The shadow ray, going from the light to the surface point
+/// \param spheres The spheres that can block the ray
+/// \param ignore The sphere the shadow ray ends on, it's skipped
+/// \return True if any sphere (except ignore) is hit before the end of the ray
+/// \example if (!is_occluded(shadow, spheres, hit.shape)) { /* The light reaches the point */ }
+NODISCARD bool is_occluded(const bardrix::ray& ray, const std::vector<sphere>& spheres, const sphere* ignore);
+
+/// \brief Checks if a shadow ray is blocked by any of a list of spheres
+/// \param ray The shadow ray, going from the light to the surface point
+/// \param spheres The spheres in the scene
+/// \param candidates The indices of the spheres that can block the ray, see occluder_lists
+/// \return True if any candidate is hit before the end of the ray
+/// \example if (!is_occluded(shadow, spheres, occluders.candidates(light, receiver))) { /* The light reaches it */ }
+NODISCARD bool is_occluded(const bardrix::ray& ray, const std::vector<sphere>& spheres,
+                           const std::vector<uint32_t>& candidates);
@@ -0,0 +1,82 @@
+//
+// visibility_buffer.cpp
+//
+
+#include "visibility_buffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+namespace {
+    /// \brief The amount of rows a thread rasterizes at once
+    constexpr std::size_t rows_per_chunk = 8;
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+} // namespace
+
+std::ostream& operator<<(std::ostream& os, const visibility_stats& stats) {
+    os << "Visibility buffer: " << stats.covered_pixels << " covered pixels, " << stats.tested_pixels
+       << " ray-sphere tests, rasterized in " << stats.raster_ms << " ms";
+    return os;
+}
+
+void visibility_buffer::render(const ray_generator& generator, double jitter_x, double jitter_y, int width, int height,
+                               const std::vector<sphere>& spheres, thread_pool& pool) {
+    const auto start = std::chrono::steady_clock::now();
+    stats_ = visibility_stats();
+
+    const std::size_t pixels = static_cast<std::size_t>(width) * height;
+    ids_.assign(pixels, none);
+    depths_.assign(pixels, std::numeric_limits<double>::infinity());
+
+    footprints_.resize(spheres.size());
+    for (std::size_t s = 0; s < spheres.size(); s++)
+        footprints_[s] = pixel_bounds(generator, spheres[s], jitter_x, jitter_y, width, height);
+
+    std::atomic<std::size_t> tested{0}, covered{0};
+    pool.parallel_for(static_cast<std::size_t>(height), rows_per_chunk, [&](std::size_t begin, std::size_t end) {
+        std::size_t chunk_tested = 0;
+        for (std::size_t s = 0; s < spheres.size(); s++) {
+            const pixel_rect& footprint = footprints_[s];
+            const int y0 = std::max(footprint.top, static_cast<int>(begin));
+            const int y1 = std::min(footprint.bottom, static_cast<int>(end) - 1);
+
+            for (int y = y0; y <= y1; y++) {
+                for (int x = footprint.left; x <= footprint.right; x++) {
+                    // Refine the footprint with the exact intersection, the same test as closest_hit
+                    const bardrix::ray ray = generator.shoot(x + jitter_x, y + jitter_y);
+                    auto intersection = spheres[s].intersection(ray);
+                    chunk_tested++;
+                    if (!intersection.has_value())
+                        continue;
+
+                    const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+                    const double distance = ray.position.distance(intersection.value());
+                    if (ids_[pixel] == none || distance < depths_[pixel]) {
+                        ids_[pixel] = static_cast<uint32_t>(s);
+                        depths_[pixel] = distance;
+                    }
+                }
+            }
+        }
+
+        std::size_t chunk_covered = 0;
+        for (std::size_t pixel = begin * width; pixel < end * width; pixel++)
+            chunk_covered += ids_[pixel] != none;
+        tested += chunk_tested;
+        covered += chunk_covered;
+    });
+
+    stats_.tested_pixels = tested;
+    stats_.covered_pixels = covered;
+    stats_.raster_ms = milliseconds_since(start);
+}
+
+uint32_t visibility_buffer::id(std::size_t pixel) const { return ids_[pixel]; }
+
+double visibility_buffer::depth(std::size_t pixel) const { return depths_[pixel]; }
+
+const visibility_stats& visibility_buffer::get_stats() const { return stats_; }
@@ -0,0 +1,81 @@
+//
+// visibility_buffer.h
+//
+
+#pragma once
+
+#include "sphere.h"
+#include "thread_pool.h"
+#include "tile_culling.h"
+#include "tracing.h"
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+/// \brief How much work the last rasterization of the visibility buffer was
+struct visibility_stats {
+    /// \brief The amount of (sphere, pixel) pairs inside the footprints, every pair is one ray-sphere test
+    std::size_t tested_pixels = 0;
+
+    /// \brief The amount of pixels that show a sphere
+    std::size_t covered_pixels = 0;
+
+    /// \brief Milliseconds it took to rasterize the spheres
+    double raster_ms = 0;
+};
+
+/// \brief Prints the stats of the visibility buffer
+std::ostream& operator<<(std::ostream& os, const visibility_stats& stats);
+
+/// \brief The sphere and depth every primary ray sees, found by rasterizing the spheres instead of tracing the pixels
+/// \details Every sphere is splatted over its footprint, the bounding box of its projection (see pixel_bounds). Inside
+///          the footprint a pixel is refined with the exact ray-sphere intersection of its primary ray, and a closer
+///          hit replaces the stored sphere and depth. The spheres are splatted in index order and only a strictly
+///          closer hit wins, exactly like closest_hit, so the buffer is the same as tracing every pixel. The rows are
+///          split over the threads, every thread splats all spheres into its own rows.
+class visibility_buffer {
+public:
+    /// \brief The id of a pixel that doesn't show any sphere
+    static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+protected:
+    /// \brief The index of the sphere every pixel shows, none for the background
+    std::vector<uint32_t> ids_;
+
+    /// \brief The distance from the camera to the hit of every pixel
+    std::vector<double> depths_;
+
+    /// \brief The footprint of every sphere
+    std::vector<pixel_rect> footprints_;
+
+    /// \brief The stats of the last frame
+    visibility_stats stats_;
+
+public:
+    /// \brief Rasterizes the spheres into the buffer
+    /// \param generator The generator of the primary rays
+    /// \param jitter_x The offset of the primary rays from the pixel centers in pixels
+    /// \param jitter_y The offset of the primary rays from the pixel centers in pixels
+    /// \param width The width of the frame
+    /// \param height The height of the frame
+    /// \param spheres The spheres in the scene
+    /// \param pool The threads to rasterize with
+    /// \example buffer.render(generator, 0, 0, width, height, spheres, pool);
+    void render(const ray_generator& generator, double jitter_x, double jitter_y, int width, int height,
+                const std::vector<sphere>& spheres, thread_pool& pool);
+
+    /// \brief Gets the sphere a pixel shows
+    /// \param pixel The index of the pixel, row by row
+    /// \return The index of the sphere, none for the background
+    NODISCARD uint32_t id(std::size_t pixel) const;
+
+    /// \brief Gets the distance from the camera to the hit of a pixel
+    /// \param pixel The index of the pixel, row by row
+    /// \return The distance, infinity for the background
+    NODISCARD double depth(std::size_t pixel) const;
+
+    /// \brief Gets the stats of the last frame
+    NODISCARD const visibility_stats& get_stats() const;
+}; // class visibility_buffer
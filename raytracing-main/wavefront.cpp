@@ -0,0 +1,449 @@
+//
+// wavefront.cpp
+//
+
+#include "wavefront.h"
+#include "sampling.h"
+#include "tracing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+namespace {
+    /// \brief Secondary rays start this far from the surface so they don't hit the sphere they start on
+    constexpr double surface_offset = 1e-6;
+
+    double milliseconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    template<typename T>
+    void gather(std::vector<T>& destination, const std::vector<T>& source, const uint32_t* indices,
+                std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++)
+            destination[i] = source[indices[i]];
+    }
+} // namespace
+
+std::size_t path_queue::size() const { return pixel.size(); }
+
+void path_queue::resize(std::size_t size) {
+    for (auto* array : {&origin_x, &origin_y, &origin_z, &direction_x, &direction_y, &direction_z, &distance})
+        array->resize(size);
+    for (auto* array : {&throughput_r, &throughput_g, &throughput_b})
+        array->resize(size);
+    pixel.resize(size);
+    rng.resize(size);
+    shape.resize(size);
+}
+
+std::size_t shadow_queue::size() const { return pixel.size(); }
+
+void shadow_queue::resize(std::size_t size) {
+    for (auto* array : {&origin_x, &origin_y, &origin_z, &direction_x, &direction_y, &direction_z, &length})
+        array->resize(size);
+    for (auto* array : {&contribution_r, &contribution_g, &contribution_b})
+        array->resize(size);
+    pixel.resize(size);
+    shape.resize(size);
+}
+
+std::ostream& operator<<(std::ostream& os, const wavefront_stats& stats) {
+    os << "Wavefront frame on " << stats.threads << " threads\n"
+       << "  generate " << stats.generate_ms << " ms, extend " << stats.extend_ms << " ms, shade "
+       << stats.shade_ms << " ms, shadow " << stats.shadow_ms << " ms, compact " << stats.compact_ms
+       << " ms, accumulate " << stats.accumulate_ms << " ms\n"
+       << "  shadow rays: " << stats.shadow_rays << ", paths per bounce:";
+    for (std::size_t paths : stats.paths_per_bounce)
+        os << ' ' << paths;
+    return os;
+}
+
+wavefront_renderer::wavefront_renderer(const bardrix::camera& camera, const std::vector<sphere>& spheres,
+                                       const std::vector<bardrix::light>& lights, thread_pool& pool)
+    : camera_(camera), spheres_(spheres), lights_(lights), pool_(pool) {}
+
+const wavefront_stats& wavefront_renderer::get_stats() const { return stats_; }
+
+const guide_buffers& wavefront_renderer::get_guides() const { return guides_; }
+
+hdr_view wavefront_renderer::get_radiance() const {
+    return {radiance_r_.data(), radiance_g_.data(), radiance_b_.data(),
+            1.0f / static_cast<float>(std::max(1, settings.samples_per_pixel))};
+}
+
+void wavefront_renderer::render(std::vector<uint32_t>& buffer, int width, int height) {
+    stats_ = wavefront_stats();
+    stats_.threads = pool_.size();
+    frame_++;
+
+    sphere_x_.resize(spheres_.size());
+    sphere_y_.resize(spheres_.size());
+    sphere_z_.resize(spheres_.size());
+    sphere_radius_.resize(spheres_.size());
+    for (std::size_t s = 0; s < spheres_.size(); s++) {
+        sphere_x_[s] = spheres_[s].get_position().x;
+        sphere_y_[s] = spheres_[s].get_position().y;
+        sphere_z_[s] = spheres_[s].get_position().z;
+        sphere_radius_[s] = spheres_[s].get_radius();
+    }
+
+    const std::size_t pixels = static_cast<std::size_t>(width) * height;
+    radiance_r_.assign(pixels, 0);
+    radiance_g_.assign(pixels, 0);
+    radiance_b_.assign(pixels, 0);
+    guides_.reset(width, height);
+
+    auto start = std::chrono::steady_clock::now();
+    generate(width, height);
+    stats_.generate_ms = milliseconds_since(start);
+
+    for (int bounce = 0; bounce <= settings.max_bounces && paths_.size() > 0; bounce++) {
+        stats_.paths_per_bounce.push_back(paths_.size());
+
+        start = std::chrono::steady_clock::now();
+        extend();
+        if (bounce == 0)
+            store_guides();
+        stats_.extend_ms += milliseconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        shade(bounce);
+        stats_.shade_ms += milliseconds_since(start);
+
+        // Only shadow rays towards lights in front of the surface are traced
+        start = std::chrono::steady_clock::now();
+        const std::size_t shadow_count = compact_indices(shadow_alive_);
+        next_shadows_.resize(shadow_count);
+        pool_.parallel_for(shadow_count, settings.grain, [&](std::size_t begin, std::size_t end) {
+            const uint32_t* indices = indices_.data();
+            for (auto array : {&shadow_queue::origin_x, &shadow_queue::origin_y, &shadow_queue::origin_z,
+                               &shadow_queue::direction_x, &shadow_queue::direction_y, &shadow_queue::direction_z,
+                               &shadow_queue::length})
+                gather(next_shadows_.*array, shadows_.*array, indices, begin, end);
+            for (auto array : {&shadow_queue::contribution_r, &shadow_queue::contribution_g,
+                               &shadow_queue::contribution_b})
+                gather(next_shadows_.*array, shadows_.*array, indices, begin, end);
+            gather(next_shadows_.pixel, shadows_.pixel, indices, begin, end);
+            gather(next_shadows_.shape, shadows_.shape, indices, begin, end);
+        });
+        stats_.compact_ms += milliseconds_since(start);
+        stats_.shadow_rays += shadow_count;
+
+        start = std::chrono::steady_clock::now();
+        shadow();
+        stats_.shadow_ms += milliseconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        accumulate();
+        stats_.accumulate_ms += milliseconds_since(start);
+
+        // Terminated paths are dropped, the survivors become the paths of the next bounce
+        start = std::chrono::steady_clock::now();
+        const std::size_t path_count = compact_indices(path_alive_);
+        paths_.resize(path_count);
+        pool_.parallel_for(path_count, settings.grain, [&](std::size_t begin, std::size_t end) {
+            const uint32_t* indices = indices_.data();
+            for (auto array : {&path_queue::origin_x, &path_queue::origin_y, &path_queue::origin_z,
+                               &path_queue::direction_x, &path_queue::direction_y, &path_queue::direction_z})
+                gather(paths_.*array, next_paths_.*array, indices, begin, end);
+            for (auto array : {&path_queue::throughput_r, &path_queue::throughput_g, &path_queue::throughput_b})
+                gather(paths_.*array, next_paths_.*array, indices, begin, end);
+            gather(paths_.pixel, next_paths_.pixel, indices, begin, end);
+            gather(paths_.rng, next_paths_.rng, indices, begin, end);
+        });
+        stats_.compact_ms += milliseconds_since(start);
+    }
+
+    resolve(buffer);
+}
+
+void wavefront_renderer::generate(int width, int height) {
+    const auto samples = static_cast<std::size_t>(std::max(1, settings.samples_per_pixel));
+    paths_.resize(static_cast<std::size_t>(width) * height * samples);
+
+    const uint32_t frame_seed = sampling::hash(frame_);
+    const ray_generator generator(camera_, 10);
+    pool_.parallel_for(paths_.size(), settings.grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const auto pixel = static_cast<uint32_t>(i / samples);
+            const bardrix::ray ray = generator.shoot(pixel % width + settings.jitter_x,
+                                                     pixel / width + settings.jitter_y);
+
+            const bardrix::point3 origin = ray.position;
+            const bardrix::vector3 direction = ray.get_direction();
+            paths_.origin_x[i] = origin.x;
+            paths_.origin_y[i] = origin.y;
+            paths_.origin_z[i] = origin.z;
+            paths_.direction_x[i] = direction.x;
+            paths_.direction_y[i] = direction.y;
+            paths_.direction_z[i] = direction.z;
+            paths_.throughput_r[i] = paths_.throughput_g[i] = paths_.throughput_b[i] = 1;
+            paths_.pixel[i] = pixel;
+            paths_.rng[i] = sampling::hash(static_cast<uint32_t>(i) ^ frame_seed);
+        }
+    });
+}
+
+void wavefront_renderer::extend() {
+    const std::size_t sphere_count = sphere_x_.size();
+
+    pool_.parallel_for(paths_.size(), settings.grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const double ox = paths_.origin_x[i], oy = paths_.origin_y[i], oz = paths_.origin_z[i];
+            const double dx = paths_.direction_x[i], dy = paths_.direction_y[i], dz = paths_.direction_z[i];
+
+            double closest = std::numeric_limits<double>::infinity();
+            int32_t shape = -1;
+
+            // Same math as sphere::intersection, but branchless so the loop stays in SIMD registers
+            for (std::size_t s = 0; s < sphere_count; s++) {
+                const double cx = sphere_x_[s] - ox, cy = sphere_y_[s] - oy, cz = sphere_z_[s] - oz;
+                const double dot = cx * dx + cy * dy + cz * dz;
+                const double distance_squared = cx * cx + cy * cy + cz * cz - dot * dot;
+                const double radius_squared = sphere_radius_[s] * sphere_radius_[s];
+                const double t = dot - std::sqrt(std::max(0.0, radius_squared - distance_squared));
+
+                const bool hit = distance_squared <= radius_squared && t > 0 && t < closest;
+                closest = hit ? t : closest;
+                shape = hit ? static_cast<int32_t>(s) : shape;
+            }
+
+            paths_.distance[i] = closest;
+            paths_.shape[i] = shape;
+        }
+    });
+}
+
+void wavefront_renderer::store_guides() {
+    const auto samples = static_cast<std::size_t>(std::max(1, settings.samples_per_pixel));
+
+    // Before the first compaction path i is sample i % samples of pixel i / samples
+    pool_.parallel_for(guides_.depth.size(), settings.grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t pixel = begin; pixel < end; pixel++) {
+            const std::size_t i = pixel * samples;
+            const int32_t shape = paths_.shape[i];
+            if (shape < 0)
+                continue;
+
+            const bardrix::point3 point =
+                bardrix::point3(paths_.origin_x[i], paths_.origin_y[i], paths_.origin_z[i]) +
+                bardrix::vector3(paths_.direction_x[i], paths_.direction_y[i], paths_.direction_z[i]) *
+                paths_.distance[i];
+            const bardrix::vector3 normal = spheres_[shape].normal_at(point);
+            const bardrix::color& albedo = spheres_[shape].get_material().color;
+
+            guides_.normal_x[pixel] = static_cast<float>(normal.x);
+            guides_.normal_y[pixel] = static_cast<float>(normal.y);
+            guides_.normal_z[pixel] = static_cast<float>(normal.z);
+            guides_.depth[pixel] = static_cast<float>(paths_.distance[i]);
+            guides_.albedo_r[pixel] = static_cast<float>(albedo.r()) / 255.0f;
+            guides_.albedo_g[pixel] = static_cast<float>(albedo.g()) / 255.0f;
+            guides_.albedo_b[pixel] = static_cast<float>(albedo.b()) / 255.0f;
+        }
+    });
+}
+
+void wavefront_renderer::shade(int bounce) {
+    const std::size_t light_count = lights_.size();
+    const bool last_bounce = bounce >= settings.max_bounces;
+
+    next_paths_.resize(paths_.size());
+    path_alive_.resize(paths_.size());
+    shadows_.resize(paths_.size() * light_count);
+    shadow_alive_.resize(paths_.size() * light_count);
+
+    pool_.parallel_for(paths_.size(), settings.grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            path_alive_[i] = 0;
+            std::fill_n(shadow_alive_.begin() + static_cast<std::ptrdiff_t>(i * light_count), light_count, 0);
+
+            const int32_t shape = paths_.shape[i];
+            if (shape < 0)
+                continue; // The path left the scene
+
+            const bardrix::vector3 direction(paths_.direction_x[i], paths_.direction_y[i], paths_.direction_z[i]);
+            const bardrix::point3 point = bardrix::point3(paths_.origin_x[i], paths_.origin_y[i], paths_.origin_z[i]) +
+                                          direction * paths_.distance[i];
+            const sphere& s = spheres_[shape];
+            const bardrix::material& material = s.get_material();
+            const bardrix::vector3 normal = s.normal_at(point);
+            const float throughput_r = paths_.throughput_r[i];
+            const float throughput_g = paths_.throughput_g[i];
+            const float throughput_b = paths_.throughput_b[i];
+
+            // Next event estimation, the same Phong model as calculate_light_intensity
+            for (std::size_t l = 0; l < light_count; l++) {
+                const bardrix::light& light = lights_[l];
+                const bardrix::vector3 to_light = point.vector_to(light.position);
+                const double distance = to_light.length();
+                const bardrix::vector3 light_direction = to_light / distance;
+
+                const double angle = normal.dot(light_direction);
+                if (angle < 0)
+                    continue; // The light is behind the surface
+
+                const bardrix::vector3 reflection = normal * (2 * angle) - light_direction;
+                const double specular_angle = std::max(0.0, -reflection.dot(direction));
+                double intensity = material.get_ambient() + material.get_diffuse() * angle +
+                                   material.get_specular() * std::pow(specular_angle, material.get_shininess());
+                intensity = std::min(1.0, intensity * light.inverse_square_law(point));
+
+                const bardrix::color color = material.color.blended(light.color);
+                const std::size_t index = i * light_count + l;
+                shadows_.origin_x[index] = light.position.x;
+                shadows_.origin_y[index] = light.position.y;
+                shadows_.origin_z[index] = light.position.z;
+                shadows_.direction_x[index] = -light_direction.x;
+                shadows_.direction_y[index] = -light_direction.y;
+                shadows_.direction_z[index] = -light_direction.z;
+                shadows_.length[index] = distance - bardrix::epsilon;
+                shadows_.contribution_r[index] = throughput_r * static_cast<float>(intensity * color.r() / 255.0);
+                shadows_.contribution_g[index] = throughput_g * static_cast<float>(intensity * color.g() / 255.0);
+                shadows_.contribution_b[index] = throughput_b * static_cast<float>(intensity * color.b() / 255.0);
+                shadows_.pixel[index] = paths_.pixel[i];
+                shadows_.shape[index] = shape;
+                shadow_alive_[index] = 1;
+            }
+
+            const double lobe_weight = material.get_diffuse() + material.get_specular();
+            if (last_bounce || lobe_weight <= 0)
+                continue;
+
+            // Pick the diffuse or the specular lobe, proportional to their weight
+            uint32_t rng = paths_.rng[i];
+            const double specular_probability = material.get_specular() / lobe_weight;
+            const double u1 = sampling::next_double(rng), u2 = sampling::next_double(rng);
+            bardrix::vector3 bounce_direction;
+            double weight_r, weight_g, weight_b;
+
+            if (sampling::next_double(rng) < specular_probability) {
+                const bardrix::vector3 mirror = direction - normal * (2 * direction.dot(normal));
+                bounce_direction = sampling::phong_lobe(mirror, material.get_shininess(), u1, u2);
+                weight_r = weight_g = weight_b = material.get_specular() / specular_probability;
+            } else {
+                bounce_direction = sampling::cosine_hemisphere(normal, u1, u2);
+                const double weight = material.get_diffuse() / (1 - specular_probability) / 255.0;
+                weight_r = material.color.r() * weight;
+                weight_g = material.color.g() * weight;
+                weight_b = material.color.b() * weight;
+            }
+
+            if (bounce_direction.dot(normal) <= 0)
+                continue; // Sampled below the surface
+
+            float next_r = throughput_r * static_cast<float>(weight_r);
+            float next_g = throughput_g * static_cast<float>(weight_g);
+            float next_b = throughput_b * static_cast<float>(weight_b);
+
+            // Russian roulette, paths that carry little light are likely terminated
+            if (bounce >= settings.russian_roulette_bounce) {
+                const float survival = std::min(0.95f, std::max({next_r, next_g, next_b}));
+                if (sampling::next_double(rng) >= survival)
+                    continue;
+                next_r /= survival;
+                next_g /= survival;
+                next_b /= survival;
+            }
+
+            const bardrix::point3 origin = point + normal * surface_offset;
+            next_paths_.origin_x[i] = origin.x;
+            next_paths_.origin_y[i] = origin.y;
+            next_paths_.origin_z[i] = origin.z;
+            next_paths_.direction_x[i] = bounce_direction.x;
+            next_paths_.direction_y[i] = bounce_direction.y;
+            next_paths_.direction_z[i] = bounce_direction.z;
+            next_paths_.throughput_r[i] = next_r;
+            next_paths_.throughput_g[i] = next_g;
+            next_paths_.throughput_b[i] = next_b;
+            next_paths_.pixel[i] = paths_.pixel[i];
+            next_paths_.rng[i] = rng;
+            path_alive_[i] = 1;
+        }
+    });
+}
+
+void wavefront_renderer::shadow() {
+    const std::size_t sphere_count = sphere_x_.size();
+    shadow_alive_.resize(next_shadows_.size());
+
+    pool_.parallel_for(next_shadows_.size(), settings.grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t i = begin; i < end; i++) {
+            const double ox = next_shadows_.origin_x[i], oy = next_shadows_.origin_y[i];
+            const double oz = next_shadows_.origin_z[i];
+            const double dx = next_shadows_.direction_x[i], dy = next_shadows_.direction_y[i];
+            const double dz = next_shadows_.direction_z[i];
+            const double length = next_shadows_.length[i];
+            const auto ignore = static_cast<std::size_t>(next_shadows_.shape[i]);
+
+            bool blocked = false;
+            for (std::size_t s = 0; s < sphere_count; s++) {
+                const double cx = sphere_x_[s] - ox, cy = sphere_y_[s] - oy, cz = sphere_z_[s] - oz;
+                const double dot = cx * dx + cy * dy + cz * dz;
+                const double distance_squared = cx * cx + cy * cy + cz * cz - dot * dot;
+                const double radius_squared = sphere_radius_[s] * sphere_radius_[s];
+                const double t = dot - std::sqrt(std::max(0.0, radius_squared - distance_squared));
+
+                blocked |= s != ignore && distance_squared <= radius_squared && t > 0 && t < length;
+            }
+
+            shadow_alive_[i] = !blocked;
+        }
+    });
+}
+
+void wavefront_renderer::accumulate() {
+    // Serial, several shadow rays can add to the same pixel and this is cheap compared to tracing them
+    for (std::size_t i = 0; i < next_shadows_.size(); i++) {
+        if (!shadow_alive_[i])
+            continue;
+
+        const uint32_t pixel = next_shadows_.pixel[i];
+        radiance_r_[pixel] += next_shadows_.contribution_r[i];
+        radiance_g_[pixel] += next_shadows_.contribution_g[i];
+        radiance_b_[pixel] += next_shadows_.contribution_b[i];
+    }
+}
+
+void wavefront_renderer::resolve(std::vector<uint32_t>& buffer) {
+    const float scale = 255.0f / static_cast<float>(std::max(1, settings.samples_per_pixel));
+
+    pool_.parallel_for(radiance_r_.size(), settings.grain, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t pixel = begin; pixel < end; pixel++) {
+            const auto r = static_cast<uint8_t>(std::min(255.0f, radiance_r_[pixel] * scale));
+            const auto g = static_cast<uint8_t>(std::min(255.0f, radiance_g_[pixel] * scale));
+            const auto b = static_cast<uint8_t>(std::min(255.0f, radiance_b_[pixel] * scale));
+            buffer[pixel] = bardrix::color(r, g, b, 255).argb(); // ARGB is the format used by Windows API
+        }
+    });
+}
+
+std::size_t wavefront_renderer::compact_indices(const std::vector<uint8_t>& alive) {
+    const std::size_t count = alive.size();
+    const std::size_t grain = std::max<std::size_t>(1, settings.grain);
+    const std::size_t chunks = (count + grain - 1) / grain;
+    chunk_offsets_.assign(chunks + 1, 0);
+
+    // Count the live items per chunk, then scan the counts so every chunk knows where to write
+    pool_.parallel_for(count, grain, [&](std::size_t begin, std::size_t end) {
+        uint32_t live = 0;
+        for (std::size_t i = begin; i < end; i++)
+            live += alive[i];
+        chunk_offsets_[begin / grain + 1] = live;
+    });
+
+    for (std::size_t chunk = 0; chunk < chunks; chunk++)
+        chunk_offsets_[chunk + 1] += chunk_offsets_[chunk];
+
+    indices_.resize(chunk_offsets_[chunks]);
+    pool_.parallel_for(count, grain, [&](std::size_t begin, std::size_t end) {
+        uint32_t offset = chunk_offsets_[begin / grain];
+        for (std::size_t i = begin; i < end; i++) {
+            if (alive[i])
+                indices_[offset++] = static_cast<uint32_t>(i);
+        }
+    });
+
+    return chunk_offsets_[chunks];
+}
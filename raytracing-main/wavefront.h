@@ -0,0 +1,215 @@
+//
+// wavefront.h
+//
+
+#pragma once
+
+#include "accumulation.h"
+#include "denoiser.h"
+#include "sphere.h"
+#include "thread_pool.h"
+
+#include <bardrix/camera.h>
+#include <bardrix/light.h>
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/// \brief The paths that are being traced, stored as a structure of arrays so every kernel streams through memory
+struct path_queue {
+    /// \brief The origin of the next ray of every path
+    std::vector<double> origin_x, origin_y, origin_z;
+
+    /// \brief The normalized direction of the next ray of every path
+    std::vector<double> direction_x, direction_y, direction_z;
+
+    /// \brief The fraction of light that reaches the camera through every path
+    std::vector<float> throughput_r, throughput_g, throughput_b;
+
+    /// \brief The pixel every path belongs to
+    std::vector<uint32_t> pixel;
+
+    /// \brief The random stream of every path
+    std::vector<uint32_t> rng;
+
+    /// \brief The distance to the closest hit (set by the extend kernel)
+    std::vector<double> distance;
+
+    /// \brief The index of the closest sphere, -1 for a miss (set by the extend kernel)
+    std::vector<int32_t> shape;
+
+    /// \brief Gets the amount of paths in the queue
+    NODISCARD std::size_t size() const;
+
+    /// \brief Resizes every array of the queue
+    void resize(std::size_t size);
+}; // struct path_queue
+
+/// \brief The shadow rays for next event estimation, stored as a structure of arrays
+struct shadow_queue {
+    /// \brief The origin of every shadow ray (the light position)
+    std::vector<double> origin_x, origin_y, origin_z;
+
+    /// \brief The normalized direction of every shadow ray
+    std::vector<double> direction_x, direction_y, direction_z;
+
+    /// \brief The length of every shadow ray, anything further away doesn't block it
+    std::vector<double> length;
+
+    /// \brief The light that's added to the pixel if the shadow ray isn't blocked
+    std::vector<float> contribution_r, contribution_g, contribution_b;
+
+    /// \brief The pixel every shadow ray belongs to
+    std::vector<uint32_t> pixel;
+
+    /// \brief The sphere the shadow ray ends on, it's skipped during the occlusion test
+    std::vector<int32_t> shape;
+
+    /// \brief Gets the amount of shadow rays in the queue
+    NODISCARD std::size_t size() const;
+
+    /// \brief Resizes every array of the queue
+    void resize(std::size_t size);
+}; // struct shadow_queue
+
+/// \brief Settings of the wavefront path tracer
+struct wavefront_settings {
+    /// \brief The amount of paths per pixel per frame
+    int samples_per_pixel = 1;
+
+    /// \brief The maximum amount of bounces of a path, 0 only does direct lighting
+    int max_bounces = 4;
+
+    /// \brief From this bounce on paths are terminated with russian roulette
+    int russian_roulette_bounce = 2;
+
+    /// \brief The amount of queue items a thread processes at once
+    std::size_t grain = 4096;
+
+    /// \brief The offset of every primary ray from the pixel center in pixels [-0.5, 0.5], a different offset every
+    ///        frame anti-aliases the accumulated image
+    double jitter_x = 0, jitter_y = 0;
+};
+
+/// \brief Timings and queue sizes of the last frame of the wavefront path tracer
+struct wavefront_stats {
+    /// \brief Milliseconds spent in every kernel
+    double generate_ms = 0, extend_ms = 0, shade_ms = 0, shadow_ms = 0, compact_ms = 0, accumulate_ms = 0;
+
+    /// \brief The amount of paths that were alive at the start of every bounce
+    std::vector<std::size_t> paths_per_bounce;
+
+    /// \brief The total amount of shadow rays that were traced
+    std::size_t shadow_rays = 0;
+
+    /// \brief The amount of threads that ran the kernels
+    std::size_t threads = 0;
+};
+
+/// \brief Writes the wavefront stats in a human readable format
+std::ostream& operator<<(std::ostream& os, const wavefront_stats& stats);
+
+/// \brief Path tracer that processes all paths of a frame at once, one kernel at a time
+/// \details Every bounce runs the kernels generate (only the first bounce), extend (closest hit), shade (creates shadow
+///          rays and the next bounce) and shadow (occlusion of the shadow rays). In between the kernels the queues are
+///          compacted so the next kernel only sees live work.
+class wavefront_renderer {
+public:
+    /// \brief The settings used for the next frame
+    wavefront_settings settings;
+
+protected:
+    /// \brief The camera to render from
+    const bardrix::camera& camera_;
+
+    /// \brief The spheres in the scene
+    const std::vector<sphere>& spheres_;
+
+    /// \brief The lights in the scene
+    const std::vector<bardrix::light>& lights_;
+
+    /// \brief The threads that run the kernels
+    thread_pool& pool_;
+
+    /// \brief The spheres as structure of arrays for the extend and shadow kernels
+    std::vector<double> sphere_x_, sphere_y_, sphere_z_, sphere_radius_;
+
+    /// \brief The paths of the current bounce and the paths of the next bounce
+    path_queue paths_, next_paths_;
+
+    /// \brief The shadow rays of the current bounce, before and after compaction
+    shadow_queue shadows_, next_shadows_;
+
+    /// \brief Whether a path or a shadow ray survives compaction, reused for the visibility of the shadow rays
+    std::vector<uint8_t> path_alive_, shadow_alive_;
+
+    /// \brief Scratch space for stream compaction
+    std::vector<uint32_t> indices_, chunk_offsets_;
+
+    /// \brief The radiance of every pixel of the current frame
+    std::vector<float> radiance_r_, radiance_g_, radiance_b_;
+
+    /// \brief The normal, depth and albedo of every pixel's primary hit, for the denoiser
+    guide_buffers guides_;
+
+    /// \brief The frame number, used to seed the random streams
+    uint32_t frame_ = 0;
+
+    /// \brief The stats of the last frame
+    wavefront_stats stats_;
+
+public:
+    /// \brief Constructor for the wavefront renderer, the scene is referenced and not copied
+    /// \param camera The camera to render from
+    /// \param spheres The spheres in the scene
+    /// \param lights The lights in the scene
+    /// \param pool The threads that run the kernels
+    wavefront_renderer(const bardrix::camera& camera, const std::vector<sphere>& spheres,
+                       const std::vector<bardrix::light>& lights, thread_pool& pool);
+
+    /// \brief Renders a frame
+    /// \param buffer The buffer to render to, the format is AARRGGBB
+    /// \param width The width of the buffer
+    /// \param height The height of the buffer
+    void render(std::vector<uint32_t>& buffer, int width, int height);
+
+    /// \brief Gets the timings and queue sizes of the last frame
+    NODISCARD const wavefront_stats& get_stats() const;
+
+    /// \brief Gets the normal, depth and albedo of the primary hits of the last frame
+    /// \return The guide buffers for the denoiser
+    NODISCARD const guide_buffers& get_guides() const;
+
+    /// \brief Gets the radiance of every pixel of the last frame, before it's clamped to ARGB
+    /// \return The radiance, only valid until the next frame
+    NODISCARD hdr_view get_radiance() const;
+
+protected:
+    /// \brief Generate kernel, creates a path for every sample of every pixel
+    void generate(int width, int height);
+
+    /// \brief Extend kernel, finds the closest sphere of every path
+    void extend();
+
+    /// \brief Writes the primary hit of the first sample of every pixel to the guide buffers (after the first extend)
+    void store_guides();
+
+    /// \brief Shade kernel, creates a shadow ray for every light and samples the next bounce of every path
+    /// \param bounce The current bounce
+    void shade(int bounce);
+
+    /// \brief Shadow kernel, traces the shadow rays and marks the ones that reach their surface point
+    void shadow();
+
+    /// \brief Adds the light of every unblocked shadow ray to its pixel
+    void accumulate();
+
+    /// \brief Converts the radiance of every pixel to ARGB
+    void resolve(std::vector<uint32_t>& buffer);
+
+    /// \brief Writes the indices of all items that are alive to indices_, in their original order
+    /// \param alive Whether every item is alive
+    /// \return The amount of items that are alive
+    std::size_t compact_indices(const std::vector<uint8_t>& alive);
+}; // class wavefront_renderer
@@ -15,7 +15,6 @@ bardrix::window::window(const char* title, int width, int height) {
     width_ = width > 0 ? width : -width;
     height_ = height > 0 ? height : -height;
     back_buffer_.resize(width_ * height_);
-    front_buffer_.resize(width_ * height_);
 
     bmi_.bmiHeader.biSize = sizeof(bmi_.bmiHeader);
     bmi_.bmiHeader.biWidth = width_;
@@ -41,6 +40,21 @@ const char* bardrix::window::get_title() const {
     return title_;
 }
 
+bool bardrix::window::get_cursor(int& x, int& y) const {
+    POINT point;
+    if (hwnd_ == nullptr || !GetCursorPos(&point) || !ScreenToClient(hwnd_, &point))
+        return false;
+
+    RECT client;
+    if (!GetClientRect(hwnd_, &client) || point.x < client.left || point.x >= client.right ||
+        point.y < client.top || point.y >= client.bottom)
+        return false;
+
+    x = point.x;
+    y = point.y;
+    return true;
+}
+
 bool bardrix::window::show(int x, int y) {
 
     WNDCLASS wc = {};
@@ -63,6 +77,10 @@ void bardrix::window::hide() const {
     ShowWindow(hwnd_, SW_HIDE);
 }
 
+void bardrix::window::set_frame_ring(frame_ring* ring) {
+    frame_ring_ = ring;
+}
+
 void bardrix::window::redraw() const {
     if (hwnd_)
         InvalidateRect(hwnd_, nullptr, FALSE);
@@ -107,12 +125,15 @@ LRESULT CALLBACK bardrix::window::window_proc(HWND hwnd, UINT msg, WPARAM wparam
             if (p_window->on_paint) // Call the on_paint function
                 p_window->on_paint(p_window, p_window->back_buffer_);
 
-            std::swap(p_window->front_buffer_, p_window->back_buffer_);
+            // The finished frame goes to the ring, other processes see it there and it's drawn from there
+            const uint32_t* frame = p_window->back_buffer_.data();
+            frame_ring* ring = p_window->frame_ring_;
+            if (ring != nullptr && ring->publish(p_window->back_buffer_, p_window->width_, p_window->height_))
+                frame = ring->latest().pixels;
 
-            // Draw the front buffer to the screen
+            // Draw the frame to the screen
             StretchDIBits(hdc, 0, 0, p_window->width_, p_window->height_, 0, 0, p_window->width_,
-                          p_window->height_, p_window->front_buffer_.data(), &p_window->bmi_, DIB_RGB_COLORS,
-                          SRCCOPY);
+                          p_window->height_, frame, &p_window->bmi_, DIB_RGB_COLORS, SRCCOPY);
 
             EndPaint(hwnd, &ps);
             break;
@@ -127,7 +148,6 @@ LRESULT CALLBACK bardrix::window::window_proc(HWND hwnd, UINT msg, WPARAM wparam
             p_window->bmi_.bmiHeader.biWidth = p_window->width_;
             p_window->bmi_.bmiHeader.biHeight = -p_window->height_; // top-down
             p_window->back_buffer_.resize(p_window->width_ * p_window->height_);
-            p_window->front_buffer_.resize(p_window->width_ * p_window->height_);
             if (p_window->on_resize)
                 p_window->on_resize(p_window, p_window->width_, p_window->height_);
             break;
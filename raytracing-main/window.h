@@ -8,6 +8,8 @@
 #include <bardrix/bardrix.h>
 #include <bardrix/color.h>
 
+#include "frame_ring.h"
+
 #undef UNICODE // This is for the window class to work with char* instead of wchar_t* (unicode)
 #define NOMINMAX // This is to avoid the min and max macros from windows.h
 #include <Windows.h>
@@ -65,8 +67,11 @@ namespace bardrix {
         /// \brief The handle to the window.
         HWND hwnd_{};
 
-        /// \brief Buffers for swapping between displaying and drawing.
-        std::vector<uint32_t> back_buffer_, front_buffer_;
+        /// \brief The buffer on_paint draws to, it still holds the previous frame when on_paint is called.
+        std::vector<uint32_t> back_buffer_;
+
+        /// \brief The ring the finished frames are published to and displayed from, nullptr to display the back buffer.
+        frame_ring* frame_ring_ = nullptr;
         /// \brief The bitmap info for the window.
         BITMAPINFO bmi_ = {};
 
@@ -92,6 +97,13 @@ namespace bardrix {
         /// \return The title of the window.
         NODISCARD const char* get_title() const;
 
+        /// \brief Gets the position of the mouse cursor relative to the window's client area.
+        /// \param x The x position of the cursor in pixels.
+        /// \param y The y position of the cursor in pixels.
+        /// \return If the cursor is inside the client area, if not x and y are left unchanged.
+        /// \example int x, y; if (window.get_cursor(x, y)) std::cout << x << ", " << y << std::endl;
+        NODISCARD bool get_cursor(int& x, int& y) const;
+
         /// \brief Shows the window at a specified position.
         /// \param x The x position of the window.
         /// \param y The y position of the window.
@@ -103,6 +115,12 @@ namespace bardrix {
         /// \brief Hides the window.
         void hide() const;
 
+        /// \brief Publishes every finished frame to a ring in shared memory, so other processes can show or record it.
+        /// \param ring The ring, created by this process, or nullptr to stop publishing.
+        /// \note Frames that don't fit in the ring are displayed without being published.
+        /// \example frame_ring ring; ring.create("raytracing-frames", 4, 1920 * 1080); window.set_frame_ring(&ring);
+        void set_frame_ring(frame_ring* ring);
+
         /// \brief Refreshes this specific window.
         /// \note This will call the on_paint function.
         void redraw() const;
@@ -0,0 +1,122 @@
+//
+// wire_format.cpp
+//
+
+#include "wire_format.h"
+
+#include <algorithm>
+#include <cstring>
+
+void message_writer::add(uint64_t value, int size) {
+    for (int i = 0; i < size; i++)
+        bytes_.push_back(static_cast<uint8_t>(value >> (i * 8)));
+}
+
+void message_writer::add(uint32_t value) { add(value, 4); }
+
+void message_writer::add(int value) { add(static_cast<uint32_t>(value), 4); }
+
+void message_writer::add(bool value) { add(value ? 1 : 0, 1); }
+
+void message_writer::add(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    add(bits, 8);
+}
+
+void message_writer::add(const bardrix::vector3& vector) {
+    add(vector.x);
+    add(vector.y);
+    add(vector.z);
+}
+
+void message_writer::add(const bardrix::point3& point) {
+    add(point.x);
+    add(point.y);
+    add(point.z);
+}
+
+void message_writer::add(const bardrix::color& color) { add(color.argb()); }
+
+void message_writer::add(const bardrix::light& light) {
+    add(light.position);
+    add(light.get_intensity());
+    add(light.color);
+}
+
+void message_writer::add(const std::string& text) {
+    add(static_cast<uint32_t>(text.size()));
+    add(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+void message_writer::add(const uint8_t* data, std::size_t size) { bytes_.insert(bytes_.end(), data, data + size); }
+
+std::vector<uint8_t>& message_writer::bytes() { return bytes_; }
+
+message_reader::message_reader(const std::vector<uint8_t>& bytes, std::size_t position)
+    : bytes_(bytes), position_(position) {}
+
+uint64_t message_reader::read(int size) {
+    if (position_ + size > bytes_.size()) {
+        ok_ = false;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++)
+        value |= static_cast<uint64_t>(bytes_[position_++]) << (i * 8);
+    return value;
+}
+
+uint32_t message_reader::read_u32() { return static_cast<uint32_t>(read(4)); }
+
+int message_reader::read_int() { return static_cast<int>(read_u32()); }
+
+bool message_reader::read_bool() { return read(1) != 0; }
+
+double message_reader::read_double() {
+    const uint64_t bits = read(8);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+bardrix::vector3 message_reader::read_vector() {
+    const double x = read_double(), y = read_double(), z = read_double();
+    return {x, y, z};
+}
+
+bardrix::point3 message_reader::read_point() {
+    const double x = read_double(), y = read_double(), z = read_double();
+    return {x, y, z};
+}
+
+bardrix::color message_reader::read_color() {
+    const uint32_t argb = read_u32();
+    return {static_cast<uint8_t>(argb >> 16), static_cast<uint8_t>(argb >> 8), static_cast<uint8_t>(argb),
+            static_cast<uint8_t>(argb >> 24)};
+}
+
+bardrix::light message_reader::read_light() {
+    const bardrix::point3 position = read_point();
+    const double intensity = read_double();
+    return {position, intensity, read_color()};
+}
+
+std::string message_reader::read_string() {
+    const std::size_t size = read_count(1);
+    std::string text(bytes_.begin() + static_cast<std::ptrdiff_t>(position_),
+                     bytes_.begin() + static_cast<std::ptrdiff_t>(position_ + size));
+    position_ += size;
+    return text;
+}
+
+std::size_t message_reader::read_count(std::size_t item_size) {
+    const std::size_t count = read_u32();
+    if (count > (bytes_.size() - std::min(position_, bytes_.size())) / item_size)
+        ok_ = false;
+    return ok_ ? count : 0;
+}
+
+std::size_t message_reader::position() const { return position_; }
+
+bool message_reader::ok() const { return ok_; }
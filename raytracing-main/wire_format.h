@@ -0,0 +1,93 @@
+//
+// wire_format.h
+//
+
+#pragma once
+
+#include <bardrix/bardrix.h>
+#include <bardrix/color.h>
+#include <bardrix/light.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// \brief Builds the payload of a message that is sent to another process, little endian and bit for bit
+/// \example message_writer writer; writer.add(42u); writer.add(1.5); stream.send_message(1, writer.bytes());
+class message_writer {
+protected:
+    /// \brief The payload
+    std::vector<uint8_t> bytes_;
+
+public:
+    /// \brief Adds the lowest bytes of a value
+    /// \param value The value
+    /// \param size The amount of bytes, at most 8
+    void add(uint64_t value, int size);
+
+    void add(uint32_t value);
+    void add(int value);
+    void add(bool value);
+
+    /// \brief Adds a double bit for bit, so it reads back exactly
+    void add(double value);
+
+    void add(const bardrix::vector3& vector);
+    void add(const bardrix::point3& point);
+    void add(const bardrix::color& color);
+    void add(const bardrix::light& light);
+
+    /// \brief Adds the length of a string followed by its characters
+    void add(const std::string& text);
+
+    /// \brief Adds raw bytes without a length
+    void add(const uint8_t* data, std::size_t size);
+
+    /// \brief Gets the payload, it can be moved out
+    NODISCARD std::vector<uint8_t>& bytes();
+}; // class message_writer
+
+/// \brief Reads the values of a message_writer back in the same order
+/// \details A payload that is too short doesn't throw, the values are 0 and ok() turns false, so a message is
+///          checked once after reading all of it.
+/// \example message_reader reader(payload); uint32_t id = reader.read_u32(); if (!reader.ok()) return false;
+class message_reader {
+protected:
+    /// \brief The payload and the position of the next value
+    const std::vector<uint8_t>& bytes_;
+    std::size_t position_ = 0;
+
+    /// \brief False once a value didn't fit in the payload
+    bool ok_ = true;
+
+public:
+    /// \brief Constructor for a reader of a payload
+    /// \param bytes The payload, it's referenced and not copied
+    /// \param position Where the first value starts
+    explicit message_reader(const std::vector<uint8_t>& bytes, std::size_t position = 0);
+
+    /// \brief Reads a value of a size in bytes, at most 8
+    uint64_t read(int size);
+
+    uint32_t read_u32();
+    int read_int();
+    bool read_bool();
+    double read_double();
+    bardrix::vector3 read_vector();
+    bardrix::point3 read_point();
+    bardrix::color read_color();
+    bardrix::light read_light();
+    std::string read_string();
+
+    /// \brief Reads an amount of items, more than the rest of the message can hold makes the message invalid
+    /// \param item_size The smallest size of an item in bytes
+    /// \return The amount, 0 if it can't be right
+    std::size_t read_count(std::size_t item_size);
+
+    /// \brief Gets the position of the next value
+    NODISCARD std::size_t position() const;
+
+    /// \brief Checks if every value so far was in the payload
+    NODISCARD bool ok() const;
+}; // class message_reader